@@ -33,12 +33,22 @@ The unit tests have all their expected outputs generated by calls to the Ruby me
 #include <limits.h>
 #include <stdarg.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
+#if (defined(__unix__) || defined(__APPLE__)) && !defined(BSTRLIB_NO_MMAP)
+#include <sys/mman.h>
+#endif
+
+#if !defined(RLIB_NO_SIMD) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define RLIB_SIMD_X86
+#include <immintrin.h>
+#endif
+
 /* Optionally include a mechanism for debugging memory (from bstrlib) */
 #if defined(MEMORY_DEBUG) || defined(BSTRLIB_MEMORY_DEBUG)
 #include "memdbg.h"
@@ -165,6 +175,18 @@ extern "C" {
 #define BSTR_OK (0)
 #define BSTR_BS_BUFF_LENGTH_GET (0)
 
+/* RMM edit: string lengths, capacities and positions.  These stay int by
+   default; defining RLIB_LARGE_STRINGS widens them to ptrdiff_t so strings
+   can exceed 2GB.  They stay signed because negative lengths mark write
+   protected strings and negative positions are error returns. */
+#if defined (RLIB_LARGE_STRINGS)
+typedef ptrdiff_t blen_t;
+# define BLEN_MAX PTRDIFF_MAX
+#else
+typedef int blen_t;
+# define BLEN_MAX INT_MAX
+#endif
+
 typedef struct tagbstring * bstring;
 typedef const struct tagbstring * const_bstring;
 
@@ -177,93 +199,94 @@ typedef const struct tagbstring * const_bstring;
 #define cstr2bstr bfromcstr
 extern bstring bfromcstr (const char * str);
 extern bstring bfromcstr_check_length (const char * str); /* RMM edit */
-extern bstring bfromcstralloc (int mlen, const char * str);
-extern bstring bfromcstrrangealloc (int minl, int maxl, const char* str);
-extern bstring blk2bstr (const void * blk, int len);
+extern bstring bfromcstralloc (blen_t mlen, const char * str);
+extern bstring bfromcstrrangealloc (blen_t minl, blen_t maxl, const char* str);
+extern bstring blk2bstr (const void * blk, blen_t len);
 extern char * bstr2cstr (const_bstring s, char z);
 extern int bcstrfree (char * s);
 extern bstring bstrcpy (const_bstring b1);
 extern int bassign (bstring a, const_bstring b);
-extern int bassignmidstr (bstring a, const_bstring b, int left, int len);
+extern int bassignmidstr (bstring a, const_bstring b, blen_t left, blen_t len);
 extern int bassigncstr (bstring a, const char * str);
-extern int bassignblk (bstring a, const void * s, int len);
+extern int bassignblk (bstring a, const void * s, blen_t len);
 
 /* Destroy function */
 extern int bdestroy (bstring b);
 
 /* Space allocation hinting functions */
-extern int balloc (bstring s, int len);
-extern int ballocmin (bstring b, int len);
+extern int balloc (bstring s, blen_t len);
+extern int ballocmin (bstring b, blen_t len);
 
 /* Substring extraction */
-extern bstring bmidstr (const_bstring b, int left, int len);
+extern bstring bmidstr (const_bstring b, blen_t left, blen_t len);
 
 /* Various standard manipulations */
 extern int bconcat (bstring b0, const_bstring b1);
 extern int bconchar (bstring b0, char c);
 extern int bcatcstr (bstring b, const char * s);
-extern int bcatblk (bstring b, const void * s, int len);
-extern int binsert (bstring s1, int pos, const_bstring s2, unsigned char fill);
-extern int binsertblk (bstring s1, int pos, const void * s2, int len, unsigned char fill);
-extern int binsertch (bstring s1, int pos, int len, unsigned char fill);
-extern int breplace (bstring b1, int pos, int len, const_bstring b2, unsigned char fill);
-extern int bdelete (bstring s1, int pos, int len);
-extern int bsetstr (bstring b0, int pos, const_bstring b1, unsigned char fill);
-extern int btrunc (bstring b, int n);
+extern int bcatblk (bstring b, const void * s, blen_t len);
+extern int binsert (bstring s1, blen_t pos, const_bstring s2, unsigned char fill);
+extern int binsertblk (bstring s1, blen_t pos, const void * s2, blen_t len, unsigned char fill);
+extern int binsertch (bstring s1, blen_t pos, blen_t len, unsigned char fill);
+extern int breplace (bstring b1, blen_t pos, blen_t len, const_bstring b2, unsigned char fill);
+extern int bdelete (bstring s1, blen_t pos, blen_t len);
+extern int bsetstr (bstring b0, blen_t pos, const_bstring b1, unsigned char fill);
+extern int btrunc (bstring b, blen_t n);
 
 /* Scan/search functions */
 extern int bstricmp (const_bstring b0, const_bstring b1);
-extern int bstrnicmp (const_bstring b0, const_bstring b1, int n);
+extern int bstrnicmp (const_bstring b0, const_bstring b1, blen_t n);
 extern int biseqcaseless (const_bstring b0, const_bstring b1);
-extern int biseqcaselessblk (const_bstring b, const void * blk, int len);
-extern int bisstemeqcaselessblk (const_bstring b0, const void * blk, int len);
+extern int biseqcaselessblk (const_bstring b, const void * blk, blen_t len);
+extern int bisstemeqcaselessblk (const_bstring b0, const void * blk, blen_t len);
 extern int biseq (const_bstring b0, const_bstring b1);
-extern int biseqblk (const_bstring b, const void * blk, int len);
-extern int bisstemeqblk (const_bstring b0, const void * blk, int len);
+extern int biseqblk (const_bstring b, const void * blk, blen_t len);
+extern int bisstemeqblk (const_bstring b0, const void * blk, blen_t len);
 extern int biseqcstr (const_bstring b, const char * s);
 extern int biseqcstrcaseless (const_bstring b, const char * s);
 extern int bstrcmp (const_bstring b0, const_bstring b1);
-extern int bstrncmp (const_bstring b0, const_bstring b1, int n);
-extern int binstr (const_bstring s1, int pos, const_bstring s2);
-extern int binstrr (const_bstring s1, int pos, const_bstring s2);
-extern int binstrcaseless (const_bstring s1, int pos, const_bstring s2);
-extern int binstrrcaseless (const_bstring s1, int pos, const_bstring s2);
-extern int bstrchrp (const_bstring b, int c, int pos);
-extern int bstrrchrp (const_bstring b, int c, int pos);
+extern int bstrncmp (const_bstring b0, const_bstring b1, blen_t n);
+extern blen_t binstr (const_bstring s1, blen_t pos, const_bstring s2);
+extern blen_t binstrr (const_bstring s1, blen_t pos, const_bstring s2);
+extern blen_t binstrcaseless (const_bstring s1, blen_t pos, const_bstring s2);
+extern blen_t binstrrcaseless (const_bstring s1, blen_t pos, const_bstring s2);
+extern blen_t bstrchrp (const_bstring b, int c, blen_t pos);
+extern blen_t bstrrchrp (const_bstring b, int c, blen_t pos);
 #define bstrchr(b,c) bstrchrp ((b), (c), 0)
 #define bstrrchr(b,c) bstrrchrp ((b), (c), blength(b)-1)
-extern int binchr (const_bstring b0, int pos, const_bstring b1);
-extern int binchrr (const_bstring b0, int pos, const_bstring b1);
-extern int bninchr (const_bstring b0, int pos, const_bstring b1);
-extern int bninchrr (const_bstring b0, int pos, const_bstring b1);
-extern int bfindreplace (bstring b, const_bstring find, const_bstring repl, int pos);
-extern int bfindreplacecaseless (bstring b, const_bstring find, const_bstring repl, int pos);
+extern blen_t binchr (const_bstring b0, blen_t pos, const_bstring b1);
+extern blen_t binchrr (const_bstring b0, blen_t pos, const_bstring b1);
+extern blen_t bninchr (const_bstring b0, blen_t pos, const_bstring b1);
+extern blen_t bninchrr (const_bstring b0, blen_t pos, const_bstring b1);
+extern int bfindreplace (bstring b, const_bstring find, const_bstring repl, blen_t pos);
+extern int bfindreplacecaseless (bstring b, const_bstring find, const_bstring repl, blen_t pos);
 
 /* List of string container functions */
 struct bstrList {
-  int qty, mlen;
+  blen_t qty, mlen; /* RMM edit: int unless RLIB_LARGE_STRINGS */
   bstring * entry;
+  int flags; /* RMM edit: storage bits, see BSTR_F_ARENA */
 };
 extern struct bstrList * bstrListCreate (void);
 extern int bstrListDestroy (struct bstrList * sl);
-extern int bstrListAlloc (struct bstrList * sl, int msz);
-extern int bstrListAllocMin (struct bstrList * sl, int msz);
+extern int bstrListAlloc (struct bstrList * sl, blen_t msz);
+extern int bstrListAllocMin (struct bstrList * sl, blen_t msz);
 
 /* String split and join functions */
 extern struct bstrList * bsplit (const_bstring str, unsigned char splitChar);
 extern struct bstrList * bsplits (const_bstring str, const_bstring splitStr);
 extern struct bstrList * bsplitstr (const_bstring str, const_bstring splitStr);
 extern bstring bjoin (const struct bstrList * bl, const_bstring sep);
-extern bstring bjoinblk (const struct bstrList * bl, const void * s, int len);
-extern int bsplitcb (const_bstring str, unsigned char splitChar, int pos,
-                     int (* cb) (void * parm, int ofs, int len), void * parm);
-extern int bsplitscb (const_bstring str, const_bstring splitStr, int pos,
-                      int (* cb) (void * parm, int ofs, int len), void * parm);
-extern int bsplitstrcb (const_bstring str, const_bstring splitStr, int pos,
-                        int (* cb) (void * parm, int ofs, int len), void * parm);
+extern bstring bjoinblk (const struct bstrList * bl, const void * s, blen_t len);
+extern int bsplitcb (const_bstring str, unsigned char splitChar, blen_t pos,
+                     int (* cb) (void * parm, blen_t ofs, blen_t len), void * parm);
+extern int bsplitscb (const_bstring str, const_bstring splitStr, blen_t pos,
+                      int (* cb) (void * parm, blen_t ofs, blen_t len), void * parm);
+extern int bsplitstrcb (const_bstring str, const_bstring splitStr, blen_t pos,
+                        int (* cb) (void * parm, blen_t ofs, blen_t len), void * parm);
 
 /* Miscellaneous functions */
-extern int bpattern (bstring b, int len);
+extern int bpattern (bstring b, blen_t len);
 extern int btoupper (bstring b);
 extern int btolower (bstring b);
 extern int bltrimws (bstring b);
@@ -315,36 +338,87 @@ extern void * bsclose (struct bStream * s);
 extern int bsbufflength (struct bStream * s, int sz);
 extern int bsreadln (bstring b, struct bStream * s, char terminator);
 extern int bsreadlns (bstring r, struct bStream * s, const_bstring term);
-extern int bsread (bstring b, struct bStream * s, int n);
+extern int bsread (bstring b, struct bStream * s, blen_t n);
 extern int bsreadlna (bstring b, struct bStream * s, char terminator);
 extern int bsreadlnsa (bstring r, struct bStream * s, const_bstring term);
-extern int bsreada (bstring b, struct bStream * s, int n);
+extern int bsreada (bstring b, struct bStream * s, blen_t n);
 extern int bsunread (struct bStream * s, const_bstring b);
 extern int bspeek (bstring r, const struct bStream * s);
 extern int bssplitscb (struct bStream * s, const_bstring splitStr,
-                       int (* cb) (void * parm, int ofs, const_bstring entry), void * parm);
+                       int (* cb) (void * parm, blen_t ofs, const_bstring entry), void * parm);
 extern int bssplitstrcb (struct bStream * s, const_bstring splitStr,
-                         int (* cb) (void * parm, int ofs, const_bstring entry), void * parm);
+                         int (* cb) (void * parm, blen_t ofs, const_bstring entry), void * parm);
 extern int bseof (const struct bStream * s);
 
 struct tagbstring {
-  int mlen;
-  int slen;
+  blen_t mlen; /* RMM edit: int unless RLIB_LARGE_STRINGS */
+  blen_t slen;
   unsigned char * data;
+  int flags; /* RMM edit: storage bits, only meaningful when mlen > 0 */
 };
 
+/* Storage bits for struct tagbstring and struct bstrList (RMM edit).  A
+   header with BSTR_F_ARENA set was carved out of an rlib_arena along with
+   its data, so it is never handed to bstr__free.  BSTR_F_INLINE means the
+   data lives in the same allocation as the header, directly after it.
+   BSTR_F_MMAP means the data is an anonymous memory mapping of mlen bytes.
+   BSTR_F_RC (only with RLIB_COW_STRINGS) means the data is a reference
+   counted heap block that may be shared with other strings.  BSTR_F_PACKED
+   means the header lives inside a packed bstrList made by the split
+   functions, so it goes away with the list.  On a bstrList, BSTR_F_PACKED
+   means the list, its entries and their data are all one allocation, and
+   BSTR_F_INLINE means the entry array is still part of it. */
+#define BSTR_F_ARENA  0x1
+#define BSTR_F_INLINE 0x2
+#define BSTR_F_MMAP   0x4
+#define BSTR_F_RC     0x8
+#define BSTR_F_PACKED 0x40
+#define BSTR_F_DATA_MASK (BSTR_F_INLINE | BSTR_F_MMAP | BSTR_F_RC)
+
+/* Strings whose buffer would be at most this many bytes are allocated
+   together with their header (RMM edit). */
+#ifndef BSTR_INLINE_MAX
+#define BSTR_INLINE_MAX 32
+#endif
+
+/* Growth policies for balloc (RMM edit).  BSTR_GROW_POW2 rounds up to the
+   next power of two (the classic bstrlib behaviour), BSTR_GROW_HALF grows by
+   at least half the current capacity, and BSTR_GROW_EXACT allocates what was
+   asked for plus BSTR_GROW_HEADROOM bytes.  A string follows the global
+   policy unless one has been stored in its flags (BSTR_GROW_DEFAULT means
+   "use the global policy"). */
+#define BSTR_GROW_DEFAULT 0
+#define BSTR_GROW_POW2    1
+#define BSTR_GROW_HALF    2
+#define BSTR_GROW_EXACT   3
+
+#define BSTR_F_GROW_SHIFT 4
+#define BSTR_F_GROW_MASK  (0x3 << BSTR_F_GROW_SHIFT)
+
+#ifndef BSTR_GROW_HEADROOM
+#define BSTR_GROW_HEADROOM 16
+#endif
+
+/* Instruction sets for the byte scanning kernels (RMM edit), see
+   rlib_set_simd_level. */
+#define RLIB_SIMD_NONE   0
+#define RLIB_SIMD_SSE2   1
+#define RLIB_SIMD_AVX2   2
+#define RLIB_SIMD_AVX512 3
+
 /* Accessor macros */
-#define blengthe(b, e)      (((b) == (void *)0 || (b)->slen < 0) ? (int)(e) : ((b)->slen))
+#define blengthe(b, e)      (((b) == (void *)0 || (b)->slen < 0) ? (blen_t)(e) : ((b)->slen))
 #define blength(b)          (blengthe ((b), 0))
 #define bdataofse(b, o, e)  (((b) == (void *)0 || (b)->data == (void*)0) ? (char *)(e) : ((char *)(b)->data) + (o))
 #define bdataofs(b, o)      (bdataofse ((b), (o), (void *)0))
 #define bdatae(b, e)        (bdataofse (b, 0, e))
 #define bdata(b)            (bdataofs (b, 0))
-#define bchare(b, p, e)     ((((unsigned)(p)) < (unsigned)blength(b)) ? ((b)->data[(p)]) : (e))
+#define bchare(b, p, e)     ((((size_t)(p)) < (size_t)blength(b)) ? ((b)->data[(p)]) : (e))
 #define bchar(b, p)         bchare ((b), (p), '\0')
 
 /* Static constant string initialization macro */
-#define bsStaticMlen(q,m)   {(m), (int) sizeof(q)-1, (unsigned char *) ("" q "")}
+/* RMM edit: spell out flags so -Wextra does not warn about the missing field. */
+#define bsStaticMlen(q,m)   {(m), (blen_t) sizeof(q)-1, (unsigned char *) ("" q ""), 0}
 #if defined(_MSC_VER)
 # define bsStatic(q)        bsStaticMlen(q,-32)
 #endif
@@ -353,7 +427,7 @@ struct tagbstring {
 #endif
 
 /* Static constant block parameter pair */
-#define bsStaticBlkParms(q) ((void *)("" q "")), ((int) sizeof(q)-1)
+#define bsStaticBlkParms(q) ((void *)("" q "")), ((blen_t) sizeof(q)-1)
 
 #define bcatStatic(b,s)     ((bcatblk)((b), bsStaticBlkParms(s)))
 #define bfromStatic(s)      ((blk2bstr)(bsStaticBlkParms(s)))
@@ -369,7 +443,7 @@ struct tagbstring {
 #define cstr2tbstr btfromcstr
 #define btfromcstr(t,s) {                                            \
     (t).data = (unsigned char *) (s);                                \
-    (t).slen = ((t).data) ? ((int) (strlen) ((char *)(t).data)) : 0; \
+    (t).slen = ((t).data) ? ((blen_t) (strlen) ((char *)(t).data)) : 0; \
     (t).mlen = -1;                                                   \
 }
 #define blk2tbstr(t,s,l) {            \
@@ -500,38 +574,1433 @@ void* bstr__alloc (size_t sz) {
 
 #define bBlockCopy(D,S,L) { if ((L) > 0) bstr__memmove ((D),(S),(L)); }
 
+/* RMM edit: thread local storage for per-thread library state. */
+#if !defined (RLIB_THREAD_LOCAL)
+# if defined (__STDC_VERSION__) && (__STDC_VERSION__ >= 201112L) && !defined (__STDC_NO_THREADS__)
+#  define RLIB_THREAD_LOCAL _Thread_local
+# elif defined (__GNUC__)
+#  define RLIB_THREAD_LOCAL __thread
+# elif defined (_MSC_VER)
+#  define RLIB_THREAD_LOCAL __declspec(thread)
+# else
+#  define RLIB_THREAD_LOCAL
+# endif
+#endif
+
+/* RMM edit: byte scanning kernels.  The hot single byte scans (find a byte,
+   find the last one, count them, find any of up to three bytes, find the
+   first or last non whitespace byte, find the first or last byte of a
+   character class, find where two runs first differ other than in ASCII
+   case), and the tr style rewrites (count, delete or squeeze the bytes of a
+   class, translate every byte) go through a table of functions chosen once,
+   at startup, for the best instruction set the CPU has: AVX-512BW, AVX2,
+   SSE2, or plain C.  Define RLIB_NO_SIMD to always use plain C.
+   Whitespace here is the C locale's: ' ' and '\t' through '\r'.
+
+   The scans return an index into p (or a count), and -1 when there is
+   nothing to find. */
+
+/* A set of bytes compiled for the find_class kernels (this replaces
+   bstrlib's struct charField).  in[] is the plain lookup table.  Sets of up
+   to three bytes are matched by comparing against each of bytes[].  Larger
+   ones use the nibble tables: the sixteen possible high nibbles are grouped
+   by which low nibbles they go with, each group gets a bit, and c is in the
+   set when lo[k][c & 15] & hi[k][c >> 4] is non zero.  Up to eight groups
+   fit in one pair of tables, sixteen in two, so any set is exact. */
+struct bstr__charclass {
+  unsigned char in[UCHAR_MAX + 1];
+  int qty, invert, tables;
+  unsigned char bytes[3];
+  unsigned char lo[2][16];
+  unsigned char hi[2][16];
+};
+
+/* Compile the len bytes at s, or with invert every byte not among them. */
+static void bstr__charclass_init (struct bstr__charclass * cc,
+                                  const unsigned char * s, blen_t len,
+                                  int invert) {
+  unsigned int rows[16], groups[16];
+  int i, j, k, ngroups = 0;
+
+  memset (cc, 0, sizeof (struct bstr__charclass));
+  memset (rows, 0, sizeof (rows));
+  for (i = 0; i < len; i++) {
+    if (!cc->in[s[i]]) {
+      if (cc->qty < 3) cc->bytes[cc->qty] = s[i];
+      cc->qty++;
+      cc->in[s[i]] = 1;
+      rows[s[i] >> 4] |= 1u << (s[i] & 15);
+    }
+  }
+  for (i = cc->qty; i < 3; i++) cc->bytes[i] = cc->bytes[0];
+  cc->invert = invert;
+  if (invert) {
+    for (i = 0; i <= UCHAR_MAX; i++) cc->in[i] = !cc->in[i];
+  }
+
+  for (i = 0; i < 16; i++) {
+    if (rows[i] == 0) continue;
+    for (k = 0; k < ngroups && groups[k] != rows[i]; k++) {}
+    if (k == ngroups) groups[ngroups++] = rows[i];
+    cc->hi[k >> 3][i] |= (unsigned char) (1u << (k & 7));
+  }
+  for (k = 0; k < ngroups; k++) {
+    for (j = 0; j < 16; j++) {
+      if (groups[k] & (1u << j)) {
+        cc->lo[k >> 3][j] |= (unsigned char) (1u << (k & 7));
+      }
+    }
+  }
+  cc->tables = ngroups > 8 ? 2 : 1;
+}
+
+/* A byte to byte translation, like tr's, for the translate kernel.  map[]
+   is the plain lookup table.  The vector kernels add to each byte c
+   delta[k][c & 15], the change map[] makes to it, when c >> 4 is rows[k]:
+   only the nrows high nibbles with some byte that changes are looked at,
+   so translating a handful of letters costs a few shuffles a vector. */
+struct bstr__trtable {
+  unsigned char map[UCHAR_MAX + 1];
+  int nrows;
+  unsigned char rows[16];
+  unsigned char delta[16][16];
+};
+
+/* Fill in the vector tables of t from t->map. */
+static void bstr__trtable_init (struct bstr__trtable * t) {
+  int i, j, k;
+
+  t->nrows = 0;
+  for (i = 0; i < 16; i++) {
+    for (j = 0; j < 16 && t->map[i * 16 + j] == i * 16 + j; j++) {}
+    if (j == 16) continue;
+    k = t->nrows++;
+    t->rows[k] = (unsigned char) i;
+    for (j = 0; j < 16; j++) {
+      t->delta[k][j] = (unsigned char) (t->map[i * 16 + j] - (i * 16 + j));
+    }
+  }
+}
+
+struct bstr__scan_kernels {
+  blen_t (* find_byte) (const unsigned char * p, blen_t len, unsigned char c);
+  blen_t (* find_last_byte) (const unsigned char * p, blen_t len,
+                             unsigned char c);
+  blen_t (* count_byte) (const unsigned char * p, blen_t len, unsigned char c);
+  blen_t (* find_any3) (const unsigned char * p, blen_t len, unsigned char a,
+                        unsigned char b, unsigned char c);
+  blen_t (* find_nonws) (const unsigned char * p, blen_t len);
+  blen_t (* find_last_nonws) (const unsigned char * p, blen_t len);
+  blen_t (* find_class) (const unsigned char * p, blen_t len,
+                         const struct bstr__charclass * cc);
+  blen_t (* find_last_class) (const unsigned char * p, blen_t len,
+                              const struct bstr__charclass * cc);
+  blen_t (* find_casediff) (const unsigned char * a, const unsigned char * b,
+                            blen_t len);
+  blen_t (* count_class) (const unsigned char * p, blen_t len,
+                          const struct bstr__charclass * cc);
+  void (* translate) (unsigned char * d, const unsigned char * s, blen_t len,
+                      const struct bstr__trtable * t);
+  blen_t (* delete_class) (unsigned char * d, const unsigned char * s,
+                           blen_t len, const struct bstr__charclass * cc);
+  blen_t (* squeeze_class) (unsigned char * d, const unsigned char * s,
+                            blen_t len, const struct bstr__charclass * cc);
+  blen_t (* find_squeeze) (const unsigned char * p, blen_t len,
+                           const struct bstr__charclass * cc);
+  blen_t (* find_case) (const unsigned char * p, blen_t len, int how);
+  void (* convert_case) (unsigned char * d, const unsigned char * s,
+                         blen_t len, int how);
+};
+
+#define bstr__isws(c) ((c) == ' ' || (unsigned char) ((c) - '\t') <= '\r' - '\t')
+
+/* ASCII case folding, without the C library's locale lookups. */
+#define bstr__ascii_lower(c) ((unsigned char) ((c) | \
+  (((unsigned char) ((c) - 'A') < 26) << 5)))
+#define bstr__ascii_upper(c) ((unsigned char) ((c) & \
+  ~(((unsigned char) ((c) - 'a') < 26) << 5)))
+
+/* What the case kernels do: BSTR__CASE_UPPER changes the small letters,
+   BSTR__CASE_LOWER the capitals, and BSTR__CASE_SWAP both. */
+#define BSTR__CASE_UPPER 1
+#define BSTR__CASE_LOWER 2
+#define BSTR__CASE_SWAP (BSTR__CASE_UPPER | BSTR__CASE_LOWER)
+#define bstr__ascii_case(c, how) ((unsigned char) ((c) ^ ((                    \
+  (((how) & BSTR__CASE_UPPER) && (unsigned char) ((c) - 'a') < 26) ||        \
+  (((how) & BSTR__CASE_LOWER) && (unsigned char) ((c) - 'A') < 26)) << 5)))
+
+static blen_t bstr__find_byte_c (const unsigned char * p, blen_t len,
+                                 unsigned char c) {
+  const unsigned char * q;
+
+  if (len <= 0) return -1;
+  q = (const unsigned char *) bstr__memchr (p, c, (size_t) len);
+  return q ? (blen_t) (q - p) : -1;
+}
+
+static blen_t bstr__find_last_byte_c (const unsigned char * p, blen_t len,
+                                      unsigned char c) {
+  while (len-- > 0) if (p[len] == c) return len;
+  return -1;
+}
+
+static blen_t bstr__count_byte_c (const unsigned char * p, blen_t len,
+                                  unsigned char c) {
+  blen_t i, n = 0;
+  for (i = 0; i < len; i++) n += (p[i] == c);
+  return n;
+}
+
+static blen_t bstr__find_any3_c (const unsigned char * p, blen_t len,
+                                 unsigned char a, unsigned char b,
+                                 unsigned char c) {
+  blen_t i;
+  for (i = 0; i < len; i++) if (p[i] == a || p[i] == b || p[i] == c) return i;
+  return -1;
+}
+
+static blen_t bstr__find_nonws_c (const unsigned char * p, blen_t len) {
+  blen_t i;
+  for (i = 0; i < len; i++) if (!bstr__isws (p[i])) return i;
+  return -1;
+}
+
+static blen_t bstr__find_last_nonws_c (const unsigned char * p, blen_t len) {
+  while (len-- > 0) if (!bstr__isws (p[len])) return len;
+  return -1;
+}
+
+static blen_t bstr__find_class_c (const unsigned char * p, blen_t len,
+                                  const struct bstr__charclass * cc) {
+  blen_t i;
+  for (i = 0; i < len; i++) if (cc->in[p[i]]) return i;
+  return -1;
+}
+
+static blen_t bstr__find_last_class_c (const unsigned char * p, blen_t len,
+                                       const struct bstr__charclass * cc) {
+  while (len-- > 0) if (cc->in[p[len]]) return len;
+  return -1;
+}
+
+static blen_t bstr__find_casediff_c (const unsigned char * a,
+                                     const unsigned char * b, blen_t len) {
+  blen_t i;
+  for (i = 0; i < len; i++) {
+    if (a[i] != b[i] && bstr__ascii_lower (a[i]) != bstr__ascii_lower (b[i]))
+      return i;
+  }
+  return -1;
+}
+
+static blen_t bstr__count_class_c (const unsigned char * p, blen_t len,
+                                   const struct bstr__charclass * cc) {
+  blen_t i, n = 0;
+  for (i = 0; i < len; i++) n += cc->in[p[i]];
+  return n;
+}
+
+static void bstr__translate_c (unsigned char * d, const unsigned char * s,
+                               blen_t len, const struct bstr__trtable * t) {
+  blen_t i;
+  for (i = 0; i < len; i++) d[i] = t->map[s[i]];
+}
+
+/* The rewriting kernels write their result to d, which may be s, and
+   return its length.  Every byte is stored, but the output only moves on
+   past the ones that are kept. */
+static blen_t bstr__delete_class_c (unsigned char * d, const unsigned char * s,
+                                    blen_t len,
+                                    const struct bstr__charclass * cc) {
+  blen_t i, o = 0;
+  for (i = 0; i < len; i++) {
+    d[o] = s[i];
+    o += !cc->in[s[i]];
+  }
+  return o;
+}
+
+static blen_t bstr__squeeze_class_c (unsigned char * d,
+                                     const unsigned char * s, blen_t len,
+                                     const struct bstr__charclass * cc) {
+  blen_t i, o = 0;
+  int prev = -1;
+  for (i = 0; i < len; i++) {
+    d[o] = s[i];
+    o += !(s[i] == prev && cc->in[s[i]]);
+    prev = s[i];
+  }
+  return o;
+}
+
+/* The index of the first byte that squeeze_class would drop, or -1. */
+static blen_t bstr__find_squeeze_c (const unsigned char * p, blen_t len,
+                                    const struct bstr__charclass * cc) {
+  blen_t i;
+  for (i = 1; i < len; i++) if (p[i] == p[i - 1] && cc->in[p[i]]) return i;
+  return -1;
+}
+
+static blen_t bstr__find_case_c (const unsigned char * p, blen_t len,
+                                 int how) {
+  blen_t i;
+  for (i = 0; i < len; i++) if (bstr__ascii_case (p[i], how) != p[i]) return i;
+  return -1;
+}
+
+static void bstr__convert_case_c (unsigned char * d, const unsigned char * s,
+                                  blen_t len, int how) {
+  blen_t i;
+  for (i = 0; i < len; i++) d[i] = bstr__ascii_case (s[i], how);
+}
+
+static const struct bstr__scan_kernels bstr__kernels_c = {
+  bstr__find_byte_c, bstr__find_last_byte_c, bstr__count_byte_c,
+  bstr__find_any3_c, bstr__find_nonws_c, bstr__find_last_nonws_c,
+  bstr__find_class_c, bstr__find_last_class_c, bstr__find_casediff_c,
+  bstr__count_class_c, bstr__translate_c, bstr__delete_class_c,
+  bstr__squeeze_class_c, bstr__find_squeeze_c, bstr__find_case_c,
+  bstr__convert_case_c
+};
+
+#if defined (RLIB_SIMD_X86)
+
+/* For each set of bits in a byte, the indexes of those bits in order: the
+   shuffle that packs the bytes of a group of eight that are kept.  Filled
+   in by bstr__kernels_init.  (AVX-512 compresses with vpcompressd instead,
+   which, unlike the byte version, needs nothing past AVX-512F.) */
+static unsigned char bstr__compress8[256][8];
+
+/* The vector kernels are stamped out from one template.  Each instruction
+   set supplies BSTR__V (the vector type), BSTR__VLOAD, BSTR__VSPLAT,
+   BSTR__VEQ (a bit mask of the lanes of v equal to those of s) and
+   BSTR__VWS (a bit mask of the whitespace lanes of v).  For character
+   classes of more than three bytes BSTR__VNIBBLE_LOAD sets up the nibble
+   tables of cc and BSTR__VNIBBLE gives the bit mask of the lanes of v in
+   the class; without a byte shuffle (SSE2) BSTR__VNIBBLE_OK is 0 and such
+   classes are left to the plain C kernel.  BSTR__VLOWER folds the ASCII
+   capitals of v to lower case, and BSTR__VCASE flips the case of the
+   letters of v that a kernel's how asks for.  It finds them the same way,
+   so BSTR__VCASE_LOAD turns off either range by making it empty.  Whole
+   vectors are scanned with these and
+   the tail with the plain C test.  The kernels that write bytes use
+   BSTR__VSTORE too, and translate sets up the tables of t with
+   BSTR__VTR_LOAD and gives r the bytes of v translated with BSTR__VTR
+   (again only where there is a byte shuffle).  BSTR__VCOMPRESS writes the
+   bytes of the vector at s whose bits are set in keep to d + o, moving o
+   past them; it stores a whole group of bytes at a time, so it may write
+   up to the end of the vector. */
+#define BSTR__VCASE_LOAD(how)                                                 \
+  cla = BSTR__VSPLAT (0x80 - 'a');                                            \
+  cln = BSTR__VSPLAT (0x80 + (((how) & BSTR__CASE_UPPER) ? 26 : 0));          \
+  cua = BSTR__VSPLAT (0x80 - 'A');                                            \
+  cun = BSTR__VSPLAT (0x80 + (((how) & BSTR__CASE_LOWER) ? 26 : 0))
+#define BSTR__VCLASS(v, cc)                                                   \
+  (((cc)->qty <= 3) ? BSTR__VEQ ((v), s0) | BSTR__VEQ ((v), s1) |             \
+                      BSTR__VEQ ((v), s2)                                     \
+                    : BSTR__VNIBBLE ((v), (cc)))
+#define BSTR__SCAN_KERNELS(isa, tgt, W)                                       \
+static tgt blen_t bstr__find_byte_##isa (const unsigned char * p,            \
+                                         blen_t len, unsigned char c) {      \
+  BSTR__V s = BSTR__VSPLAT (c);                                               \
+  blen_t i = 0;                                                               \
+  uint64_t m;                                                                 \
+  for (; i + (W) <= len; i += (W)) {                                          \
+    m = BSTR__VEQ (BSTR__VLOAD (p + i), s);                                   \
+    if (m) return i + (blen_t) __builtin_ctzll (m);                           \
+  }                                                                           \
+  for (; i < len; i++) if (p[i] == c) return i;                               \
+  return -1;                                                                  \
+}                                                                             \
+static tgt blen_t bstr__find_last_byte_##isa (const unsigned char * p,       \
+                                              blen_t len, unsigned char c) { \
+  BSTR__V s = BSTR__VSPLAT (c);                                               \
+  uint64_t m;                                                                 \
+  for (; len >= (W); len -= (W)) {                                            \
+    m = BSTR__VEQ (BSTR__VLOAD (p + len - (W)), s);                           \
+    if (m) return len - (W) + 63 - (blen_t) __builtin_clzll (m);              \
+  }                                                                           \
+  while (len-- > 0) if (p[len] == c) return len;                              \
+  return -1;                                                                  \
+}                                                                             \
+static tgt blen_t bstr__count_byte_##isa (const unsigned char * p,           \
+                                          blen_t len, unsigned char c) {     \
+  BSTR__V s = BSTR__VSPLAT (c);                                               \
+  blen_t i = 0, n = 0;                                                        \
+  for (; i + (W) <= len; i += (W)) {                                          \
+    n += __builtin_popcountll (BSTR__VEQ (BSTR__VLOAD (p + i), s));           \
+  }                                                                           \
+  for (; i < len; i++) n += (p[i] == c);                                      \
+  return n;                                                                   \
+}                                                                             \
+static tgt blen_t bstr__find_any3_##isa (const unsigned char * p,            \
+                                         blen_t len, unsigned char a,        \
+                                         unsigned char b, unsigned char c) { \
+  BSTR__V sa = BSTR__VSPLAT (a), sb = BSTR__VSPLAT (b), sc = BSTR__VSPLAT (c);\
+  BSTR__V v;                                                                  \
+  blen_t i = 0;                                                               \
+  uint64_t m;                                                                 \
+  for (; i + (W) <= len; i += (W)) {                                          \
+    v = BSTR__VLOAD (p + i);                                                  \
+    m = BSTR__VEQ (v, sa) | BSTR__VEQ (v, sb) | BSTR__VEQ (v, sc);            \
+    if (m) return i + (blen_t) __builtin_ctzll (m);                           \
+  }                                                                           \
+  for (; i < len; i++) if (p[i] == a || p[i] == b || p[i] == c) return i;     \
+  return -1;                                                                  \
+}                                                                             \
+static tgt blen_t bstr__find_nonws_##isa (const unsigned char * p,           \
+                                          blen_t len) {                      \
+  blen_t i = 0;                                                               \
+  uint64_t m, all = ((W) == 64) ? ~(uint64_t) 0 : ((uint64_t) 1 << (W)) - 1;  \
+  for (; i + (W) <= len; i += (W)) {                                          \
+    m = ~BSTR__VWS (BSTR__VLOAD (p + i)) & all;                               \
+    if (m) return i + (blen_t) __builtin_ctzll (m);                           \
+  }                                                                           \
+  for (; i < len; i++) if (!bstr__isws (p[i])) return i;                      \
+  return -1;                                                                  \
+}                                                                             \
+static tgt blen_t bstr__find_last_nonws_##isa (const unsigned char * p,      \
+                                               blen_t len) {                 \
+  uint64_t m, all = ((W) == 64) ? ~(uint64_t) 0 : ((uint64_t) 1 << (W)) - 1;  \
+  for (; len >= (W); len -= (W)) {                                            \
+    m = ~BSTR__VWS (BSTR__VLOAD (p + len - (W))) & all;                       \
+    if (m) return len - (W) + 63 - (blen_t) __builtin_clzll (m);              \
+  }                                                                           \
+  while (len-- > 0) if (!bstr__isws (p[len])) return len;                     \
+  return -1;                                                                  \
+}                                                                             \
+static tgt blen_t bstr__find_class_##isa (const unsigned char * p,           \
+                                          blen_t len,                        \
+                                          const struct bstr__charclass * cc) {\
+  BSTR__V s0, s1, s2, v;                                                      \
+  BSTR__VNIBBLE_DECLS                                                         \
+  blen_t i = 0;                                                               \
+  uint64_t m, all = ((W) == 64) ? ~(uint64_t) 0 : ((uint64_t) 1 << (W)) - 1;  \
+  uint64_t flip = cc->invert ? all : 0;                                       \
+  if (cc->qty == 0 || (cc->qty > 3 && !BSTR__VNIBBLE_OK))                    \
+    return bstr__find_class_c (p, len, cc);                                   \
+  s0 = BSTR__VSPLAT (cc->bytes[0]);                                           \
+  s1 = BSTR__VSPLAT (cc->bytes[1]);                                           \
+  s2 = BSTR__VSPLAT (cc->bytes[2]);                                           \
+  BSTR__VNIBBLE_LOAD (cc);                                                    \
+  for (; i + (W) <= len; i += (W)) {                                          \
+    v = BSTR__VLOAD (p + i);                                                  \
+    m = BSTR__VCLASS (v, cc) ^ flip;                                          \
+    if (m) return i + (blen_t) __builtin_ctzll (m);                           \
+  }                                                                           \
+  for (; i < len; i++) if (cc->in[p[i]]) return i;                            \
+  return -1;                                                                  \
+}                                                                             \
+static tgt blen_t bstr__find_last_class_##isa (const unsigned char * p,      \
+                                               blen_t len,                   \
+                                               const struct bstr__charclass * cc) {\
+  BSTR__V s0, s1, s2, v;                                                      \
+  BSTR__VNIBBLE_DECLS                                                         \
+  uint64_t m, all = ((W) == 64) ? ~(uint64_t) 0 : ((uint64_t) 1 << (W)) - 1;  \
+  uint64_t flip = cc->invert ? all : 0;                                       \
+  if (cc->qty == 0 || (cc->qty > 3 && !BSTR__VNIBBLE_OK))                    \
+    return bstr__find_last_class_c (p, len, cc);                              \
+  s0 = BSTR__VSPLAT (cc->bytes[0]);                                           \
+  s1 = BSTR__VSPLAT (cc->bytes[1]);                                           \
+  s2 = BSTR__VSPLAT (cc->bytes[2]);                                           \
+  BSTR__VNIBBLE_LOAD (cc);                                                    \
+  for (; len >= (W); len -= (W)) {                                            \
+    v = BSTR__VLOAD (p + len - (W));                                          \
+    m = BSTR__VCLASS (v, cc) ^ flip;                                          \
+    if (m) return len - (W) + 63 - (blen_t) __builtin_clzll (m);              \
+  }                                                                           \
+  while (len-- > 0) if (cc->in[p[len]]) return len;                           \
+  return -1;                                                                  \
+}                                                                             \
+static tgt blen_t bstr__find_casediff_##isa (const unsigned char * a,       \
+                                             const unsigned char * b,       \
+                                             blen_t len) {                  \
+  blen_t i = 0;                                                               \
+  uint64_t m, all = ((W) == 64) ? ~(uint64_t) 0 : ((uint64_t) 1 << (W)) - 1;  \
+  for (; i + (W) <= len; i += (W)) {                                          \
+    m = BSTR__VEQ (BSTR__VLOWER (BSTR__VLOAD (a + i)),                        \
+                   BSTR__VLOWER (BSTR__VLOAD (b + i))) ^ all;                 \
+    if (m) return i + (blen_t) __builtin_ctzll (m);                           \
+  }                                                                           \
+  for (; i < len; i++) {                                                      \
+    if (bstr__ascii_lower (a[i]) != bstr__ascii_lower (b[i])) return i;       \
+  }                                                                           \
+  return -1;                                                                  \
+}                                                                             \
+static tgt blen_t bstr__count_class_##isa (const unsigned char * p,          \
+                                           blen_t len,                       \
+                                           const struct bstr__charclass * cc) {\
+  BSTR__V s0, s1, s2, v;                                                      \
+  BSTR__VNIBBLE_DECLS                                                         \
+  blen_t i = 0, n = 0;                                                        \
+  uint64_t all = ((W) == 64) ? ~(uint64_t) 0 : ((uint64_t) 1 << (W)) - 1;     \
+  uint64_t flip = cc->invert ? all : 0;                                       \
+  if (cc->qty == 0 || (cc->qty > 3 && !BSTR__VNIBBLE_OK))                    \
+    return bstr__count_class_c (p, len, cc);                                  \
+  s0 = BSTR__VSPLAT (cc->bytes[0]);                                           \
+  s1 = BSTR__VSPLAT (cc->bytes[1]);                                           \
+  s2 = BSTR__VSPLAT (cc->bytes[2]);                                           \
+  BSTR__VNIBBLE_LOAD (cc);                                                    \
+  for (; i + (W) <= len; i += (W)) {                                          \
+    v = BSTR__VLOAD (p + i);                                                  \
+    n += __builtin_popcountll (BSTR__VCLASS (v, cc) ^ flip);                  \
+  }                                                                           \
+  return n + bstr__count_class_c (p + i, len - i, cc);                        \
+}                                                                             \
+static tgt void bstr__translate_##isa (unsigned char * d,                    \
+                                       const unsigned char * s, blen_t len,  \
+                                       const struct bstr__trtable * t) {     \
+  BSTR__V v, r;                                                               \
+  BSTR__VTR_DECLS                                                             \
+  blen_t i = 0;                                                               \
+  if (!BSTR__VNIBBLE_OK || t->nrows == 0) {                                   \
+    bstr__translate_c (d, s, len, t);                                         \
+    return;                                                                   \
+  }                                                                           \
+  BSTR__VTR_LOAD (t);                                                         \
+  for (; i + (W) <= len; i += (W)) {                                          \
+    v = BSTR__VLOAD (s + i);                                                  \
+    BSTR__VTR (r, v, t);                                                      \
+    BSTR__VSTORE (d + i, r);                                                  \
+  }                                                                           \
+  bstr__translate_c (d + i, s + i, len - i, t);                               \
+}                                                                             \
+/* A vector with nothing to drop is stored whole, and one with some kept    \
+   bytes has them compressed to the front.  Either way only bytes already   \
+   read are written over: the output is never ahead of the input. */        \
+static tgt blen_t bstr__delete_class_##isa (unsigned char * d,               \
+                                            const unsigned char * s,         \
+                                            blen_t len,                      \
+                                            const struct bstr__charclass * cc) {\
+  BSTR__V s0, s1, s2, v;                                                      \
+  BSTR__VNIBBLE_DECLS                                                         \
+  blen_t i = 0, o = 0;                                                        \
+  int j;                                                                      \
+  uint64_t m, all = ((W) == 64) ? ~(uint64_t) 0 : ((uint64_t) 1 << (W)) - 1;  \
+  uint64_t flip = cc->invert ? all : 0;                                       \
+  if (cc->qty == 0 || (cc->qty > 3 && !BSTR__VNIBBLE_OK))                    \
+    return bstr__delete_class_c (d, s, len, cc);                              \
+  s0 = BSTR__VSPLAT (cc->bytes[0]);                                           \
+  s1 = BSTR__VSPLAT (cc->bytes[1]);                                           \
+  s2 = BSTR__VSPLAT (cc->bytes[2]);                                           \
+  BSTR__VNIBBLE_LOAD (cc);                                                    \
+  for (; i + (W) <= len; i += (W)) {                                          \
+    v = BSTR__VLOAD (s + i);                                                  \
+    m = BSTR__VCLASS (v, cc) ^ flip;                                          \
+    if (m == 0) {                                                             \
+      BSTR__VSTORE (d + o, v);                                                \
+      o += (W);                                                               \
+    } else if (m != all) {                                                    \
+      BSTR__VCOMPRESS (d, o, s + i, ~m & all);                                \
+    }                                                                         \
+  }                                                                           \
+  return o + bstr__delete_class_c (d + o, s + i, len - i, cc);                \
+}                                                                             \
+/* Like delete, with the bytes to drop those in the class that are the      \
+   same as the one before.  A compressed store can write over the byte      \
+   before the next vector, so those are loaded before storing. */           \
+static tgt blen_t bstr__squeeze_class_##isa (unsigned char * d,              \
+                                             const unsigned char * s,        \
+                                             blen_t len,                     \
+                                             const struct bstr__charclass * cc) {\
+  BSTR__V s0, s1, s2, v, pv;                                                  \
+  BSTR__VNIBBLE_DECLS                                                         \
+  blen_t i = 1, o = 1;                                                        \
+  int j;                                                                      \
+  unsigned char c, prev;                                                      \
+  uint64_t m, all = ((W) == 64) ? ~(uint64_t) 0 : ((uint64_t) 1 << (W)) - 1;  \
+  uint64_t flip = cc->invert ? all : 0;                                       \
+  if (len <= (W) || (cc->qty == 0 && !cc->invert) ||                         \
+      (cc->qty > 3 && !BSTR__VNIBBLE_OK))                                     \
+    return bstr__squeeze_class_c (d, s, len, cc);                             \
+  s0 = BSTR__VSPLAT (cc->bytes[0]);                                           \
+  s1 = BSTR__VSPLAT (cc->bytes[1]);                                           \
+  s2 = BSTR__VSPLAT (cc->bytes[2]);                                           \
+  BSTR__VNIBBLE_LOAD (cc);                                                    \
+  d[0] = prev = s[0];                                                         \
+  pv = BSTR__VLOAD (s);                                                       \
+  for (; i + (W) <= len; i += (W)) {                                          \
+    v = BSTR__VLOAD (s + i);                                                  \
+    m = (cc->qty ? BSTR__VCLASS (v, cc) ^ flip : all) & BSTR__VEQ (v, pv);   \
+    prev = s[i + (W) - 1];                                                    \
+    if (i + 2 * (W) <= len) pv = BSTR__VLOAD (s + i + (W) - 1);               \
+    if (m == 0) {                                                             \
+      BSTR__VSTORE (d + o, v);                                                \
+      o += (W);                                                               \
+    } else if (m != all) {                                                    \
+      BSTR__VCOMPRESS (d, o, s + i, ~m & all);                                \
+    }                                                                         \
+  }                                                                           \
+  for (; i < len; i++) {                                                      \
+    c = s[i];                                                                 \
+    d[o] = c;                                                                 \
+    o += !(c == prev && cc->in[c]);                                           \
+    prev = c;                                                                 \
+  }                                                                           \
+  return o;                                                                   \
+}                                                                             \
+static tgt blen_t bstr__find_squeeze_##isa (const unsigned char * p,         \
+                                            blen_t len,                      \
+                                            const struct bstr__charclass * cc) {\
+  BSTR__V s0, s1, s2, v;                                                      \
+  BSTR__VNIBBLE_DECLS                                                         \
+  blen_t i = 1, j;                                                            \
+  uint64_t m, all = ((W) == 64) ? ~(uint64_t) 0 : ((uint64_t) 1 << (W)) - 1;  \
+  uint64_t flip = cc->invert ? all : 0;                                       \
+  if ((cc->qty == 0 && !cc->invert) || (cc->qty > 3 && !BSTR__VNIBBLE_OK))   \
+    return bstr__find_squeeze_c (p, len, cc);                                 \
+  s0 = BSTR__VSPLAT (cc->bytes[0]);                                           \
+  s1 = BSTR__VSPLAT (cc->bytes[1]);                                           \
+  s2 = BSTR__VSPLAT (cc->bytes[2]);                                           \
+  BSTR__VNIBBLE_LOAD (cc);                                                    \
+  for (; i + (W) <= len; i += (W)) {                                          \
+    v = BSTR__VLOAD (p + i);                                                  \
+    m = BSTR__VEQ (v, BSTR__VLOAD (p + i - 1));                               \
+    if (m && cc->qty) m &= BSTR__VCLASS (v, cc) ^ flip;                       \
+    if (m) return i + (blen_t) __builtin_ctzll (m);                           \
+  }                                                                           \
+  j = bstr__find_squeeze_c (p + i - 1, len - i + 1, cc);                      \
+  return (j < 0) ? -1 : i - 1 + j;                                            \
+}                                                                             \
+static tgt blen_t bstr__find_case_##isa (const unsigned char * p,            \
+                                         blen_t len, int how) {              \
+  BSTR__V cla, cln, cua, cun, v;                                              \
+  blen_t i = 0, j;                                                            \
+  uint64_t m, all = ((W) == 64) ? ~(uint64_t) 0 : ((uint64_t) 1 << (W)) - 1;  \
+  BSTR__VCASE_LOAD (how);                                                     \
+  for (; i + (W) <= len; i += (W)) {                                          \
+    v = BSTR__VLOAD (p + i);                                                  \
+    m = BSTR__VEQ (BSTR__VCASE (v), v) ^ all;                                 \
+    if (m) return i + (blen_t) __builtin_ctzll (m);                           \
+  }                                                                           \
+  j = bstr__find_case_c (p + i, len - i, how);                                \
+  return (j < 0) ? -1 : i + j;                                                \
+}                                                                             \
+static tgt void bstr__convert_case_##isa (unsigned char * d,                 \
+                                          const unsigned char * s,           \
+                                          blen_t len, int how) {             \
+  BSTR__V cla, cln, cua, cun;                                                 \
+  blen_t i = 0;                                                               \
+  BSTR__VCASE_LOAD (how);                                                     \
+  for (; i + (W) <= len; i += (W)) {                                          \
+    BSTR__VSTORE (d + i, BSTR__VCASE (BSTR__VLOAD (s + i)));                  \
+  }                                                                           \
+  bstr__convert_case_c (d + i, s + i, len - i, how);                          \
+}                                                                             \
+static const struct bstr__scan_kernels bstr__kernels_##isa = {                \
+  bstr__find_byte_##isa, bstr__find_last_byte_##isa, bstr__count_byte_##isa,  \
+  bstr__find_any3_##isa, bstr__find_nonws_##isa, bstr__find_last_nonws_##isa, \
+  bstr__find_class_##isa, bstr__find_last_class_##isa,                        \
+  bstr__find_casediff_##isa, bstr__count_class_##isa,                         \
+  bstr__translate_##isa, bstr__delete_class_##isa, bstr__squeeze_class_##isa, \
+  bstr__find_squeeze_##isa, bstr__find_case_##isa, bstr__convert_case_##isa   \
+};
+
+/* Whitespace is ' ' or a byte whose distance above '\t' is at most 4,
+   tested with an unsigned min since SSE2 and AVX2 lack unsigned compares.
+   For the same reason capitals are found by moving 'A' to -128 and doing
+   a signed compare against -128 + 26. */
+#define BSTR__V __m128i
+#define BSTR__VLOAD(p) _mm_loadu_si128 ((const __m128i *) (const void *) (p))
+#define BSTR__VSPLAT(c) _mm_set1_epi8 ((char) (c))
+#define BSTR__VEQ(v, s) \
+  ((uint64_t) (unsigned) _mm_movemask_epi8 (_mm_cmpeq_epi8 ((v), (s))))
+#define BSTR__VWS(v) ((uint64_t) (unsigned) _mm_movemask_epi8 (_mm_or_si128 ( \
+  _mm_cmpeq_epi8 ((v), _mm_set1_epi8 (' ')),                                  \
+  _mm_cmpeq_epi8 (_mm_min_epu8 (_mm_sub_epi8 ((v), _mm_set1_epi8 ('\t')),     \
+                                _mm_set1_epi8 ('\r' - '\t')),                 \
+                  _mm_sub_epi8 ((v), _mm_set1_epi8 ('\t'))))))
+#define BSTR__VLOWER(v) _mm_or_si128 ((v), _mm_and_si128 (                  \
+  _mm_cmplt_epi8 (_mm_add_epi8 ((v), _mm_set1_epi8 ((char) (0x80 - 'A'))),     \
+                  _mm_set1_epi8 ((char) (0x80 + 26))),                        \
+  _mm_set1_epi8 (0x20)))
+#define BSTR__VNIBBLE_OK 0
+#define BSTR__VNIBBLE_DECLS
+#define BSTR__VNIBBLE_LOAD(cc)
+#define BSTR__VNIBBLE(v, cc) 0
+#define BSTR__VSTORE(p, v) _mm_storeu_si128 ((__m128i *) (void *) (p), (v))
+#define BSTR__VTR_DECLS
+#define BSTR__VTR_LOAD(t)
+#define BSTR__VTR(r, v, t) r = (v)
+#define BSTR__VCASE(v) _mm_xor_si128 ((v), _mm_and_si128 (_mm_or_si128 (     \
+  _mm_cmplt_epi8 (_mm_add_epi8 ((v), cla), cln),                              \
+  _mm_cmplt_epi8 (_mm_add_epi8 ((v), cua), cun)), _mm_set1_epi8 (0x20)))
+#define BSTR__VCOMPRESS(d, o, s, keep)                                        \
+  for (j = 0; j < 16; j++) {                                                  \
+    (d)[o] = (s)[j];                                                          \
+    o += ((keep) >> j) & 1;                                                   \
+  }
+BSTR__SCAN_KERNELS (sse2, __attribute__ ((target ("sse2"))), 16)
+#undef BSTR__V
+#undef BSTR__VLOAD
+#undef BSTR__VSPLAT
+#undef BSTR__VEQ
+#undef BSTR__VWS
+#undef BSTR__VLOWER
+#undef BSTR__VNIBBLE_OK
+#undef BSTR__VNIBBLE_DECLS
+#undef BSTR__VNIBBLE_LOAD
+#undef BSTR__VSTORE
+#undef BSTR__VTR_DECLS
+#undef BSTR__VTR_LOAD
+#undef BSTR__VTR
+#undef BSTR__VCOMPRESS
+#undef BSTR__VCASE
+#undef BSTR__VNIBBLE
+
+#define BSTR__V __m256i
+#define BSTR__VLOAD(p) \
+  _mm256_loadu_si256 ((const __m256i *) (const void *) (p))
+#define BSTR__VSPLAT(c) _mm256_set1_epi8 ((char) (c))
+#define BSTR__VEQ(v, s) \
+  ((uint64_t) (unsigned) _mm256_movemask_epi8 (_mm256_cmpeq_epi8 ((v), (s))))
+#define BSTR__VWS(v) ((uint64_t) (unsigned) _mm256_movemask_epi8 (            \
+  _mm256_or_si256 (                                                           \
+    _mm256_cmpeq_epi8 ((v), _mm256_set1_epi8 (' ')),                          \
+    _mm256_cmpeq_epi8 (                                                       \
+      _mm256_min_epu8 (_mm256_sub_epi8 ((v), _mm256_set1_epi8 ('\t')),        \
+                       _mm256_set1_epi8 ('\r' - '\t')),                       \
+      _mm256_sub_epi8 ((v), _mm256_set1_epi8 ('\t'))))))
+#define BSTR__VLOWER(v) _mm256_or_si256 ((v), _mm256_and_si256 (            \
+  _mm256_cmpgt_epi8 (_mm256_set1_epi8 ((char) (0x80 + 26)),                   \
+                     _mm256_add_epi8 ((v),                                    \
+                                      _mm256_set1_epi8 ((char) (0x80 - 'A')))),\
+  _mm256_set1_epi8 (0x20)))
+#define BSTR__VNIBBLE_OK 1
+#define BSTR__VNIBBLE_DECLS __m256i lo0, hi0, lo1, hi1, nib;
+#define BSTR__VNIBBLE_LOAD(cc)                                                \
+  lo0 = _mm256_broadcastsi128_si256 (                                         \
+    _mm_loadu_si128 ((const __m128i *) (const void *) (cc)->lo[0]));          \
+  hi0 = _mm256_broadcastsi128_si256 (                                         \
+    _mm_loadu_si128 ((const __m128i *) (const void *) (cc)->hi[0]));          \
+  lo1 = _mm256_broadcastsi128_si256 (                                         \
+    _mm_loadu_si128 ((const __m128i *) (const void *) (cc)->lo[1]));          \
+  hi1 = _mm256_broadcastsi128_si256 (                                         \
+    _mm_loadu_si128 ((const __m128i *) (const void *) (cc)->hi[1]));          \
+  nib = _mm256_set1_epi8 (0x0f)
+#define BSTR__VNIBBLE_HALF(v, lo, hi)                                         \
+  _mm256_and_si256 (                                                          \
+    _mm256_shuffle_epi8 ((lo), _mm256_and_si256 ((v), nib)),                  \
+    _mm256_shuffle_epi8 ((hi), _mm256_and_si256 (_mm256_srli_epi16 ((v), 4),  \
+                                                 nib)))
+#define BSTR__VNIBBLE(v, cc) ((uint64_t) (unsigned) ~_mm256_movemask_epi8 (   \
+  _mm256_cmpeq_epi8 (                                                         \
+    ((cc)->tables > 1) ? _mm256_or_si256 (BSTR__VNIBBLE_HALF (v, lo0, hi0),   \
+                                          BSTR__VNIBBLE_HALF (v, lo1, hi1))   \
+                       : BSTR__VNIBBLE_HALF (v, lo0, hi0),                    \
+    _mm256_setzero_si256 ())))
+#define BSTR__VSTORE(p, v) \
+  _mm256_storeu_si256 ((__m256i *) (void *) (p), (v))
+#define BSTR__VTR_DECLS __m256i trdelta[16], trrow[16], trnib, trlo, trhi;   \
+  int trk;
+#define BSTR__VTR_LOAD(t)                                                     \
+  trnib = _mm256_set1_epi8 (0x0f);                                            \
+  for (trk = 0; trk < (t)->nrows; trk++) {                                    \
+    trdelta[trk] = _mm256_broadcastsi128_si256 (                              \
+      _mm_loadu_si128 ((const __m128i *) (const void *) (t)->delta[trk]));    \
+    trrow[trk] = _mm256_set1_epi8 ((char) (t)->rows[trk]);                    \
+  }
+#define BSTR__VTR(r, v, t)                                                    \
+  trlo = _mm256_and_si256 ((v), trnib);                                       \
+  trhi = _mm256_and_si256 (_mm256_srli_epi16 ((v), 4), trnib);                \
+  for (r = (v), trk = 0; trk < (t)->nrows; trk++) {                           \
+    r = _mm256_add_epi8 (r, _mm256_and_si256 (                                \
+          _mm256_shuffle_epi8 (trdelta[trk], trlo),                           \
+          _mm256_cmpeq_epi8 (trhi, trrow[trk])));                             \
+  }
+#define BSTR__VCASE(v) _mm256_xor_si256 ((v), _mm256_and_si256 (            \
+  _mm256_or_si256 (_mm256_cmpgt_epi8 (cln, _mm256_add_epi8 ((v), cla)),       \
+                   _mm256_cmpgt_epi8 (cun, _mm256_add_epi8 ((v), cua))),      \
+  _mm256_set1_epi8 (0x20)))
+#define BSTR__VCOMPRESS(d, o, s, keep)                                        \
+  for (j = 0; j < 32; j += 8) {                                               \
+    unsigned int k8 = (unsigned int) ((keep) >> j) & 0xff;                    \
+    _mm_storel_epi64 ((__m128i *) (void *) ((d) + (o)), _mm_shuffle_epi8 (    \
+      _mm_loadl_epi64 ((const __m128i *) (const void *) ((s) + j)),           \
+      _mm_loadl_epi64 ((const __m128i *) (const void *) bstr__compress8[k8])));\
+    o += __builtin_popcount (k8);                                             \
+  }
+BSTR__SCAN_KERNELS (avx2, __attribute__ ((target ("avx2"))), 32)
+#undef BSTR__V
+#undef BSTR__VLOAD
+#undef BSTR__VSPLAT
+#undef BSTR__VEQ
+#undef BSTR__VWS
+#undef BSTR__VLOWER
+#undef BSTR__VNIBBLE_OK
+#undef BSTR__VNIBBLE_DECLS
+#undef BSTR__VNIBBLE_LOAD
+#undef BSTR__VSTORE
+#undef BSTR__VTR_DECLS
+#undef BSTR__VTR_LOAD
+#undef BSTR__VTR
+#undef BSTR__VCOMPRESS
+#undef BSTR__VCASE
+#undef BSTR__VNIBBLE_HALF
+#undef BSTR__VNIBBLE
+
+#define BSTR__V __m512i
+#define BSTR__VLOAD(p) _mm512_loadu_si512 ((const void *) (p))
+#define BSTR__VSPLAT(c) _mm512_set1_epi8 ((char) (c))
+#define BSTR__VEQ(v, s) ((uint64_t) _mm512_cmpeq_epi8_mask ((v), (s)))
+#define BSTR__VWS(v) ((uint64_t) (                                            \
+  _mm512_cmpeq_epi8_mask ((v), _mm512_set1_epi8 (' ')) |                      \
+  _mm512_cmple_epu8_mask (_mm512_sub_epi8 ((v), _mm512_set1_epi8 ('\t')),     \
+                          _mm512_set1_epi8 ('\r' - '\t'))))
+#define BSTR__VLOWER(v) _mm512_or_si512 ((v), _mm512_maskz_mov_epi8 (       \
+  _mm512_cmplt_epu8_mask (_mm512_sub_epi8 ((v), _mm512_set1_epi8 ('A')),      \
+                          _mm512_set1_epi8 (26)),                             \
+  _mm512_set1_epi8 (0x20)))
+#define BSTR__VNIBBLE_OK 1
+#define BSTR__VNIBBLE_DECLS __m512i lo0, hi0, lo1, hi1, nib;
+#define BSTR__VNIBBLE_LOAD(cc)                                                \
+  lo0 = _mm512_broadcast_i32x4 (                                              \
+    _mm_loadu_si128 ((const __m128i *) (const void *) (cc)->lo[0]));          \
+  hi0 = _mm512_broadcast_i32x4 (                                              \
+    _mm_loadu_si128 ((const __m128i *) (const void *) (cc)->hi[0]));          \
+  lo1 = _mm512_broadcast_i32x4 (                                              \
+    _mm_loadu_si128 ((const __m128i *) (const void *) (cc)->lo[1]));          \
+  hi1 = _mm512_broadcast_i32x4 (                                              \
+    _mm_loadu_si128 ((const __m128i *) (const void *) (cc)->hi[1]));          \
+  nib = _mm512_set1_epi8 (0x0f)
+#define BSTR__VNIBBLE_HALF(v, lo, hi)                                         \
+  _mm512_and_si512 (                                                          \
+    _mm512_shuffle_epi8 ((lo), _mm512_and_si512 ((v), nib)),                  \
+    _mm512_shuffle_epi8 ((hi), _mm512_and_si512 (_mm512_srli_epi16 ((v), 4),  \
+                                                 nib)))
+#define BSTR__VNIBBLE(v, cc) ((uint64_t) _mm512_test_epi8_mask (              \
+  ((cc)->tables > 1) ? _mm512_or_si512 (BSTR__VNIBBLE_HALF (v, lo0, hi0),     \
+                                        BSTR__VNIBBLE_HALF (v, lo1, hi1))     \
+                     : BSTR__VNIBBLE_HALF (v, lo0, hi0),                      \
+  _mm512_set1_epi8 ((char) 0xff)))
+#define BSTR__VSTORE(p, v) _mm512_storeu_si512 ((void *) (p), (v))
+#define BSTR__VTR_DECLS __m512i trdelta[16], trrow[16], trnib, trlo, trhi;   \
+  int trk;
+#define BSTR__VTR_LOAD(t)                                                     \
+  trnib = _mm512_set1_epi8 (0x0f);                                            \
+  for (trk = 0; trk < (t)->nrows; trk++) {                                    \
+    trdelta[trk] = _mm512_broadcast_i32x4 (                                   \
+      _mm_loadu_si128 ((const __m128i *) (const void *) (t)->delta[trk]));    \
+    trrow[trk] = _mm512_set1_epi8 ((char) (t)->rows[trk]);                    \
+  }
+#define BSTR__VTR(r, v, t)                                                    \
+  trlo = _mm512_and_si512 ((v), trnib);                                       \
+  trhi = _mm512_and_si512 (_mm512_srli_epi16 ((v), 4), trnib);                \
+  for (r = (v), trk = 0; trk < (t)->nrows; trk++) {                           \
+    r = _mm512_mask_add_epi8 (r, _mm512_cmpeq_epi8_mask (trhi, trrow[trk]),   \
+                              r, _mm512_shuffle_epi8 (trdelta[trk], trlo));   \
+  }
+#define BSTR__VCASE(v) _mm512_xor_si512 ((v), _mm512_maskz_mov_epi8 (       \
+  _mm512_cmplt_epi8_mask (_mm512_add_epi8 ((v), cla), cln) |                  \
+  _mm512_cmplt_epi8_mask (_mm512_add_epi8 ((v), cua), cun),                   \
+  _mm512_set1_epi8 (0x20)))
+#define BSTR__VCOMPRESS(d, o, s, keep)                                        \
+  for (j = 0; j < 64; j += 16) {                                              \
+    __mmask16 k16 = (__mmask16) ((keep) >> j);                                \
+    _mm_storeu_si128 ((__m128i *) (void *) ((d) + (o)), _mm512_cvtepi32_epi8 (\
+      _mm512_maskz_compress_epi32 (k16, _mm512_cvtepu8_epi32 (                \
+        _mm_loadu_si128 ((const __m128i *) (const void *) ((s) + j))))));      \
+    o += __builtin_popcount (k16);                                            \
+  }
+BSTR__SCAN_KERNELS (avx512, __attribute__ ((target ("avx512f,avx512bw"))), 64)
+#undef BSTR__V
+#undef BSTR__VLOAD
+#undef BSTR__VSPLAT
+#undef BSTR__VEQ
+#undef BSTR__VWS
+#undef BSTR__VLOWER
+#undef BSTR__VNIBBLE_OK
+#undef BSTR__VNIBBLE_DECLS
+#undef BSTR__VNIBBLE_LOAD
+#undef BSTR__VSTORE
+#undef BSTR__VTR_DECLS
+#undef BSTR__VTR_LOAD
+#undef BSTR__VTR
+#undef BSTR__VCOMPRESS
+#undef BSTR__VCASE
+#undef BSTR__VNIBBLE_HALF
+#undef BSTR__VNIBBLE
+
+#undef BSTR__SCAN_KERNELS
+#undef BSTR__VCLASS
+#undef BSTR__VCASE_LOAD
+
+#endif /* RLIB_SIMD_X86 */
+
+/* The kernels in use, and the best level this CPU supports. */
+static const struct bstr__scan_kernels * bstr__kernels = &bstr__kernels_c;
+static int bstr__simd_level = RLIB_SIMD_NONE;
+static int bstr__simd_best = RLIB_SIMD_NONE;
+
+static const struct bstr__scan_kernels * bstr__kernels_for (int level) {
+  switch (level) {
+#if defined (RLIB_SIMD_X86)
+  case RLIB_SIMD_AVX512: return &bstr__kernels_avx512;
+  case RLIB_SIMD_AVX2: return &bstr__kernels_avx2;
+  case RLIB_SIMD_SSE2: return &bstr__kernels_sse2;
+#endif
+  default: return &bstr__kernels_c;
+  }
+}
+
+#if defined (RLIB_SIMD_X86)
+__attribute__ ((constructor)) static void bstr__kernels_init (void) {
+  int k, b, n;
+
+  for (k = 0; k < 256; k++) {
+    for (b = n = 0; b < 8; b++) {
+      if (k & (1 << b)) bstr__compress8[k][n++] = (unsigned char) b;
+    }
+  }
+
+  __builtin_cpu_init ();
+  if (__builtin_cpu_supports ("avx512bw")) bstr__simd_best = RLIB_SIMD_AVX512;
+  else if (__builtin_cpu_supports ("avx2")) bstr__simd_best = RLIB_SIMD_AVX2;
+  else if (__builtin_cpu_supports ("sse2")) bstr__simd_best = RLIB_SIMD_SSE2;
+  bstr__simd_level = bstr__simd_best;
+  bstr__kernels = bstr__kernels_for (bstr__simd_level);
+}
+#endif
+
 /* Compute the snapped size for a given requested size.  By snapping to powers
    of 2 like this, repeated reallocations are avoided. */
-static int snapUpSize (int i) {
+static blen_t snapUpSize (blen_t i) {
   if (i < 8) {
     i = 8;
   } else {
-    unsigned int j;
-    j = (unsigned int) i;
-
-    j |= (j >>  1);
-    j |= (j >>  2);
-    j |= (j >>  4);
-    j |= (j >>  8);		/* Ok, since int >= 16 bits */
-#if (UINT_MAX != 0xffff)
-    j |= (j >> 16);		/* For 32 bit int systems */
-#if (UINT_MAX > 0xffffffffUL)
-    j |= (j >> 32);		/* For 64 bit int systems */
-#endif
-#endif
+    size_t j, k;
+    j = (size_t) i;
+
+    /* RMM edit: size_t rather than unsigned int so that this also works
+       for RLIB_LARGE_STRINGS lengths */
+    for (k = 1; k < sizeof (size_t) * CHAR_BIT; k <<= 1) j |= (j >> k);
+
     /* Least power of two greater than i */
     j++;
-    if ((int) j >= i) i = (int) j;
+    if (j <= (size_t) BLEN_MAX && (blen_t) j >= i) i = (blen_t) j;
   }
   return i;
 }
 
-/*  int balloc (bstring b, int len)
+/* RMM edit: the global growth policy, see BSTR_GROW_POW2 and friends. */
+static int bstr__grow_policy = BSTR_GROW_POW2;
+
+/* RMM edit: number of times balloc and ballocmin have moved or resized a
+   buffer, for tuning growth policies against realloc traffic. */
+static RLIB_THREAD_LOCAL size_t bstr__resize_count = 0;
+
+/* Compute the capacity to use for a buffer with flags flags that currently
+   holds mlen bytes (0 for a new buffer) and needs at least olen. */
+static blen_t bstr__grow_size (int flags, blen_t mlen, blen_t olen) {
+  int policy = (flags & BSTR_F_GROW_MASK) >> BSTR_F_GROW_SHIFT;
+  blen_t len;
+
+  if (policy == BSTR_GROW_DEFAULT) policy = bstr__grow_policy;
+
+  switch (policy) {
+  case BSTR_GROW_HALF:
+    len = (mlen > BLEN_MAX - (mlen >> 1)) ? BLEN_MAX : mlen + (mlen >> 1);
+    if (len < olen) len = olen;
+    if (len < 8) len = 8;
+    return len;
+  case BSTR_GROW_EXACT:
+    if (mlen <= 0) return olen;
+    return (olen > BLEN_MAX - BSTR_GROW_HEADROOM) ?
+           olen : olen + BSTR_GROW_HEADROOM;
+  default:
+    return snapUpSize (olen);
+  }
+}
+
+/* RMM edit: storage helpers.
+ *
+ * Every bstring header and data buffer (and every bstrList) that bstrlib
+ * hands out goes through these, so that the backing store can be chosen per
+ * object.  While an rlib_arena is installed with rlib_arena_use (), new
+ * headers and data are carved out of that arena and flagged BSTR_F_ARENA;
+ * they are released all at once by rlib_arena_reset () or rlib_arena_free ()
+ * rather than one at a time.  The arena an object came from is stored just
+ * in front of its header so that growing it later does not depend on which
+ * arena happens to be current. */
+
+typedef struct rlib_arena rlib_arena;
+
+static void * rlib__arena_alloc (rlib_arena * arena, size_t sz);
+static void * rlib__arena_grow (rlib_arena * arena, void * p, size_t osz,
+                                size_t nsz);
+
+static RLIB_THREAD_LOCAL rlib_arena * rlib__arena_current = NULL;
+
+struct bstr__arena_hdr {
+  rlib_arena * arena;
+  struct tagbstring b;
+};
+
+struct bstr__arena_list {
+  rlib_arena * arena;
+  struct bstrList l;
+};
+
+#define bstr__arena_of(b) \
+  (((struct bstr__arena_hdr *) ((char *) (b) - \
+    offsetof (struct bstr__arena_hdr, b)))->arena)
+
+#define bstr__list_arena_of(sl) \
+  (((struct bstr__arena_list *) ((char *) (sl) - \
+    offsetof (struct bstr__arena_list, l)))->arena)
+
+/* RMM edit: large buffer tier.  Data buffers of at least
+   bstr__mmap_threshold bytes are backed by anonymous memory mappings so that
+   they can grow with mremap (on Linux) instead of a realloc that may copy
+   the whole buffer.  A threshold of 0 turns the tier off. */
+
+#if defined (MAP_ANONYMOUS) || defined (MAP_ANON)
+# define BSTR_HAVE_MMAP
+# if !defined (MAP_ANONYMOUS)
+#  define MAP_ANONYMOUS MAP_ANON
+# endif
+#endif
+
+#ifndef BSTR_MMAP_THRESHOLD
+#define BSTR_MMAP_THRESHOLD (64 * 1024 * 1024)
+#endif
+
+static size_t bstr__mmap_threshold = BSTR_MMAP_THRESHOLD;
+static int bstr__mmap_hugepages = 0;
+
+#if defined (BSTR_HAVE_MMAP)
+
+#if defined (__linux__)
+/* Declared here since sys/mman.h only does so under _GNU_SOURCE. */
+extern void * mremap (void * old_address, size_t old_size, size_t new_size,
+                      int flags, ...);
+# ifndef MREMAP_MAYMOVE
+#  define MREMAP_MAYMOVE 1
+# endif
+#endif
+
+#define bstr__use_mmap(len) \
+  (bstr__mmap_threshold > 0 && (size_t) (len) >= bstr__mmap_threshold)
+#define bstr__mmap_free(p,len) munmap ((p), (len))
+
+static void bstr__mmap_advise (void * p, size_t len) {
+#if defined (MADV_HUGEPAGE)
+  if (bstr__mmap_hugepages) madvise (p, len, MADV_HUGEPAGE);
+#else
+  (void) p; (void) len;
+#endif
+}
+
+static unsigned char * bstr__mmap_alloc (size_t len) {
+  void * p = mmap (NULL, len, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (p == MAP_FAILED) return NULL;
+  bstr__mmap_advise (p, len);
+  return (unsigned char *) p;
+}
+
+static unsigned char * bstr__mmap_resize (unsigned char * p, size_t olen,
+                                          size_t nlen) {
+#if defined (__linux__)
+  void * q = mremap (p, olen, nlen, MREMAP_MAYMOVE);
+  if (q == MAP_FAILED) return NULL;
+  if (nlen > olen) bstr__mmap_advise (q, nlen);
+  return (unsigned char *) q;
+#else
+  unsigned char * q = bstr__mmap_alloc (nlen);
+  if (q == NULL) return NULL;
+  bstr__memcpy (q, p, olen < nlen ? olen : nlen);
+  munmap (p, olen);
+  return q;
+#endif
+}
+
+#else
+
+#define bstr__use_mmap(len) 0
+#define bstr__mmap_alloc(len) NULL
+#define bstr__mmap_resize(p,olen,nlen) NULL
+#define bstr__mmap_free(p,len) ((void) 0)
+
+#endif
+
+/* RMM edit: copy on write.  With RLIB_COW_STRINGS defined, heap data
+   buffers carry a reference count in front of them and bstrcpy shares the
+   buffer of its argument instead of copying it.  Every function that writes
+   to a string's data first calls bstr__unshare, which gives the string a
+   private copy if any other string still refers to its buffer.  Arena,
+   inline and mmap buffers are never shared. */
+
+#if defined (RLIB_COW_STRINGS)
+
+typedef union {
+  long refs;
+  double align_d;
+  void * align_p;
+} bstr__rc_hdr;
+
+#define bstr__rc_of(p) \
+  ((bstr__rc_hdr *) ((unsigned char *) (p) - sizeof (bstr__rc_hdr)))
+
+#if defined (__GNUC__)
+# define bstr__rc_load(h) __atomic_load_n (&(h)->refs, __ATOMIC_ACQUIRE)
+# define bstr__rc_inc(h)  __atomic_add_fetch (&(h)->refs, 1, __ATOMIC_RELAXED)
+# define bstr__rc_dec(h)  __atomic_sub_fetch (&(h)->refs, 1, __ATOMIC_ACQ_REL)
+#else
+/* Not thread safe: only share strings within one thread. */
+# define bstr__rc_load(h) ((h)->refs)
+# define bstr__rc_inc(h)  (++(h)->refs)
+# define bstr__rc_dec(h)  (--(h)->refs)
+#endif
+
+#define bstr__shared(b) \
+  ((b)->mlen > 0 && ((b)->flags & BSTR_F_RC) && \
+   bstr__rc_load (bstr__rc_of ((b)->data)) > 1)
+#define bstr__unshare(b) \
+  (bstr__shared (b) ? bstr__unshare_slow (b) : BSTR_OK)
+
+static int bstr__unshare_slow (bstring b);
+
+#else
+
+#define bstr__shared(b) 0
+#define bstr__unshare(b) BSTR_OK
+
+#endif
+
+/* Allocate a string header from the current backing store.  If inl is
+   positive, inl bytes of data are allocated right behind the header in the
+   same block and attached as an inline buffer.  Otherwise the data pointer
+   is left NULL and the caller attaches data with bstr__dalloc. */
+static bstring bstr__halloc (blen_t inl) {
+  bstring b;
+
+  if (rlib__arena_current != NULL) {
+    struct bstr__arena_hdr * h = (struct bstr__arena_hdr *)
+      rlib__arena_alloc (rlib__arena_current,
+                         sizeof (struct bstr__arena_hdr) + (size_t) inl);
+    if (h == NULL) return NULL;
+    h->arena = rlib__arena_current;
+    b = &h->b;
+    b->flags = BSTR_F_ARENA;
+  } else {
+    b = (bstring) bstr__alloc (sizeof (struct tagbstring) + (size_t) inl);
+    if (b == NULL) return NULL;
+    b->flags = 0;
+  }
+
+  b->slen = 0;
+  if (inl > 0) {
+    b->mlen = inl;
+    b->data = (unsigned char *) (b + 1);
+    b->flags |= BSTR_F_INLINE;
+  } else {
+    b->mlen = 0;
+    b->data = NULL;
+  }
+  return b;
+}
+
+/* Release a header returned by bstr__halloc whose data has already been
+   released (or was never attached). */
+static void bstr__hfree (bstring b) {
+  if ((b->flags & (BSTR_F_ARENA | BSTR_F_PACKED)) == 0) bstr__free (b);
+}
+
+/* Allocate len bytes of data storage for b, from the same backing store
+   as its header.  The BSTR_F_DATA_MASK bits describing the new buffer are
+   stored in *kind; the caller folds them into b->flags once it attaches the
+   buffer (see bstr__dattach). */
+static unsigned char * bstr__dalloc (bstring b, blen_t len, int * kind) {
+  *kind = 0;
+  if (b->flags & BSTR_F_ARENA) {
+    return (unsigned char *)
+      rlib__arena_alloc (bstr__arena_of (b), (size_t) len);
+  }
+  if (bstr__use_mmap (len)) {
+    unsigned char * x = bstr__mmap_alloc ((size_t) len);
+    if (x != NULL) {
+      *kind = BSTR_F_MMAP;
+      return x;
+    }
+  }
+#if defined (RLIB_COW_STRINGS)
+  {
+    bstr__rc_hdr * h = (bstr__rc_hdr *)
+      bstr__alloc (sizeof (bstr__rc_hdr) + (size_t) len);
+    if (h == NULL) return NULL;
+    h->refs = 1;
+    *kind = BSTR_F_RC;
+    return (unsigned char *) (h + 1);
+  }
+#else
+  return (unsigned char *) bstr__alloc ((size_t) len);
+#endif
+}
+
+/* Release the data storage of b.  Arena storage is reclaimed in bulk and
+   inline storage goes with the header, so this is a no-op for those.  A
+   shared buffer is only released by the last string referring to it. */
+static void bstr__dfree (bstring b) {
+  if (b->flags & (BSTR_F_ARENA | BSTR_F_INLINE)) return;
+  if (b->flags & BSTR_F_MMAP) {
+    bstr__mmap_free (b->data, (size_t) b->mlen);
+#if defined (RLIB_COW_STRINGS)
+  } else if (b->flags & BSTR_F_RC) {
+    bstr__rc_hdr * h = bstr__rc_of (b->data);
+    if (bstr__rc_dec (h) == 0) bstr__free (h);
+#endif
+  } else {
+    bstr__free (b->data);
+  }
+}
+
+/* Resize the data storage of b to len bytes, preserving its first
+   min (b->mlen, len) bytes and releasing the old buffer on success.  b->data
+   and b->mlen are not updated and *kind is set as for bstr__dalloc.  An
+   inline buffer cannot be resized, so it is copied out to a separate one.
+   b must not be sharing its buffer (see bstr__unshare). */
+static unsigned char * bstr__drealloc (bstring b, blen_t len, int * kind) {
+  unsigned char * x;
+  size_t keep = (size_t) (len < b->mlen ? len : b->mlen);
+
+  if (b->flags & BSTR_F_INLINE) {
+    x = bstr__dalloc (b, len, kind);
+    if (x != NULL) bstr__memcpy (x, b->data, keep);
+    return x;
+  }
+  if (b->flags & BSTR_F_ARENA) {
+    *kind = 0;
+    return (unsigned char *)
+      rlib__arena_grow (bstr__arena_of (b), b->data, (size_t) b->mlen,
+                        (size_t) len);
+  }
+  if ((b->flags & BSTR_F_MMAP) || bstr__use_mmap (len)) {
+    if ((b->flags & BSTR_F_MMAP) && bstr__use_mmap (len)) {
+      *kind = BSTR_F_MMAP;
+      return bstr__mmap_resize (b->data, (size_t) b->mlen, (size_t) len);
+    }
+
+    /* Crossing the threshold in either direction */
+    x = bstr__dalloc (b, len, kind);
+    if (x == NULL) return NULL;
+    bstr__memcpy (x, b->data, keep);
+    bstr__dfree (b);
+    return x;
+  }
+#if defined (RLIB_COW_STRINGS)
+  if (b->flags & BSTR_F_RC) {
+    bstr__rc_hdr * h = (bstr__rc_hdr *)
+      bstr__realloc (bstr__rc_of (b->data),
+                     sizeof (bstr__rc_hdr) + (size_t) len);
+    if (h == NULL) return NULL;
+    *kind = BSTR_F_RC;
+    return (unsigned char *) (h + 1);
+  }
+#endif
+  *kind = 0;
+  return (unsigned char *) bstr__realloc (b->data, (size_t) len);
+}
+
+/* Attach a buffer returned by bstr__dalloc or bstr__drealloc to b. */
+#define bstr__dattach(b,x,len,kind) { \
+  (b)->data = (x); \
+  (b)->mlen = (len); \
+  (b)->flags = ((b)->flags & ~BSTR_F_DATA_MASK) | (kind); \
+}
+
+#if defined (RLIB_COW_STRINGS)
+/* Give b a private copy of its shared buffer, with the same capacity. */
+static int bstr__unshare_slow (bstring b) {
+  unsigned char * x;
+  int kind;
+
+  if (NULL == (x = bstr__dalloc (b, b->mlen, &kind))) return BSTR_ERR;
+  bstr__memcpy (x, b->data, (size_t) (b->slen < b->mlen ? b->slen + 1
+                                                         : b->mlen));
+  bstr__dfree (b);
+  bstr__dattach (b, x, b->mlen, kind);
+  return BSTR_OK;
+}
+#endif
+
+/* Allocate a string header with an mlen byte data buffer attached, sharing
+   one allocation when the buffer is small enough. */
+static bstring bstr__new (blen_t mlen) {
+  bstring b;
+  unsigned char * x;
+  int kind;
+
+  if (mlen <= BSTR_INLINE_MAX) return bstr__halloc (mlen);
+
+  if (NULL == (b = bstr__halloc (0))) return NULL;
+  if (NULL == (x = bstr__dalloc (b, mlen, &kind))) {
+    bstr__hfree (b);
+    return NULL;
+  }
+  bstr__dattach (b, x, mlen, kind);
+  return b;
+}
+
+/* Allocate a bstrList with room for mlen entries and no entries in use. */
+static struct bstrList * bstr__list_new (blen_t mlen) {
+  struct bstrList * sl;
+  size_t nsz = ((size_t) mlen) * sizeof (bstring);
+
+  if (rlib__arena_current != NULL) {
+    struct bstr__arena_list * h = (struct bstr__arena_list *)
+      rlib__arena_alloc (rlib__arena_current, sizeof (struct bstr__arena_list));
+    if (h == NULL) return NULL;
+    h->arena = rlib__arena_current;
+    sl = &h->l;
+    sl->flags = BSTR_F_ARENA;
+    sl->entry = (bstring *) rlib__arena_alloc (h->arena, nsz);
+    if (sl->entry == NULL) return NULL;
+  } else {
+    sl = (struct bstrList *) bstr__alloc (sizeof (struct bstrList));
+    if (sl == NULL) return NULL;
+    sl->flags = 0;
+    sl->entry = (bstring *) bstr__alloc (nsz);
+    if (sl->entry == NULL) {
+      bstr__free (sl);
+      return NULL;
+    }
+  }
+
+  sl->qty = 0;
+  sl->mlen = mlen;
+  return sl;
+}
+
+/* Resize the entry array of sl to hold mlen entries.  sl->entry and
+   sl->mlen are not updated.  The entry array of a packed list cannot be
+   resized, so it is copied out to a separate one. */
+static bstring * bstr__list_realloc (struct bstrList * sl, blen_t mlen) {
+  size_t nsz = ((size_t) mlen) * sizeof (bstring);
+  if (sl->flags & BSTR_F_INLINE) {
+    bstring * l = (bstring *) bstr__alloc (nsz);
+    if (l == NULL) return NULL;
+    bstr__memcpy (l, sl->entry,
+                  ((size_t) (mlen < sl->mlen ? mlen : sl->mlen))
+                  * sizeof (bstring));
+    sl->flags &= ~BSTR_F_INLINE;
+    return l;
+  }
+  if (sl->flags & BSTR_F_ARENA) {
+    return (bstring *) rlib__arena_grow (bstr__list_arena_of (sl), sl->entry,
+                                         ((size_t) sl->mlen) * sizeof (bstring),
+                                         nsz);
+  }
+  return (bstring *) bstr__realloc (sl->entry, nsz);
+}
+
+/* Release the entry array and header of sl (not the entries). */
+static void bstr__list_free (struct bstrList * sl) {
+  if ((sl->flags & BSTR_F_ARENA) == 0) {
+    if ((sl->flags & BSTR_F_INLINE) == 0) bstr__free (sl->entry);
+    bstr__free (sl);
+  }
+}
+
+/* The fields found by a split, as (offset, length) pairs, gathered by
+   bstr__rangecb so that bstr__list_pack can size one allocation for them
+   all.  The first few pairs are kept in the struct to avoid a malloc. */
+#define BSTR_STATIC_RANGE_COUNT 32
+
+struct bstr__ranges {
+  blen_t * r;
+  blen_t qty, mlen;
+  size_t bytes;
+  blen_t static_r[2 * BSTR_STATIC_RANGE_COUNT];
+};
+
+static void bstr__ranges_init (struct bstr__ranges * rg) {
+  rg->r = rg->static_r;
+  rg->qty = 0;
+  rg->mlen = BSTR_STATIC_RANGE_COUNT;
+  rg->bytes = 0;
+}
+
+static void bstr__ranges_free (struct bstr__ranges * rg) {
+  if (rg->r != rg->static_r) bstr__free (rg->r);
+}
+
+static int bstr__rangecb (void * parm, blen_t ofs, blen_t len) {
+  struct bstr__ranges * rg = (struct bstr__ranges *) parm;
+
+  if (rg->qty >= rg->mlen) {
+    blen_t * t;
+    size_t sz;
+
+    if ((size_t) rg->mlen > ((size_t) BLEN_MAX) / (4 * sizeof (blen_t)))
+      return BSTR_ERR;
+    sz = 4 * sizeof (blen_t) * (size_t) rg->mlen;
+    if (rg->r == rg->static_r) {
+      if (NULL == (t = (blen_t *) bstr__alloc (sz))) return BSTR_ERR;
+      bstr__memcpy (t, rg->static_r, sizeof (rg->static_r));
+    } else {
+      if (NULL == (t = (blen_t *) bstr__realloc (rg->r, sz))) return BSTR_ERR;
+    }
+    rg->r = t;
+    rg->mlen += rg->mlen;
+  }
+
+  rg->r[2 * rg->qty] = ofs;
+  rg->r[2 * rg->qty + 1] = len;
+  rg->qty++;
+  rg->bytes += (size_t) len + 1;
+  return BSTR_OK;
+}
+
+/* Build a bstrList holding the fields of str in rg with a single
+   allocation: the list header, its entry array, the entry headers and the
+   '\0' terminated field bytes, in that order.  The entries are flagged
+   BSTR_F_PACKED | BSTR_F_INLINE, so writes that fit stay in place and
+   anything bigger is copied out by balloc like for any inline string.
+   Destroying the list is then one free.  rg is released. */
+static struct bstrList * bstr__list_pack (const_bstring str,
+                                          struct bstr__ranges * rg) {
+  struct bstrList * sl;
+  struct tagbstring * hdr;
+  unsigned char * p;
+  blen_t i, mlen = rg->qty > 0 ? rg->qty : 1;
+
+  sl = (struct bstrList *)
+    bstr__alloc (sizeof (struct bstrList) +
+                 ((size_t) mlen) * sizeof (bstring) +
+                 ((size_t) rg->qty) * sizeof (struct tagbstring) +
+                 rg->bytes);
+  if (sl != NULL) {
+    sl->entry = (bstring *) (sl + 1);
+    sl->qty = rg->qty;
+    sl->mlen = mlen;
+    sl->flags = BSTR_F_PACKED | BSTR_F_INLINE;
+
+    hdr = (struct tagbstring *) (sl->entry + mlen);
+    p = (unsigned char *) (hdr + rg->qty);
+    for (i = 0; i < rg->qty; i++) {
+      blen_t len = rg->r[2 * i + 1];
+      if (len) bstr__memcpy (p, str->data + rg->r[2 * i], (size_t) len);
+      p[len] = (unsigned char) '\0';
+      hdr[i].data = p;
+      hdr[i].slen = len;
+      hdr[i].mlen = len + 1;
+      hdr[i].flags = BSTR_F_PACKED | BSTR_F_INLINE;
+      sl->entry[i] = &hdr[i];
+      p += len + 1;
+    }
+  }
+
+  bstr__ranges_free (rg);
+  return sl;
+}
+
+/*  int balloc (bstring b, blen_t len)
  *
  *  Increase the size of the memory backing the bstring b to at least len.
  */
-int balloc (bstring b, int olen) {
-  int len;
+int balloc (bstring b, blen_t olen) {
+  blen_t len;
   if (b == NULL || b->data == NULL || b->slen < 0 || b->mlen <= 0 ||
       b->mlen < b->slen || olen <= 0) {
     return BSTR_ERR;
@@ -539,25 +2008,31 @@ int balloc (bstring b, int olen) {
 
   if (olen >= b->mlen) {
     unsigned char * x;
+    int kind;
 
-    if ((len = snapUpSize (olen)) <= b->mlen) return BSTR_OK;
+    /* RMM edit: size chosen by the string's growth policy */
+    if ((len = bstr__grow_size (b->flags, b->mlen, olen)) <= b->mlen)
+      return bstr__unshare (b);
 
-    /* Assume probability of a non-moving realloc is 0.125 */
-    if (7 * b->mlen < 8 * b->slen) {
+    /* Assume probability of a non-moving realloc is 0.125.  Arena storage
+       can often be extended in place, so always try that first.  A shared
+       buffer is never resized in place, it is copied (RMM edit). */
+    if (!bstr__shared (b) && (7 * b->mlen < 8 * b->slen ||
+        (b->flags & (BSTR_F_ARENA | BSTR_F_MMAP)))) { /* RMM edit */
 
       /* If slen is close to mlen in size then use realloc to reduce
          the memory defragmentation */
 
       reallocStrategy:;
 
-      x = (unsigned char *) bstr__realloc (b->data, (size_t) len);
+      x = bstr__drealloc (b, len, &kind); /* RMM edit */
       if (x == NULL){
 
         /* Since we failed, try allocating the tighest possible
            allocation */
 
         len = olen;
-        x = (unsigned char *) bstr__realloc (b->data, (size_t) olen);
+        x = bstr__drealloc (b, olen, &kind); /* RMM edit */
         if (NULL == x) {
           return BSTR_ERR;
         }
@@ -568,21 +2043,22 @@ int balloc (bstring b, int olen) {
          the extra bytes that are allocated, but not considered part of
          the string */
 
-      if (NULL == (x = (unsigned char *) bstr__alloc ((size_t) len))) {
+      if (NULL == (x = bstr__dalloc (b, len, &kind))) { /* RMM edit */
 
         /* Perhaps there is no available memory for the two
            allocations to be in memory at once */
 
+        if (bstr__shared (b)) return BSTR_ERR; /* RMM edit */
         goto reallocStrategy;
 
       } else {
         if (b->slen) bstr__memcpy ((char *) x, (char *) b->data,
                                    (size_t) b->slen);
-        bstr__free (b->data);
+        bstr__dfree (b); /* RMM edit */
       }
     }
-    b->data = x;
-    b->mlen = len;
+    bstr__dattach (b, x, len, kind); /* RMM edit */
+    bstr__resize_count++;
     b->data[b->slen] = (unsigned char) '\0';
 
 #if defined (BSTRLIB_TEST_CANARY)
@@ -590,34 +2066,41 @@ int balloc (bstring b, int olen) {
 			memchr (b->data + b->slen + 1, 'X', len - (b->slen + 1));
 		}
 #endif
+  } else if (bstr__unshare (b) != BSTR_OK) { /* RMM edit */
+    return BSTR_ERR;
   }
 
   return BSTR_OK;
 }
 
-/*  int ballocmin (bstring b, int len)
+/*  int ballocmin (bstring b, blen_t len)
  *
  *  Set the size of the memory backing the bstring b to len or b->slen+1,
  *  whichever is larger.  Note that repeated use of this function can degrade
  *  performance.
  */
-int ballocmin (bstring b, int len) {
+int ballocmin (bstring b, blen_t len) {
   unsigned char * s;
+  int kind;
 
   if (b == NULL || b->data == NULL) return BSTR_ERR;
-  if (b->slen >= INT_MAX || b->slen < 0) return BSTR_ERR;
+  if (b->slen >= BLEN_MAX || b->slen < 0) return BSTR_ERR;
   if (b->mlen <= 0 || b->mlen < b->slen || len <= 0) {
     return BSTR_ERR;
   }
 
   if (len < b->slen + 1) len = b->slen + 1;
 
+  /* RMM edit: an inline buffer costs nothing extra, so never shrink it. */
+  if ((b->flags & BSTR_F_INLINE) && len <= b->mlen) return BSTR_OK;
+  if (bstr__unshare (b) != BSTR_OK) return BSTR_ERR; /* RMM edit */
+
   if (len != b->mlen) {
-    s = (unsigned char *) bstr__realloc (b->data, (size_t) len);
+    s = bstr__drealloc (b, len, &kind); /* RMM edit */
     if (NULL == s) return BSTR_ERR;
     s[b->slen] = (unsigned char) '\0';
-    b->data = s;
-    b->mlen = len;
+    bstr__dattach (b, s, len, kind);
+    bstr__resize_count++;
   }
 
   return BSTR_OK;
@@ -630,30 +2113,26 @@ int ballocmin (bstring b, int len) {
  */
 bstring bfromcstr (const char * str) {
   bstring b;
-  int i;
+  blen_t i;
   size_t j;
 
   if (str == NULL) return NULL;
   j = (strlen) (str);
-  i = snapUpSize ((int) (j + (2 - (j != 0))));
-  if (i <= (int) j) return NULL;
+  i = bstr__grow_size (0, 0, (blen_t) (j + (2 - (j != 0))));
+  if (i <= (blen_t) j) return NULL;
 
-  b = (bstring) bstr__alloc (sizeof (struct tagbstring));
+  b = bstr__new (i); /* RMM edit */
   if (NULL == b) return NULL;
-  b->slen = (int) j;
-  if (NULL == (b->data = (unsigned char *) bstr__alloc (b->mlen = i))) {
-    bstr__free (b);
-    return NULL;
-  }
+  b->slen = (blen_t) j;
 
   bstr__memcpy (b->data, str, j+1);
   return b;
 }
 
 /**
- * @brief Like `bfromcstr` but checks that the strlen is not >= INT_MAX.
+ * @brief Like `bfromcstr` but checks that the strlen is not >= BLEN_MAX.
  *
- * @returns the bstring or NULL if there were errors or the string length is longer than INT_MAX.
+ * @returns the bstring or NULL if there were errors or the string length is longer than BLEN_MAX (INT_MAX unless RLIB_LARGE_STRINGS is defined).
  *
  * @author mooreryan
  * @date 2018-05-27
@@ -661,40 +2140,38 @@ bstring bfromcstr (const char * str) {
 bstring
 bfromcstr_check_length(const char* str) {
   bstring b;
-  int i;
+  blen_t i;
   size_t j;
 
   if (str == NULL) return NULL;
 
-  j = (strnlen) (str, INT_MAX);
-  if (j == INT_MAX) return NULL;
+  j = (strnlen) (str, BLEN_MAX);
+  if (j == BLEN_MAX) return NULL;
 
-  i = snapUpSize ((int) (j + (2 - (j != 0))));
-  if (i <= (int) j) return NULL;
+  i = bstr__grow_size (0, 0, (blen_t) (j + (2 - (j != 0))));
+  if (i <= (blen_t) j) return NULL;
 
-  b = (bstring) bstr__alloc (sizeof (struct tagbstring));
+  b = bstr__new (i); /* RMM edit */
   if (NULL == b) return NULL;
-  b->slen = (int) j;
-  if (NULL == (b->data = (unsigned char *) bstr__alloc (b->mlen = i))) {
-    bstr__free (b);
-    return NULL;
-  }
+  b->slen = (blen_t) j;
 
   bstr__memcpy (b->data, str, j+1);
   return b;
 }
 
 
-/*  bstring bfromcstrrangealloc (int minl, int maxl, const char* str)
+/*  bstring bfromcstrrangealloc (blen_t minl, blen_t maxl, const char* str)
  *
  *  Create a bstring which contains the contents of the '\0' terminated
  *  char* buffer str.  The memory buffer backing the string is at least
  *  minl characters in length, but an attempt is made to allocate up to
  *  maxl characters.
  */
-bstring bfromcstrrangealloc (int minl, int maxl, const char* str) {
+bstring bfromcstrrangealloc (blen_t minl, blen_t maxl, const char* str) {
   bstring b;
-  int i;
+  unsigned char * x;
+  blen_t i;
+  int kind;
   size_t j;
 
   /* Bad parameters? */
@@ -703,61 +2180,55 @@ bstring bfromcstrrangealloc (int minl, int maxl, const char* str) {
 
   /* Adjust lengths */
   j = (strlen) (str);
-  if ((size_t) minl < (j+1)) minl = (int) (j+1);
+  if ((size_t) minl < (j+1)) minl = (blen_t) (j+1);
   if (maxl < minl) maxl = minl;
   i = maxl;
 
-  b = (bstring) bstr__alloc (sizeof (struct tagbstring));
+  b = bstr__halloc (0); /* RMM edit */
   if (b == NULL) return NULL;
-  b->slen = (int) j;
+  b->slen = (blen_t) j;
 
-  while (NULL == (b->data = (unsigned char *) bstr__alloc (b->mlen = i))) {
-    int k = (i >> 1) + (minl >> 1);
+  while (NULL == (x = bstr__dalloc (b, i, &kind))) {
+    blen_t k = (i >> 1) + (minl >> 1);
     if (i == k || i < minl) {
-      bstr__free (b);
+      bstr__hfree (b);
       return NULL;
     }
     i = k;
   }
+  bstr__dattach (b, x, i, kind); /* RMM edit */
 
   bstr__memcpy (b->data, str, j+1);
   return b;
 }
 
-/*  bstring bfromcstralloc (int mlen, const char * str)
+/*  bstring bfromcstralloc (blen_t mlen, const char * str)
  *
  *  Create a bstring which contains the contents of the '\0' terminated
  *  char* buffer str.  The memory buffer backing the string is at least
  *  mlen characters in length.
  */
-bstring bfromcstralloc (int mlen, const char * str) {
+bstring bfromcstralloc (blen_t mlen, const char * str) {
   return bfromcstrrangealloc (mlen, mlen, str);
 }
 
-/*  bstring blk2bstr (const void * blk, int len)
+/*  bstring blk2bstr (const void * blk, blen_t len)
  *
  *  Create a bstring which contains the content of the block blk of length
  *  len.
  */
-bstring blk2bstr (const void * blk, int len) {
+bstring blk2bstr (const void * blk, blen_t len) {
   bstring b;
-  int i;
+  blen_t i;
 
   if (blk == NULL || len < 0) return NULL;
-  b = (bstring) bstr__alloc (sizeof (struct tagbstring));
-  if (b == NULL) return NULL;
-  b->slen = len;
 
   i = len + (2 - (len != 0));
-  i = snapUpSize (i);
-
-  b->mlen = i;
+  i = bstr__grow_size (0, 0, i);
 
-  b->data = (unsigned char *) bstr__alloc ((size_t) b->mlen);
-  if (b->data == NULL) {
-    bstr__free (b);
-    return NULL;
-  }
+  b = bstr__new (i); /* RMM edit */
+  if (b == NULL) return NULL;
+  b->slen = len;
 
   if (len > 0) bstr__memcpy (b->data, blk, (size_t) len);
   b->data[len] = (unsigned char) '\0';
@@ -773,7 +2244,7 @@ bstring blk2bstr (const void * blk, int len) {
  *  bcstrfree () call, by the calling application.
  */
 char * bstr2cstr (const_bstring b, char z) {
-  int i, l;
+  blen_t i, l;
   char * r;
 
   if (b == NULL || b->slen < 0 || b->data == NULL) return NULL;
@@ -814,7 +2285,7 @@ int bcstrfree (char * s) {
  *  Concatenate the bstring b1 to the bstring b0.
  */
 int bconcat (bstring b0, const_bstring b1) {
-  int len, d;
+  blen_t len, d;
   bstring aux = (bstring) b1;
 
   if (b0 == NULL || b1 == NULL || b0->data == NULL || b1->data == NULL)
@@ -833,6 +2304,8 @@ int bconcat (bstring b0, const_bstring b1) {
       if (aux != b1) bdestroy (aux);
       return BSTR_ERR;
     }
+  } else if (bstr__unshare (b0) != BSTR_OK) { /* RMM edit */
+    return BSTR_ERR;
   }
 
   bBlockCopy (&b0->data[d], &aux->data[0], (size_t) len);
@@ -847,7 +2320,7 @@ int bconcat (bstring b0, const_bstring b1) {
  *  Concatenate the single character c to the bstring b.
  */
 int bconchar (bstring b, char c) {
-  int d;
+  blen_t d;
 
   if (b == NULL) return BSTR_ERR;
   d = b->slen;
@@ -865,10 +2338,11 @@ int bconchar (bstring b, char c) {
  */
 int bcatcstr (bstring b, const char * s) {
   char * d;
-  int i, l;
+  blen_t i, l;
 
   if (b == NULL || b->data == NULL || b->slen < 0 || b->mlen < b->slen
       || b->mlen <= 0 || s == NULL) return BSTR_ERR;
+  if (bstr__unshare (b) != BSTR_OK) return BSTR_ERR; /* RMM edit */
 
   /* Optimistically concatenate directly */
   l = b->mlen - b->slen;
@@ -882,21 +2356,25 @@ int bcatcstr (bstring b, const char * s) {
   b->slen += i;
 
   /* Need to explicitely resize and concatenate tail */
-  return bcatblk (b, (const void *) s, (int) strlen (s));
+  return bcatblk (b, (const void *) s, (blen_t) strlen (s));
 }
 
-/*  int bcatblk (bstring b, const void * s, int len)
+/*  int bcatblk (bstring b, const void * s, blen_t len)
  *
  *  Concatenate a fixed length buffer to a bstring.
  */
-int bcatblk (bstring b, const void * s, int len) {
-  int nl;
+int bcatblk (bstring b, const void * s, blen_t len) {
+  blen_t nl;
 
   if (b == NULL || b->data == NULL || b->slen < 0 || b->mlen < b->slen
       || b->mlen <= 0 || s == NULL || len < 0) return BSTR_ERR;
 
   if (0 > (nl = b->slen + len)) return BSTR_ERR; /* Overflow? */
-  if (b->mlen <= nl && 0 > balloc (b, nl + 1)) return BSTR_ERR;
+  if (b->mlen <= nl) {
+    if (0 > balloc (b, nl + 1)) return BSTR_ERR;
+  } else if (bstr__unshare (b) != BSTR_OK) { /* RMM edit */
+    return BSTR_ERR;
+  }
 
   bBlockCopy (&b->data[b->slen], s, (size_t) len);
   b->slen = nl;
@@ -910,32 +2388,39 @@ int bcatblk (bstring b, const void * s, int len) {
  */
 bstring bstrcpy (const_bstring b) {
   bstring b0;
-  int i,j;
+  blen_t i,j;
 
   /* Attempted to copy an invalid string? */
   if (b == NULL || b->slen < 0 || b->data == NULL) return NULL;
 
-  b0 = (bstring) bstr__alloc (sizeof (struct tagbstring));
-  if (b0 == NULL) {
-    /* Unable to allocate memory for string header */
-    return NULL;
+#if defined (RLIB_COW_STRINGS)
+  /* RMM edit: share a reference counted buffer rather than copying it.  The
+     copy happens when either string is first written to. */
+  if (b->mlen > 0 && (b->flags & BSTR_F_RC) && rlib__arena_current == NULL) {
+    if (NULL == (b0 = bstr__halloc (0))) return NULL;
+    bstr__rc_inc (bstr__rc_of (b->data));
+    b0->data = b->data;
+    b0->mlen = b->mlen;
+    b0->slen = b->slen;
+    b0->flags |= BSTR_F_RC;
+    return b0;
   }
+#endif
 
   i = b->slen;
-  j = snapUpSize (i + 1);
+  j = bstr__grow_size (0, 0, i + 1);
 
-  b0->data = (unsigned char *) bstr__alloc (j);
-  if (b0->data == NULL) {
+  /* RMM edit: header and data come from bstr__new */
+  b0 = bstr__new (j);
+  if (b0 == NULL) {
     j = i + 1;
-    b0->data = (unsigned char *) bstr__alloc (j);
-    if (b0->data == NULL) {
-      /* Unable to allocate memory for string data */
-      bstr__free (b0);
+    b0 = bstr__new (j);
+    if (b0 == NULL) {
+      /* Unable to allocate memory for string */
       return NULL;
     }
   }
 
-  b0->mlen = j;
   b0->slen = i;
 
   if (i) bstr__memcpy ((char *) b0->data, (char *) b->data, i);
@@ -958,19 +2443,20 @@ int bassign (bstring a, const_bstring b) {
     if (a == NULL || a->data == NULL || a->mlen < a->slen ||
         a->slen < 0 || a->mlen == 0)
       return BSTR_ERR;
+    if (bstr__unshare (a) != BSTR_OK) return BSTR_ERR; /* RMM edit */
   }
   a->data[b->slen] = (unsigned char) '\0';
   a->slen = b->slen;
   return BSTR_OK;
 }
 
-/*  int bassignmidstr (bstring a, const_bstring b, int left, int len)
+/*  int bassignmidstr (bstring a, const_bstring b, blen_t left, blen_t len)
  *
  *  Overwrite the string a with the middle of contents of string b
  *  starting from position left and running for a length len.  left and
  *  len are clamped to the ends of b as with the function bmidstr.
  */
-int bassignmidstr (bstring a, const_bstring b, int left, int len) {
+int bassignmidstr (bstring a, const_bstring b, blen_t left, blen_t len) {
   if (b == NULL || b->data == NULL || b->slen < 0)
     return BSTR_ERR;
 
@@ -990,6 +2476,7 @@ int bassignmidstr (bstring a, const_bstring b, int left, int len) {
     bstr__memmove (a->data, b->data + left, len);
     a->slen = len;
   } else {
+    if (bstr__unshare (a) != BSTR_OK) return BSTR_ERR; /* RMM edit */
     a->slen = 0;
   }
   a->data[a->slen] = (unsigned char) '\0';
@@ -1003,11 +2490,12 @@ int bassignmidstr (bstring a, const_bstring b, int left, int len) {
  *  occurs BSTR_ERR is returned however a may be partially overwritten.
  */
 int bassigncstr (bstring a, const char * str) {
-  int i;
+  blen_t i;
   size_t len;
   if (a == NULL || a->data == NULL || a->mlen < a->slen ||
       a->slen < 0 || a->mlen == 0 || NULL == str)
     return BSTR_ERR;
+  if (bstr__unshare (a) != BSTR_OK) return BSTR_ERR; /* RMM edit */
 
   for (i=0; i < a->mlen; i++) {
     if ('\0' == (a->data[i] = str[i])) {
@@ -1018,60 +2506,132 @@ int bassigncstr (bstring a, const char * str) {
 
   a->slen = i;
   len = strlen (str + i);
-  if (len + 1 > (size_t) INT_MAX - i ||
-      0 > balloc (a, (int) (i + len + 1))) return BSTR_ERR;
+  if (len + 1 > (size_t) BLEN_MAX - i ||
+      0 > balloc (a, (blen_t) (i + len + 1))) return BSTR_ERR;
   bBlockCopy (a->data + i, str + i, (size_t) len + 1);
-  a->slen += (int) len;
+  a->slen += (blen_t) len;
   return BSTR_OK;
 }
 
-/*  int bassignblk (bstring a, const void * s, int len)
+/*  int bassignblk (bstring a, const void * s, blen_t len)
  *
  *  Overwrite the string a with the contents of the block (s, len).  Note that
  *  the bstring a must be a well defined and writable bstring.  If an error
  *  occurs BSTR_ERR is returned and a is not overwritten.
  */
-int bassignblk (bstring a, const void * s, int len) {
+int bassignblk (bstring a, const void * s, blen_t len) {
   if (a == NULL || a->data == NULL || a->mlen < a->slen ||
-      a->slen < 0 || a->mlen == 0 || NULL == s || len < 0 || len >= INT_MAX)
+      a->slen < 0 || a->mlen == 0 || NULL == s || len < 0 || len >= BLEN_MAX)
     return BSTR_ERR;
-  if (len + 1 > a->mlen && 0 > balloc (a, len + 1)) return BSTR_ERR;
+  if (len + 1 > a->mlen) {
+    if (0 > balloc (a, len + 1)) return BSTR_ERR;
+  } else if (bstr__unshare (a) != BSTR_OK) { /* RMM edit */
+    return BSTR_ERR;
+  }
   bBlockCopy (a->data, s, (size_t) len);
   a->data[len] = (unsigned char) '\0';
   a->slen = len;
   return BSTR_OK;
 }
 
-/*  int btrunc (bstring b, int n)
+/*  int btrunc (bstring b, blen_t n)
  *
  *  Truncate the bstring to at most n characters.
  */
-int btrunc (bstring b, int n) {
+int btrunc (bstring b, blen_t n) {
   if (n < 0 || b == NULL || b->data == NULL || b->mlen < b->slen ||
       b->slen < 0 || b->mlen <= 0) return BSTR_ERR;
   if (b->slen > n) {
+    if (bstr__unshare (b) != BSTR_OK) return BSTR_ERR; /* RMM edit */
     b->slen = n;
     b->data[n] = (unsigned char) '\0';
   }
   return BSTR_OK;
 }
 
+/* RMM edit: case conversion and caseless comparison are ASCII only, with
+   no locale lookups, unless RLIB_LOCALE_CASE is defined to go through
+   toupper and tolower (and so the current C locale) as bstrlib did. */
+#if defined (RLIB_LOCALE_CASE)
 #define   upcase(c) (toupper ((unsigned char) c))
 #define downcase(c) (tolower ((unsigned char) c))
+#else
+#define   upcase(c) bstr__ascii_upper ((unsigned char) (c))
+#define downcase(c) bstr__ascii_lower ((unsigned char) (c))
+#endif
 #define   wspace(c) (isspace ((unsigned char) c))
 
+/* RMM edit: the index of the first of the len bytes at a and b which
+   differ other than in case, or -1. */
+static blen_t bstr__casediff (const unsigned char * a, const unsigned char * b,
+                              blen_t len) {
+#if defined (RLIB_LOCALE_CASE)
+  blen_t i;
+  for (i = 0; i < len; i++) {
+    if (a[i] != b[i] && downcase (a[i]) != downcase (b[i])) return i;
+  }
+  return -1;
+#else
+  if (a == b) return -1;
+  return bstr__kernels->find_casediff (a, b, len);
+#endif
+}
+
+/* RMM edit: the index of the first of the len bytes at p that converting
+   them as how (a BSTR__CASE_ value) says would change, or -1, and that
+   conversion from s to d, which may be s.  Both go a vector at a time,
+   except with RLIB_LOCALE_CASE, where the C locale decides. */
+#if defined (RLIB_LOCALE_CASE)
+static int bstr__locale_case (int c, int how) {
+  if ((how & BSTR__CASE_UPPER) && islower (c)) return toupper (c);
+  if ((how & BSTR__CASE_LOWER) && isupper (c)) return tolower (c);
+  return c;
+}
+#endif
+
+static blen_t bstr__find_case (const unsigned char * p, blen_t len,
+                               int how) {
+#if defined (RLIB_LOCALE_CASE)
+  blen_t i;
+  for (i = 0; i < len; i++) {
+    if (bstr__locale_case (p[i], how) != p[i]) return i;
+  }
+  return -1;
+#else
+  return bstr__kernels->find_case (p, len, how);
+#endif
+}
+
+static void bstr__convert_case (unsigned char * d, const unsigned char * s,
+                                blen_t len, int how) {
+#if defined (RLIB_LOCALE_CASE)
+  blen_t i;
+  for (i = 0; i < len; i++) {
+    d[i] = (unsigned char) bstr__locale_case (s[i], how);
+  }
+#else
+  bstr__kernels->convert_case (d, s, len, how);
+#endif
+}
+
+/* RMM edit: convert b in place as how says.  Returns 1 if that changed
+   it, 0 if not (and then a shared buffer stays shared), or BSTR_ERR. */
+static int bstr__tocase (bstring b, int how) {
+  blen_t i;
+  if (b == NULL || b->data == NULL || b->mlen < b->slen ||
+      b->slen < 0 || b->mlen <= 0) return BSTR_ERR;
+  if ((i = bstr__find_case (b->data, b->slen, how)) < 0) return 0;
+  if (bstr__unshare (b) != BSTR_OK) return BSTR_ERR;
+  bstr__convert_case (b->data + i, b->data + i, b->slen - i, how);
+  return 1;
+}
+
 /*  int btoupper (bstring b)
  *
  *  Convert contents of bstring to upper case.
  */
 int btoupper (bstring b) {
-  int i, len;
-  if (b == NULL || b->data == NULL || b->mlen < b->slen ||
-      b->slen < 0 || b->mlen <= 0) return BSTR_ERR;
-  for (i=0, len = b->slen; i < len; i++) {
-    b->data[i] = (unsigned char) upcase (b->data[i]);
-  }
-  return BSTR_OK;
+  return (bstr__tocase (b, BSTR__CASE_UPPER) < 0) ? BSTR_ERR : BSTR_OK;
 }
 
 /*  int btolower (bstring b)
@@ -1079,13 +2639,7 @@ int btoupper (bstring b) {
  *  Convert contents of bstring to lower case.
  */
 int btolower (bstring b) {
-  int i, len;
-  if (b == NULL || b->data == NULL || b->mlen < b->slen ||
-      b->slen < 0 || b->mlen <= 0) return BSTR_ERR;
-  for (i=0, len = b->slen; i < len; i++) {
-    b->data[i] = (unsigned char) downcase (b->data[i]);
-  }
-  return BSTR_OK;
+  return (bstr__tocase (b, BSTR__CASE_LOWER) < 0) ? BSTR_ERR : BSTR_OK;
 }
 
 /*  int bstricmp (const_bstring b0, const_bstring b1)
@@ -1098,17 +2652,17 @@ int btolower (bstring b) {
  *  character is '\0', then it is taken to be the value UCHAR_MAX+1.
  */
 int bstricmp (const_bstring b0, const_bstring b1) {
-  int i, v, n;
+  blen_t i, n;
+  int v;
 
   if (bdata (b0) == NULL || b0->slen < 0 ||
       bdata (b1) == NULL || b1->slen < 0) return SHRT_MIN;
   if ((n = b0->slen) > b1->slen) n = b1->slen;
   else if (b0->slen == b1->slen && b0->data == b1->data) return BSTR_OK;
 
-  for (i = 0; i < n; i ++) {
-    v  = (char) downcase (b0->data[i])
-         - (char) downcase (b1->data[i]);
-    if (0 != v) return v;
+  /* RMM edit */
+  if ((i = bstr__casediff (b0->data, b1->data, n)) >= 0) {
+    return (char) downcase (b0->data[i]) - (char) downcase (b1->data[i]);
   }
 
   if (b0->slen > n) {
@@ -1124,7 +2678,7 @@ int bstricmp (const_bstring b0, const_bstring b1) {
   return BSTR_OK;
 }
 
-/*  int bstrnicmp (const_bstring b0, const_bstring b1, int n)
+/*  int bstrnicmp (const_bstring b0, const_bstring b1, blen_t n)
  *
  *  Compare two strings without differentiating between case for at most n
  *  characters.  If the position where the two strings first differ is
@@ -1134,8 +2688,9 @@ int bstricmp (const_bstring b0, const_bstring b1) {
  *  first extra character is '\0', then it is taken to be the value
  *  UCHAR_MAX+1.
  */
-int bstrnicmp (const_bstring b0, const_bstring b1, int n) {
-  int i, v, m;
+int bstrnicmp (const_bstring b0, const_bstring b1, blen_t n) {
+  blen_t i, m;
+  int v;
 
   if (bdata (b0) == NULL || b0->slen < 0 ||
       bdata (b1) == NULL || b1->slen < 0 || n < 0) return SHRT_MIN;
@@ -1143,12 +2698,9 @@ int bstrnicmp (const_bstring b0, const_bstring b1, int n) {
   if (m > b0->slen) m = b0->slen;
   if (m > b1->slen) m = b1->slen;
 
-  if (b0->data != b1->data) {
-    for (i = 0; i < m; i ++) {
-      v  = (char) downcase (b0->data[i]);
-      v -= (char) downcase (b1->data[i]);
-      if (v != 0) return b0->data[i] - b1->data[i];
-    }
+  /* RMM edit */
+  if ((i = bstr__casediff (b0->data, b1->data, m)) >= 0) {
+    return b0->data[i] - b1->data[i];
   }
 
   if (n == m || b0->slen == b1->slen) return BSTR_OK;
@@ -1164,7 +2716,7 @@ int bstrnicmp (const_bstring b0, const_bstring b1, int n) {
   return - (int) (UCHAR_MAX + 1);
 }
 
-/*  int biseqcaselessblk (const_bstring b, const void * blk, int len)
+/*  int biseqcaselessblk (const_bstring b, const void * blk, blen_t len)
  *
  *  Compare content of b and the array of bytes in blk for length len for
  *  equality without differentiating between character case.  If the content
@@ -1173,21 +2725,12 @@ int bstrnicmp (const_bstring b0, const_bstring b1, int n) {
  *  length of the strings are different, this function is O(1).  '\0'
  *  characters are not treated in any special way.
  */
-int biseqcaselessblk (const_bstring b, const void * blk, int len) {
-  int i;
-
+int biseqcaselessblk (const_bstring b, const void * blk, blen_t len) {
   if (bdata (b) == NULL || b->slen < 0 ||
       blk == NULL || len < 0) return BSTR_ERR;
   if (b->slen != len) return 0;
   if (len == 0 || b->data == blk) return 1;
-  for (i=0; i < len; i++) {
-    if (b->data[i] != ((unsigned char*)blk)[i]) {
-      unsigned char c = (unsigned char) downcase (b->data[i]);
-      if (c != (unsigned char) downcase (((unsigned char*)blk)[i]))
-        return 0;
-    }
-  }
-  return 1;
+  return bstr__casediff (b->data, (const unsigned char *) blk, len) < 0;
 }
 
 
@@ -1204,7 +2747,7 @@ int biseqcaseless (const_bstring b0, const_bstring b1) {
   return biseqcaselessblk (b0, b1->data, b1->slen);
 }
 
-/*  int bisstemeqcaselessblk (const_bstring b0, const void * blk, int len)
+/*  int bisstemeqcaselessblk (const_bstring b0, const void * blk, blen_t len)
  *
  *  Compare beginning of string b0 with a block of memory of length len
  *  without differentiating between case for equality.  If the beginning of b0
@@ -1213,21 +2756,12 @@ int biseqcaseless (const_bstring b0, const_bstring b1) {
  *  error, -1 is returned.  '\0' characters are not treated in any special
  *  way.
  */
-int bisstemeqcaselessblk (const_bstring b0, const void * blk, int len) {
-  int i;
-
+int bisstemeqcaselessblk (const_bstring b0, const void * blk, blen_t len) {
   if (bdata (b0) == NULL || b0->slen < 0 || NULL == blk || len < 0)
     return BSTR_ERR;
   if (b0->slen < len) return BSTR_OK;
   if (b0->data == (const unsigned char *) blk || len == 0) return 1;
-
-  for (i = 0; i < len; i ++) {
-    if (b0->data[i] != ((const unsigned char *) blk)[i]) {
-      if (downcase (b0->data[i]) !=
-          downcase (((const unsigned char *) blk)[i])) return 0;
-    }
-  }
-  return 1;
+  return bstr__casediff (b0->data, (const unsigned char *) blk, len) < 0;
 }
 
 /*
@@ -1236,17 +2770,17 @@ int bisstemeqcaselessblk (const_bstring b0, const void * blk, int len) {
  * Delete whitespace contiguous from the left end of the string.
  */
 int bltrimws (bstring b) {
-  int i, len;
+  blen_t i;
 
   if (b == NULL || b->data == NULL || b->mlen < b->slen ||
       b->slen < 0 || b->mlen <= 0) return BSTR_ERR;
 
-  for (len = b->slen, i = 0; i < len; i++) {
-    if (!wspace (b->data[i])) {
-      return bdelete (b, 0, i);
-    }
+  /* RMM edit */
+  if ((i = bstr__kernels->find_nonws (b->data, b->slen)) >= 0) {
+    return bdelete (b, 0, i);
   }
 
+  if (bstr__unshare (b) != BSTR_OK) return BSTR_ERR; /* RMM edit */
   b->data[0] = (unsigned char) '\0';
   b->slen = 0;
   return BSTR_OK;
@@ -1258,19 +2792,21 @@ int bltrimws (bstring b) {
  * Delete whitespace contiguous from the right end of the string.
  */
 int brtrimws (bstring b) {
-  int i;
+  blen_t i;
 
   if (b == NULL || b->data == NULL || b->mlen < b->slen ||
       b->slen < 0 || b->mlen <= 0) return BSTR_ERR;
 
-  for (i = b->slen - 1; i >= 0; i--) {
-    if (!wspace (b->data[i])) {
-      if (b->mlen > i) b->data[i+1] = (unsigned char) '\0';
-      b->slen = i + 1;
-      return BSTR_OK;
-    }
+  /* RMM edit */
+  if ((i = bstr__kernels->find_last_nonws (b->data, b->slen)) >= 0) {
+    if (i + 1 == b->slen) return BSTR_OK; /* RMM edit: nothing to trim */
+    if (bstr__unshare (b) != BSTR_OK) return BSTR_ERR;
+    if (b->mlen > i) b->data[i+1] = (unsigned char) '\0';
+    b->slen = i + 1;
+    return BSTR_OK;
   }
 
+  if (bstr__unshare (b) != BSTR_OK) return BSTR_ERR; /* RMM edit */
   b->data[0] = (unsigned char) '\0';
   b->slen = 0;
   return BSTR_OK;
@@ -1282,26 +2818,29 @@ int brtrimws (bstring b) {
  * Delete whitespace contiguous from both ends of the string.
  */
 int btrimws (bstring b) {
-  int i, j;
+  blen_t i, j;
 
   if (b == NULL || b->data == NULL || b->mlen < b->slen ||
       b->slen < 0 || b->mlen <= 0) return BSTR_ERR;
 
-  for (i = b->slen - 1; i >= 0; i--) {
-    if (!wspace (b->data[i])) {
-      if (b->mlen > i) b->data[i+1] = (unsigned char) '\0';
+  /* RMM edit */
+  if ((i = bstr__kernels->find_last_nonws (b->data, b->slen)) >= 0) {
+    if (i + 1 < b->slen) { /* RMM edit: only write if there is a tail */
+      if (bstr__unshare (b) != BSTR_OK) return BSTR_ERR;
+      b->data[i+1] = (unsigned char) '\0';
       b->slen = i + 1;
-      for (j = 0; wspace (b->data[j]); j++) {}
-      return bdelete (b, 0, j);
     }
+    j = bstr__kernels->find_nonws (b->data, b->slen);
+    return bdelete (b, 0, j);
   }
 
+  if (bstr__unshare (b) != BSTR_OK) return BSTR_ERR; /* RMM edit */
   b->data[0] = (unsigned char) '\0';
   b->slen = 0;
   return BSTR_OK;
 }
 
-/*  int biseqblk (const_bstring b, const void * blk, int len)
+/*  int biseqblk (const_bstring b, const void * blk, blen_t len)
  *
  *  Compare the string b with the character block blk of length len.  If the
  *  content differs, 0 is returned, if the content is the same, 1 is returned,
@@ -1309,7 +2848,7 @@ int btrimws (bstring b) {
  *  different, this function is O(1).  '\0' characters are not treated in any
  *  special way.
  */
-int biseqblk (const_bstring b, const void * blk, int len) {
+int biseqblk (const_bstring b, const void * blk, blen_t len) {
   if (len < 0 || b == NULL || blk == NULL || b->data == NULL || b->slen < 0)
     return BSTR_ERR;
   if (b->slen != len) return 0;
@@ -1332,7 +2871,7 @@ int biseq (const_bstring b0, const_bstring b1) {
   return !bstr__memcmp (b0->data, b1->data, b0->slen);
 }
 
-/*  int bisstemeqblk (const_bstring b0, const void * blk, int len)
+/*  int bisstemeqblk (const_bstring b0, const void * blk, blen_t len)
  *
  *  Compare beginning of string b0 with a block of memory of length len for
  *  equality.  If the beginning of b0 differs from the memory block (or if b0
@@ -1340,8 +2879,8 @@ int biseq (const_bstring b0, const_bstring b1) {
  *  if there is an error, -1 is returned.  '\0' characters are not treated in
  *  any special way.
  */
-int bisstemeqblk (const_bstring b0, const void * blk, int len) {
-  int i;
+int bisstemeqblk (const_bstring b0, const void * blk, blen_t len) {
+  blen_t i;
 
   if (bdata (b0) == NULL || b0->slen < 0 || NULL == blk || len < 0)
     return BSTR_ERR;
@@ -1366,7 +2905,7 @@ int bisstemeqblk (const_bstring b0, const void * blk, int len) {
  *  returned and if there is a detectable error BSTR_ERR is returned.
  */
 int biseqcstr (const_bstring b, const char * s) {
-  int i;
+  blen_t i;
   if (b == NULL || s == NULL || b->data == NULL || b->slen < 0)
     return BSTR_ERR;
   for (i=0; i < b->slen; i++) {
@@ -1389,7 +2928,7 @@ int biseqcstr (const_bstring b, const char * s) {
  *  if there is a detectable error BSTR_ERR is returned.
  */
 int biseqcstrcaseless (const_bstring b, const char * s) {
-  int i;
+  blen_t i;
   if (b == NULL || s == NULL || b->data == NULL || b->slen < 0)
     return BSTR_ERR;
   for (i=0; i < b->slen; i++) {
@@ -1416,7 +2955,8 @@ int biseqcstrcaseless (const_bstring b, const char * s) {
  *  past any '\0' termination characters encountered.
  */
 int bstrcmp (const_bstring b0, const_bstring b1) {
-  int i, v, n;
+  blen_t i, n;
+  int v;
 
   if (b0 == NULL || b1 == NULL || b0->data == NULL || b1->data == NULL ||
       b0->slen < 0 || b1->slen < 0) return SHRT_MIN;
@@ -1435,7 +2975,7 @@ int bstrcmp (const_bstring b0, const_bstring b1) {
   return BSTR_OK;
 }
 
-/*  int bstrncmp (const_bstring b0, const_bstring b1, int n)
+/*  int bstrncmp (const_bstring b0, const_bstring b1, blen_t n)
  *
  *  Compare the string b0 and b1 for at most n characters.  If there is an
  *  error, SHRT_MIN is returned, otherwise a value is returned as if b0 and
@@ -1445,8 +2985,9 @@ int bstrcmp (const_bstring b0, const_bstring b1) {
  *  part strcmp, the comparison does not proceed past any '\0' termination
  *  characters encountered.
  */
-int bstrncmp (const_bstring b0, const_bstring b1, int n) {
-  int i, v, m;
+int bstrncmp (const_bstring b0, const_bstring b1, blen_t n) {
+  blen_t i, m;
+  int v;
 
   if (b0 == NULL || b1 == NULL || b0->data == NULL || b1->data == NULL ||
       b0->slen < 0 || b1->slen < 0) return SHRT_MIN;
@@ -1468,14 +3009,14 @@ int bstrncmp (const_bstring b0, const_bstring b1, int n) {
   return -1;
 }
 
-/*  bstring bmidstr (const_bstring b, int left, int len)
+/*  bstring bmidstr (const_bstring b, blen_t left, blen_t len)
  *
  *  Create a bstring which is the substring of b starting from position left
  *  and running for a length len (clamped by the end of the bstring b.)  If
  *  b is detectably invalid, then NULL is returned.  The section described
  *  by (left, len) is clamped to the boundaries of b.
  */
-bstring bmidstr (const_bstring b, int left, int len) {
+bstring bmidstr (const_bstring b, blen_t left, blen_t len) {
 
   if (b == NULL || b->slen < 0 || b->data == NULL) return NULL;
 
@@ -1490,14 +3031,14 @@ bstring bmidstr (const_bstring b, int left, int len) {
   return blk2bstr (b->data + left, len);
 }
 
-/*  int bdelete (bstring b, int pos, int len)
+/*  int bdelete (bstring b, blen_t pos, blen_t len)
  *
  *  Removes characters from pos to pos+len-1 inclusive and shifts the tail of
  *  the bstring starting from pos+len to pos.  len must be positive for this
  *  call to have any effect.  The section of the string described by (pos,
  *  len) is clamped to boundaries of the bstring b.
  */
-int bdelete (bstring b, int pos, int len) {
+int bdelete (bstring b, blen_t pos, blen_t len) {
   /* Clamp to left side of bstring */
   if (pos < 0) {
     len += pos;
@@ -1508,6 +3049,7 @@ int bdelete (bstring b, int pos, int len) {
       b->mlen < b->slen || b->mlen <= 0)
     return BSTR_ERR;
   if (len > 0 && pos < b->slen) {
+    if (bstr__unshare (b) != BSTR_OK) return BSTR_ERR; /* RMM edit */
     if (pos + len >= b->slen) {
       b->slen = pos;
     } else {
@@ -1533,7 +3075,7 @@ int bdestroy (bstring b) {
       b->data == NULL)
     return BSTR_ERR;
 
-  bstr__free (b->data);
+  bstr__dfree (b); /* RMM edit */
 
   /* In case there is any stale usage, there is one more chance to
      notice this error. */
@@ -1542,109 +3084,307 @@ int bdestroy (bstring b) {
   b->mlen = -__LINE__;
   b->data = NULL;
 
-  bstr__free (b);
+  bstr__hfree (b); /* RMM edit */
   return BSTR_OK;
 }
 
-/*  int binstr (const_bstring b1, int pos, const_bstring b2)
- *
- *  Search for the bstring b2 in b1 starting from position pos, and searching
- *  forward.  If it is found then return with the first position where it is
- *  found, otherwise return BSTR_ERR.  Note that this is just a brute force
- *  string searcher that does not attempt clever things like the Boyer-Moore
- *  search algorithm.  Because of this there are many degenerate cases where
- *  this can take much longer than it needs to.
- */
-int binstr (const_bstring b1, int pos, const_bstring b2) {
-  int j, ii, ll, lf;
-  unsigned char * d0;
-  unsigned char c0;
-  register unsigned char * d1;
-  register unsigned char c1;
-  register int i;
+/* RMM edit: the binstr family shares one substring search engine, the
+   Two-Way algorithm of Crochemore and Perrin.  It runs in linear time and
+   constant space whatever the input, so runs like "AAAA...AB" no longer go
+   quadratic.  For longer needles a Horspool style bad character table lets
+   most windows be skipped after one compare, and otherwise the plain
+   forward search uses the find_byte kernel on the first needle byte to
+   jump between candidates.
+
+   The per needle work (factorization, skip and case folding tables) lives
+   in a struct bstr__pattern so that callers searching for the same needle
+   many times, like findreplaceengine and rstring_matcher, pay for it once.
+   With step -1 the needle and haystack are read back to front, which finds
+   the last match instead of the first. */
+
+#define BSTR_SKIP_MIN_NEEDLE 4
+#define BSTR_SKIP_MIN_HAYSTACK 256
+
+struct bstr__pattern {
+  blen_t nlen, suffix, period;
+  int step, fold, periodic, skip_ok;
+  blen_t skip[UCHAR_MAX + 1];
+  unsigned char canon[UCHAR_MAX + 1];
+};
 
-  if (b1 == NULL || b1->data == NULL || b1->slen < 0 ||
-      b2 == NULL || b2->data == NULL || b2->slen < 0) return BSTR_ERR;
-  if (b1->slen == pos) return (b2->slen == 0)?pos:BSTR_ERR;
-  if (b1->slen < pos || pos < 0) return BSTR_ERR;
-  if (b2->slen == 0) return pos;
+#define bstr__canon(c) \
+  (pat->fold ? pat->canon[(unsigned char) (c)] : (unsigned char) (c))
+#define bstr__hat(k) bstr__canon (h[(k) * step])
+#define bstr__nat(k) bstr__canon (n[(k) * step])
+
+/* Find the critical factorization of the needle: sets pat->suffix to the
+   split point and pat->period to the period of the right half. */
+static void bstr__critical (struct bstr__pattern * pat,
+                            const unsigned char * n) {
+  blen_t ms, msr, j, k, p, nlen = pat->nlen;
+  int step = pat->step;
+  unsigned char a, b;
+
+  /* Maximal suffix under <. */
+  ms = -1; j = 0; k = p = 1;
+  while (j + k < nlen) {
+    a = bstr__nat (j + k);
+    b = bstr__nat (ms + k);
+    if (a < b) {
+      j += k; k = 1; p = j - ms;
+    } else if (a == b) {
+      if (k != p) k++;
+      else { j += p; k = 1; }
+    } else {
+      ms = j++; k = p = 1;
+    }
+  }
+  pat->period = p;
+
+  /* Maximal suffix under >. */
+  msr = -1; j = 0; k = p = 1;
+  while (j + k < nlen) {
+    a = bstr__nat (j + k);
+    b = bstr__nat (msr + k);
+    if (b < a) {
+      j += k; k = 1; p = j - msr;
+    } else if (a == b) {
+      if (k != p) k++;
+      else { j += p; k = 1; }
+    } else {
+      msr = j++; k = p = 1;
+    }
+  }
 
-  /* No space to find such a string? */
-  if ((lf = b1->slen - b2->slen + 1) <= pos) return BSTR_ERR;
+  if (msr < ms) {
+    pat->suffix = ms + 1;
+  } else {
+    pat->suffix = msr + 1;
+    pat->period = p;
+  }
+}
+
+/* Prepare to search for the nlen bytes at n.  step is 1 to find first
+   matches or -1 to find last ones, fold asks for caseless matching and
+   skip_ok allows building the bad character table. */
+static void bstr__pattern_init (struct bstr__pattern * pat,
+                                const unsigned char * n, blen_t nlen,
+                                int step, int fold, int skip_ok) {
+  blen_t i;
+
+  pat->nlen = nlen;
+  pat->step = step;
+  pat->fold = fold;
+  pat->suffix = 0;
+  pat->period = 1;
+  pat->periodic = 0;
+  pat->skip_ok = 0;
+  if (fold) {
+    for (i = 0; i <= UCHAR_MAX; i++) {
+      pat->canon[i] = (unsigned char) downcase (i);
+    }
+  }
+  if (nlen < 2) return;
+  if (step < 0) n += nlen - 1;
 
-  /* An obvious alias case */
-  if (b1->data == b2->data && pos == 0) return 0;
+  bstr__critical (pat, n);
 
-  i = pos;
+  /* Is the left half a suffix of the period? */
+  pat->periodic = pat->suffix + pat->period <= nlen;
+  for (i = 0; pat->periodic && i < pat->suffix; i++) {
+    if (bstr__nat (i) != bstr__nat (i + pat->period)) pat->periodic = 0;
+  }
+  if (!pat->periodic) {
+    pat->period = (pat->suffix > nlen - pat->suffix ?
+                   pat->suffix : nlen - pat->suffix) + 1;
+  }
+
+  if (skip_ok && nlen >= BSTR_SKIP_MIN_NEEDLE) {
+    pat->skip_ok = 1;
+    for (i = 0; i <= UCHAR_MAX; i++) pat->skip[i] = nlen;
+    for (i = 0; i < nlen; i++) pat->skip[bstr__nat (i)] = nlen - 1 - i;
+    if (fold) {
+      for (i = 0; i <= UCHAR_MAX; i++) pat->skip[i] = pat->skip[pat->canon[i]];
+    }
+  }
+}
 
-  d0 = b2->data;
-  d1 = b1->data;
-  ll = b2->slen;
+/* Search the hlen bytes at h for the needle n that pat was prepared for.
+   Returns the index in h of the first (or with step -1 the last) match,
+   or -1. */
+static blen_t bstr__pattern_exec (const struct bstr__pattern * pat,
+                                  const unsigned char * n,
+                                  const unsigned char * h, blen_t hlen) {
+  blen_t i, j, s, last, memory, nlen = pat->nlen, suffix = pat->suffix;
+  int step = pat->step;
 
-  /* Peel off the b2->slen == 1 case */
-  c0 = d0[0];
-  if (1 == ll) {
-    for (;i < lf; i++) if (c0 == d1[i]) return i;
-    return BSTR_ERR;
+  if (nlen > hlen) return -1;
+  if (nlen == 0) return (step > 0) ? 0 : hlen;
+  last = hlen - nlen;
+  if (step < 0) {
+    n += nlen - 1;
+    h += hlen - 1;
+  }
+
+  /* Single bytes need no preprocessing. */
+  if (nlen == 1) {
+    unsigned char c = bstr__nat (0);
+    if (!pat->fold) {
+      return (step > 0) ? bstr__kernels->find_byte (h, hlen, c)
+                        : bstr__kernels->find_last_byte (h - last, hlen, c);
+    }
+    if (step > 0) {
+      return bstr__kernels->find_any3 (h, hlen, c,
+                                       (unsigned char) upcase (c), c);
+    }
+    for (j = 0; j < hlen; j++) {
+      if (bstr__hat (j) == c) return (step > 0) ? j : last - j;
+    }
+    return -1;
   }
 
-  c1 = c0;
+  memory = 0;
   j = 0;
-  lf = b1->slen - 1;
-
-  ii = -1;
-  if (i < lf) do {
-      /* Unrolled current character test */
-      if (c1 != d1[i]) {
-        if (c1 != d1[1+i]) {
-          i += 2;
-          continue;
-        }
-        i++;
+  while (j <= last) {
+    if (pat->skip_ok) {
+      s = pat->skip[h[(j + nlen - 1) * step]];
+      if (s > 0) {
+        if (memory && s < pat->period) s = nlen - pat->period;
+        memory = 0;
+        j += s;
+        continue;
       }
+    } else if (step > 0 && !pat->fold && h[j] != n[0]) {
+      s = bstr__kernels->find_byte (h + j, last - j + 1, n[0]);
+      if (s < 0) return -1;
+      j += s;
+      memory = 0;
+    } else if (step < 0 && !pat->fold && bstr__hat (j) != n[0]) {
+      /* Backwards, the candidates are the bytes of h - last up to the one
+         at distance j from the end. */
+      s = bstr__kernels->find_last_byte (h - last, last - j + 1, n[0]);
+      if (s < 0) return -1;
+      j = last - s;
+      memory = 0;
+    } else if (step > 0 && pat->fold && bstr__hat (j) != bstr__nat (0)) {
+      s = bstr__kernels->find_any3 (h + j, last - j + 1, bstr__nat (0),
+                                    (unsigned char) upcase (bstr__nat (0)),
+                                    bstr__nat (0));
+      if (s < 0) return -1;
+      j += s;
+      memory = 0;
+    }
 
-      /* Take note if this is the start of a potential match */
-      if (0 == j) ii = i;
+    /* Match the right half, left to right. */
+    i = suffix > memory ? suffix : memory;
+    while (i < nlen && bstr__nat (i) == bstr__hat (i + j)) i++;
+    if (i < nlen) {
+      j += i - suffix + 1;
+      memory = 0;
+      continue;
+    }
 
-      /* Shift the test character down by one */
-      j++;
-      i++;
+    /* Then the left half, right to left. */
+    i = suffix - 1;
+    while (i >= memory && bstr__nat (i) == bstr__hat (i + j)) i--;
+    if (i < memory) return (step > 0) ? j : last - j;
+    j += pat->period;
+    if (pat->periodic) memory = nlen - pat->period;
+  }
 
-      /* If this isn't past the last character continue */
-      if (j < ll) {
-        c1 = d0[j];
-        continue;
-      }
+  return -1;
+}
 
-      N0:;
+#undef bstr__hat
+#undef bstr__nat
+#undef bstr__canon
 
-      /* If no characters mismatched, then we matched */
-      if (i == ii+j) return ii;
+/* One shot search for n in h, see bstr__pattern_exec.  The skip table is
+   only worth building for long enough haystacks. */
+static blen_t bstr__search (const unsigned char * h, blen_t hlen,
+                            const unsigned char * n, blen_t nlen,
+                            int step, int fold) {
+  struct bstr__pattern pat;
 
-      /* Shift back to the beginning */
-      i -= j;
-      j  = 0;
-      c1 = c0;
-    } while (i < lf);
+  if (nlen > hlen) return -1;
+  bstr__pattern_init (&pat, n, nlen, step, fold,
+                      hlen >= BSTR_SKIP_MIN_HAYSTACK);
+  return bstr__pattern_exec (&pat, n, h, hlen);
+}
 
-  /* Deal with last case if unrolling caused a misalignment */
-  if (i == lf && ll == j+1 && c1 == d1[i]) goto N0;
+/* binstr for a needle b2 already prepared (forward) in pat. */
+static blen_t bstr__pattern_instr (const struct bstr__pattern * pat,
+                                   const_bstring b1, blen_t pos,
+                                   const_bstring b2) {
+  blen_t i;
 
-  return BSTR_ERR;
+  if (pos < 0 || pos > b1->slen) return BSTR_ERR;
+  i = bstr__pattern_exec (pat, b2->data, b1->data + pos, b1->slen - pos);
+  return (i < 0) ? BSTR_ERR : pos + i;
+}
+
+/* RMM edit: calls cb (if not NULL) with the offset of each match of the
+   needle n, prepared forward in pat, in the hlen bytes at h.  Matches
+   don't overlap, and an empty needle matches at every offset.  Each
+   search carries on from the end of the last match, so h is gone over
+   once however many matches there are.  Returns the number of matches,
+   or what cb returned if it was negative, which stops the search. */
+static blen_t bstr__pattern_each (const struct bstr__pattern * pat,
+                                  const unsigned char * n,
+                                  const unsigned char * h, blen_t hlen,
+                                  int (* cb) (void * parm, blen_t ofs),
+                                  void * parm) {
+  blen_t i, pos = 0, count = 0;
+  int ret;
+
+  if (cb == NULL && pat->nlen == 1 && !pat->fold) {
+    return bstr__kernels->count_byte (h, hlen, n[0]);
+  }
+
+  while (pos <= hlen &&
+         (i = bstr__pattern_exec (pat, n, h + pos, hlen - pos)) >= 0) {
+    count++;
+    if (cb != NULL && (ret = cb (parm, pos + i)) < 0) return ret;
+    pos += i + (pat->nlen > 0 ? pat->nlen : 1);
+  }
+  return count;
+}
+
+/*  blen_t binstr (const_bstring b1, blen_t pos, const_bstring b2)
+ *
+ *  Search for the bstring b2 in b1 starting from position pos, and searching
+ *  forward.  If it is found then return with the first position where it is
+ *  found, otherwise return BSTR_ERR.  The search takes time linear in the
+ *  lengths of b1 and b2 (see bstr__search above).
+ */
+blen_t binstr (const_bstring b1, blen_t pos, const_bstring b2) {
+  blen_t i;
+
+  if (b1 == NULL || b1->data == NULL || b1->slen < 0 ||
+      b2 == NULL || b2->data == NULL || b2->slen < 0) return BSTR_ERR;
+  if (b1->slen == pos) return (b2->slen == 0)?pos:BSTR_ERR;
+  if (b1->slen < pos || pos < 0) return BSTR_ERR;
+  if (b2->slen == 0) return pos;
+
+  /* No space to find such a string? */
+  if (b1->slen - b2->slen + 1 <= pos) return BSTR_ERR;
+
+  /* An obvious alias case */
+  if (b1->data == b2->data && pos == 0) return 0;
+
+  i = bstr__search (b1->data + pos, b1->slen - pos, b2->data, b2->slen, 1, 0);
+  return (i < 0) ? BSTR_ERR : pos + i;
 }
 
-/*  int binstrr (const_bstring b1, int pos, const_bstring b2)
+/*  blen_t binstrr (const_bstring b1, blen_t pos, const_bstring b2)
  *
  *  Search for the bstring b2 in b1 starting from position pos, and searching
  *  backward.  If it is found then return with the first position where it is
- *  found, otherwise return BSTR_ERR.  Note that this is just a brute force
- *  string searcher that does not attempt clever things like the Boyer-Moore
- *  search algorithm.  Because of this there are many degenerate cases where
- *  this can take much longer than it needs to.
+ *  found, otherwise return BSTR_ERR.  The search takes time linear in the
+ *  lengths of b1 and b2 (see bstr__search above).
  */
-int binstrr (const_bstring b1, int pos, const_bstring b2) {
-  int j, i, l;
-  unsigned char * d0, * d1;
+blen_t binstrr (const_bstring b1, blen_t pos, const_bstring b2) {
+  blen_t i, l;
 
   if (b1 == NULL || b1->data == NULL || b1->slen < 0 ||
       b2 == NULL || b2->data == NULL || b2->slen < 0) return BSTR_ERR;
@@ -1660,38 +3400,21 @@ int binstrr (const_bstring b1, int pos, const_bstring b2) {
 
   /* If no space to find such a string then snap back */
   if (l + 1 <= i) i = l;
-  j = 0;
-
-  d0 = b2->data;
-  d1 = b1->data;
-  l  = b2->slen;
-
-  for (;;) {
-    if (d0[j] == d1[i + j]) {
-      j ++;
-      if (j >= l) return i;
-    } else {
-      i --;
-      if (i < 0) break;
-      j=0;
-    }
-  }
 
-  return BSTR_ERR;
+  /* The last match in b1[0, i + b2->slen) */
+  l = bstr__search (b1->data, i + b2->slen, b2->data, b2->slen, -1, 0);
+  return (l < 0) ? BSTR_ERR : l;
 }
 
-/*  int binstrcaseless (const_bstring b1, int pos, const_bstring b2)
+/*  blen_t binstrcaseless (const_bstring b1, blen_t pos, const_bstring b2)
  *
  *  Search for the bstring b2 in b1 starting from position pos, and searching
  *  forward but without regard to case.  If it is found then return with the
- *  first position where it is found, otherwise return BSTR_ERR.  Note that
- *  this is just a brute force string searcher that does not attempt clever
- *  things like the Boyer-Moore search algorithm.  Because of this there are
- *  many degenerate cases where this can take much longer than it needs to.
+ *  first position where it is found, otherwise return BSTR_ERR.  The search
+ *  takes time linear in the lengths of b1 and b2 (see bstr__search above).
  */
-int binstrcaseless (const_bstring b1, int pos, const_bstring b2) {
-  int j, i, l, ll;
-  unsigned char * d0, * d1;
+blen_t binstrcaseless (const_bstring b1, blen_t pos, const_bstring b2) {
+  blen_t i;
 
   if (b1 == NULL || b1->data == NULL || b1->slen < 0 ||
       b2 == NULL || b2->data == NULL || b2->slen < 0) return BSTR_ERR;
@@ -1699,47 +3422,25 @@ int binstrcaseless (const_bstring b1, int pos, const_bstring b2) {
   if (b1->slen < pos || pos < 0) return BSTR_ERR;
   if (b2->slen == 0) return pos;
 
-  l = b1->slen - b2->slen + 1;
-
   /* No space to find such a string? */
-  if (l <= pos) return BSTR_ERR;
+  if (b1->slen - b2->slen + 1 <= pos) return BSTR_ERR;
 
   /* An obvious alias case */
   if (b1->data == b2->data && pos == 0) return BSTR_OK;
 
-  i = pos;
-  j = 0;
-
-  d0 = b2->data;
-  d1 = b1->data;
-  ll = b2->slen;
-
-  for (;;) {
-    if (d0[j] == d1[i + j] || downcase (d0[j]) == downcase (d1[i + j])) {
-      j ++;
-      if (j >= ll) return i;
-    } else {
-      i ++;
-      if (i >= l) break;
-      j=0;
-    }
-  }
-
-  return BSTR_ERR;
+  i = bstr__search (b1->data + pos, b1->slen - pos, b2->data, b2->slen, 1, 1);
+  return (i < 0) ? BSTR_ERR : pos + i;
 }
 
-/*  int binstrrcaseless (const_bstring b1, int pos, const_bstring b2)
+/*  blen_t binstrrcaseless (const_bstring b1, blen_t pos, const_bstring b2)
  *
  *  Search for the bstring b2 in b1 starting from position pos, and searching
  *  backward but without regard to case.  If it is found then return with the
- *  first position where it is found, otherwise return BSTR_ERR.  Note that
- *  this is just a brute force string searcher that does not attempt clever
- *  things like the Boyer-Moore search algorithm.  Because of this there are
- *  many degenerate cases where this can take much longer than it needs to.
+ *  first position where it is found, otherwise return BSTR_ERR.  The search
+ *  takes time linear in the lengths of b1 and b2 (see bstr__search above).
  */
-int binstrrcaseless (const_bstring b1, int pos, const_bstring b2) {
-  int j, i, l;
-  unsigned char * d0, * d1;
+blen_t binstrrcaseless (const_bstring b1, blen_t pos, const_bstring b2) {
+  blen_t i, l;
 
   if (b1 == NULL || b1->data == NULL || b1->slen < 0 ||
       b2 == NULL || b2->data == NULL || b2->slen < 0) return BSTR_ERR;
@@ -1756,192 +3457,139 @@ int binstrrcaseless (const_bstring b1, int pos, const_bstring b2) {
 
   /* If no space to find such a string then snap back */
   if (l + 1 <= i) i = l;
-  j = 0;
 
-  d0 = b2->data;
-  d1 = b1->data;
-  l  = b2->slen;
-
-  for (;;) {
-    if (d0[j] == d1[i + j] || downcase (d0[j]) == downcase (d1[i + j])) {
-      j ++;
-      if (j >= l) return i;
-    } else {
-      i --;
-      if (i < 0) break;
-      j=0;
-    }
-  }
-
-  return BSTR_ERR;
+  /* The last match in b1[0, i + b2->slen) */
+  l = bstr__search (b1->data, i + b2->slen, b2->data, b2->slen, -1, 1);
+  return (l < 0) ? BSTR_ERR : l;
 }
 
 
-/*  int bstrchrp (const_bstring b, int c, int pos)
+/*  blen_t bstrchrp (const_bstring b, int c, blen_t pos)
  *
  *  Search for the character c in b forwards from the position pos
  *  (inclusive).
  */
-int bstrchrp (const_bstring b, int c, int pos) {
-  unsigned char * p;
+blen_t bstrchrp (const_bstring b, int c, blen_t pos) {
+  blen_t i;
 
   if (b == NULL || b->data == NULL || b->slen <= pos || pos < 0)
     return BSTR_ERR;
-  p = (unsigned char *) bstr__memchr ((b->data + pos), (unsigned char) c,
-                                      (b->slen - pos));
-  if (p) return (int) (p - b->data);
+  i = bstr__kernels->find_byte (b->data + pos, b->slen - pos,
+                                (unsigned char) c); /* RMM edit */
+  if (i >= 0) return pos + i;
   return BSTR_ERR;
 }
 
-/*  int bstrrchrp (const_bstring b, int c, int pos)
+/*  blen_t bstrrchrp (const_bstring b, int c, blen_t pos)
  *
  *  Search for the character c in b backwards from the position pos in string
  *  (inclusive).
  */
-int bstrrchrp (const_bstring b, int c, int pos) {
-  int i;
+blen_t bstrrchrp (const_bstring b, int c, blen_t pos) {
+  blen_t i;
 
   if (b == NULL || b->data == NULL || b->slen <= pos || pos < 0)
     return BSTR_ERR;
-  for (i=pos; i >= 0; i--) {
-    if (b->data[i] == (unsigned char) c) return i;
-  }
+  i = bstr__kernels->find_last_byte (b->data, pos + 1,
+                                     (unsigned char) c); /* RMM edit */
+  if (i >= 0) return i;
   return BSTR_ERR;
 }
 
-#if !defined (BSTRLIB_AGGRESSIVE_MEMORY_FOR_SPEED_TRADEOFF)
-#define LONG_LOG_BITS_QTY (3)
-#define LONG_BITS_QTY (1 << LONG_LOG_BITS_QTY)
-#define LONG_TYPE unsigned char
-
-#define CFCLEN ((1 << CHAR_BIT) / LONG_BITS_QTY)
-struct charField { LONG_TYPE content[CFCLEN]; };
-#define testInCharField(cf,c) ((cf)->content[(c) >> LONG_LOG_BITS_QTY] & \
-	                           (((long)1) << ((c) & (LONG_BITS_QTY-1))))
-#define setInCharField(cf,idx) { \
-	unsigned int c = (unsigned int) (idx); \
-	(cf)->content[c >> LONG_LOG_BITS_QTY] |= \
-		(LONG_TYPE) (1ul << (c & (LONG_BITS_QTY-1))); \
-}
-
-#else
-
-#define CFCLEN (1 << CHAR_BIT)
-struct charField { unsigned char content[CFCLEN]; };
-#define testInCharField(cf,c) ((cf)->content[(unsigned char) (c)])
-#define setInCharField(cf,idx) (cf)->content[(unsigned int) (idx)] = ~0
-
-#endif
-
-/* Convert a bstring to charField */
-static int buildCharField (struct charField * cf, const_bstring b) {
-  int i;
+/* RMM edit: the binchr family compiles b1 into a struct bstr__charclass and
+   scans with the find_class kernels rather than a byte at a time. */
+static int bstr__charclass_build (struct bstr__charclass * cc, const_bstring b,
+                                  int invert) {
   if (b == NULL || b->data == NULL || b->slen <= 0) return BSTR_ERR;
-  memset ((void *) cf->content, 0, sizeof (struct charField));
-  for (i=0; i < b->slen; i++) {
-    setInCharField (cf, b->data[i]);
-  }
+  bstr__charclass_init (cc, b->data, b->slen, invert);
   return BSTR_OK;
 }
 
-static void invertCharField (struct charField * cf) {
-  int i;
-  for (i=0; i < CFCLEN; i++) cf->content[i] = ~cf->content[i];
-}
-
 /* Inner engine for binchr */
-static int binchrCF (const unsigned char * data, int len, int pos,
-                     const struct charField * cf) {
-  int i;
-  for (i=pos; i < len; i++) {
-    unsigned char c = (unsigned char) data[i];
-    if (testInCharField (cf, c)) return i;
-  }
+static blen_t binchrCC (const unsigned char * data, blen_t len, blen_t pos,
+                        const struct bstr__charclass * cc) {
+  blen_t i = bstr__kernels->find_class (data + pos, len - pos, cc);
+  if (i >= 0) return pos + i;
   return BSTR_ERR;
 }
 
-/*  int binchr (const_bstring b0, int pos, const_bstring b1);
+/*  blen_t binchr (const_bstring b0, blen_t pos, const_bstring b1);
  *
  *  Search for the first position in b0 starting from pos or after, in which
  *  one of the characters in b1 is found and return it.  If such a position
  *  does not exist in b0, then BSTR_ERR is returned.
  */
-int binchr (const_bstring b0, int pos, const_bstring b1) {
-  struct charField chrs;
+blen_t binchr (const_bstring b0, blen_t pos, const_bstring b1) {
+  struct bstr__charclass chrs;
   if (pos < 0 || b0 == NULL || b0->data == NULL ||
       b0->slen <= pos) return BSTR_ERR;
   if (1 == b1->slen) return bstrchrp (b0, b1->data[0], pos);
-  if (0 > buildCharField (&chrs, b1)) return BSTR_ERR;
-  return binchrCF (b0->data, b0->slen, pos, &chrs);
+  if (0 > bstr__charclass_build (&chrs, b1, 0)) return BSTR_ERR;
+  return binchrCC (b0->data, b0->slen, pos, &chrs);
 }
 
 /* Inner engine for binchrr */
-static int binchrrCF (const unsigned char * data, int pos,
-                      const struct charField * cf) {
-  int i;
-  for (i=pos; i >= 0; i--) {
-    unsigned int c = (unsigned int) data[i];
-    if (testInCharField (cf, c)) return i;
-  }
+static blen_t binchrrCC (const unsigned char * data, blen_t pos,
+                         const struct bstr__charclass * cc) {
+  blen_t i = bstr__kernels->find_last_class (data, pos + 1, cc);
+  if (i >= 0) return i;
   return BSTR_ERR;
 }
 
-/*  int binchrr (const_bstring b0, int pos, const_bstring b1);
+/*  blen_t binchrr (const_bstring b0, blen_t pos, const_bstring b1);
  *
  *  Search for the last position in b0 no greater than pos, in which one of
  *  the characters in b1 is found and return it.  If such a position does not
  *  exist in b0, then BSTR_ERR is returned.
  */
-int binchrr (const_bstring b0, int pos, const_bstring b1) {
-  struct charField chrs;
+blen_t binchrr (const_bstring b0, blen_t pos, const_bstring b1) {
+  struct bstr__charclass chrs;
   if (pos < 0 || b0 == NULL || b0->data == NULL || b1 == NULL ||
       b0->slen < pos) return BSTR_ERR;
   if (pos == b0->slen) pos--;
   if (1 == b1->slen) return bstrrchrp (b0, b1->data[0], pos);
-  if (0 > buildCharField (&chrs, b1)) return BSTR_ERR;
-  return binchrrCF (b0->data, pos, &chrs);
+  if (0 > bstr__charclass_build (&chrs, b1, 0)) return BSTR_ERR;
+  return binchrrCC (b0->data, pos, &chrs);
 }
 
-/*  int bninchr (const_bstring b0, int pos, const_bstring b1);
+/*  blen_t bninchr (const_bstring b0, blen_t pos, const_bstring b1);
  *
  *  Search for the first position in b0 starting from pos or after, in which
  *  none of the characters in b1 is found and return it.  If such a position
  *  does not exist in b0, then BSTR_ERR is returned.
  */
-int bninchr (const_bstring b0, int pos, const_bstring b1) {
-  struct charField chrs;
+blen_t bninchr (const_bstring b0, blen_t pos, const_bstring b1) {
+  struct bstr__charclass chrs;
   if (pos < 0 || b0 == NULL || b0->data == NULL ||
       b0->slen <= pos) return BSTR_ERR;
-  if (buildCharField (&chrs, b1) < 0) return BSTR_ERR;
-  invertCharField (&chrs);
-  return binchrCF (b0->data, b0->slen, pos, &chrs);
+  if (bstr__charclass_build (&chrs, b1, 1) < 0) return BSTR_ERR;
+  return binchrCC (b0->data, b0->slen, pos, &chrs);
 }
 
-/*  int bninchrr (const_bstring b0, int pos, const_bstring b1);
+/*  blen_t bninchrr (const_bstring b0, blen_t pos, const_bstring b1);
  *
  *  Search for the last position in b0 no greater than pos, in which none of
  *  the characters in b1 is found and return it.  If such a position does not
  *  exist in b0, then BSTR_ERR is returned.
  */
-int bninchrr (const_bstring b0, int pos, const_bstring b1) {
-  struct charField chrs;
+blen_t bninchrr (const_bstring b0, blen_t pos, const_bstring b1) {
+  struct bstr__charclass chrs;
   if (pos < 0 || b0 == NULL || b0->data == NULL ||
       b0->slen < pos) return BSTR_ERR;
   if (pos == b0->slen) pos--;
-  if (buildCharField (&chrs, b1) < 0) return BSTR_ERR;
-  invertCharField (&chrs);
-  return binchrrCF (b0->data, pos, &chrs);
+  if (bstr__charclass_build (&chrs, b1, 1) < 0) return BSTR_ERR;
+  return binchrrCC (b0->data, pos, &chrs);
 }
 
-/*  int bsetstr (bstring b0, int pos, bstring b1, unsigned char fill)
+/*  int bsetstr (bstring b0, blen_t pos, bstring b1, unsigned char fill)
  *
  *  Overwrite the string b0 starting at position pos with the string b1. If
  *  the position pos is past the end of b0, then the character "fill" is
  *  appended as necessary to make up the gap between the end of b0 and pos.
  *  If b1 is NULL, it behaves as if it were a 0-length string.
  */
-int bsetstr (bstring b0, int pos, const_bstring b1, unsigned char fill) {
-  int d, newlen;
+int bsetstr (bstring b0, blen_t pos, const_bstring b1, unsigned char fill) {
+  blen_t d, newlen;
   ptrdiff_t pd;
   bstring aux = (bstring) b1;
 
@@ -1990,7 +3638,7 @@ int bsetstr (bstring b0, int pos, const_bstring b1, unsigned char fill) {
   return BSTR_OK;
 }
 
-/*  int binsertblk (bstring b, int pos, const void * blk, int len,
+/*  int binsertblk (bstring b, blen_t pos, const void * blk, blen_t len,
  *                  unsigned char fill)
  *
  *  Inserts the block of characters at blk with length len into b at position
@@ -1998,9 +3646,9 @@ int bsetstr (bstring b0, int pos, const_bstring b1, unsigned char fill) {
  *  is appended as necessary to make up the gap between the end of b1 and pos.
  *  Unlike bsetstr, binsert does not allow b2 to be NULL.
  */
-int binsertblk (bstring b, int pos, const void * blk, int len,
+int binsertblk (bstring b, blen_t pos, const void * blk, blen_t len,
                 unsigned char fill) {
-  int d, l;
+  blen_t d, l;
   unsigned char* aux = (unsigned char*) blk;
 
   if (b == NULL || blk == NULL || pos < 0 || len < 0 || b->slen < 0 ||
@@ -2043,32 +3691,32 @@ int binsertblk (bstring b, int pos, const void * blk, int len,
   return BSTR_OK;
 }
 
-/*  int binsert (bstring b1, int pos, const_bstring b2, unsigned char fill)
+/*  int binsert (bstring b1, blen_t pos, const_bstring b2, unsigned char fill)
  *
  *  Inserts the string b2 into b1 at position pos.  If the position pos is
  *  past the end of b1, then the character "fill" is appended as necessary to
  *  make up the gap between the end of b1 and pos.  Unlike bsetstr, binsert
  *  does not allow b2 to be NULL.
  */
-int binsert (bstring b1, int pos, const_bstring b2, unsigned char fill) {
+int binsert (bstring b1, blen_t pos, const_bstring b2, unsigned char fill) {
   if (NULL == b2 || (b2->mlen > 0 && b2->slen > b2->mlen)) return BSTR_ERR;
   return binsertblk (b1, pos, b2->data, b2->slen, fill);
 }
 
-/*  int breplace (bstring b1, int pos, int len, bstring b2,
+/*  int breplace (bstring b1, blen_t pos, blen_t len, bstring b2,
  *                unsigned char fill)
  *
  *  Replace a section of a string from pos for a length len with the string
  *  b2. fill is used is pos > b1->slen.
  */
-int breplace (bstring b1, int pos, int len, const_bstring b2,
+int breplace (bstring b1, blen_t pos, blen_t len, const_bstring b2,
               unsigned char fill) {
-  int pl, ret;
+  blen_t pl, ret;
   ptrdiff_t pd;
   bstring aux = (bstring) b2;
 
   if (pos < 0 || len < 0) return BSTR_ERR;
-  if (pos > INT_MAX - len) return BSTR_ERR; /* Overflow */
+  if (pos > BLEN_MAX - len) return BSTR_ERR; /* Overflow */
   pl = pos + len;
   if (b1 == NULL || b2 == NULL || b1->data == NULL || b2->data == NULL ||
       b1->slen < 0 || b2->slen < 0 || b1->mlen < b1->slen ||
@@ -2095,6 +3743,9 @@ int breplace (bstring b1, int pos, int len, const_bstring b2,
       if (aux != b2) bdestroy (aux);
       return BSTR_ERR;
     }
+  } else if (bstr__unshare (b1) != BSTR_OK) { /* RMM edit */
+    if (aux != b2) bdestroy (aux);
+    return BSTR_ERR;
   }
 
   if (aux->slen != len) bstr__memmove (b1->data + pos + aux->slen,
@@ -2111,19 +3762,18 @@ int breplace (bstring b1, int pos, int len, const_bstring b2,
  *  findreplaceengine is used to implement bfindreplace and
  *  bfindreplacecaseless. It works by breaking the three cases of
  *  expansion, reduction and replacement, and solving each of these
- *  in the most efficient way possible.
+ *  in the most efficient way possible.  (RMM edit) The search for find is
+ *  prepared once in pat, which also says whether case matters.
  */
 
-typedef int (*instr_fnptr) (const_bstring s1, int pos, const_bstring s2);
-
 #define INITIAL_STATIC_FIND_INDEX_COUNT 32
 
 static int findreplaceengine (bstring b, const_bstring find,
-                              const_bstring repl, int pos,
-                              instr_fnptr instr) {
-  int i, ret, slen, mlen, delta, acc;
-  int * d;
-  int static_d[INITIAL_STATIC_FIND_INDEX_COUNT+1]; /* This +1 is for LINT. */
+                              const_bstring repl, blen_t pos,
+                              const struct bstr__pattern * pat) {
+  blen_t i, ret, slen, mlen, delta, acc;
+  blen_t * d;
+  blen_t static_d[INITIAL_STATIC_FIND_INDEX_COUNT+1]; /* This +1 is for LINT. */
   ptrdiff_t pd;
   bstring auxf = (bstring) find;
   bstring auxr = (bstring) repl;
@@ -2134,6 +3784,10 @@ static int findreplaceengine (bstring b, const_bstring find,
       b->slen < 0 || repl->slen < 0) return BSTR_ERR;
   if (pos > b->slen - find->slen) return BSTR_OK;
 
+  /* RMM edit: nothing to replace leaves b, and any buffer it shares, alone */
+  if ((pos = bstr__pattern_instr (pat, b, pos, find)) < 0) return BSTR_OK;
+  if (bstr__unshare (b) != BSTR_OK) return BSTR_ERR;
+
   /* Alias with find string */
   pd = (ptrdiff_t) (find->data - b->data);
   if ((ptrdiff_t) (pos - find->slen) < pd && pd < (ptrdiff_t) b->slen) {
@@ -2154,7 +3808,7 @@ static int findreplaceengine (bstring b, const_bstring find,
   /* in-place replacement since find and replace strings are of equal
      length */
   if (delta == 0) {
-    while ((pos = instr (b, pos, auxf)) >= 0) {
+    while ((pos = bstr__pattern_instr (pat, b, pos, auxf)) >= 0) {
       bstr__memcpy (b->data + pos, auxr->data, auxr->slen);
       pos += auxf->slen;
     }
@@ -2167,7 +3821,7 @@ static int findreplaceengine (bstring b, const_bstring find,
   if (delta > 0) {
     acc = 0;
 
-    while ((i = instr (b, pos, auxf)) >= 0) {
+    while ((i = bstr__pattern_instr (pat, b, pos, auxf)) >= 0) {
       if (acc && i > pos)
         bstr__memmove (b->data + pos - acc, b->data + pos, i - pos);
       if (auxr->slen)
@@ -2204,22 +3858,22 @@ static int findreplaceengine (bstring b, const_bstring find,
   */
 
   mlen = INITIAL_STATIC_FIND_INDEX_COUNT;
-  d = (int *) static_d; /* Avoid malloc for trivial/initial cases */
+  d = (blen_t *) static_d; /* Avoid malloc for trivial/initial cases */
   acc = slen = 0;
 
-  while ((pos = instr (b, pos, auxf)) >= 0) {
+  while ((pos = bstr__pattern_instr (pat, b, pos, auxf)) >= 0) {
     if (slen >= mlen - 1) {
-      int *t;
-      int sl;
+      blen_t *t;
+      size_t sl;
       /* Overflow */
-      if (mlen > (INT_MAX / sizeof(int *)) / 2) {
+      if ((size_t) mlen > (((size_t) BLEN_MAX) / sizeof(blen_t)) / 2) {
         ret = BSTR_ERR;
         goto done;
       }
       mlen += mlen;
-      sl = sizeof (int *) * mlen;
+      sl = sizeof (blen_t) * (size_t) mlen;
       if (static_d == d) d = NULL; /* static_d cannot be realloced */
-      if (NULL == (t = (int *) bstr__realloc (d, sl))) {
+      if (NULL == (t = (blen_t *) bstr__realloc (d, sl))) {
         ret = BSTR_ERR;
         goto done;
       }
@@ -2242,7 +3896,7 @@ static int findreplaceengine (bstring b, const_bstring find,
   if (BSTR_OK == (ret = balloc (b, b->slen + acc + 1))) {
     b->slen += acc;
     for (i = slen-1; i >= 0; i--) {
-      int s, l;
+      blen_t s, l;
       s = d[i] + auxf->slen;
       l = d[i+1] - s; /* d[slen] may be accessed here. */
       if (l) {
@@ -2264,37 +3918,151 @@ static int findreplaceengine (bstring b, const_bstring find,
   return ret;
 }
 
+/* RMM edit: the length to size the result of replacing find by repl in src
+   for up front: that of src, plus the exact growth when repl is longer and
+   find is a single byte (counting those is cheap).  first is the offset of
+   the first match, or -1 if there is none, and nothing before it is looked
+   at.  Returns BSTR_ERR if the result would be too long. */
+static blen_t bstr__findreplace_need (const_bstring src, const_bstring find,
+                                      const_bstring repl,
+                                      const struct bstr__pattern * pat,
+                                      blen_t first) {
+  blen_t need = src->slen, count;
+
+  if (first >= 0 && repl->slen > find->slen && find->slen == 1 && !pat->fold) {
+    count = bstr__kernels->count_byte (src->data + first, src->slen - first,
+                                       find->data[0]);
+    if (count > 0 && repl->slen - 1 > (BLEN_MAX - 1 - need) / count)
+      return BSTR_ERR;
+    need += count * (repl->slen - 1);
+  }
+  if (need >= BLEN_MAX) return BSTR_ERR;
+
+  return need;
+}
+
+/* RMM edit: like findreplaceengine, but src is left alone and the result is
+   written to dst instead, which must not be or overlap src, find or repl.
+   The runs between matches and the replacements are copied across as the
+   matches are found, so src is gone over once and nothing moves twice.
+   first is the offset of the first match if the caller has already looked
+   for it (with pat), or -1 to have it looked for here.  Whatever dst held is
+   dropped, but its buffer is kept and only grown when the result doesn't
+   fit, after sizing it with bstr__findreplace_need.  Returns the number of
+   replacements, or BSTR_ERR. */
+static blen_t bstr__findreplace_into (bstring dst, const_bstring src,
+                                      const_bstring find, const_bstring repl,
+                                      const struct bstr__pattern * pat,
+                                      blen_t first) {
+  blen_t i, pos, out, need, count;
+
+  if (dst == NULL || dst->data == NULL || dst->mlen <= 0 ||
+      dst->slen < 0 || dst->slen > dst->mlen ||
+      src == NULL || src->data == NULL || src->slen < 0 ||
+      find == NULL || find->data == NULL || find->slen <= 0 ||
+      repl == NULL || repl->data == NULL || repl->slen < 0) return BSTR_ERR;
+  if (dst == src || dst == find || dst == repl) return BSTR_ERR;
+
+  /* A shared buffer is swapped for a fresh one by balloc below, so only a
+     buffer dst owns alone can overlap the others. */
+#define bstr__overlaps(b) \
+  ((uintptr_t) (b)->data < (uintptr_t) (dst->data + dst->mlen) && \
+   (uintptr_t) dst->data < (uintptr_t) ((b)->data + (b)->slen))
+  if (!bstr__shared (dst) &&
+      (bstr__overlaps (src) || bstr__overlaps (find) ||
+       bstr__overlaps (repl))) return BSTR_ERR;
+#undef bstr__overlaps
+
+  if (first < 0) first = bstr__pattern_exec (pat, find->data, src->data,
+                                             src->slen);
+  if ((need = bstr__findreplace_need (src, find, repl, pat, first)) < 0)
+    return BSTR_ERR;
+
+  /* With slen at 0 neither has anything of the old contents to copy.  A
+     dst already big enough is only given a buffer of its own if shared. */
+  dst->slen = 0;
+  if ((need >= dst->mlen ? balloc (dst, need + 1) : bstr__unshare (dst))
+      != BSTR_OK) return BSTR_ERR;
+
+  out = pos = count = 0;
+  for (i = first; i >= 0;
+       i = bstr__pattern_exec (pat, find->data, src->data + pos,
+                               src->slen - pos)) {
+    if (i > BLEN_MAX - 1 - out - repl->slen) goto fail;
+    need = out + i + repl->slen;
+    if (need >= dst->mlen) {
+      dst->slen = out;
+      if (balloc (dst, need + 1) != BSTR_OK) goto fail;
+    }
+    if (i) bstr__memcpy (dst->data + out, src->data + pos, (size_t) i);
+    if (repl->slen) bstr__memcpy (dst->data + out + i, repl->data,
+                                  (size_t) repl->slen);
+    out = need;
+    pos += i + find->slen;
+    count++;
+  }
+
+  i = src->slen - pos;
+  if (i > BLEN_MAX - 1 - out) goto fail;
+  need = out + i;
+  if (need >= dst->mlen) {
+    dst->slen = out;
+    if (balloc (dst, need + 1) != BSTR_OK) goto fail;
+  }
+  if (i) bstr__memcpy (dst->data + out, src->data + pos, (size_t) i);
+  dst->slen = need;
+  dst->data[need] = (unsigned char) '\0';
+  return count;
+
+  fail:;
+  dst->slen = out;
+  dst->data[out] = (unsigned char) '\0';
+  return BSTR_ERR;
+}
+
 /*  int bfindreplace (bstring b, const_bstring find, const_bstring repl,
- *                    int pos)
+ *                    blen_t pos)
  *
  *  Replace all occurrences of a find string with a replace string after a
  *  given point in a bstring.
  */
 int bfindreplace (bstring b, const_bstring find, const_bstring repl,
-                  int pos) {
-  return findreplaceengine (b, find, repl, pos, binstr);
+                  blen_t pos) {
+  struct bstr__pattern pat; /* RMM edit */
+
+  if (b == NULL || find == NULL || find->data == NULL || find->slen < 0)
+    return BSTR_ERR;
+  bstr__pattern_init (&pat, find->data, find->slen, 1, 0,
+                      b->slen >= BSTR_SKIP_MIN_HAYSTACK);
+  return findreplaceengine (b, find, repl, pos, &pat);
 }
 
 /*  int bfindreplacecaseless (bstring b, const_bstring find,
- *                            const_bstring repl, int pos)
+ *                            const_bstring repl, blen_t pos)
  *
  *  Replace all occurrences of a find string, ignoring case, with a replace
  *  string after a given point in a bstring.
  */
 int bfindreplacecaseless (bstring b, const_bstring find, const_bstring repl,
-                          int pos) {
-  return findreplaceengine (b, find, repl, pos, binstrcaseless);
+                          blen_t pos) {
+  struct bstr__pattern pat; /* RMM edit */
+
+  if (b == NULL || find == NULL || find->data == NULL || find->slen < 0)
+    return BSTR_ERR;
+  bstr__pattern_init (&pat, find->data, find->slen, 1, 1,
+                      b->slen >= BSTR_SKIP_MIN_HAYSTACK);
+  return findreplaceengine (b, find, repl, pos, &pat);
 }
 
-/*  int binsertch (bstring b, int pos, int len, unsigned char fill)
+/*  int binsertch (bstring b, blen_t pos, blen_t len, unsigned char fill)
  *
  *  Inserts the character fill repeatedly into b at position pos for a
  *  length len.  If the position pos is past the end of b, then the
  *  character "fill" is appended as necessary to make up the gap between the
  *  end of b and the position pos + len.
  */
-int binsertch (bstring b, int pos, int len, unsigned char fill) {
-  int d, l, i;
+int binsertch (bstring b, blen_t pos, blen_t len, unsigned char fill) {
+  blen_t d, l, i;
 
   if (pos < 0 || b == NULL || b->slen < 0 || b->mlen < b->slen ||
       b->mlen <= 0 || len < 0) return BSTR_ERR;
@@ -2323,15 +4091,15 @@ int binsertch (bstring b, int pos, int len, unsigned char fill) {
   return BSTR_OK;
 }
 
-/*  int bpattern (bstring b, int len)
+/*  int bpattern (bstring b, blen_t len)
  *
  *  Replicate the bstring, b in place, end to end repeatedly until it
  *  surpasses len characters, then chop the result to exactly len characters.
  *  This function operates in-place.  The function will return with BSTR_ERR
  *  if b is NULL or of length 0, otherwise BSTR_OK is returned.
  */
-int bpattern (bstring b, int len) {
-  int i, d;
+int bpattern (bstring b, blen_t len) {
+  blen_t i, d;
 
   d = blength (b);
   if (d <= 0 || len < 0 || balloc (b, len + 1) != BSTR_OK) return BSTR_ERR;
@@ -2353,7 +4121,7 @@ int bpattern (bstring b, int len) {
  *  efficient way.
  */
 int breada (bstring b, bNread readPtr, void * parm) {
-  int i, l, n;
+  blen_t i, l, n;
 
   if (b == NULL || b->mlen <= 0 || b->slen < 0 || b->mlen < b->slen ||
       readPtr == NULL) return BSTR_ERR;
@@ -2361,7 +4129,7 @@ int breada (bstring b, bNread readPtr, void * parm) {
   i = b->slen;
   for (n=i+16; ; n += ((n < BS_BUFF_SZ) ? n : BS_BUFF_SZ)) {
     if (BSTR_OK != balloc (b, n + 1)) return BSTR_ERR;
-    l = (int) readPtr ((void *) (b->data + i), 1, n - i, parm);
+    l = (blen_t) readPtr ((void *) (b->data + i), 1, n - i, parm);
     i += l;
     b->slen = i;
     if (i < n) break;
@@ -2401,10 +4169,11 @@ bstring bread (bNread readPtr, void * parm) {
  *  detectable error, BSTR_ERR is returned.
  */
 int bassigngets (bstring b, bNgetc getcPtr, void * parm, char terminator) {
-  int c, d, e;
+  blen_t c, d, e;
 
   if (b == NULL || b->mlen <= 0 || b->slen < 0 || b->mlen < b->slen ||
       getcPtr == NULL) return BSTR_ERR;
+  if (bstr__unshare (b) != BSTR_OK) return BSTR_ERR; /* RMM edit */
   d = 0;
   e = b->mlen - 2;
 
@@ -2439,10 +4208,11 @@ int bassigngets (bstring b, bNgetc getcPtr, void * parm, char terminator) {
  *  there is some other detectable error, BSTR_ERR is returned.
  */
 int bgetsa (bstring b, bNgetc getcPtr, void * parm, char terminator) {
-  int c, d, e;
+  blen_t c, d, e;
 
   if (b == NULL || b->mlen <= 0 || b->slen < 0 || b->mlen < b->slen ||
       getcPtr == NULL) return BSTR_ERR;
+  if (bstr__unshare (b) != BSTR_OK) return BSTR_ERR; /* RMM edit */
   d = b->slen;
   e = b->mlen - 2;
 
@@ -2557,7 +4327,7 @@ void * bsclose (struct bStream * s) {
  *  returned, but will be retained for subsequent read operations.
  */
 int bsreadlna (bstring r, struct bStream * s, char terminator) {
-  int i, l, ret, rlo;
+  blen_t i, l, ret, rlo;
   char * b;
   struct tagbstring x;
 
@@ -2569,9 +4339,9 @@ int bsreadlna (bstring r, struct bStream * s, char terminator) {
   x.data = (unsigned char *) b;
 
   /* First check if the current buffer holds the terminator */
-  b[l] = terminator; /* Set sentinel */
-  for (i=0; b[i] != terminator; i++) ;
-  if (i < l) {
+  i = bstr__kernels->find_byte ((unsigned char *) b, l,
+                                (unsigned char) terminator); /* RMM edit */
+  if (i >= 0) {
     x.slen = i + 1;
     ret = bconcat (r, &x);
     s->buff->slen = l;
@@ -2591,7 +4361,7 @@ int bsreadlna (bstring r, struct bStream * s, char terminator) {
     if (BSTR_OK != balloc (r, r->slen + s->maxBuffSz + 1))
       return BSTR_ERR;
     b = (char *) (r->data + r->slen);
-    l = (int) s->readFnPtr (b, 1, s->maxBuffSz, s->parm);
+    l = (blen_t) s->readFnPtr (b, 1, s->maxBuffSz, s->parm);
     if (l <= 0) {
       r->data[r->slen] = (unsigned char) '\0';
       s->buff->slen = 0;
@@ -2599,9 +4369,9 @@ int bsreadlna (bstring r, struct bStream * s, char terminator) {
       /* If nothing was read return with an error message */
       return BSTR_ERR & -(r->slen == rlo);
     }
-    b[l] = terminator; /* Set sentinel */
-    for (i=0; b[i] != terminator; i++) ;
-    if (i < l) break;
+    i = bstr__kernels->find_byte ((unsigned char *) b, l,
+                                  (unsigned char) terminator); /* RMM edit */
+    if (i >= 0) break;
     r->slen += l;
   }
 
@@ -2622,16 +4392,17 @@ int bsreadlna (bstring r, struct bStream * s, char terminator) {
  *  are not returned, but will be retained for subsequent read operations.
  */
 int bsreadlnsa (bstring r, struct bStream * s, const_bstring term) {
-  int i, l, ret, rlo;
+  blen_t i, l, ret, rlo;
   unsigned char * b;
   struct tagbstring x;
-  struct charField cf;
+  struct bstr__charclass cf;
 
   if (s == NULL || s->buff == NULL || r == NULL || term == NULL ||
       term->data == NULL || r->mlen <= 0 || r->slen < 0 ||
       r->mlen < r->slen) return BSTR_ERR;
   if (term->slen == 1) return bsreadlna (r, s, term->data[0]);
-  if (term->slen < 1 || buildCharField (&cf, term)) return BSTR_ERR;
+  if (term->slen < 1 || bstr__charclass_build (&cf, term, 0))
+    return BSTR_ERR;
 
   l = s->buff->slen;
   if (BSTR_OK != balloc (s->buff, s->maxBuffSz + 1)) return BSTR_ERR;
@@ -2639,9 +4410,8 @@ int bsreadlnsa (bstring r, struct bStream * s, const_bstring term) {
   x.data = b;
 
   /* First check if the current buffer holds the terminator */
-  b[l] = term->data[0]; /* Set sentinel */
-  for (i=0; !testInCharField (&cf, b[i]); i++) ;
-  if (i < l) {
+  i = bstr__kernels->find_class (b, l, &cf); /* RMM edit */
+  if (i >= 0) {
     x.slen = i + 1;
     ret = bconcat (r, &x);
     s->buff->slen = l;
@@ -2661,7 +4431,7 @@ int bsreadlnsa (bstring r, struct bStream * s, const_bstring term) {
     if (BSTR_OK != balloc (r, r->slen + s->maxBuffSz + 1))
       return BSTR_ERR;
     b = (unsigned char *) (r->data + r->slen);
-    l = (int) s->readFnPtr (b, 1, s->maxBuffSz, s->parm);
+    l = (blen_t) s->readFnPtr (b, 1, s->maxBuffSz, s->parm);
     if (l <= 0) {
       r->data[r->slen] = (unsigned char) '\0';
       s->buff->slen = 0;
@@ -2670,9 +4440,8 @@ int bsreadlnsa (bstring r, struct bStream * s, const_bstring term) {
       return BSTR_ERR & -(r->slen == rlo);
     }
 
-    b[l] = term->data[0]; /* Set sentinel */
-    for (i=0; !testInCharField (&cf, b[i]); i++) ;
-    if (i < l) break;
+    i = bstr__kernels->find_class (b, l, &cf); /* RMM edit */
+    if (i >= 0) break;
     r->slen += l;
   }
 
@@ -2685,7 +4454,7 @@ int bsreadlnsa (bstring r, struct bStream * s, const_bstring term) {
   return BSTR_OK;
 }
 
-/*  int bsreada (bstring r, struct bStream * s, int n)
+/*  int bsreada (bstring r, struct bStream * s, blen_t n)
  *
  *  Read a bstring of length n (or, if it is fewer, as many bytes as is
  *  remaining) from the bStream.  This function may read additional
@@ -2693,15 +4462,16 @@ int bsreadlnsa (bstring r, struct bStream * s, const_bstring term) {
  *  retained for subsequent read operations.  This function will not read
  *  additional characters from the core stream beyond virtual stream pointer.
  */
-int bsreada (bstring r, struct bStream * s, int n) {
-  int l, ret, orslen;
+int bsreada (bstring r, struct bStream * s, blen_t n) {
+  blen_t l, ret, orslen;
   char * b;
   struct tagbstring x;
 
   if (s == NULL || s->buff == NULL || r == NULL || r->mlen <= 0
       || r->slen < 0 || r->mlen < r->slen || n <= 0) return BSTR_ERR;
+  if (bstr__unshare (r) != BSTR_OK) return BSTR_ERR; /* RMM edit */
 
-  if (n > INT_MAX - r->slen) return BSTR_ERR;
+  if (n > BLEN_MAX - r->slen) return BSTR_ERR;
   n += r->slen;
 
   l = s->buff->slen;
@@ -2711,7 +4481,7 @@ int bsreada (bstring r, struct bStream * s, int n) {
   if (0 == l) {
     if (s->isEOF) return BSTR_ERR;
     if (r->mlen > n) {
-      l = (int) s->readFnPtr (r->data + r->slen, 1, n - r->slen,
+      l = (blen_t) s->readFnPtr (r->data + r->slen, 1, n - r->slen,
                               s->parm);
       if (0 >= l || l > n - r->slen) {
         s->isEOF = 1;
@@ -2742,7 +4512,7 @@ int bsreada (bstring r, struct bStream * s, int n) {
     l = n - r->slen;
     if (l > s->maxBuffSz) l = s->maxBuffSz;
 
-    l = (int) s->readFnPtr (b, 1, l, s->parm);
+    l = (blen_t) s->readFnPtr (b, 1, l, s->parm);
 
   } while (l > 0);
   if (l < 0) l = 0;
@@ -2783,7 +4553,7 @@ int bsreadlns (bstring r, struct bStream * s, const_bstring term) {
   return bsreadlnsa (r, s, term);
 }
 
-/*  int bsread (bstring r, struct bStream * s, int n)
+/*  int bsread (bstring r, struct bStream * s, blen_t n)
  *
  *  Read a bstring of length n (or, if it is fewer, as many bytes as is
  *  remaining) from the bStream.  This function may read additional
@@ -2791,7 +4561,7 @@ int bsreadlns (bstring r, struct bStream * s, const_bstring term) {
  *  retained for subsequent read operations.  This function will not read
  *  additional characters from the core stream beyond virtual stream pointer.
  */
-int bsread (bstring r, struct bStream * s, int n) {
+int bsread (bstring r, struct bStream * s, blen_t n) {
   if (s == NULL || s->buff == NULL || r == NULL || r->mlen <= 0
       || n <= 0) return BSTR_ERR;
   if (BSTR_OK != balloc (s->buff, s->maxBuffSz + 1)) return BSTR_ERR;
@@ -2820,17 +4590,17 @@ int bspeek (bstring r, const struct bStream * s) {
   return bassign (r, s->buff);
 }
 
-/*  bstring bjoinblk (const struct bstrList * bl, void * blk, int len);
+/*  bstring bjoinblk (const struct bstrList * bl, void * blk, blen_t len);
  *
  *  Join the entries of a bstrList into one bstring by sequentially
  *  concatenating them with the content from blk for length len in between.
  *  If there is an error NULL is returned, otherwise a bstring with the
  *  correct result is returned.
  */
-bstring bjoinblk (const struct bstrList * bl, const void * blk, int len) {
+bstring bjoinblk (const struct bstrList * bl, const void * blk, blen_t len) {
   bstring b;
   unsigned char * p;
-  int i, c, v;
+  blen_t i, c, v;
 
   if (bl == NULL || bl->qty < 0) return NULL;
   if (len < 0) return NULL;
@@ -2840,17 +4610,14 @@ bstring bjoinblk (const struct bstrList * bl, const void * blk, int len) {
   for (i = 0, c = 1; i < bl->qty; i++) {
     v = bl->entry[i]->slen;
     if (v < 0) return NULL;	/* Invalid input */
-    if (v > INT_MAX - c) return NULL;	/* Overflow */
+    if (v > BLEN_MAX - c) return NULL;	/* Overflow */
     c += v;
   }
 
-  b = (bstring) bstr__alloc (sizeof (struct tagbstring));
   if (len == 0) {
-    p = b->data = (unsigned char *) bstr__alloc (c);
-    if (p == NULL) {
-      bstr__free (b);
-      return NULL;
-    }
+    b = bstr__new (c); /* RMM edit */
+    if (b == NULL) return NULL;
+    p = b->data;
     for (i = 0; i < bl->qty; i++) {
       v = bl->entry[i]->slen;
       bstr__memcpy (p, bl->entry[i]->data, v);
@@ -2860,13 +4627,11 @@ bstring bjoinblk (const struct bstrList * bl, const void * blk, int len) {
     v = (bl->qty - 1) * len;
     if ((bl->qty > 512 || len > 127) &&
         v / len != bl->qty - 1) return NULL; /* Overflow */
-    if (v > INT_MAX - c) return NULL;	/* Overflow */
+    if (v > BLEN_MAX - c) return NULL;	/* Overflow */
     c += v;
-    p = b->data = (unsigned char *) bstr__alloc (c);
-    if (p == NULL) {
-      bstr__free (b);
-      return NULL;
-    }
+    b = bstr__new (c); /* RMM edit */
+    if (b == NULL) return NULL;
+    p = b->data;
     v = bl->entry[0]->slen;
     bstr__memcpy (p, bl->entry[0]->data, v);
     p += v;
@@ -2900,7 +4665,7 @@ bstring bjoin (const struct bstrList * bl, const_bstring sep) {
 #define BSSSC_BUFF_LEN (256)
 
 /*  int bssplitscb (struct bStream * s, const_bstring splitStr,
- *                  int (* cb) (void * parm, int ofs, const_bstring entry),
+ *                  int (* cb) (void * parm, blen_t ofs, const_bstring entry),
  *                  void * parm)
  *
  *  Iterate the set of disjoint sequential substrings read from a stream
@@ -2918,10 +4683,10 @@ bstring bjoin (const struct bstrList * bl, const_bstring sep) {
  *  undefined manner.
  */
 int bssplitscb (struct bStream * s, const_bstring splitStr,
-                int (* cb) (void * parm, int ofs, const_bstring entry), void * parm) {
-  struct charField chrs;
+                int (* cb) (void * parm, blen_t ofs, const_bstring entry), void * parm) {
+  struct bstr__charclass chrs;
   bstring buff;
-  int i, p, ret;
+  blen_t i, j, p, ret;
 
   if (cb == NULL || s == NULL || s->readFnPtr == NULL ||
       splitStr == NULL || splitStr->slen < 0) return BSTR_ERR;
@@ -2933,7 +4698,7 @@ int bssplitscb (struct bStream * s, const_bstring splitStr,
     if ((ret = cb (parm, 0, buff)) > 0)
       ret = 0;
   } else {
-    buildCharField (&chrs, splitStr);
+    bstr__charclass_init (&chrs, splitStr->data, splitStr->slen, 0);
     ret = p = i = 0;
     for (;;) {
       if (i >= buff->slen) {
@@ -2943,7 +4708,14 @@ int bssplitscb (struct bStream * s, const_bstring splitStr,
           break;
         }
       }
-      if (testInCharField (&chrs, buff->data[i])) {
+      /* RMM edit: jump to the next split character */
+      j = bstr__kernels->find_class (buff->data + i, buff->slen - i, &chrs);
+      if (j < 0) {
+        i = buff->slen;
+        continue;
+      }
+      i += j;
+      {
         struct tagbstring t;
         unsigned char c;
 
@@ -2967,7 +4739,7 @@ int bssplitscb (struct bStream * s, const_bstring splitStr,
 }
 
 /*  int bssplitstrcb (struct bStream * s, const_bstring splitStr,
- *                    int (* cb) (void * parm, int ofs, const_bstring entry),
+ *                    int (* cb) (void * parm, blen_t ofs, const_bstring entry),
  *                    void * parm)
  *
  *  Iterate the set of disjoint sequential substrings read from a stream
@@ -2985,9 +4757,9 @@ int bssplitscb (struct bStream * s, const_bstring splitStr,
  *  undefined manner.
  */
 int bssplitstrcb (struct bStream * s, const_bstring splitStr,
-                  int (* cb) (void * parm, int ofs, const_bstring entry), void * parm) {
+                  int (* cb) (void * parm, blen_t ofs, const_bstring entry), void * parm) {
   bstring buff;
-  int i, p, ret;
+  blen_t i, p, ret;
 
   if (cb == NULL || s == NULL || s->readFnPtr == NULL
       || splitStr == NULL || splitStr->slen < 0) return BSTR_ERR;
@@ -3034,19 +4806,7 @@ int bssplitstrcb (struct bStream * s, const_bstring splitStr,
  *  Create a bstrList.
  */
 struct bstrList * bstrListCreate (void) {
-  struct bstrList * sl =
-                      (struct bstrList *) bstr__alloc (sizeof (struct bstrList));
-  if (sl) {
-    sl->entry = (bstring *) bstr__alloc (1*sizeof (bstring));
-    if (!sl->entry) {
-      bstr__free (sl);
-      sl = NULL;
-    } else {
-      sl->qty = 0;
-      sl->mlen = 1;
-    }
-  }
-  return sl;
+  return bstr__list_new (1); /* RMM edit */
 }
 
 /*  int bstrListDestroy (struct bstrList * sl)
@@ -3055,7 +4815,7 @@ struct bstrList * bstrListCreate (void) {
  *  bstrListCreate.
  */
 int bstrListDestroy (struct bstrList * sl) {
-  int i;
+  blen_t i;
   if (sl == NULL || sl->qty < 0) return BSTR_ERR;
   for (i=0; i < sl->qty; i++) {
     if (sl->entry[i]) {
@@ -3065,20 +4825,18 @@ int bstrListDestroy (struct bstrList * sl) {
   }
   sl->qty  = -1;
   sl->mlen = -1;
-  bstr__free (sl->entry);
-  sl->entry = NULL;
-  bstr__free (sl);
+  bstr__list_free (sl); /* RMM edit */
   return BSTR_OK;
 }
 
-/*  int bstrListAlloc (struct bstrList * sl, int msz)
+/*  int bstrListAlloc (struct bstrList * sl, blen_t msz)
  *
  *  Ensure that there is memory for at least msz number of entries for the
  *  list.
  */
-int bstrListAlloc (struct bstrList * sl, int msz) {
+int bstrListAlloc (struct bstrList * sl, blen_t msz) {
   bstring * l;
-  int smsz;
+  blen_t smsz;
   size_t nsz;
   if (!sl || msz <= 0 || !sl->entry || sl->qty < 0 || sl->mlen <= 0 ||
       sl->qty > sl->mlen) return BSTR_ERR;
@@ -3086,11 +4844,11 @@ int bstrListAlloc (struct bstrList * sl, int msz) {
   smsz = snapUpSize (msz);
   nsz = ((size_t) smsz) * sizeof (bstring);
   if (nsz < (size_t) smsz) return BSTR_ERR;
-  l = (bstring *) bstr__realloc (sl->entry, nsz);
+  l = bstr__list_realloc (sl, smsz); /* RMM edit */
   if (!l) {
     smsz = msz;
     nsz = ((size_t) smsz) * sizeof (bstring);
-    l = (bstring *) bstr__realloc (sl->entry, nsz);
+    l = bstr__list_realloc (sl, smsz); /* RMM edit */
     if (!l) return BSTR_ERR;
   }
   sl->mlen = smsz;
@@ -3098,12 +4856,12 @@ int bstrListAlloc (struct bstrList * sl, int msz) {
   return BSTR_OK;
 }
 
-/*  int bstrListAllocMin (struct bstrList * sl, int msz)
+/*  int bstrListAllocMin (struct bstrList * sl, blen_t msz)
  *
  *  Try to allocate the minimum amount of memory for the list to include at
  *  least msz entries or sl->qty whichever is greater.
  */
-int bstrListAllocMin (struct bstrList * sl, int msz) {
+int bstrListAllocMin (struct bstrList * sl, blen_t msz) {
   bstring * l;
   size_t nsz;
   if (!sl || msz <= 0 || !sl->entry || sl->qty < 0 || sl->mlen <= 0 ||
@@ -3112,15 +4870,15 @@ int bstrListAllocMin (struct bstrList * sl, int msz) {
   if (sl->mlen == msz) return BSTR_OK;
   nsz = ((size_t) msz) * sizeof (bstring);
   if (nsz < (size_t) msz) return BSTR_ERR;
-  l = (bstring *) bstr__realloc (sl->entry, nsz);
+  l = bstr__list_realloc (sl, msz); /* RMM edit */
   if (!l) return BSTR_ERR;
   sl->mlen = msz;
   sl->entry = l;
   return BSTR_OK;
 }
 
-/*  int bsplitcb (const_bstring str, unsigned char splitChar, int pos,
- *                int (* cb) (void * parm, int ofs, int len), void * parm)
+/*  int bsplitcb (const_bstring str, unsigned char splitChar, blen_t pos,
+ *                int (* cb) (void * parm, blen_t ofs, blen_t len), void * parm)
  *
  *  Iterate the set of disjoint sequential substrings over str divided by the
  *  character in splitChar.
@@ -3134,26 +4892,46 @@ int bstrListAllocMin (struct bstrList * sl, int msz) {
  *  cb function destroys str, then it *must* return with a negative value,
  *  otherwise bsplitcb will continue in an undefined manner.
  */
-int bsplitcb (const_bstring str, unsigned char splitChar, int pos,
-              int (* cb) (void * parm, int ofs, int len), void * parm) {
-  int i, p, ret;
+int bsplitcb (const_bstring str, unsigned char splitChar, blen_t pos,
+              int (* cb) (void * parm, blen_t ofs, blen_t len), void * parm) {
+  blen_t i, p, ret;
 
   if (cb == NULL || str == NULL || pos < 0 || pos > str->slen)
     return BSTR_ERR;
 
   p = pos;
   do {
-    for (i=p; i < str->slen; i++) {
-      if (str->data[i] == splitChar) break;
-    }
+    /* RMM edit */
+    i = bstr__kernels->find_byte (str->data + p, str->slen - p, splitChar);
+    i = (i < 0) ? str->slen : p + i;
     if ((ret = cb (parm, p, i - p)) < 0) return ret;
     p = i + 1;
   } while (p <= str->slen);
   return BSTR_OK;
 }
 
-/*  int bsplitscb (const_bstring str, const_bstring splitStr, int pos,
- *                 int (* cb) (void * parm, int ofs, int len), void * parm)
+/* RMM edit: bsplitscb with the split characters compiled in cc. */
+static int bstr__splitscb (const_bstring str, const struct bstr__charclass * cc,
+                           blen_t pos,
+                           int (* cb) (void * parm, blen_t ofs, blen_t len),
+                           void * parm) {
+  blen_t i, p, ret;
+
+  if (cb == NULL || str == NULL || pos < 0 || pos > str->slen)
+    return BSTR_ERR;
+
+  p = pos;
+  do {
+    i = bstr__kernels->find_class (str->data + p, str->slen - p, cc);
+    i = (i < 0) ? str->slen : p + i;
+    if ((ret = cb (parm, p, i - p)) < 0) return ret;
+    p = i + 1;
+  } while (p <= str->slen);
+  return BSTR_OK;
+}
+
+/*  int bsplitscb (const_bstring str, const_bstring splitStr, blen_t pos,
+ *                 int (* cb) (void * parm, blen_t ofs, blen_t len), void * parm)
  *
  *  Iterate the set of disjoint sequential substrings over str divided by any
  *  of the characters in splitStr.  An empty splitStr causes the whole str to
@@ -3168,10 +4946,10 @@ int bsplitcb (const_bstring str, unsigned char splitChar, int pos,
  *  cb function destroys str, then it *must* return with a negative value,
  *  otherwise bsplitscb will continue in an undefined manner.
  */
-int bsplitscb (const_bstring str, const_bstring splitStr, int pos,
-               int (* cb) (void * parm, int ofs, int len), void * parm) {
-  struct charField chrs;
-  int i, p, ret;
+int bsplitscb (const_bstring str, const_bstring splitStr, blen_t pos,
+               int (* cb) (void * parm, blen_t ofs, blen_t len), void * parm) {
+  struct bstr__charclass chrs;
+  blen_t ret;
 
   if (cb == NULL || str == NULL || pos < 0 || pos > str->slen
       || splitStr == NULL || splitStr->slen < 0) return BSTR_ERR;
@@ -3183,21 +4961,49 @@ int bsplitscb (const_bstring str, const_bstring splitStr, int pos,
   if (splitStr->slen == 1)
     return bsplitcb (str, splitStr->data[0], pos, cb, parm);
 
-  buildCharField (&chrs, splitStr);
+  bstr__charclass_init (&chrs, splitStr->data, splitStr->slen, 0);
+  return bstr__splitscb (str, &chrs, pos, cb, parm); /* RMM edit */
+}
 
-  p = pos;
-  do {
-    for (i=p; i < str->slen; i++) {
-      if (testInCharField (&chrs, str->data[i])) break;
+/* RMM edit: bsplitstrcb, searching for splitStr with the Two-Way engine
+   rather than a memcmp at every position.  pat is splitStr prepared for
+   a forward search, or NULL to prepare it here. */
+static int bstr__splitstrcb (const_bstring str, const_bstring splitStr,
+                             const struct bstr__pattern * pat, blen_t pos,
+                             int (* cb) (void * parm, blen_t ofs, blen_t len),
+                             void * parm) {
+  struct bstr__pattern local;
+  blen_t i, p, ret;
+
+  if (cb == NULL || str == NULL || pos < 0 || pos > str->slen
+      || splitStr == NULL || splitStr->slen < 0) return BSTR_ERR;
+
+  if (0 == splitStr->slen) {
+    for (i=pos; i < str->slen; i++) {
+      if ((ret = cb (parm, i, 1)) < 0) return ret;
     }
+    return BSTR_OK;
+  }
+
+  if (pat == NULL) {
+    if (splitStr->slen == 1)
+      return bsplitcb (str, splitStr->data[0], pos, cb, parm);
+    bstr__pattern_init (&local, splitStr->data, splitStr->slen, 1, 0,
+                        str->slen - pos >= BSTR_SKIP_MIN_HAYSTACK);
+    pat = &local;
+  }
+
+  p = pos;
+  while ((i = bstr__pattern_instr (pat, str, p, splitStr)) >= 0) {
     if ((ret = cb (parm, p, i - p)) < 0) return ret;
-    p = i + 1;
-  } while (p <= str->slen);
+    p = i + splitStr->slen;
+  }
+  if ((ret = cb (parm, p, str->slen - p)) < 0) return ret;
   return BSTR_OK;
 }
 
-/*  int bsplitstrcb (const_bstring str, const_bstring splitStr, int pos,
- *	int (* cb) (void * parm, int ofs, int len), void * parm)
+/*  int bsplitstrcb (const_bstring str, const_bstring splitStr, blen_t pos,
+ *	int (* cb) (void * parm, blen_t ofs, blen_t len), void * parm)
  *
  *  Iterate the set of disjoint sequential substrings over str divided by the
  *  substring splitStr.  An empty splitStr causes the whole str to be
@@ -3212,33 +5018,9 @@ int bsplitscb (const_bstring str, const_bstring splitStr, int pos,
  *  cb function destroys str, then it *must* return with a negative value,
  *  otherwise bsplitscb will continue in an undefined manner.
  */
-int bsplitstrcb (const_bstring str, const_bstring splitStr, int pos,
-                 int (* cb) (void * parm, int ofs, int len), void * parm) {
-  int i, p, ret;
-
-  if (cb == NULL || str == NULL || pos < 0 || pos > str->slen
-      || splitStr == NULL || splitStr->slen < 0) return BSTR_ERR;
-
-  if (0 == splitStr->slen) {
-    for (i=pos; i < str->slen; i++) {
-      if ((ret = cb (parm, i, 1)) < 0) return ret;
-    }
-    return BSTR_OK;
-  }
-
-  if (splitStr->slen == 1)
-    return bsplitcb (str, splitStr->data[0], pos, cb, parm);
-
-  for (i=p=pos; i <= str->slen - splitStr->slen; i++) {
-    if (0 == bstr__memcmp (splitStr->data, str->data + i,
-                           splitStr->slen)) {
-      if ((ret = cb (parm, p, i - p)) < 0) return ret;
-      i += splitStr->slen;
-      p = i;
-    }
-  }
-  if ((ret = cb (parm, p, str->slen - p)) < 0) return ret;
-  return BSTR_OK;
+int bsplitstrcb (const_bstring str, const_bstring splitStr, blen_t pos,
+                 int (* cb) (void * parm, blen_t ofs, blen_t len), void * parm) {
+  return bstr__splitstrcb (str, splitStr, NULL, pos, cb, parm); /* RMM edit */
 }
 
 struct genBstrList {
@@ -3246,10 +5028,10 @@ struct genBstrList {
   struct bstrList * bl;
 };
 
-static int bscb (void * parm, int ofs, int len) {
+static int bscb (void * parm, blen_t ofs, blen_t len) {
   struct genBstrList * g = (struct genBstrList *) parm;
   if (g->bl->qty >= g->bl->mlen) {
-    int mlen = g->bl->mlen * 2;
+    blen_t mlen = g->bl->mlen * 2;
     bstring * tbl;
 
     while (g->bl->qty >= mlen) {
@@ -3257,8 +5039,7 @@ static int bscb (void * parm, int ofs, int len) {
       mlen += mlen;
     }
 
-    tbl = (bstring *) bstr__realloc (g->bl->entry,
-                                     sizeof (bstring) * mlen);
+    tbl = bstr__list_realloc (g->bl, mlen); /* RMM edit */
     if (tbl == NULL) return BSTR_ERR;
 
     g->bl->entry = tbl;
@@ -3270,60 +5051,119 @@ static int bscb (void * parm, int ofs, int len) {
   return BSTR_OK;
 }
 
-/*  struct bstrList * bsplit (const_bstring str, unsigned char splitChar)
- *
- *  Create an array of sequential substrings from str divided by the character
- *  splitChar.
- */
-struct bstrList * bsplit (const_bstring str, unsigned char splitChar) {
+/* RMM edit: a split of str from the start, passing each field to cb, with
+   what to split on in how. */
+typedef int (* bstr__splitfn) (const_bstring str, const void * how,
+                               int (* cb) (void * parm, blen_t ofs,
+                                           blen_t len),
+                               void * parm);
+
+/* RMM edit: the list of the fields fn splits str into.  They are packed
+   into one allocation unless they are going into an arena, which is already
+   cheap to fill and free. */
+static struct bstrList * bstr__split_packed (const_bstring str,
+                                             bstr__splitfn fn,
+                                             const void * how) {
   struct genBstrList g;
+  struct bstr__ranges rg;
 
-  if (str == NULL || str->data == NULL || str->slen < 0) return NULL;
+  if (rlib__arena_current == NULL) {
+    bstr__ranges_init (&rg);
+    if (fn (str, how, bstr__rangecb, &rg) < 0) {
+      bstr__ranges_free (&rg);
+      return NULL;
+    }
+    return bstr__list_pack (str, &rg);
+  }
 
-  g.bl = (struct bstrList *) bstr__alloc (sizeof (struct bstrList));
+  g.bl = bstr__list_new (4);
   if (g.bl == NULL) return NULL;
-  g.bl->mlen = 4;
-  g.bl->entry = (bstring *) bstr__alloc (g.bl->mlen * sizeof (bstring));
-  if (NULL == g.bl->entry) {
-    bstr__free (g.bl);
-    return NULL;
-  }
 
   g.b = (bstring) str;
-  g.bl->qty = 0;
-  if (bsplitcb (str, splitChar, 0, bscb, &g) < 0) {
+  if (fn (str, how, bscb, &g) < 0) {
     bstrListDestroy (g.bl);
     return NULL;
   }
   return g.bl;
 }
 
+/* RMM edit: the splits bstr__split_packed runs. */
+static int bstr__splitfn_char (const_bstring str, const void * how,
+                               int (* cb) (void * parm, blen_t ofs,
+                                           blen_t len),
+                               void * parm) {
+  return bsplitcb (str, *(const unsigned char *) how, 0, cb, parm);
+}
+
+struct bstr__splitstr_how {
+  const_bstring splitStr;
+  const struct bstr__pattern * pat;
+};
+
+static int bstr__splitfn_str (const_bstring str, const void * how,
+                              int (* cb) (void * parm, blen_t ofs,
+                                          blen_t len),
+                              void * parm) {
+  const struct bstr__splitstr_how * h =
+    (const struct bstr__splitstr_how *) how;
+  return bstr__splitstrcb (str, h->splitStr, h->pat, 0, cb, parm);
+}
+
+static int bstr__splitfn_class (const_bstring str, const void * how,
+                                int (* cb) (void * parm, blen_t ofs,
+                                            blen_t len),
+                                void * parm) {
+  return bstr__splitscb (str, (const struct bstr__charclass *) how, 0, cb,
+                         parm);
+}
+
+static int bstr__splitfn_chars (const_bstring str, const void * how,
+                                int (* cb) (void * parm, blen_t ofs,
+                                            blen_t len),
+                                void * parm) {
+  return bsplitscb (str, (const_bstring) how, 0, cb, parm);
+}
+
+/*  struct bstrList * bsplit (const_bstring str, unsigned char splitChar)
+ *
+ *  Create an array of sequential substrings from str divided by the character
+ *  splitChar.
+ */
+struct bstrList * bsplit (const_bstring str, unsigned char splitChar) {
+  if (str == NULL || str->data == NULL || str->slen < 0) return NULL;
+
+  /* RMM edit */
+  return bstr__split_packed (str, bstr__splitfn_char, &splitChar);
+}
+
+/* RMM edit: bsplitstr with splitStr prepared in pat, see bstr__splitstrcb. */
+static struct bstrList * bstr__splitstr (const_bstring str,
+                                         const_bstring splitStr,
+                                         const struct bstr__pattern * pat) {
+  struct bstr__splitstr_how how;
+
+  if (str == NULL || str->data == NULL || str->slen < 0) return NULL;
+
+  how.splitStr = splitStr;
+  how.pat = pat;
+  return bstr__split_packed (str, bstr__splitfn_str, &how);
+}
+
 /*  struct bstrList * bsplitstr (const_bstring str, const_bstring splitStr)
  *
  *  Create an array of sequential substrings from str divided by the entire
  *  substring splitStr.
  */
 struct bstrList * bsplitstr (const_bstring str, const_bstring splitStr) {
-  struct genBstrList g;
+  return bstr__splitstr (str, splitStr, NULL); /* RMM edit */
+}
 
+/* RMM edit: bsplits with the split characters compiled in cc. */
+static struct bstrList * bstr__splits (const_bstring str,
+                                       const struct bstr__charclass * cc) {
   if (str == NULL || str->data == NULL || str->slen < 0) return NULL;
 
-  g.bl = (struct bstrList *) bstr__alloc (sizeof (struct bstrList));
-  if (g.bl == NULL) return NULL;
-  g.bl->mlen = 4;
-  g.bl->entry = (bstring *) bstr__alloc (g.bl->mlen * sizeof (bstring));
-  if (NULL == g.bl->entry) {
-    bstr__free (g.bl);
-    return NULL;
-  }
-
-  g.b = (bstring) str;
-  g.bl->qty = 0;
-  if (bsplitstrcb (str, splitStr, 0, bscb, &g) < 0) {
-    bstrListDestroy (g.bl);
-    return NULL;
-  }
-  return g.bl;
+  return bstr__split_packed (str, bstr__splitfn_class, cc);
 }
 
 /*  struct bstrList * bsplits (const_bstring str, bstring splitStr)
@@ -3333,28 +5173,12 @@ struct bstrList * bsplitstr (const_bstring str, const_bstring splitStr) {
  *  containing a copy of str to be returned.
  */
 struct bstrList * bsplits (const_bstring str, const_bstring splitStr) {
-  struct genBstrList g;
-
   if (     str == NULL ||      str->slen < 0 ||      str->data == NULL ||
            splitStr == NULL || splitStr->slen < 0 || splitStr->data == NULL)
     return NULL;
 
-  g.bl = (struct bstrList *) bstr__alloc (sizeof (struct bstrList));
-  if (g.bl == NULL) return NULL;
-  g.bl->mlen = 4;
-  g.bl->entry = (bstring *) bstr__alloc (g.bl->mlen * sizeof (bstring));
-  if (NULL == g.bl->entry) {
-    bstr__free (g.bl);
-    return NULL;
-  }
-  g.b = (bstring) str;
-  g.bl->qty = 0;
-
-  if (bsplitscb (str, splitStr, 0, bscb, &g) < 0) {
-    bstrListDestroy (g.bl);
-    return NULL;
-  }
-  return g.bl;
+  /* RMM edit */
+  return bstr__split_packed (str, bstr__splitfn_chars, splitStr);
 }
 
 #if defined (__TURBOC__) && !defined (__BORLANDC__)
@@ -3408,7 +5232,7 @@ extern int vsnprintf (char *buf, size_t count, const char *format, va_list arg);
 int bformata (bstring b, const char * fmt, ...) {
   va_list arglist;
   bstring buff;
-  int n, r;
+  blen_t n, r;
 
   if (b == NULL || fmt == NULL || b->data == NULL || b->mlen <= 0
       || b->slen < 0 || b->slen > b->mlen) return BSTR_ERR;
@@ -3429,7 +5253,7 @@ int bformata (bstring b, const char * fmt, ...) {
     va_end (arglist);
 
     buff->data[n] = (unsigned char) '\0';
-    buff->slen = (int) (strlen) ((char *) buff->data);
+    buff->slen = (blen_t) (strlen) ((char *) buff->data);
 
     if (buff->slen < n) break;
 
@@ -3456,7 +5280,7 @@ int bformata (bstring b, const char * fmt, ...) {
 int bassignformat (bstring b, const char * fmt, ...) {
   va_list arglist;
   bstring buff;
-  int n, r;
+  blen_t n, r;
 
   if (b == NULL || fmt == NULL || b->data == NULL || b->mlen <= 0
       || b->slen < 0 || b->slen > b->mlen) return BSTR_ERR;
@@ -3477,7 +5301,7 @@ int bassignformat (bstring b, const char * fmt, ...) {
     va_end (arglist);
 
     buff->data[n] = (unsigned char) '\0';
-    buff->slen = (int) (strlen) ((char *) buff->data);
+    buff->slen = (blen_t) (strlen) ((char *) buff->data);
 
     if (buff->slen < n) break;
 
@@ -3504,7 +5328,7 @@ int bassignformat (bstring b, const char * fmt, ...) {
 bstring bformat (const char * fmt, ...) {
   va_list arglist;
   bstring buff;
-  int n, r;
+  blen_t n, r;
 
   if (fmt == NULL) return NULL;
 
@@ -3524,7 +5348,7 @@ bstring bformat (const char * fmt, ...) {
     va_end (arglist);
 
     buff->data[n] = (unsigned char) '\0';
-    buff->slen = (int) (strlen) ((char *) buff->data);
+    buff->slen = (blen_t) (strlen) ((char *) buff->data);
 
     if (buff->slen < n) break;
 
@@ -3560,7 +5384,7 @@ bstring bformat (const char * fmt, ...) {
  *  to this end point.
  */
 int bvcformata (bstring b, int count, const char * fmt, va_list arg) {
-  int n, r, l;
+  blen_t n, r, l;
 
   if (b == NULL || fmt == NULL || count <= 0 || b->data == NULL
       || b->mlen <= 0 || b->slen < 0 || b->slen > b->mlen) return BSTR_ERR;
@@ -3573,7 +5397,7 @@ int bvcformata (bstring b, int count, const char * fmt, va_list arg) {
 
   /* Did the operation complete successfully within bounds? */
 
-  if (n >= (l = b->slen + (int) (strlen) ((char *) b->data + b->slen))) {
+  if (n >= (l = b->slen + (blen_t) (strlen) ((char *) b->data + b->slen))) {
     b->slen = l;
     return BSTR_OK;
   }
@@ -3607,11 +5431,316 @@ int bvcformata (bstring b, int count, const char * fmt, va_list arg) {
 #define RTRUE 1
 #define RFALSE 0
 
+/* START OF RARENA */
+
+/**
+ * @brief Default size in bytes of each block an rlib_arena carves allocations out of.
+ */
+#ifndef RLIB_ARENA_CHUNK_SIZE
+#define RLIB_ARENA_CHUNK_SIZE 65536
+#endif
+
+/**
+ * @brief Alignment of every allocation handed out by an rlib_arena.
+ */
+#define RLIB_ARENA_ALIGN 16
+
+#define rlib__arena_round(sz) (((sz) + (RLIB_ARENA_ALIGN - 1)) & ~((size_t)RLIB_ARENA_ALIGN - 1))
+
+struct rlib_arena_chunk {
+  struct rlib_arena_chunk* next;
+  size_t size;
+};
+
+#define RLIB_ARENA_CHUNK_HDR rlib__arena_round(sizeof(struct rlib_arena_chunk))
+#define rlib__arena_chunk_data(chunk) ((unsigned char*)(chunk) + RLIB_ARENA_CHUNK_HDR)
+
+/**
+ * @brief A bump allocator that rstrings and rstring_arrays can be built in.
+ *
+ * Allocations are carved sequentially out of large chunks and are never freed individually.  Instead the whole arena is reset (keeping its chunks for reuse) or freed in one go.  This suits batch workloads that build many short-lived strings (e.g., splitting every line of a file) and then throw them all away together.
+ */
+struct rlib_arena {
+  struct rlib_arena_chunk* head;
+  struct rlib_arena_chunk* cur;
+  size_t used;
+  size_t chunk_size;
+  unsigned char* last;
+};
+
+rlib_arena* rlib_arena_new(size_t chunk_size);
+int rlib_arena_reset(rlib_arena* arena);
+int rlib_arena_free(rlib_arena* arena);
+rlib_arena* rlib_arena_use(rlib_arena* arena);
+
+static struct rlib_arena_chunk*
+rlib__arena_chunk_new(size_t size)
+{
+  struct rlib_arena_chunk* chunk = malloc(RLIB_ARENA_CHUNK_HDR + size);
+  if (chunk == NULL) { return NULL; }
+
+  chunk->next = NULL;
+  chunk->size = size;
+
+  return chunk;
+}
+
+static void*
+rlib__arena_alloc(rlib_arena* arena, size_t sz)
+{
+  if (arena == NULL) { return NULL; }
+
+  size_t need = rlib__arena_round(sz == 0 ? 1 : sz);
+  if (need < sz) { return NULL; }
+
+  /* Move forward through the chunk list (chunks are kept around after a reset) until one fits, splicing in a fresh chunk if none does. */
+  while (arena->cur == NULL || arena->used + need > arena->cur->size) {
+    struct rlib_arena_chunk* next = arena->cur == NULL ? arena->head : arena->cur->next;
+
+    if (next == NULL || next->size < need) {
+      size_t size = need > arena->chunk_size ? need : arena->chunk_size;
+      struct rlib_arena_chunk* chunk = rlib__arena_chunk_new(size);
+      if (chunk == NULL) { return NULL; }
+
+      chunk->next = next;
+      if (arena->cur == NULL) {
+        arena->head = chunk;
+      } else {
+        arena->cur->next = chunk;
+      }
+      next = chunk;
+    }
+
+    arena->cur = next;
+    arena->used = 0;
+  }
+
+  unsigned char* p = rlib__arena_chunk_data(arena->cur) + arena->used;
+  arena->used += need;
+  arena->last = p;
+
+  return p;
+}
+
+static void*
+rlib__arena_grow(rlib_arena* arena, void* p, size_t osz, size_t nsz)
+{
+  if (arena == NULL) { return NULL; }
+  if (p == NULL) { return rlib__arena_alloc(arena, nsz); }
+
+  /* The most recent allocation can be resized in place if the chunk has room. */
+  if (p == arena->last) {
+    size_t offset = (unsigned char*)p - rlib__arena_chunk_data(arena->cur);
+    size_t need = rlib__arena_round(nsz == 0 ? 1 : nsz);
+
+    if (need >= nsz && offset + need <= arena->cur->size) {
+      arena->used = offset + need;
+      return p;
+    }
+  }
+
+  /* Anything else can only shrink in place; the tail is simply left unused. */
+  if (nsz <= osz) { return p; }
+
+  void* q = rlib__arena_alloc(arena, nsz);
+  if (q == NULL) { return NULL; }
+
+  memcpy(q, p, osz < nsz ? osz : nsz);
+
+  return q;
+}
+
+/**
+ * @brief Make a new, empty arena.
+ *
+ * @param chunk_size Size in bytes of each block the arena allocates from.  Pass 0 to use RLIB_ARENA_CHUNK_SIZE.
+ *
+ * @retval rlib_arena* A new arena.
+ * @retval NULL There were errors allocating the arena.
+ *
+ * @warning The caller must free the result with rlib_arena_free.
+ */
+rlib_arena*
+rlib_arena_new(size_t chunk_size)
+{
+  rlib_arena* arena = malloc(sizeof(rlib_arena));
+  if (arena == NULL) { return NULL; }
+
+  arena->head = NULL;
+  arena->cur = NULL;
+  arena->used = 0;
+  arena->chunk_size = chunk_size == 0 ? RLIB_ARENA_CHUNK_SIZE : chunk_size;
+  arena->last = NULL;
+
+  return arena;
+}
+
+/**
+ * @brief Release everything allocated from the arena at once, but keep its memory for reuse.
+ *
+ * This is O(1): no chunk is walked or freed.
+ *
+ * @param arena The arena to reset.
+ *
+ * @retval ROKAY The arena was reset.
+ * @retval RERROR The arena was NULL.
+ *
+ * @warning Every rstring and rstring_array built in the arena is invalid after this.  Don't use them (or free them) again.
+ */
+int
+rlib_arena_reset(rlib_arena* arena)
+{
+  if (arena == NULL) { return RERROR; }
+
+  arena->cur = NULL;
+  arena->used = 0;
+  arena->last = NULL;
+
+  return ROKAY;
+}
+
+/**
+ * @brief Free the arena and all the memory it holds.
+ *
+ * @param arena The arena to free.
+ *
+ * @retval ROKAY The arena was freed.
+ * @retval RERROR The arena was NULL.
+ *
+ * @warning Every rstring and rstring_array built in the arena is invalid after this.
+ * @warning If the arena is the current arena of this thread, it is uninstalled.
+ */
+int
+rlib_arena_free(rlib_arena* arena)
+{
+  if (arena == NULL) { return RERROR; }
+
+  if (rlib__arena_current == arena) { rlib__arena_current = NULL; }
+
+  struct rlib_arena_chunk* chunk = arena->head;
+  while (chunk != NULL) {
+    struct rlib_arena_chunk* next = chunk->next;
+    free(chunk);
+    chunk = next;
+  }
+
+  free(arena);
+
+  return ROKAY;
+}
+
+/**
+ * @brief Make the arena the backing store for every rstring and rstring_array created on this thread until the next call.
+ *
+ * While an arena is in use, rstring_free and rstring_array_free on arena-backed objects are cheap no-ops (they may still be called).  Pass NULL to go back to the heap.
+ *
+ * @code
+rlib_arena* arena = rlib_arena_new(0);
+rlib_arena* prev = rlib_arena_use(arena);
+
+... build lots of rstrings ...
+
+rlib_arena_use(prev);
+rlib_arena_free(arena);
+ * @endcode
+ *
+ * @param arena The arena to use, or NULL to use the heap.
+ *
+ * @retval rlib_arena* The arena that was in use before (NULL for the heap), so it can be restored.
+ */
+rlib_arena*
+rlib_arena_use(rlib_arena* arena)
+{
+  rlib_arena* prev = rlib__arena_current;
+
+  rlib__arena_current = arena;
+
+  return prev;
+}
+
+/* END OF RARENA */
+
 /* START OF RSTRING */
 typedef struct tagbstring rstring;
 
 typedef struct bstrList rstring_array;
 
+/**
+ * @brief A read-only window onto bytes owned by something else, usually part of an rstring.
+ *
+ * A view is a write protected struct tagbstring, like the ones bstrlib's bmid2tbstr() makes, so its address can be passed to any function that takes a const rstring*.  Use rstring_copy() on it to get an rstring of your own.
+ *
+ * @warning A view is not '\0' terminated and is never freed.  It is only valid while the bytes it points at are alive and unchanged.
+ */
+typedef struct tagbstring rstring_view;
+
+/**
+ * @brief A search pattern prepared once so it can be looked for in many rstrings.
+ *
+ * Searching with rstring_index() and friends works out the search tables for the pattern on every call.  When the same pattern is searched for over and over (say once per input line), make an rstring_matcher for it with rstring_matcher_new() and use the _matcher variants instead so that work is only done once.
+ */
+typedef struct rstring_matcher rstring_matcher;
+
+/**
+ * @brief Flag for rstring_matcher_new(): match without regard to (ASCII) case.
+ */
+#define RSTRING_MATCHER_CASELESS 0x1
+
+/**
+ * @brief Many search patterns prepared together (an Aho-Corasick automaton), so that one pass over an rstring finds any of them.
+ *
+ * Make one with rstring_multimatcher_new() and search with the _multimatcher functions.  Checking a record against hundreds of keywords then costs one scan rather than hundreds.
+ */
+typedef struct rstring_multimatcher rstring_multimatcher;
+
+/**
+ * @brief A set of bytes prepared once for finding the first or last byte of an rstring that is (or is not) in the set.
+ *
+ * Make one with rstring_charclass_new() and search with the _charclass functions.  Sets of up to three bytes are found with plain byte compares; larger ones with a table lookup that checks a whole vector of bytes at a time.
+ */
+typedef struct rstring_charclass rstring_charclass;
+
+/**
+ * @brief Flag for rstring_charclass_new(): the class is every byte not in the given ones.
+ */
+#define RSTRING_CHARCLASS_INVERT 0x1
+
+/**
+ * @brief A compiled regular expression for rstring_match(), rstring_scan(), rstring_gsub_re() and rstring_split_re().
+ *
+ * See rstring_regex_new() for the syntax.  Matching never backtracks, so it takes time linear in the length of the text for every pattern (though the cost per byte depends on the pattern; see rstring_regex_new()).
+ */
+typedef struct rstring_regex rstring_regex;
+
+/**
+ * @brief Flag for rstring_regex_new(): match without regard to (ASCII) case, like Ruby's /i.
+ */
+#define RSTRING_REGEX_CASELESS 0x1
+
+/**
+ * @brief Flag for rstring_regex_new(): let . match a newline, like Ruby's /m.
+ */
+#define RSTRING_REGEX_MULTILINE 0x2
+
+/**
+ * @brief Most bytes of DFA states an rstring_regex keeps for each direction of search before it starts over.
+ */
+#ifndef RLIB_REGEX_CACHE_SIZE
+#define RLIB_REGEX_CACHE_SIZE (1 << 20)
+#endif
+
+/**
+ * @brief An index of one text (a suffix array and FM-index) for answering many substring queries against it, each in time depending on the length of the query rather than of the text.
+ *
+ * Make one with rstring_index_build() and query it with the _text_index functions.
+ */
+typedef struct rstring_text_index rstring_text_index;
+
+/**
+ * @brief Flag for rstring_index_build(): keep only every 32nd suffix array entry, so the index takes a fraction of the memory but finding where matches are is slower.
+ */
+#define RSTRING_INDEX_COMPRESSED 0x1
+
 /* Macros */
 
 /**
@@ -3619,6 +5748,11 @@ typedef struct bstrList rstring_array;
  */
 #define rstring_bad(rstr) (rstr == NULL || rstr->data == NULL || rstr->mlen < rstr->slen || rstr->slen < 0 || rstr->mlen <= 0)
 
+/**
+ * @brief Like rstring_bad() but for functions that only read from rstr, so an rstring_view is fine too.
+ */
+#define rstring_view_bad(rstr) ((rstr) == NULL || (rstr)->data == NULL || (rstr)->slen < 0 || ((rstr)->mlen > 0 && (rstr)->mlen < (rstr)->slen))
+
 /**
  * @brief Check that an rstring_array is valid.
  */
@@ -3658,28 +5792,112 @@ rstring* new_rstr = rstring_format("%d apple %s", 3, rstring_data(rstr));
  */
 #define rstring_format(fmt, ...) ((rstring*)bformat(fmt, __VA_ARGS__))
 
+/**
+ * @brief A static rstring made from a string literal, like bstrlib's bsStatic(), for passing wherever a const rstring* is expected.
+ *
+ * @code
+blen_t i = rstring_index(rstr, RSTR_LIT("pie"));
+ * @endcode
+ *
+ * @param q A string literal.  (It won't work with a char* variable; use rstring_view_of_cstr() for those.)
+ *
+ * @note It is a write protected rstring_view living on the stack (or in static storage at file scope), so it costs no allocation and must not be freed.
+ */
+#define RSTR_LIT(q) (&(rstring_view) bsStatic(q))
+
 /* Constructing */
 
 rstring* rstring_new(const char* cstr);
 rstring* rstring_copy(const rstring* rstr);
 int rstring_free(rstring* rstr);
 
+/* Constructing in an rlib_arena */
+
+rstring* rstring_new_arena(rlib_arena* arena, const char* cstr);
+rstring* rstring_copy_arena(rlib_arena* arena, const rstring* rstr);
+rstring* rstring_slice_arena(rlib_arena* arena, const rstring* rstr, blen_t index, blen_t length);
+rstring_array* rstring_split_arena(rlib_arena* arena, rstring* rstr, const rstring* sep);
+
+/* Zero-copy views */
+
+rstring_view rstring_view_of(const rstring* rstr);
+rstring_view rstring_view_of_cstr(const char* cstr);
+rstring_view rstring_view_of_blk(const void* blk, blen_t len);
+rstring_view rstring_slice_view(const rstring* rstr, blen_t index, blen_t length);
+rstring_view rstring_chomp_view(const rstring* rstr);
+rstring_view rstring_chomp_sep_view(const rstring* rstr, const rstring* sep);
+rstring_view rstring_strip_view(const rstring* rstr);
+rstring_view rstring_lstrip_view(const rstring* rstr);
+rstring_view rstring_rstrip_view(const rstring* rstr);
+int rstring_split_view_next(const rstring* rstr, const rstring* sep, blen_t* pos, rstring_view* field);
+
+/* Memory tuning */
+
+int rlib_set_growth_policy(int policy);
+size_t rlib_resize_count();
+size_t rlib_set_mmap_threshold(size_t bytes);
+int rlib_set_mmap_hugepages(int enable);
+int rstring_set_growth_policy(rstring* rstr, int policy);
+int rstring_compact(rstring* rstr);
+int rstring_array_compact(rstring_array* rary);
+blen_t rstring_capacity(const rstring* rstr);
+blen_t rstring_slack(const rstring* rstr);
+blen_t rstring_array_slack(const rstring_array* rary);
+
+/* Byte scanning */
+
+int rlib_simd_level();
+int rlib_set_simd_level(int level);
 
 /* Returning modified rstrings */
 
+rstring* rstring_capitalize(const rstring* rstr);
 rstring* rstring_chomp(const rstring* rstr);
+rstring* rstring_chomp_sep(const rstring* rstr, const rstring* sep);
+rstring* rstring_chomp_sep_cstr(const rstring* rstr, const char* sep);
+rstring* rstring_delete(const rstring* rstr, const rstring* chars);
+rstring* rstring_delete_cstr(const rstring* rstr, const char* chars);
 rstring* rstring_downcase(const rstring* rstr);
 rstring* rstring_gsub(const rstring* rstr, const rstring* pattern, const rstring* replacement);
 rstring* rstring_gsub_cstr(const rstring* rstr, const char* pattern, const char* replacement);
+blen_t rstring_gsub_into(rstring* dst, const rstring* src, const rstring* pattern, const rstring* replacement);
+blen_t rstring_gsub_cstr_into(rstring* dst, const rstring* src, const char* pattern, const char* replacement);
 
 rstring* rstring_lstrip(const rstring* rstr);
 rstring* rstring_reverse(const rstring* rstr);
 rstring* rstring_rstrip(const rstring* rstr);
-rstring* rstring_slice1(const rstring* rstr, int index);
-rstring* rstring_slice(const rstring* rstr, int index, int length);
+rstring* rstring_slice1(const rstring* rstr, blen_t index);
+rstring* rstring_slice(const rstring* rstr, blen_t index, blen_t length);
+rstring* rstring_squeeze(const rstring* rstr, const rstring* chars);
+rstring* rstring_squeeze_cstr(const rstring* rstr, const char* chars);
 rstring* rstring_strip(const rstring* rstr);
+rstring* rstring_swapcase(const rstring* rstr);
+rstring* rstring_tr(const rstring* rstr, const rstring* from, const rstring* to);
+rstring* rstring_tr_cstr(const rstring* rstr, const char* from, const char* to);
 rstring* rstring_upcase(const rstring* rstr);
 
+/* Modifying rstrings in place */
+
+int rstring_capitalize_bang(rstring* rstr);
+int rstring_chomp_bang(rstring* rstr);
+int rstring_chomp_sep_bang(rstring* rstr, const rstring* sep);
+int rstring_chomp_sep_cstr_bang(rstring* rstr, const char* sep);
+int rstring_delete_bang(rstring* rstr, const rstring* chars);
+int rstring_delete_cstr_bang(rstring* rstr, const char* chars);
+int rstring_downcase_bang(rstring* rstr);
+int rstring_gsub_bang(rstring* rstr, const rstring* pattern, const rstring* replacement);
+int rstring_gsub_cstr_bang(rstring* rstr, const char* pattern, const char* replacement);
+int rstring_lstrip_bang(rstring* rstr);
+int rstring_reverse_bang(rstring* rstr);
+int rstring_rstrip_bang(rstring* rstr);
+int rstring_squeeze_bang(rstring* rstr, const rstring* chars);
+int rstring_squeeze_cstr_bang(rstring* rstr, const char* chars);
+int rstring_strip_bang(rstring* rstr);
+int rstring_swapcase_bang(rstring* rstr);
+int rstring_tr_bang(rstring* rstr, const rstring* from, const rstring* to);
+int rstring_tr_cstr_bang(rstring* rstr, const char* from, const char* to);
+int rstring_upcase_bang(rstring* rstr);
+
 /* Get info about rstrings */
 
 int rstring_eql(const rstring* rstr1, const rstring* rstr2);
@@ -3687,17 +5905,38 @@ int rstring_eql_cstr(const rstring* rstr, const char* cstr);
 int rstring_include(const rstring* rstr, const rstring* substring);
 int rstring_include_cstr(const rstring* rstr, const char* substring);
 
-int rstring_index(const rstring* rstr, const rstring* substring);
-int rstring_index_cstr(const rstring* rstr, const char* substring);
+int rstring_casecmp(const rstring* rstr1, const rstring* rstr2);
+int rstring_casecmp_cstr(const rstring* rstr, const char* cstr);
+int rstring_eql_caseless(const rstring* rstr1, const rstring* rstr2);
+int rstring_eql_caseless_cstr(const rstring* rstr, const char* cstr);
+int rstring_include_caseless(const rstring* rstr, const rstring* substring);
+int rstring_include_caseless_cstr(const rstring* rstr, const char* substring);
+
+blen_t rstring_index(const rstring* rstr, const rstring* substring);
+blen_t rstring_index_cstr(const rstring* rstr, const char* substring);
+
+blen_t rstring_index_offset(const rstring* rstr, const rstring* substring, blen_t start_pos);
+blen_t rstring_index_offset_cstr(const rstring* rstr, const char* substring, blen_t start_pos);
+
+blen_t rstring_rindex(const rstring* rstr, const rstring* substring);
+blen_t rstring_rindex_cstr(const rstring* rstr, const char* substring);
+
+blen_t rstring_rindex_offset(const rstring* rstr, const rstring* substring, blen_t start_pos);
+blen_t rstring_rindex_offset_cstr(const rstring* rstr, const char* substring, blen_t start_pos);
+
+blen_t rstring_count_substr(const rstring* rstr, const rstring* substring);
+blen_t rstring_count_substr_cstr(const rstring* rstr, const char* substring);
+blen_t rstring_scan_positions(const rstring* rstr, const rstring* substring, blen_t* positions, blen_t max);
+int rstring_each_match(const rstring* rstr, const rstring* substring, int (*cb)(void* parm, blen_t pos), void* parm);
 
-int rstring_index_offset(const rstring* rstr, const rstring* substring, int start_pos);
-int rstring_index_offset_cstr(const rstring* rstr, const char* substring, int start_pos);
+blen_t rstring_count(const rstring* rstr, const rstring* chars);
+blen_t rstring_count_cstr(const rstring* rstr, const char* chars);
 
-int rstring_length(const rstring* rstr);
+blen_t rstring_length(const rstring* rstr);
 
 /* Utility functions */
 
-int rstring_char_at(const rstring* rstr, int idx);
+int rstring_char_at(const rstring* rstr, blen_t idx);
 
 /* rstring array functions */
 
@@ -3705,20 +5944,69 @@ rstring_array* rstring_array_new();
 int rstring_array_free(rstring_array* rary);
 int rstring_array_push_cstr(rstring_array* rary, char* cstr);
 int rstring_array_push_rstr(rstring_array* rary, rstring* rstr);
-rstring* rstring_array_get(rstring_array* rary, int index);
+rstring* rstring_array_get(rstring_array* rary, blen_t index);
 rstring* rstring_array_join(rstring_array* rstrings, const rstring* sep);
 rstring* rstring_array_join_cstr(rstring_array* rstrings, const char* sep);
+int rstring_array_chomp_bang(rstring_array* rary, const rstring* sep);
+int rstring_array_chomp_cstr_bang(rstring_array* rary, const char* sep);
 
 rstring_array* rstring_split(rstring* rstr, const rstring* sep);
 rstring_array* rstring_split_cstr(rstring* rstr, const char* sep);
 
+/* Reusable search patterns */
+
+rstring_matcher* rstring_matcher_new(const rstring* pattern, int flags);
+rstring_matcher* rstring_matcher_new_cstr(const char* pattern, int flags);
+int rstring_matcher_free(rstring_matcher* matcher);
+int rstring_include_matcher(const rstring* rstr, const rstring_matcher* matcher);
+blen_t rstring_index_matcher(const rstring* rstr, const rstring_matcher* matcher);
+blen_t rstring_index_offset_matcher(const rstring* rstr, const rstring_matcher* matcher, blen_t offset);
+blen_t rstring_rindex_matcher(const rstring* rstr, const rstring_matcher* matcher);
+rstring* rstring_gsub_matcher(const rstring* rstr, const rstring_matcher* matcher, const rstring* replacement);
+int rstring_gsub_matcher_bang(rstring* rstr, const rstring_matcher* matcher, const rstring* replacement);
+rstring_array* rstring_split_matcher(rstring* rstr, const rstring_matcher* matcher);
+
+rstring_multimatcher* rstring_multimatcher_new(const rstring_array* patterns, int flags);
+int rstring_multimatcher_free(rstring_multimatcher* mm);
+int rstring_include_multimatcher(const rstring* rstr, const rstring_multimatcher* mm);
+blen_t rstring_index_multimatcher(const rstring* rstr, const rstring_multimatcher* mm, blen_t* which);
+int rstring_scan_multimatcher(const rstring* rstr, const rstring_multimatcher* mm, int (*cb)(void* parm, blen_t pos, blen_t which), void* parm);
+blen_t rstring_count_multimatcher(const rstring* rstr, const rstring_multimatcher* mm);
+rstring* rstring_gsub_multimatcher(const rstring* rstr, const rstring_multimatcher* mm, const rstring_array* replacements);
+
+rstring_charclass* rstring_charclass_new(const rstring* chars, int flags);
+rstring_charclass* rstring_charclass_new_cstr(const char* chars, int flags);
+int rstring_charclass_free(rstring_charclass* cc);
+blen_t rstring_index_charclass(const rstring* rstr, const rstring_charclass* cc);
+blen_t rstring_index_offset_charclass(const rstring* rstr, const rstring_charclass* cc, blen_t offset);
+blen_t rstring_rindex_charclass(const rstring* rstr, const rstring_charclass* cc);
+rstring_array* rstring_split_charclass(rstring* rstr, const rstring_charclass* cc);
+
+rstring_regex* rstring_regex_new(const rstring* pattern, int flags);
+rstring_regex* rstring_regex_new_cstr(const char* pattern, int flags);
+int rstring_regex_free(rstring_regex* re);
+int rstring_match_p(const rstring* rstr, rstring_regex* re);
+blen_t rstring_index_re(const rstring* rstr, rstring_regex* re);
+rstring_array* rstring_match(const rstring* rstr, rstring_regex* re);
+rstring_array* rstring_scan(const rstring* rstr, rstring_regex* re);
+rstring* rstring_gsub_re(const rstring* rstr, rstring_regex* re, const rstring* replacement);
+rstring_array* rstring_split_re(const rstring* rstr, rstring_regex* re);
+
+rstring_text_index* rstring_index_build(const rstring* text, int flags);
+int rstring_text_index_free(rstring_text_index* idx);
+blen_t rstring_count_text_index(const rstring_text_index* idx, const rstring* pattern);
+int rstring_include_text_index(const rstring_text_index* idx, const rstring* pattern);
+blen_t rstring_index_text_index(const rstring_text_index* idx, const rstring* pattern);
+rstring* rstring_text_index_dump(const rstring_text_index* idx);
+rstring_text_index* rstring_text_index_load(const rstring* data);
+
 /**
  * @brief Make a new rstring from c string.
  *
  * @param cstr Char array to convert to rstring.  (Not modified.)
  *
  * @retval rstring* A valid rstring.
- * @retval NULL The cstr is NULL, the length of cstr >= INT_MAX, or there were errors creating the rstring.
+ * @retval NULL The cstr is NULL, the length of cstr >= BLEN_MAX, or there were errors creating the rstring.
  *
  * @warning The caller must free the result.
 */
@@ -3742,12 +6030,15 @@ rstring_new(const char* cstr)
  * @retval rstring* A valid rstring copy.
  * @retval NULL The input rstring is invalid or there was an error.
  *
+ * @note With RLIB_COW_STRINGS defined, the copy shares rstr's buffer and
+ * is O(1).  The bytes are copied the first time either string is modified.
+ *
  * @warning The caller must free the result.
  */
 rstring*
 rstring_copy(const rstring* rstr)
 {
-  if (rstring_bad(rstr)) { return NULL; }
+  if (rstring_view_bad(rstr)) { return NULL; }
 
   return (rstring*)bstrcpy((const_bstring)rstr);
 }
@@ -3766,6 +6057,16 @@ rstring_free(rstring* rstr)
   return bdestroy((bstring)rstr);
 }
 
+/* Copy just the bytes a view of rstr covers.  A view of all of rstr copies
+   rstr itself so that COW builds can share its buffer. */
+static rstring*
+rstring__copy_of_view(const rstring* rstr, const rstring_view* view)
+{
+  if (view->slen == RERROR) { return NULL; }
+
+  return rstring_copy(view->slen == rstr->slen ? rstr : view);
+}
+
 /**
  * @brief Make a new string with final trailing record separator removed.
  *
@@ -3781,26 +6082,112 @@ rstring_free(rstring* rstr)
 rstring*
 rstring_chomp(const rstring* rstr)
 {
-  if (rstring_bad(rstr)) { return NULL; }
+  rstring_view view = rstring_chomp_view(rstr);
 
-  int len = rstring_length(rstr);
-  if (len == RERROR) { return NULL; }
+  return rstring__copy_of_view(rstr, &view);
+}
 
-  int c_last = rstring_char_at(rstr, len - 1);
-  if (c_last == RERROR) { return NULL; }
+/**
+ * @brief Make a new string with the trailing separator sep removed, like Ruby's String#chomp(sep).
+ *
+ * A sep of `"\n"` removes `\n`, `\r`, or `\r\n`, just like rstring_chomp().  An empty sep is Ruby's paragraph mode and removes all trailing `\n` and `\r\n`, but not a lone `\r`.  Any other sep is removed only if rstr ends with it.
+ *
+ * @code
+rstring* rstr = rstring_chomp_sep(RSTR_LIT("para\r\n\n\n"), RSTR_LIT(""));
 
-  if (c_last == '\r') {
-    return rstring_slice(rstr, 0, len-1);
-  }
-  else if (c_last == '\n' && rstring_char_at(rstr, len - 2) == '\r') {
-    return rstring_slice(rstr, 0, len-2);
-  }
-  else if (c_last == '\n') {
-    return rstring_slice(rstr, 0, len-1);
-  }
-  else {
-    return rstring_copy(rstr);
+assert(rstring_eql_cstr(rstr, "para") == RTRUE);
+ * @endcode
+ *
+ * @param rstr An rstring. (Not modified.)
+ * @param sep The separator to remove.
+ *
+ * @retval rstring* A valid rstring without the trailing separator.
+ * @retval NULL rstr or sep is invalid or there was an error.
+ *
+ * @warning The caller must free the result.
+ */
+rstring*
+rstring_chomp_sep(const rstring* rstr, const rstring* sep)
+{
+  rstring_view view = rstring_chomp_sep_view(rstr, sep);
+
+  return rstring__copy_of_view(rstr, &view);
+}
+
+/**
+ * @brief Wraps rstring_chomp_sep() but takes char* for sep.
+ */
+rstring*
+rstring_chomp_sep_cstr(const rstring* rstr, const char* sep)
+{
+  if (sep == NULL) { return NULL; }
+
+  rstring_view rsep = rstring_view_of_cstr(sep);
+
+  return rstring_chomp_sep(rstr, &rsep);
+}
+
+/* Case conversion for the rstrings: first_how (a BSTR__CASE_ value) is
+   for the first byte and how for the rest, which is all capitalize needs
+   on top of upcase and downcase.  Where the first byte that changes is,
+   or -1 if none does. */
+static blen_t
+rstring__case_find(const rstring* rstr, int first_how, int how)
+{
+  if (rstr->slen == 0) { return -1; }
+  if (bstr__find_case(rstr->data, 1, first_how) == 0) { return 0; }
+
+  blen_t i = bstr__find_case(rstr->data + 1, rstr->slen - 1, how);
+
+  return i < 0 ? -1 : i + 1;
+}
+
+/* Convert the bytes of src from first on into d (which may be src->data). */
+static void
+rstring__case_convert(unsigned char* d, const rstring* src, blen_t first, int first_how, int how)
+{
+  if (first == 0) {
+    bstr__convert_case(d, src->data, 1, first_how);
+    first = 1;
   }
+  bstr__convert_case(d + first, src->data + first, src->slen - first, how);
+}
+
+/* A converted copy of rstr, made in one pass over it: the bytes before the
+   first that changes are copied across and the rest converted on the way.
+   If nothing changes the copy can share rstr's bytes. */
+static rstring*
+rstring__case_copy(const rstring* rstr, int first_how, int how)
+{
+  if (rstring_view_bad(rstr)) { return NULL; }
+
+  blen_t first = rstring__case_find(rstr, first_how, how);
+  if (first < 0) { return rstring_copy(rstr); }
+
+  rstring* result = (rstring*)bfromcstralloc(rstr->slen + 1, "");
+  if (rstring_bad(result)) { return NULL; }
+
+  bstr__memcpy(result->data, rstr->data, (size_t)first);
+  rstring__case_convert(result->data, rstr, first, first_how, how);
+  result->slen = rstr->slen;
+  result->data[result->slen] = '\0';
+
+  return result;
+}
+
+/* Convert rstr in place.  RFALSE (and nothing written) if it is unchanged. */
+static int
+rstring__case_bang(rstring* rstr, int first_how, int how)
+{
+  if (rstring_bad(rstr)) { return RERROR; }
+
+  blen_t first = rstring__case_find(rstr, first_how, how);
+  if (first < 0) { return RFALSE; }
+
+  if (bstr__unshare(rstr) != BSTR_OK) { return RERROR; }
+  rstring__case_convert(rstr->data, rstr, first, first_how, how);
+
+  return RTRUE;
 }
 
 /**
@@ -3816,20 +6203,7 @@ rstring_chomp(const rstring* rstr)
 rstring*
 rstring_downcase(const rstring* rstr)
 {
-  if (rstring_bad(rstr)) { return NULL; }
-
-  int len = rstring_length(rstr);
-  if (len == RERROR) { return NULL; }
-
-  if (len == 0) { return rstring_new(""); }
-
-  rstring* new_rstr = rstring_copy(rstr);
-  if (new_rstr == NULL) { return NULL; }
-
-  int val = btolower(new_rstr);
-  if (val == RERROR) { return NULL; }
-
-  return new_rstr;
+  return rstring__case_copy(rstr, BSTR__CASE_LOWER, BSTR__CASE_LOWER);
 }
 
 /**
@@ -3863,22 +6237,44 @@ rstring_gsub(const rstring* rstr,
              const rstring* pattern,
              const rstring* replacement)
 {
-  if (rstring_bad(rstr)) { return NULL; }
-  if (rstring_bad(pattern)) { return NULL; }
-  if (rstring_bad(replacement)) { return NULL; }
-
-  rstring* copy = rstring_copy(rstr);
-  if (rstring_bad(copy)) { return NULL; }
-
-  int start_pos = 0;
-  int val = bfindreplace((bstring)copy,
-                         (const_bstring)pattern,
-                         (const_bstring)replacement,
-                         start_pos);
-
-  if (val == BSTR_ERR) { rstring_free(copy); return NULL; }
+  if (rstring_view_bad(rstr)) { return NULL; }
+  if (rstring_view_bad(pattern)) { return NULL; }
+  if (rstring_view_bad(replacement)) { return NULL; }
+
+  if (pattern->slen == 0) { return NULL; }
+
+  /* The pattern is built and the first match found once, and the result
+     written from there in a single pass. */
+  struct bstr__pattern pat;
+  bstr__pattern_init(&pat, pattern->data, pattern->slen, 1, 0,
+                     rstr->slen >= BSTR_SKIP_MIN_HAYSTACK);
+
+  blen_t first = bstr__pattern_exec(&pat, pattern->data, rstr->data, rstr->slen);
+
+  /* With nothing to replace the copy can share rstr's bytes. */
+  if (first < 0) { return rstring_copy(rstr); }
+
+  blen_t need = bstr__findreplace_need((const_bstring)rstr,
+                                       (const_bstring)pattern,
+                                       (const_bstring)replacement,
+                                       &pat,
+                                       first);
+  if (need < 0) { return NULL; }
+
+  rstring* result = (rstring*)bfromcstralloc(need + 1, "");
+  if (rstring_bad(result)) { return NULL; }
+
+  if (bstr__findreplace_into((bstring)result,
+                             (const_bstring)rstr,
+                             (const_bstring)pattern,
+                             (const_bstring)replacement,
+                             &pat,
+                             first) < 0) {
+    rstring_free(result);
+    return NULL;
+  }
 
-  return copy;
+  return result;
 }
 
 /**
@@ -3889,32 +6285,84 @@ rstring_gsub_cstr(const rstring* rstr,
                   const char* pattern,
                   const char* replacement)
 {
-  if (rstring_bad(rstr)) { return NULL; }
-  if (pattern == NULL) { return NULL; }
-  if (replacement == NULL) { return NULL; }
+  if (rstring_view_bad(rstr)) { return NULL; }
 
-  rstring* rpattern = rstring_new(pattern);
-  if (rstring_bad(rpattern)) { return NULL; }
+  rstring_view rpattern = rstring_view_of_cstr(pattern);
+  if (rstring_view_bad(&rpattern)) { return NULL; }
 
-  rstring* rreplacement = rstring_new(replacement);
-  if (rstring_bad(rreplacement)) {
-    rstring_free(rpattern);
+  rstring_view rreplacement = rstring_view_of_cstr(replacement);
+  if (rstring_view_bad(&rreplacement)) { return NULL; }
 
-    return NULL;
-  }
+  return rstring_gsub(rstr, &rpattern, &rreplacement);
+}
+
+/**
+ * @brief Writes src, with all occurrences of pattern substituted for the value of replacement, to dst.
+ *
+ * The result is the same as rstring_gsub() would return, but it is built in one pass over src, straight into dst.  Whatever dst held before is dropped, but its buffer is kept and only grown when the result doesn't fit, so a loop rewriting many strings into the same dst stops allocating once dst is big enough.
+ *
+ * @code
+rstring* dst = rstring_new("");
+rstring* pattern = rstring_new("\t");
+rstring* replacement = rstring_new(",");
 
-  rstring* new_rstr = rstring_gsub(rstr, rpattern, rreplacement);
-  if (rstring_bad(new_rstr)) {
-    rstring_free(rpattern);
-    rstring_free(rreplacement);
+while (...read the next line into line...) {
+  if (rstring_gsub_into(dst, line, pattern, replacement) == RERROR) { ...handle error... }
+  ... use dst, it is "a,b,c" for the line "a\tb\tc" ...
+}
 
-    return NULL;
-  }
+... code to free variables here ...
+ * @endcode
+ *
+ * @param dst The rstring to write the result to.
+ * @param src The rstring for replacing. (Not modified.)
+ * @param pattern The rstring pattern to search for.
+ * @param replacement The rstring to replace with.
+ *
+ * @retval count The number of replacements made.  If it is 0, dst is now a copy of src.
+ * @retval RERROR Any of the args are invalid, pattern is empty, dst is or overlaps one of the others, or there was an error.
+ *
+ * @warning dst must be a full rstring, not a view, and it may not be one of (or share bytes with) the other args.  A copy-on-write dst sharing its buffer with src is fine though, it is given a buffer of its own.
+ */
+blen_t
+rstring_gsub_into(rstring* dst,
+                  const rstring* src,
+                  const rstring* pattern,
+                  const rstring* replacement)
+{
+  if (rstring_bad(dst)) { return RERROR; }
+  if (rstring_view_bad(src)) { return RERROR; }
+  if (rstring_view_bad(pattern)) { return RERROR; }
+  if (rstring_view_bad(replacement)) { return RERROR; }
+
+  struct bstr__pattern pat;
+  bstr__pattern_init(&pat, pattern->data, pattern->slen, 1, 0,
+                     src->slen >= BSTR_SKIP_MIN_HAYSTACK);
+
+  return bstr__findreplace_into((bstring)dst,
+                                (const_bstring)src,
+                                (const_bstring)pattern,
+                                (const_bstring)replacement,
+                                &pat,
+                                -1);
+}
 
-  rstring_free(rpattern);
-  rstring_free(rreplacement);
+/**
+ * @brief Wraps rstring_gsub_into() but takes char* for pattern and replacement.
+ */
+blen_t
+rstring_gsub_cstr_into(rstring* dst,
+                       const rstring* src,
+                       const char* pattern,
+                       const char* replacement)
+{
+  if (pattern == NULL) { return RERROR; }
+  if (replacement == NULL) { return RERROR; }
+
+  rstring_view rpattern = rstring_view_of_cstr(pattern);
+  rstring_view rreplacement = rstring_view_of_cstr(replacement);
 
-  return new_rstr;
+  return rstring_gsub_into(dst, src, &rpattern, &rreplacement);
 }
 
 
@@ -3931,9 +6379,9 @@ rstring_gsub_cstr(const rstring* rstr,
  * @warning The caller must free the result.
  */
 rstring*
-rstring_slice1(const rstring* rstr, int index)
+rstring_slice1(const rstring* rstr, blen_t index)
 {
-  if (rstring_bad(rstr)) { return NULL; }
+  if (rstring_view_bad(rstr)) { return NULL; }
 
   if (index < 0 || index >= rstring_length(rstr)) {
     return NULL;
@@ -3957,14 +6405,14 @@ rstring_slice1(const rstring* rstr, int index)
  * @warning The caller must free the result.
  */
 rstring*
-rstring_slice(const rstring* rstr, int index, int length)
+rstring_slice(const rstring* rstr, blen_t index, blen_t length)
 {
-  if (rstring_bad(rstr)) { return NULL; }
+  if (rstring_view_bad(rstr)) { return NULL; }
 
-  int len = rstring_length(rstr);
+  blen_t len = rstring_length(rstr);
   if (len == RERROR) { return NULL; }
 
-  int idx = index;
+  blen_t idx = index;
 
   /* Special weird ruby case. */
   if (index == len) {
@@ -3992,26 +6440,13 @@ rstring_slice(const rstring* rstr, int index, int length)
  * @retval NULL The input rstring is invalid or there was an error.
  *
  * @warning The caller must free the result.
- *
- * @todo Lots of code duplication with strip(), lstrip(), and rstrip().
  */
 rstring*
 rstring_strip(const rstring* rstr)
 {
-  if (rstring_bad(rstr)) { return NULL; }
+  rstring_view view = rstring_strip_view(rstr);
 
-  int len = rstring_length(rstr);
-  if (len == RERROR) { return NULL; }
-
-  if (len == 0) { return rstring_new(""); }
-
-  rstring* copy = rstring_copy(rstr);
-  if (rstring_bad(copy)) { return NULL; }
-
-  int val = btrimws(copy);
-  if (val == BSTR_ERR) { rstring_free(copy); return NULL; }
-
-  return copy;
+  return rstring__copy_of_view(rstr, &view);
 }
 
 /**
@@ -4023,26 +6458,13 @@ rstring_strip(const rstring* rstr)
  * @retval NULL The input rstring is invalid or there was an error.
  *
  * @warning The caller must free the result.
- *
- * @todo Lots of code duplication with strip(), lstrip(), and rstrip().
  */
 rstring*
 rstring_lstrip(const rstring* rstr)
 {
-  if (rstring_bad(rstr)) { return NULL; }
-
-  int len = rstring_length(rstr);
-  if (len == RERROR) { return NULL; }
-
-  if (len == 0) { return rstring_new(""); }
-
-  rstring* copy = rstring_copy(rstr);
-  if (rstring_bad(copy)) { return NULL; }
+  rstring_view view = rstring_lstrip_view(rstr);
 
-  int val = bltrimws(copy);
-  if (val == BSTR_ERR) { rstring_free(copy); return NULL; }
-
-  return copy;
+  return rstring__copy_of_view(rstr, &view);
 }
 
 /**
@@ -4058,24 +6480,12 @@ rstring_lstrip(const rstring* rstr)
 rstring*
 rstring_reverse(const rstring* rstr)
 {
-  if (rstring_bad(rstr)) { return NULL; }
+  if (rstring_view_bad(rstr)) { return NULL; }
 
   rstring* copy = rstring_copy(rstr);
   if (rstring_bad(copy)) { return NULL; }
 
-  /* From bstraux.c */
-  int i, n, m;
-  unsigned char t;
-  n = copy->slen;
-  if (2 <= n) {
-    m = ((unsigned)n) >> 1;
-    n--;
-    for (i=0; i < m; i++) {
-      t = copy->data[n - i];
-      copy->data[n - i] = copy->data[i];
-      copy->data[i] = t;
-    }
-  }
+  if (rstring_reverse_bang(copy) == RERROR) { rstring_free(copy); return NULL; }
 
   return copy;
 }
@@ -4090,26 +6500,13 @@ rstring_reverse(const rstring* rstr)
  * @retval NULL The input rstring is invalid or there was an error.
  *
  * @warning The caller must free the result.
- *
- * @todo Lots of code duplication with strip(), lstrip(), and rstrip().
  */
 rstring*
 rstring_rstrip(const rstring* rstr)
 {
-  if (rstring_bad(rstr)) { return NULL; }
-
-  int len = rstring_length(rstr);
-  if (len == RERROR) { return NULL; }
-
-  if (len == 0) { return rstring_new(""); }
-
-  rstring* copy = rstring_copy(rstr);
-  if (rstring_bad(copy)) { return NULL; }
+  rstring_view view = rstring_rstrip_view(rstr);
 
-  int val = brtrimws(copy);
-  if (val == BSTR_ERR) { rstring_free(copy); return NULL; }
-
-  return copy;
+  return rstring__copy_of_view(rstr, &view);
 }
 
 
@@ -4127,403 +6524,5403 @@ rstring_rstrip(const rstring* rstr)
 rstring*
 rstring_upcase(const rstring* rstr)
 {
-  if (rstring_bad(rstr)) { return NULL; }
-
-  int len = rstring_length(rstr);
-  if (len == RERROR) { return NULL; }
-
-  if (len == 0) { return rstring_new(""); }
+  return rstring__case_copy(rstr, BSTR__CASE_UPPER, BSTR__CASE_UPPER);
+}
 
-  rstring* new_rstr = rstring_copy(rstr);
-  if (new_rstr == NULL) { return NULL; }
+/**
+ * @brief Return a copy of rstr with the lowercase letters made uppercase and the uppercase ones lowercase, like Ruby's String#swapcase.
+ *
+ * @param rstr The rstring to swap the case of. (Not modified.)
+ *
+ * @retval rstring* A valid rstring copy of rstr with the case of each letter swapped.
+ * @retval NULL The input rstring is invalid or there was an error.
+ *
+ * @warning The caller must free the result.
+ */
+rstring*
+rstring_swapcase(const rstring* rstr)
+{
+  return rstring__case_copy(rstr, BSTR__CASE_SWAP, BSTR__CASE_SWAP);
+}
 
-  int val = btoupper(new_rstr);
-  if (val == RERROR) { return NULL; }
+/**
+ * @brief Return a copy of rstr with the first char uppercase and the rest lowercase, like Ruby's String#capitalize.
+ *
+ * @code
+rstring* rstr = rstring_capitalize(RSTR_LIT("hELLO wORLD"));
 
-  return new_rstr;
+assert(rstring_eql_cstr(rstr, "Hello world") == RTRUE);
+ * @endcode
+ *
+ * @param rstr The rstring to capitalize. (Not modified.)
+ *
+ * @retval rstring* A valid rstring copy of rstr, capitalized.
+ * @retval NULL The input rstring is invalid or there was an error.
+ *
+ * @warning The caller must free the result.
+ */
+rstring*
+rstring_capitalize(const rstring* rstr)
+{
+  return rstring__case_copy(rstr, BSTR__CASE_UPPER, BSTR__CASE_LOWER);
 }
 
 /*
- * String info functions
+ * Modifying rstrings in place
+ *
+ * Like Ruby's bang methods, these change the receiver rather than returning
+ * a copy.  Where Ruby would return nil when nothing changed, these return
+ * RFALSE.
  */
 
 /**
- * @brief Two strings are equal if they have the same length and content.
- *
- * @param rstr1 Not modified.
- * @param rstr2 Not modified.
+ * @brief Removes the trailing record separator from rstr, like rstring_chomp() but in place.
  *
- * @retval RTRUE The rstrings are equal.
- * @retval RFALSE The rstrings are not equal.
- * @retval RERROR The rstr1 or rstr2 is invalid or there was an error.
+ * @param rstr The rstring to chomp.
  *
- * @note This differs from ruby in that you can't just check for true or false, you must check for 1 or 0 as RERROR signals an error.
+ * @retval RTRUE A record separator was removed.
+ * @retval RFALSE rstr did not end in a record separator, so it was not changed.
+ * @retval RERROR rstr is invalid or there was an error.
  */
 int
-rstring_eql(const rstring* rstr1, const rstring* rstr2)
+rstring_chomp_bang(rstring* rstr)
 {
-  if (rstring_bad(rstr1)) { return RERROR; }
-  if (rstring_bad(rstr2)) { return RERROR; }
+  if (rstring_bad(rstr)) { return RERROR; }
 
-  int val = biseq((const_bstring)rstr1, (const_bstring)rstr2);
+  rstring_view view = rstring_chomp_view(rstr);
+  if (view.slen == rstr->slen) { return RFALSE; }
 
-  if (val == 1) {
-    return RTRUE;
-  }
-  else if (val == 0) {
-    return RFALSE;
-  }
-  else {
-    return RERROR;
-  }
+  if (btrunc(rstr, view.slen) != BSTR_OK) { return RERROR; }
+
+  return RTRUE;
 }
 
 /**
- * @brief Two strings are equal if they have the same length and content.
+ * @brief Removes the trailing separator sep from rstr, like rstring_chomp_sep() but in place.
  *
- * @param rstr Not modified.
- * @param cstr Not modified.
+ * Only the length of rstr changes; nothing is allocated or moved, unless the buffer is shared in a RLIB_COW_STRINGS build, in which case it is copied first.
  *
- * @retval RTRUE The strings are equal.
- * @retval RFALSE The strings are not equal.
- * @retval RERROR The rstr or cstring is invalid or there was an error.
+ * @param rstr The rstring to chomp.
+ * @param sep The separator to remove.
  *
- * @note This differs from ruby in that you can't just check for true or false, you must check for 1 or 0 as RERROR signals an error.
+ * @retval RTRUE A separator was removed.
+ * @retval RFALSE rstr did not end in sep, so it was not changed.
+ * @retval RERROR rstr or sep is invalid or there was an error.
  */
 int
-rstring_eql_cstr(const rstring* rstr, const char* cstr)
+rstring_chomp_sep_bang(rstring* rstr, const rstring* sep)
 {
   if (rstring_bad(rstr)) { return RERROR; }
-  if (cstr == NULL) { return RERROR; }
 
-  int val = biseqcstr((const_bstring)rstr, cstr);
+  rstring_view view = rstring_chomp_sep_view(rstr, sep);
+  if (view.slen == RERROR) { return RERROR; }
+  if (view.slen == rstr->slen) { return RFALSE; }
 
-  if (val == 1) {
-    return RTRUE;
-  }
-  else if (val == 0) {
-    return RFALSE;
-  }
-  else {
-    return RERROR;
-  }
+  if (btrunc(rstr, view.slen) != BSTR_OK) { return RERROR; }
+
+  return RTRUE;
 }
 
 /**
- * @brief Tells whether rstr contains the other rstring.
- *
- * @param rstr The rstring to search in.
- * @param substring The rstring to search for.
- *
- * @retval RTRUE The substring is present.
- * @retval RFALSE The substring is not present.
- * @retval RERROR Either input rstring is invalid.
+ * @brief Wraps rstring_chomp_sep_bang() but takes char* for sep.
  */
 int
-rstring_include(const rstring* rstr, const rstring* substring)
+rstring_chomp_sep_cstr_bang(rstring* rstr, const char* sep)
 {
-  if (rstring_bad(rstr)) { return RERROR; }
-  if (rstring_bad(substring)) { return RERROR; }
+  if (sep == NULL) { return RERROR; }
 
-  int start_pos = 0;
-  int val = binstr(rstr, start_pos, substring);
+  rstring_view rsep = rstring_view_of_cstr(sep);
 
-  if (val == BSTR_ERR) {
-    /* It wasn't found. */
-    return RFALSE;
-  }
-  else {
-    return RTRUE;
-  }
+  return rstring_chomp_sep_bang(rstr, &rsep);
 }
 
 /**
- * @brief Wraps rstring_include() but takes char* for substring.
+ * @brief Converts rstr to lowercase, like rstring_downcase() but in place.
+ *
+ * @param rstr The rstring to downcase.
+ *
+ * @retval RTRUE rstr was changed.
+ * @retval RFALSE rstr was already all lowercase.
+ * @retval RERROR rstr is invalid or there was an error.
  */
 int
-rstring_include_cstr(const rstring* rstr, const char* substring)
+rstring_downcase_bang(rstring* rstr)
 {
-  if (rstring_bad(rstr)) { return RERROR; }
-  if (substring == NULL) { return RERROR; }
-
-  rstring* rsubstring = rstring_new(substring);
-  if (rstring_bad(rsubstring)) { return RERROR; }
-
-  int val = rstring_include(rstr, rsubstring);
-
-  rstring_free(rsubstring);
-
-  return val;
+  return rstring__case_bang(rstr, BSTR__CASE_LOWER, BSTR__CASE_LOWER);
 }
 
-
 /**
- * @brief Tells the first occurence of substring in rstr.
- *
- * @param rstr The rstring to search in.
- * @param substring The rstring to search for.
+ * @brief Substitutes replacement for all occurrences of pattern, like rstring_gsub() but in place.
  *
- * @retval index The index of the first occurence of substring in rstr.
- * @retval RERROR Either input rstrings are invalid or the substring was not found.
+ * @param rstr The rstring for replacing.
+ * @param pattern The rstring pattern to search for.
+ * @param replacement The rstring to replace with.
  *
- * @todo Need a better way to handle errors as not found and error would be the same thing for this function.
+ * @retval RTRUE pattern was found (and replaced).
+ * @retval RFALSE pattern was not found, so rstr was not changed.
+ * @retval RERROR Any of the args are invalid or there was an error.
  */
 int
-rstring_index(const rstring* rstr, const rstring* substring)
+rstring_gsub_bang(rstring* rstr, const rstring* pattern, const rstring* replacement)
 {
   if (rstring_bad(rstr)) { return RERROR; }
-  if (rstring_bad(substring)) { return RERROR; }
+  if (rstring_view_bad(pattern)) { return RERROR; }
+  if (rstring_view_bad(replacement)) { return RERROR; }
+  if (pattern->slen == 0) { return RERROR; }
 
-  int start_pos = 0;
-  int val = binstr(rstr, start_pos, substring);
+  blen_t start_pos = binstr((const_bstring)rstr, 0, (const_bstring)pattern);
+  if (start_pos == BSTR_ERR) { return RFALSE; }
 
-  if (val == BSTR_ERR) {
-    /* It wasn't found. */
-    return RERROR;
-  }
-  else {
-    return val;
-  }
+  int val = bfindreplace((bstring)rstr,
+                         (const_bstring)pattern,
+                         (const_bstring)replacement,
+                         start_pos);
+  if (val == BSTR_ERR) { return RERROR; }
+
+  return RTRUE;
 }
 
 /**
- * @brief Wraps rstring_index() but takes char* for substring
+ * @brief Wraps rstring_gsub_bang() but takes char* for pattern and replacement.
  */
 int
-rstring_index_cstr(const rstring* rstr, const char* substring)
+rstring_gsub_cstr_bang(rstring* rstr, const char* pattern, const char* replacement)
 {
   if (rstring_bad(rstr)) { return RERROR; }
-  if (substring == NULL) { return RERROR; }
+  if (pattern == NULL) { return RERROR; }
+  if (replacement == NULL) { return RERROR; }
 
-  rstring* rsubstring = rstring_new(substring);
-  if (rstring_bad(rsubstring)) { return RERROR; }
+  rstring_view rpattern = rstring_view_of_cstr(pattern);
+  rstring_view rreplacement = rstring_view_of_cstr(replacement);
+
+  return rstring_gsub_bang(rstr, &rpattern, &rreplacement);
+}
 
-  int val = rstring_index(rstr, rsubstring);
+/**
+ * @brief Removes leading whitespace from rstr, like rstring_lstrip() but in place.
+ *
+ * @retval RTRUE Whitespace was removed.
+ * @retval RFALSE There was no leading whitespace, so rstr was not changed.
+ * @retval RERROR rstr is invalid or there was an error.
+ */
+int
+rstring_lstrip_bang(rstring* rstr)
+{
+  if (rstring_bad(rstr)) { return RERROR; }
 
-  rstring_free(rsubstring);
+  blen_t len = rstr->slen;
+  if (bltrimws(rstr) != BSTR_OK) { return RERROR; }
 
-  return val;
+  return rstr->slen == len ? RFALSE : RTRUE;
+}
+
+/**
+ * @brief Reverses the characters of rstr, like rstring_reverse() but in place.
+ *
+ * @retval RTRUE rstr was changed.
+ * @retval RFALSE rstr reads the same backwards, so it was not changed.
+ * @retval RERROR rstr is invalid or there was an error.
+ */
+int
+rstring_reverse_bang(rstring* rstr)
+{
+  if (rstring_bad(rstr)) { return RERROR; }
+
+  int changed = RFALSE;
+
+  /* From bstraux.c */
+  blen_t i, n, m;
+  unsigned char t;
+  n = rstr->slen;
+  if (2 <= n) {
+    m = n >> 1;
+    n--;
+    for (i=0; i < m; i++) {
+      if (rstr->data[n - i] == rstr->data[i]) { continue; }
+
+      /* Writes to rstr->data directly, so it needs its own buffer. */
+      if (!changed && bstr__unshare(rstr) != BSTR_OK) { return RERROR; }
+      changed = RTRUE;
+
+      t = rstr->data[n - i];
+      rstr->data[n - i] = rstr->data[i];
+      rstr->data[i] = t;
+    }
+  }
+
+  return changed;
 }
 
+/**
+ * @brief Removes trailing whitespace from rstr, like rstring_rstrip() but in place.
+ *
+ * @retval RTRUE Whitespace was removed.
+ * @retval RFALSE There was no trailing whitespace, so rstr was not changed.
+ * @retval RERROR rstr is invalid or there was an error.
+ */
+int
+rstring_rstrip_bang(rstring* rstr)
+{
+  if (rstring_bad(rstr)) { return RERROR; }
+
+  blen_t len = rstr->slen;
+  if (brtrimws(rstr) != BSTR_OK) { return RERROR; }
+
+  return rstr->slen == len ? RFALSE : RTRUE;
+}
 
 /**
- * @brief Tells the first occurence (starting at offset) of substring in rstr.
+ * @brief Removes leading and trailing whitespace from rstr, like rstring_strip() but in place.
+ *
+ * @retval RTRUE Whitespace was removed.
+ * @retval RFALSE There was no leading or trailing whitespace, so rstr was not changed.
+ * @retval RERROR rstr is invalid or there was an error.
+ */
+int
+rstring_strip_bang(rstring* rstr)
+{
+  if (rstring_bad(rstr)) { return RERROR; }
+
+  blen_t len = rstr->slen;
+  if (btrimws(rstr) != BSTR_OK) { return RERROR; }
+
+  return rstr->slen == len ? RFALSE : RTRUE;
+}
+
+/**
+ * @brief Converts rstr to uppercase, like rstring_upcase() but in place.
+ *
+ * @retval RTRUE rstr was changed.
+ * @retval RFALSE rstr was already all uppercase.
+ * @retval RERROR rstr is invalid or there was an error.
+ */
+int
+rstring_upcase_bang(rstring* rstr)
+{
+  return rstring__case_bang(rstr, BSTR__CASE_UPPER, BSTR__CASE_UPPER);
+}
+
+/**
+ * @brief Swaps the case of the letters of rstr, like rstring_swapcase() but in place.
+ *
+ * @retval RTRUE rstr was changed.
+ * @retval RFALSE rstr has no letters.
+ * @retval RERROR rstr is invalid or there was an error.
+ */
+int
+rstring_swapcase_bang(rstring* rstr)
+{
+  return rstring__case_bang(rstr, BSTR__CASE_SWAP, BSTR__CASE_SWAP);
+}
+
+/**
+ * @brief Makes the first char of rstr uppercase and the rest lowercase, like rstring_capitalize() but in place.
+ *
+ * @retval RTRUE rstr was changed.
+ * @retval RFALSE rstr was already capitalized.
+ * @retval RERROR rstr is invalid or there was an error.
+ */
+int
+rstring_capitalize_bang(rstring* rstr)
+{
+  return rstring__case_bang(rstr, BSTR__CASE_UPPER, BSTR__CASE_LOWER);
+}
+
+/*
+ * String info functions
+ */
+
+/**
+ * @brief Two strings are equal if they have the same length and content.
+ *
+ * @param rstr1 Not modified.
+ * @param rstr2 Not modified.
+ *
+ * @retval RTRUE The rstrings are equal.
+ * @retval RFALSE The rstrings are not equal.
+ * @retval RERROR The rstr1 or rstr2 is invalid or there was an error.
+ *
+ * @note This differs from ruby in that you can't just check for true or false, you must check for 1 or 0 as RERROR signals an error.
+ */
+int
+rstring_eql(const rstring* rstr1, const rstring* rstr2)
+{
+  if (rstring_view_bad(rstr1)) { return RERROR; }
+  if (rstring_view_bad(rstr2)) { return RERROR; }
+
+  int val = biseq((const_bstring)rstr1, (const_bstring)rstr2);
+
+  if (val == 1) {
+    return RTRUE;
+  }
+  else if (val == 0) {
+    return RFALSE;
+  }
+  else {
+    return RERROR;
+  }
+}
+
+/**
+ * @brief Two strings are equal if they have the same length and content.
+ *
+ * @param rstr Not modified.
+ * @param cstr Not modified.
+ *
+ * @retval RTRUE The strings are equal.
+ * @retval RFALSE The strings are not equal.
+ * @retval RERROR The rstr or cstring is invalid or there was an error.
+ *
+ * @note This differs from ruby in that you can't just check for true or false, you must check for 1 or 0 as RERROR signals an error.
+ */
+int
+rstring_eql_cstr(const rstring* rstr, const char* cstr)
+{
+  if (rstring_view_bad(rstr)) { return RERROR; }
+  if (cstr == NULL) { return RERROR; }
+
+  int val = biseqcstr((const_bstring)rstr, cstr);
+
+  if (val == 1) {
+    return RTRUE;
+  }
+  else if (val == 0) {
+    return RFALSE;
+  }
+  else {
+    return RERROR;
+  }
+}
+
+/**
+ * @brief Tells whether rstr contains the other rstring.
  *
  * @param rstr The rstring to search in.
  * @param substring The rstring to search for.
- * @param offset The index in rstr to start the search from.
- *
- * @retval index The index of the first occurence (>= index) of substring in rstr.
- * @retval RERROR Either input rstrings are invalid or the substring was not found in the string after the offset/index.
  *
- * @todo Need a better way to handle errors as not found and error would be the same thing for this function.
+ * @retval RTRUE The substring is present.
+ * @retval RFALSE The substring is not present.
+ * @retval RERROR Either input rstring is invalid.
  */
 int
-rstring_index_offset(const rstring* rstr, const rstring* substring, int offset)
+rstring_include(const rstring* rstr, const rstring* substring)
 {
-  if (rstring_bad(rstr)) { return RERROR; }
-  if (rstring_bad(substring)) { return RERROR; }
+  if (rstring_view_bad(rstr)) { return RERROR; }
+  if (rstring_view_bad(substring)) { return RERROR; }
 
-  int val = binstr(rstr, offset, substring);
+  blen_t start_pos = 0;
+  blen_t val = binstr(rstr, start_pos, substring);
 
   if (val == BSTR_ERR) {
     /* It wasn't found. */
-    return RERROR;
+    return RFALSE;
   }
   else {
-    return val;
+    return RTRUE;
   }
 }
 
 /**
- * @brief Wraps rstring_index_offset() but takes char* for substring
+ * @brief Wraps rstring_include() but takes char* for substring.
  */
 int
-rstring_index_offset_cstr(const rstring* rstr, const char* substring, int start_pos)
+rstring_include_cstr(const rstring* rstr, const char* substring)
 {
-  if (rstring_bad(rstr)) { return RERROR; }
-  if (substring == NULL) { return RERROR; }
+  if (rstring_view_bad(rstr)) { return RERROR; }
+
+  rstring_view rsubstring = rstring_view_of_cstr(substring);
+  if (rstring_view_bad(&rsubstring)) { return RERROR; }
+
+  return rstring_include(rstr, &rsubstring);
+}
+
+/**
+ * @brief Compares two rstrings without regard to case, like Ruby's casecmp.
+ *
+ * Only ASCII letters are folded (unless rlib is built with RLIB_LOCALE_CASE, in which case tolower() and the current C locale decide).  The bytes are compared as unsigned values.
+ *
+ * @param rstr1 Not modified.
+ * @param rstr2 Not modified.
+ *
+ * @retval -1 rstr1 sorts before rstr2.
+ * @retval 0 The rstrings are equal apart from case.
+ * @retval 1 rstr1 sorts after rstr2.
+ * @retval SHRT_MIN Either rstring is invalid.  (As with bstricmp, since -1 is taken.)
+ */
+int
+rstring_casecmp(const rstring* rstr1, const rstring* rstr2)
+{
+  if (rstring_view_bad(rstr1)) { return SHRT_MIN; }
+  if (rstring_view_bad(rstr2)) { return SHRT_MIN; }
 
-  rstring* rsubstring = rstring_new(substring);
-  if (rstring_bad(rsubstring)) { return RERROR; }
+  blen_t len = rstr1->slen < rstr2->slen ? rstr1->slen : rstr2->slen;
+  blen_t i = bstr__casediff(rstr1->data, rstr2->data, len);
 
-  int val = rstring_index_offset(rstr, rsubstring, start_pos);
+  if (i >= 0) {
+    return downcase(rstr1->data[i]) < downcase(rstr2->data[i]) ? -1 : 1;
+  }
 
-  rstring_free(rsubstring);
+  if (rstr1->slen == rstr2->slen) { return 0; }
 
-  return val;
+  return rstr1->slen < rstr2->slen ? -1 : 1;
 }
 
+/**
+ * @brief Wraps rstring_casecmp() but takes char* for cstr.
+ */
+int
+rstring_casecmp_cstr(const rstring* rstr, const char* cstr)
+{
+  rstring_view rcstr = rstring_view_of_cstr(cstr);
+
+  return rstring_casecmp(rstr, &rcstr);
+}
 
 /**
- * @brief Returns the length of the rstring.
+ * @brief Like rstring_eql() but without regard to case, like Ruby's casecmp?
  *
- * @param rstr Not modified.
+ * @retval RTRUE The rstrings are equal apart from case.
+ * @retval RFALSE The rstrings are not equal.
+ * @retval RERROR Either rstring is invalid.
+ */
+int
+rstring_eql_caseless(const rstring* rstr1, const rstring* rstr2)
+{
+  if (rstring_view_bad(rstr1)) { return RERROR; }
+  if (rstring_view_bad(rstr2)) { return RERROR; }
+
+  int val = biseqcaseless(rstr1, rstr2);
+
+  if (val == 1) {
+    return RTRUE;
+  }
+  else if (val == 0) {
+    return RFALSE;
+  }
+  else {
+    return RERROR;
+  }
+}
+
+/**
+ * @brief Wraps rstring_eql_caseless() but takes char* for cstr.
+ */
+int
+rstring_eql_caseless_cstr(const rstring* rstr, const char* cstr)
+{
+  rstring_view rcstr = rstring_view_of_cstr(cstr);
+
+  return rstring_eql_caseless(rstr, &rcstr);
+}
+
+/**
+ * @brief Like rstring_include() but without regard to case.
  *
- * @retval length The length of the rstring.
- * @retval RERROR The input rstring is invalid or there was an error.
+ * @code
+if (rstring_include_caseless_cstr(header, "content-type") == RTRUE) { ... }
+ * @endcode
+ *
+ * @retval RTRUE The substring is present.
+ * @retval RFALSE The substring is not present.
+ * @retval RERROR Either input rstring is invalid.
  */
 int
-rstring_length(const rstring* rstr)
+rstring_include_caseless(const rstring* rstr, const rstring* substring)
 {
-  if (rstring_bad(rstr)) { return RERROR; }
+  if (rstring_view_bad(rstr)) { return RERROR; }
+  if (rstring_view_bad(substring)) { return RERROR; }
 
-  return blengthe(rstr, RERROR);
+  blen_t val = binstrcaseless(rstr, 0, substring);
+
+  return val == BSTR_ERR ? RFALSE : RTRUE;
 }
 
+/**
+ * @brief Wraps rstring_include_caseless() but takes char* for substring.
+ */
+int
+rstring_include_caseless_cstr(const rstring* rstr, const char* substring)
+{
+  rstring_view rsubstring = rstring_view_of_cstr(substring);
 
+  return rstring_include_caseless(rstr, &rsubstring);
+}
 
-/*
- * Utility functions
+
+/**
+ * @brief Tells the first occurence of substring in rstr.
+ *
+ * @param rstr The rstring to search in.
+ * @param substring The rstring to search for.
+ *
+ * @retval index The index of the first occurence of substring in rstr.
+ * @retval RERROR Either input rstrings are invalid or the substring was not found.
+ *
+ * @todo Need a better way to handle errors as not found and error would be the same thing for this function.
  */
+blen_t
+rstring_index(const rstring* rstr, const rstring* substring)
+{
+  if (rstring_view_bad(rstr)) { return RERROR; }
+  if (rstring_view_bad(substring)) { return RERROR; }
+
+  blen_t start_pos = 0;
+  blen_t val = binstr(rstr, start_pos, substring);
+
+  if (val == BSTR_ERR) {
+    /* It wasn't found. */
+    return RERROR;
+  }
+  else {
+    return val;
+  }
+}
 
 /**
- * @brief Return the char at given position
+ * @brief Wraps rstring_index() but takes char* for substring
+ */
+blen_t
+rstring_index_cstr(const rstring* rstr, const char* substring)
+{
+  if (rstring_view_bad(rstr)) { return RERROR; }
+
+  rstring_view rsubstring = rstring_view_of_cstr(substring);
+  if (rstring_view_bad(&rsubstring)) { return RERROR; }
+
+  return rstring_index(rstr, &rsubstring);
+}
+
+
+/**
+ * @brief Tells the first occurence (starting at offset) of substring in rstr.
+ *
+ * @param rstr The rstring to search in.
+ * @param substring The rstring to search for.
+ * @param offset The index in rstr to start the search from.
+ *
+ * @retval index The index of the first occurence (>= index) of substring in rstr.
+ * @retval RERROR Either input rstrings are invalid or the substring was not found in the string after the offset/index.
+ *
+ * @todo Need a better way to handle errors as not found and error would be the same thing for this function.
+ */
+blen_t
+rstring_index_offset(const rstring* rstr, const rstring* substring, blen_t offset)
+{
+  if (rstring_view_bad(rstr)) { return RERROR; }
+  if (rstring_view_bad(substring)) { return RERROR; }
+
+  blen_t val = binstr(rstr, offset, substring);
+
+  if (val == BSTR_ERR) {
+    /* It wasn't found. */
+    return RERROR;
+  }
+  else {
+    return val;
+  }
+}
+
+/**
+ * @brief Wraps rstring_index_offset() but takes char* for substring
+ */
+blen_t
+rstring_index_offset_cstr(const rstring* rstr, const char* substring, blen_t start_pos)
+{
+  if (rstring_view_bad(rstr)) { return RERROR; }
+
+  rstring_view rsubstring = rstring_view_of_cstr(substring);
+  if (rstring_view_bad(&rsubstring)) { return RERROR; }
+
+  return rstring_index_offset(rstr, &rsubstring, start_pos);
+}
+
+/**
+ * @brief Tells the last occurence of substring in rstr.
+ *
+ * The search runs backwards from the end of rstr, so a match near the end is found without looking at the rest.
+ *
+ * @param rstr The rstring to search in.
+ * @param substring The rstring to search for.
+ *
+ * @retval index The index of the last occurence of substring in rstr.  (An empty substring is found at the end of rstr, like Ruby's rindex.)
+ * @retval RERROR Either input rstrings are invalid or the substring was not found.
+ */
+blen_t
+rstring_rindex(const rstring* rstr, const rstring* substring)
+{
+  if (rstring_view_bad(rstr)) { return RERROR; }
+
+  return rstring_rindex_offset(rstr, substring, rstr->slen);
+}
+
+/**
+ * @brief Wraps rstring_rindex() but takes char* for substring.
+ */
+blen_t
+rstring_rindex_cstr(const rstring* rstr, const char* substring)
+{
+  rstring_view rsubstring = rstring_view_of_cstr(substring);
+
+  return rstring_rindex(rstr, &rsubstring);
+}
+
+/**
+ * @brief Tells the last occurence of substring in rstr that starts at or before offset.
+ *
+ * @param rstr The rstring to search in.
+ * @param substring The rstring to search for.
+ * @param offset The last index in rstr a match may start at.
+ *
+ * @retval index The index of the last occurence (<= offset) of substring in rstr.
+ * @retval RERROR Either input rstrings are invalid, offset is out of range, or the substring was not found in the string before the offset.
+ */
+blen_t
+rstring_rindex_offset(const rstring* rstr, const rstring* substring, blen_t offset)
+{
+  if (rstring_view_bad(rstr)) { return RERROR; }
+  if (rstring_view_bad(substring)) { return RERROR; }
+
+  blen_t val = binstrr(rstr, offset, substring);
+
+  return val == BSTR_ERR ? RERROR : val;
+}
+
+/**
+ * @brief Wraps rstring_rindex_offset() but takes char* for substring.
+ */
+blen_t
+rstring_rindex_offset_cstr(const rstring* rstr, const char* substring, blen_t start_pos)
+{
+  rstring_view rsubstring = rstring_view_of_cstr(substring);
+
+  return rstring_rindex_offset(rstr, &rsubstring, start_pos);
+}
+
+/* Run bstr__pattern_each for substring over all of rstr, preparing the
+   search once. */
+static blen_t
+rstring__each_substr(const rstring* rstr, const rstring* substring, int (*cb)(void* parm, blen_t pos), void* parm)
+{
+  struct bstr__pattern pat;
+
+  bstr__pattern_init(&pat, substring->data, substring->slen, 1, 0,
+                     rstr->slen >= BSTR_SKIP_MIN_HAYSTACK);
+
+  return bstr__pattern_each(&pat, substring->data, rstr->data, rstr->slen, cb, parm);
+}
+
+/**
+ * @brief Counts the occurences of substring in rstr, like Ruby's `rstr.scan(substring).length`.
+ *
+ * Occurences don't overlap: "aaaa" has two of "aa".  All of them are found in one pass of the search over rstr.
+ *
+ * @param rstr The rstring to search in.
+ * @param substring The rstring to count.  (An empty one is found before every byte and at the end.)
+ *
+ * @retval count The number of occurences.
+ * @retval RERROR Either input rstrings are invalid.
+ */
+blen_t
+rstring_count_substr(const rstring* rstr, const rstring* substring)
+{
+  if (rstring_view_bad(rstr)) { return RERROR; }
+  if (rstring_view_bad(substring)) { return RERROR; }
+
+  return rstring__each_substr(rstr, substring, NULL, NULL);
+}
+
+/**
+ * @brief Wraps rstring_count_substr() but takes char* for substring.
+ */
+blen_t
+rstring_count_substr_cstr(const rstring* rstr, const char* substring)
+{
+  rstring_view rsubstring = rstring_view_of_cstr(substring);
+
+  return rstring_count_substr(rstr, &rsubstring);
+}
+
+struct rstring__positions {
+  blen_t* positions;
+  blen_t max;
+  blen_t qty;
+};
+
+static int
+rstring__positions_cb(void* parm, blen_t pos)
+{
+  struct rstring__positions* ps = parm;
+
+  if (ps->qty < ps->max) { ps->positions[ps->qty] = pos; }
+  ps->qty++;
+
+  return 0;
+}
+
+/**
+ * @brief Finds where each occurence of substring is in rstr.
+ *
+ * The occurences are the ones rstring_count_substr() counts, in order.  Like snprintf(), the return value is the total even when positions is too small, so a caller can count first (or pass max 0) and then size the buffer.
+ *
+ * @code
+blen_t pos[16];
+blen_t n = rstring_scan_positions(RSTR_LIT("a,b,,c"), RSTR_LIT(","), pos, 16);
+// n is 3 and pos starts 1, 3, 4
+ * @endcode
+ *
+ * @param rstr The rstring to search in.
+ * @param substring The rstring to search for.
+ * @param positions Where to put the indices of the first max occurences.  (Can be NULL if max is 0.)
+ * @param max How many indices positions has room for.
+ *
+ * @retval count The number of occurences in rstr.
+ * @retval RERROR Any of the args are invalid.
+ */
+blen_t
+rstring_scan_positions(const rstring* rstr, const rstring* substring, blen_t* positions, blen_t max)
+{
+  if (rstring_view_bad(rstr)) { return RERROR; }
+  if (rstring_view_bad(substring)) { return RERROR; }
+  if (max < 0 || (max > 0 && positions == NULL)) { return RERROR; }
+
+  struct rstring__positions ps = { positions, max, 0 };
+  if (max == 0) { return rstring__each_substr(rstr, substring, NULL, NULL); }
+
+  rstring__each_substr(rstr, substring, rstring__positions_cb, &ps);
+
+  return ps.qty;
+}
+
+/**
+ * @brief Calls cb with the index of each occurence of substring in rstr.
+ *
+ * The occurences are the ones rstring_count_substr() counts, in order.  Like rstring_scan_multimatcher(), scanning stops if cb returns a negative value, which is then returned.
+ *
+ * @param rstr The rstring to search in.
+ * @param substring The rstring to search for.
+ * @param cb Called with parm and the index in rstr of the occurence.
+ * @param parm Passed through to cb.
+ *
+ * @retval ROKAY The whole of rstr was scanned.
+ * @retval RERROR Any of the args are invalid.
+ * @retval negative What cb returned when it stopped the scan.
+ */
+int
+rstring_each_match(const rstring* rstr, const rstring* substring, int (*cb)(void* parm, blen_t pos), void* parm)
+{
+  if (rstring_view_bad(rstr)) { return RERROR; }
+  if (rstring_view_bad(substring)) { return RERROR; }
+  if (cb == NULL) { return RERROR; }
+
+  blen_t val = rstring__each_substr(rstr, substring, cb, parm);
+
+  return val < 0 ? (int)val : ROKAY;
+}
+
+
+/**
+ * @brief Returns the length of the rstring.
+ *
+ * @param rstr Not modified.
+ *
+ * @retval length The length of the rstring.
+ * @retval RERROR The input rstring is invalid or there was an error.
+ */
+blen_t
+rstring_length(const rstring* rstr)
+{
+  if (rstring_view_bad(rstr)) { return RERROR; }
+
+  return blengthe(rstr, RERROR);
+}
+
+
+
+/*
+ * Utility functions
+ */
+
+/**
+ * @brief Return the char at given position
+ *
+ * @param rstr Not modified.
+ * @param index Get the char at this index in rstr.
+ *
+ * @retval char The idx'th character of the rstring.
+ * @retval RERROR If The input rstring is invalid or there was an error.
+ */
+int
+rstring_char_at(const rstring* rstr, blen_t idx)
+{
+  if (rstring_view_bad(rstr)) { return RERROR; }
+
+  return bchare(rstr, idx, RERROR);
+}
+
+
+rstring_array*
+rstring_array_new()
+{
+  rstring_array* rary = NULL;
+
+  rary = bstrListCreate();
+  if (rary == NULL) { return NULL; }
+
+  return rary;
+}
+
+int
+rstring_array_push_rstr(rstring_array* rary, rstring* rstr)
+{
+  blen_t current_size = rary->qty;
+  int rval = 0;
+  rval = bstrListAlloc((struct bstrList*)rary, current_size + 1);
+  if (rval == BSTR_ERR) { return RERROR; }
+  rary->qty = current_size + 1;
+  rary->entry[rary->qty - 1] = rstr;
+  assert(rary->qty <= rary->mlen);
+  assert(rary->qty == current_size + 1);
+
+  return ROKAY;
+}
+
+int
+rstring_array_push_cstr(rstring_array* rary, char* cstr)
+{
+  blen_t current_size = rary->qty;
+  int rval = 0;
+  rstring* rstr = NULL;
+  rval = bstrListAlloc((struct bstrList*)rary, current_size + 1);
+  if (rval == BSTR_ERR) { return RERROR; }
+
+  rstr = rstring_new(cstr);
+  if (rstr == NULL) { return RERROR; }
+
+  rary->qty = current_size + 1;
+  rary->entry[rary->qty - 1] = rstr;
+  assert(rary->qty <= rary->mlen);
+  assert(rary->qty == current_size + 1);
+
+  return ROKAY;
+}
+
+rstring*
+rstring_array_get(rstring_array* rary, blen_t index)
+{
+  if (index < 0 || index >= rary->qty) { return NULL; }
+  if (rary->qty > rary->mlen) { return NULL; }
+
+  rstring* rstr = NULL;
+  rstr = rary->entry[index];
+  if (rstr == NULL) { return NULL; }
+
+  return rstr;
+}
+
+int
+rstring_array_free(rstring_array* rary)
+{
+  return bstrListDestroy((struct bstrList*)rary);
+}
+
+rstring*
+rstring_array_join(rstring_array* rstrings, const rstring* sep)
+{
+  if (rstrings == NULL || sep == NULL) { return NULL; }
+  if (rstrings->qty == 0) {
+    return rstring_new("");
+  }
+
+  return bjoin((const struct bstrList*)rstrings, (const_bstring)sep);
+}
+
+/**
+ * @brief Wraps rstring_array_join() but takes char* for sep
+ */
+rstring*
+rstring_array_join_cstr(rstring_array* rstrings, const char* sep)
+{
+  if (rstrings == NULL || sep == NULL) { return NULL; }
+  if (rstrings->qty == 0) {
+    return rstring_new("");
+  }
+
+  rstring_view rsep = rstring_view_of_cstr(sep);
+  if (rstring_view_bad(&rsep)) { return NULL; }
+
+  return bjoin((const struct bstrList*)rstrings, (const_bstring)&rsep);
+}
+
+/**
+ * @brief Removes the trailing separator sep from every rstring in rary, as rstring_chomp_sep_bang() does for one.
+ *
+ * Handy for lines read in bulk: nothing is allocated, only the lengths change, unless an entry's buffer is shared in a RLIB_COW_STRINGS build, in which case it is copied first.
+ *
+ * @code
+rstring_array* lines = rstring_split_cstr(rstring_new("a\r\n|b\n|c"), "|");
+rstring_array_chomp_bang(lines, RSTR_LIT("\n"));
+
+assert(rstring_eql_cstr(rstring_array_get(lines, 0), "a") == RTRUE);
+ * @endcode
+ *
+ * @param rary The rstring_array to chomp.
+ * @param sep The separator to remove.
+ *
+ * @retval RTRUE At least one rstring was changed.
+ * @retval RFALSE None of the rstrings ended in sep, so nothing was changed.
+ * @retval RERROR rary or sep is invalid or there was an error.
+ */
+int
+rstring_array_chomp_bang(rstring_array* rary, const rstring* sep)
+{
+  if (rstring_array_bad(rary) || rstring_view_bad(sep)) { return RERROR; }
+
+  int changed = RFALSE;
+
+  for (blen_t i = 0; i < rary->qty; ++i) {
+    int val = rstring_chomp_sep_bang(rary->entry[i], sep);
+    if (val == RERROR) { return RERROR; }
+    if (val == RTRUE) { changed = RTRUE; }
+  }
+
+  return changed;
+}
+
+/**
+ * @brief Wraps rstring_array_chomp_bang() but takes char* for sep.
+ */
+int
+rstring_array_chomp_cstr_bang(rstring_array* rary, const char* sep)
+{
+  if (sep == NULL) { return RERROR; }
+
+  rstring_view rsep = rstring_view_of_cstr(sep);
+
+  return rstring_array_chomp_bang(rary, &rsep);
+}
+
+rstring_array*
+rstring_split(rstring* rstr, const rstring* sep)
+{
+  return bsplitstr((bstring)rstr, (const_bstring)sep);
+}
+
+/**
+ * @brief Wraps rstring_split() but takes char* for sep
+ */
+rstring_array*
+rstring_split_cstr(rstring* rstr, const char* sep)
+{
+  if (rstring_view_bad(rstr)) { return NULL; }
+
+  rstring_view rsep = rstring_view_of_cstr(sep);
+  if (rstring_view_bad(&rsep)) { return NULL; }
+
+  return bsplitstr((bstring)rstr, (const_bstring)&rsep);
+}
+
+/*
+ * Reusable search patterns
+ */
+
+struct rstring_matcher {
+  /* A write protected view of bytes, which follow the struct. */
+  rstring_view pattern;
+  int flags;
+  /* The pattern prepared for finding first and last matches. */
+  struct bstr__pattern fwd;
+  struct bstr__pattern rev;
+  unsigned char bytes[];
+};
+
+/**
+ * @brief Prepare pattern for searching.
+ *
+ * The search tables (the Two-Way factorization, a bad character skip table and, for caseless matchers, a case folding table) are worked out here, once, rather than on every search.
+ *
+ * @code
+rstring_matcher* matcher = rstring_matcher_new_cstr("GATTACA", 0);
+
+while (... read line ...) {
+  if (rstring_include_matcher(line, matcher) == RTRUE) { ... }
+}
+
+rstring_matcher_free(matcher);
+ * @endcode
+ *
+ * @param pattern The rstring to search for.  (Not modified.  The matcher keeps its own copy.)
+ * @param flags 0 or RSTRING_MATCHER_CASELESS.
+ *
+ * @retval rstring_matcher* A new matcher.
+ * @retval NULL The pattern is invalid or there were errors.
+ *
+ * @warning The caller must free the result with rstring_matcher_free().
+ */
+rstring_matcher*
+rstring_matcher_new(const rstring* pattern, int flags)
+{
+  if (rstring_view_bad(pattern)) { return NULL; }
+  if ((flags & ~RSTRING_MATCHER_CASELESS) != 0) { return NULL; }
+
+  rstring_matcher* matcher =
+    malloc(sizeof(rstring_matcher) + (size_t)pattern->slen + 1);
+  if (matcher == NULL) { return NULL; }
+
+  memcpy(matcher->bytes, pattern->data, (size_t)pattern->slen);
+  matcher->bytes[pattern->slen] = '\0';
+  matcher->pattern = rstring_view_of_blk(matcher->bytes, pattern->slen);
+  matcher->flags = flags;
+
+  int fold = (flags & RSTRING_MATCHER_CASELESS) != 0;
+  bstr__pattern_init(&matcher->fwd, matcher->bytes, pattern->slen, 1, fold, 1);
+  bstr__pattern_init(&matcher->rev, matcher->bytes, pattern->slen, -1, fold, 1);
+
+  return matcher;
+}
+
+/**
+ * @brief Wraps rstring_matcher_new() but takes char* for pattern.
+ */
+rstring_matcher*
+rstring_matcher_new_cstr(const char* pattern, int flags)
+{
+  rstring_view rpattern = rstring_view_of_cstr(pattern);
+
+  return rstring_matcher_new(&rpattern, flags);
+}
+
+/**
+ * @brief Free a matcher made by rstring_matcher_new().
+ *
+ * @retval ROKAY The matcher was freed.
+ * @retval RERROR The matcher is NULL.
+ */
+int
+rstring_matcher_free(rstring_matcher* matcher)
+{
+  if (matcher == NULL) { return RERROR; }
+
+  free(matcher);
+
+  return ROKAY;
+}
+
+/**
+ * @brief Like rstring_include() but the substring is the one matcher was made for.
+ *
+ * @retval RTRUE The pattern is present.
+ * @retval RFALSE The pattern is not present.
+ * @retval RERROR Either input is invalid.
+ */
+int
+rstring_include_matcher(const rstring* rstr, const rstring_matcher* matcher)
+{
+  blen_t val = rstring_index_matcher(rstr, matcher);
+
+  if (val == RERROR) {
+    return (rstring_view_bad(rstr) || matcher == NULL) ? RERROR : RFALSE;
+  }
+
+  return RTRUE;
+}
+
+/**
+ * @brief Like rstring_index() but the substring is the one matcher was made for.
+ *
+ * @retval index The index of the first occurence of the pattern in rstr.
+ * @retval RERROR Either input is invalid or the pattern was not found.
+ */
+blen_t
+rstring_index_matcher(const rstring* rstr, const rstring_matcher* matcher)
+{
+  return rstring_index_offset_matcher(rstr, matcher, 0);
+}
+
+/**
+ * @brief Like rstring_index_offset() but the substring is the one matcher was made for.
+ *
+ * @retval index The index of the first occurence (>= offset) of the pattern in rstr.
+ * @retval RERROR Either input is invalid or the pattern was not found in rstr after the offset.
+ */
+blen_t
+rstring_index_offset_matcher(const rstring* rstr, const rstring_matcher* matcher, blen_t offset)
+{
+  if (rstring_view_bad(rstr)) { return RERROR; }
+  if (matcher == NULL) { return RERROR; }
+
+  blen_t val = bstr__pattern_instr(&matcher->fwd, rstr, offset, &matcher->pattern);
+
+  return val == BSTR_ERR ? RERROR : val;
+}
+
+/**
+ * @brief Tells the last occurence of the pattern of matcher in rstr.
+ *
+ * @retval index The index of the last occurence of the pattern in rstr.  (An empty pattern is found at the end of rstr, like Ruby's rindex.)
+ * @retval RERROR Either input is invalid or the pattern was not found.
+ */
+blen_t
+rstring_rindex_matcher(const rstring* rstr, const rstring_matcher* matcher)
+{
+  if (rstring_view_bad(rstr)) { return RERROR; }
+  if (matcher == NULL) { return RERROR; }
+
+  blen_t val = bstr__pattern_exec(&matcher->rev,
+                                  matcher->pattern.data,
+                                  rstr->data,
+                                  rstr->slen);
+
+  return val < 0 ? RERROR : val;
+}
+
+/**
+ * @brief Like rstring_gsub() but the pattern is the one matcher was made for.
+ *
+ * @retval rstring* A valid rstring with the appropriate replacements.
+ * @retval NULL Any of the args are invalid, the pattern is empty, or there were errors.
+ */
+rstring*
+rstring_gsub_matcher(const rstring* rstr, const rstring_matcher* matcher, const rstring* replacement)
+{
+  if (rstring_view_bad(rstr)) { return NULL; }
+
+  rstring* copy = rstring_copy(rstr);
+  if (rstring_bad(copy)) { return NULL; }
+
+  if (rstring_gsub_matcher_bang(copy, matcher, replacement) == RERROR) {
+    rstring_free(copy);
+    return NULL;
+  }
+
+  return copy;
+}
+
+/**
+ * @brief Like rstring_gsub_bang() but the pattern is the one matcher was made for.
+ *
+ * @retval RTRUE At least one replacement was made.
+ * @retval RFALSE The pattern was not found, so rstr was not changed.
+ * @retval RERROR Any of the args are invalid, the pattern is empty, or there were errors.
+ */
+int
+rstring_gsub_matcher_bang(rstring* rstr, const rstring_matcher* matcher, const rstring* replacement)
+{
+  if (rstring_bad(rstr)) { return RERROR; }
+  if (matcher == NULL) { return RERROR; }
+  if (rstring_view_bad(replacement)) { return RERROR; }
+  if (matcher->pattern.slen == 0) { return RERROR; }
+
+  blen_t start_pos = bstr__pattern_instr(&matcher->fwd, rstr, 0, &matcher->pattern);
+  if (start_pos == BSTR_ERR) { return RFALSE; }
+
+  int val = findreplaceengine((bstring)rstr,
+                              &matcher->pattern,
+                              (const_bstring)replacement,
+                              start_pos,
+                              &matcher->fwd);
+  if (val == BSTR_ERR) { return RERROR; }
+
+  return RTRUE;
+}
+
+/**
+ * @brief Like rstring_split() but splits on the pattern matcher was made for.
+ *
+ * @retval rstring_array* The fields of rstr.
+ * @retval NULL Either input is invalid or there were errors.
+ */
+rstring_array*
+rstring_split_matcher(rstring* rstr, const rstring_matcher* matcher)
+{
+  if (rstring_view_bad(rstr)) { return NULL; }
+  if (matcher == NULL) { return NULL; }
+
+  return bstr__splitstr(rstr, &matcher->pattern, &matcher->fwd);
+}
+
+struct rstring_multimatcher {
+  /* Number of patterns and their lengths. */
+  blen_t qty;
+  blen_t* lens;
+
+  /* Bytes are mapped to classes: one for each distinct byte in the
+     patterns (after case folding) and class 0 for all the rest.  The DFA
+     then only needs nclasses columns. */
+  unsigned char cls[UCHAR_MAX + 1];
+  int nclasses;
+  int nstates;
+
+  /* delta[state * nclasses + class] is the next state.  pat[state] is the
+     pattern the state spells, or -1.  out[state] is the state spelling the
+     longest pattern that ends here, or -1, and next_out[state] the one
+     spelling the next shorter such pattern.  depth[state] is the length of
+     the string the state spells. */
+  int* delta;
+  int* pat;
+  int* out;
+  int* next_out;
+  int* depth;
+};
+
+/**
+ * @brief Prepare many patterns for searching all at once.
+ *
+ * The patterns are compiled into an Aho-Corasick automaton, stored as a dense DFA over the bytes that actually occur in the patterns.  Searching with it reads each byte of the searched rstring once, however many patterns there are.
+ *
+ * @code
+rstring_array* keywords = rstring_split_cstr(line_of_keywords, " ");
+rstring_multimatcher* mm = rstring_multimatcher_new(keywords, 0);
+
+while (... read line ...) {
+  if (rstring_include_multimatcher(line, mm) == RTRUE) { ... }
+}
+
+rstring_multimatcher_free(mm);
+ * @endcode
+ *
+ * @param patterns The rstrings to search for.  (Not modified or kept.)  Pattern i is reported as `which` == i.  If a pattern appears twice, the first one is reported.
+ * @param flags 0 or RSTRING_MATCHER_CASELESS.
+ *
+ * @retval rstring_multimatcher* A new multimatcher.
+ * @retval NULL patterns is invalid, empty, or holds an invalid or empty pattern, or there were errors.
+ *
+ * @warning The caller must free the result with rstring_multimatcher_free().
+ */
+rstring_multimatcher*
+rstring_multimatcher_new(const rstring_array* patterns, int flags)
+{
+  if (rstring_array_bad(patterns) || patterns->qty == 0) { return NULL; }
+  if ((flags & ~RSTRING_MATCHER_CASELESS) != 0) { return NULL; }
+
+  int fold = (flags & RSTRING_MATCHER_CASELESS) != 0;
+  size_t total = 0;
+  int i;
+
+  for (i = 0; i < patterns->qty; ++i) {
+    const rstring* p = patterns->entry[i];
+    if (rstring_view_bad(p) || p->slen == 0) { return NULL; }
+    total += (size_t)p->slen;
+  }
+
+  rstring_multimatcher* mm = calloc(1, sizeof(rstring_multimatcher));
+  if (mm == NULL) { return NULL; }
+
+  /* Byte classes */
+  unsigned char seen[UCHAR_MAX + 1] = { 0 };
+  for (i = 0; i < patterns->qty; ++i) {
+    const rstring* p = patterns->entry[i];
+    for (blen_t j = 0; j < p->slen; ++j) {
+      seen[fold ? downcase(p->data[j]) : p->data[j]] = 1;
+    }
+  }
+  mm->nclasses = 1;
+  for (i = 0; i <= UCHAR_MAX; ++i) {
+    mm->cls[i] = seen[i] ? (unsigned char)mm->nclasses++ : 0;
+  }
+  if (fold) {
+    for (i = 0; i <= UCHAR_MAX; ++i) { mm->cls[i] = mm->cls[downcase(i)]; }
+  }
+
+  /* At most one state per pattern byte, plus the root. */
+  int nc = mm->nclasses;
+  if (total >= (size_t)INT_MAX / (size_t)nc) { free(mm); return NULL; }
+  size_t max_states = total + 1;
+
+  mm->qty = patterns->qty;
+  mm->lens = malloc(sizeof(blen_t) * (size_t)mm->qty);
+  mm->delta = malloc(sizeof(int) * max_states * (size_t)nc);
+  mm->pat = malloc(sizeof(int) * max_states);
+  mm->out = malloc(sizeof(int) * max_states);
+  mm->next_out = malloc(sizeof(int) * max_states);
+  mm->depth = malloc(sizeof(int) * max_states);
+  int* fail = malloc(sizeof(int) * max_states);
+
+  if (mm->lens == NULL || mm->delta == NULL || mm->pat == NULL ||
+      mm->out == NULL || mm->next_out == NULL || mm->depth == NULL ||
+      fail == NULL) {
+    free(fail);
+    rstring_multimatcher_free(mm);
+    return NULL;
+  }
+
+  /* The trie */
+  memset(mm->delta, 0xff, sizeof(int) * max_states * (size_t)nc);
+  mm->nstates = 1;
+  mm->pat[0] = -1;
+  mm->depth[0] = 0;
+
+  for (i = 0; i < patterns->qty; ++i) {
+    const rstring* p = patterns->entry[i];
+    int s = 0;
+
+    for (blen_t j = 0; j < p->slen; ++j) {
+      int* t = &mm->delta[s * nc + mm->cls[p->data[j]]];
+      if (*t < 0) {
+        *t = mm->nstates++;
+        mm->pat[*t] = -1;
+        mm->depth[*t] = mm->depth[s] + 1;
+      }
+      s = *t;
+    }
+    if (mm->pat[s] < 0) { mm->pat[s] = i; }
+    mm->lens[i] = p->slen;
+  }
+
+  /* Failure links, breadth first, filling in the missing transitions so
+     that delta becomes a complete DFA.  next_out is free until the end,
+     so it serves as the queue. */
+  int* queue = mm->next_out;
+  int head = 0;
+  int tail = 0;
+
+  mm->out[0] = -1;
+  fail[0] = 0;
+  for (int k = 0; k < nc; ++k) {
+    int t = mm->delta[k];
+    if (t < 0) {
+      mm->delta[k] = 0;
+    }
+    else {
+      fail[t] = 0;
+      queue[tail++] = t;
+    }
+  }
+
+  while (head < tail) {
+    int s = queue[head++];
+
+    mm->out[s] = mm->pat[s] >= 0 ? s : mm->out[fail[s]];
+
+    for (int k = 0; k < nc; ++k) {
+      int* t = &mm->delta[s * nc + k];
+      int f = mm->delta[fail[s] * nc + k];
+      if (*t < 0) {
+        *t = f;
+      }
+      else {
+        fail[*t] = f;
+        queue[tail++] = *t;
+      }
+    }
+  }
+
+  /* out of a state's failure link is the next shorter pattern ending at
+     the same place. */
+  for (int s = 0; s < mm->nstates; ++s) {
+    mm->next_out[s] = s == 0 ? -1 : mm->out[fail[s]];
+  }
+  free(fail);
+
+  return mm;
+}
+
+/**
+ * @brief Free a multimatcher made by rstring_multimatcher_new().
+ *
+ * @retval ROKAY The multimatcher was freed.
+ * @retval RERROR mm is NULL.
+ */
+int
+rstring_multimatcher_free(rstring_multimatcher* mm)
+{
+  if (mm == NULL) { return RERROR; }
+
+  free(mm->lens);
+  free(mm->delta);
+  free(mm->pat);
+  free(mm->out);
+  free(mm->next_out);
+  free(mm->depth);
+  free(mm);
+
+  return ROKAY;
+}
+
+/* Leftmost-longest match in data[0, len): returns its start and sets
+   *which, or returns -1. */
+static blen_t
+rstring__multimatcher_find(const rstring_multimatcher* mm,
+                           const unsigned char* data,
+                           blen_t len,
+                           blen_t* which)
+{
+  blen_t best = -1;
+  int best_state = -1;
+  int nc = mm->nclasses;
+  int s = 0;
+
+  for (blen_t i = 0; i < len; ++i) {
+    s = mm->delta[s * nc + mm->cls[data[i]]];
+
+    /* Anything found from here on starts after best. */
+    if (best >= 0 && i + 1 - mm->depth[s] > best) { break; }
+
+    int o = mm->out[s];
+    if (o >= 0) {
+      blen_t start = i + 1 - mm->depth[o];
+      if (best < 0 || start < best ||
+          (start == best && mm->depth[o] > mm->depth[best_state])) {
+        best = start;
+        best_state = o;
+      }
+    }
+  }
+
+  if (best >= 0) { *which = mm->pat[best_state]; }
+  return best;
+}
+
+/**
+ * @brief Tells whether rstr contains any of the patterns of mm.
+ *
+ * @retval RTRUE At least one pattern is present.
+ * @retval RFALSE None of the patterns are present.
+ * @retval RERROR Either input is invalid.
+ */
+int
+rstring_include_multimatcher(const rstring* rstr, const rstring_multimatcher* mm)
+{
+  if (rstring_view_bad(rstr)) { return RERROR; }
+  if (mm == NULL) { return RERROR; }
+
+  int nc = mm->nclasses;
+  int s = 0;
+
+  for (blen_t i = 0; i < rstr->slen; ++i) {
+    s = mm->delta[s * nc + mm->cls[rstr->data[i]]];
+    if (mm->out[s] >= 0) { return RTRUE; }
+  }
+
+  return RFALSE;
+}
+
+/**
+ * @brief Tells the first place in rstr where any of the patterns of mm occurs.
+ *
+ * If several patterns start there, the longest is reported.
+ *
+ * @param rstr The rstring to search in.
+ * @param mm The patterns to search for.
+ * @param which If not NULL, set to the index (in the array mm was made from) of the pattern found.
+ *
+ * @retval index The index of the first match in rstr.
+ * @retval RERROR Either input is invalid or none of the patterns were found.
+ */
+blen_t
+rstring_index_multimatcher(const rstring* rstr, const rstring_multimatcher* mm, blen_t* which)
+{
+  if (rstring_view_bad(rstr)) { return RERROR; }
+  if (mm == NULL) { return RERROR; }
+
+  blen_t w = 0;
+  blen_t val = rstring__multimatcher_find(mm, rstr->data, rstr->slen, &w);
+  if (val < 0) { return RERROR; }
+
+  if (which != NULL) { *which = w; }
+  return val;
+}
+
+/**
+ * @brief Calls cb for every occurence in rstr of every pattern of mm, overlapping ones included.
+ *
+ * Matches are reported in order of where they end, and longest first among those ending at the same place.  Like bstrlib's bsplitcb(), scanning stops if cb returns a negative value, which is then returned.
+ *
+ * @param rstr The rstring to search in.
+ * @param mm The patterns to search for.
+ * @param cb Called with parm, the index in rstr of the match and the index of the pattern matched.
+ * @param parm Passed through to cb.
+ *
+ * @retval ROKAY The whole of rstr was scanned.
+ * @retval RERROR Any of the args are invalid.
+ * @retval negative What cb returned when it stopped the scan.
+ */
+int
+rstring_scan_multimatcher(const rstring* rstr,
+                          const rstring_multimatcher* mm,
+                          int (*cb)(void* parm, blen_t pos, blen_t which),
+                          void* parm)
+{
+  if (rstring_view_bad(rstr)) { return RERROR; }
+  if (mm == NULL || cb == NULL) { return RERROR; }
+
+  int nc = mm->nclasses;
+  int s = 0;
+  int ret;
+
+  for (blen_t i = 0; i < rstr->slen; ++i) {
+    s = mm->delta[s * nc + mm->cls[rstr->data[i]]];
+
+    for (int o = mm->out[s]; o >= 0; o = mm->next_out[o]) {
+      ret = cb(parm, i + 1 - mm->depth[o], mm->pat[o]);
+      if (ret < 0) { return ret; }
+    }
+  }
+
+  return ROKAY;
+}
+
+/**
+ * @brief Counts the matches rstring_scan_multimatcher() would report.
+ *
+ * @retval count The number of occurences, overlapping ones included, of all the patterns of mm in rstr.
+ * @retval RERROR Either input is invalid.
+ */
+blen_t
+rstring_count_multimatcher(const rstring* rstr, const rstring_multimatcher* mm)
+{
+  if (rstring_view_bad(rstr)) { return RERROR; }
+  if (mm == NULL) { return RERROR; }
+
+  int nc = mm->nclasses;
+  int s = 0;
+  blen_t count = 0;
+
+  for (blen_t i = 0; i < rstr->slen; ++i) {
+    s = mm->delta[s * nc + mm->cls[rstr->data[i]]];
+
+    for (int o = mm->out[s]; o >= 0; o = mm->next_out[o]) { ++count; }
+  }
+
+  return count;
+}
+
+/**
+ * @brief Replace every pattern of mm with its entry in replacements, like Ruby's `gsub(Regexp.union(hash.keys), hash)`.
+ *
+ * rstr is searched left to right.  Each match is the leftmost one (longest first, if several start at the same place), and searching then goes on after it, so replacements never overlap and are not searched again.
+ *
+ * @code
+rstring_array* from = rstring_split_cstr(rstring_new("cat dog"), " ");
+rstring_array* to = rstring_split_cstr(rstring_new("dog cat"), " ");
+rstring_multimatcher* mm = rstring_multimatcher_new(from, 0);
+
+rstring* actual = rstring_gsub_multimatcher(RSTR_LIT("cat chases dog"), mm, to);
+// actual is "dog chases cat"
+ * @endcode
+ *
+ * @param rstr The rstring for replacing.
+ * @param mm The patterns to search for.
+ * @param replacements replacements->entry[i] replaces pattern i.  It must have one entry per pattern.
+ *
+ * @retval rstring* A valid rstring with the replacements made.
+ * @retval NULL Any of the args are invalid or there were errors.
+ */
+rstring*
+rstring_gsub_multimatcher(const rstring* rstr, const rstring_multimatcher* mm, const rstring_array* replacements)
+{
+  if (rstring_view_bad(rstr)) { return NULL; }
+  if (mm == NULL) { return NULL; }
+  if (rstring_array_bad(replacements) || replacements->qty != mm->qty) { return NULL; }
+  for (blen_t i = 0; i < replacements->qty; ++i) {
+    if (rstring_view_bad(replacements->entry[i])) { return NULL; }
+  }
+
+  rstring* result = (rstring*)bfromcstralloc(rstr->slen + 1, "");
+  if (rstring_bad(result)) { return NULL; }
+
+  blen_t pos = 0;
+  blen_t which = 0;
+  blen_t start;
+
+  while (pos < rstr->slen &&
+         (start = rstring__multimatcher_find(mm,
+                                             rstr->data + pos,
+                                             rstr->slen - pos,
+                                             &which)) >= 0) {
+    const rstring* repl = replacements->entry[which];
+
+    if (bcatblk(result, rstr->data + pos, start) != BSTR_OK ||
+        bcatblk(result, repl->data, repl->slen) != BSTR_OK) {
+      rstring_free(result);
+      return NULL;
+    }
+    pos += start + mm->lens[which];
+  }
+
+  if (bcatblk(result, rstr->data + pos, rstr->slen - pos) != BSTR_OK) {
+    rstring_free(result);
+    return NULL;
+  }
+
+  return result;
+}
+
+struct rstring_charclass {
+  struct bstr__charclass cc;
+};
+
+/**
+ * @brief Prepare a set of bytes for searching.
+ *
+ * @code
+// Find the first byte that is not a DNA base.
+rstring_charclass* cc = rstring_charclass_new_cstr("ACGTacgt", RSTRING_CHARCLASS_INVERT);
+
+blen_t bad = rstring_index_charclass(seq, cc);
+
+rstring_charclass_free(cc);
+ * @endcode
+ *
+ * @param chars The bytes in the class.  Order and repeats don't matter.  (Not modified.)
+ * @param flags 0 or RSTRING_CHARCLASS_INVERT.
+ *
+ * @retval rstring_charclass* A new char class.
+ * @retval NULL chars is invalid or there were errors.
+ *
+ * @warning The caller must free the result with rstring_charclass_free().
+ */
+rstring_charclass*
+rstring_charclass_new(const rstring* chars, int flags)
+{
+  if (rstring_view_bad(chars)) { return NULL; }
+  if ((flags & ~RSTRING_CHARCLASS_INVERT) != 0) { return NULL; }
+
+  rstring_charclass* cc = malloc(sizeof(rstring_charclass));
+  if (cc == NULL) { return NULL; }
+
+  bstr__charclass_init(&cc->cc,
+                       chars->data,
+                       chars->slen,
+                       (flags & RSTRING_CHARCLASS_INVERT) != 0);
+
+  return cc;
+}
+
+/**
+ * @brief Wraps rstring_charclass_new() but takes char* for chars.
+ */
+rstring_charclass*
+rstring_charclass_new_cstr(const char* chars, int flags)
+{
+  rstring_view rchars = rstring_view_of_cstr(chars);
+
+  return rstring_charclass_new(&rchars, flags);
+}
+
+/**
+ * @brief Free a char class made by rstring_charclass_new().
+ *
+ * @retval ROKAY The char class was freed.
+ * @retval RERROR The char class is NULL.
+ */
+int
+rstring_charclass_free(rstring_charclass* cc)
+{
+  if (cc == NULL) { return RERROR; }
+
+  free(cc);
+
+  return ROKAY;
+}
+
+/**
+ * @brief Tells the first byte of rstr that is in the class.
+ *
+ * @retval index The index of the first byte of rstr in the class.
+ * @retval RERROR Either input is invalid or no byte of rstr is in the class.
+ */
+blen_t
+rstring_index_charclass(const rstring* rstr, const rstring_charclass* cc)
+{
+  return rstring_index_offset_charclass(rstr, cc, 0);
+}
+
+/**
+ * @brief Like rstring_index_charclass() but starts looking at offset.
+ *
+ * @retval index The index of the first byte (>= offset) of rstr in the class.
+ * @retval RERROR Either input is invalid, offset is out of range, or no byte of rstr after the offset is in the class.
+ */
+blen_t
+rstring_index_offset_charclass(const rstring* rstr, const rstring_charclass* cc, blen_t offset)
+{
+  if (rstring_view_bad(rstr)) { return RERROR; }
+  if (cc == NULL) { return RERROR; }
+  if (offset < 0 || offset > rstr->slen) { return RERROR; }
+
+  blen_t val = bstr__kernels->find_class(rstr->data + offset,
+                                         rstr->slen - offset,
+                                         &cc->cc);
+
+  return val < 0 ? RERROR : offset + val;
+}
+
+/**
+ * @brief Tells the last byte of rstr that is in the class.
+ *
+ * @retval index The index of the last byte of rstr in the class.
+ * @retval RERROR Either input is invalid or no byte of rstr is in the class.
+ */
+blen_t
+rstring_rindex_charclass(const rstring* rstr, const rstring_charclass* cc)
+{
+  if (rstring_view_bad(rstr)) { return RERROR; }
+  if (cc == NULL) { return RERROR; }
+
+  blen_t val = bstr__kernels->find_last_class(rstr->data, rstr->slen, &cc->cc);
+
+  return val < 0 ? RERROR : val;
+}
+
+/**
+ * @brief Split rstr on every byte in the class.
+ *
+ * Like rstring_split() with a separator of one byte, but any byte of the class separates fields.  Back to back separators give empty fields.
+ *
+ * @retval rstring_array* The fields of rstr.
+ * @retval NULL Either input is invalid or there were errors.
+ */
+rstring_array*
+rstring_split_charclass(rstring* rstr, const rstring_charclass* cc)
+{
+  if (rstring_view_bad(rstr)) { return NULL; }
+  if (cc == NULL) { return NULL; }
+
+  return bstr__splits(rstr, &cc->cc);
+}
+
+/* Reads a character spec for tr, delete, squeeze and count one byte at a
+   time, as Ruby does: a-z is a range, a backslash makes the byte after it
+   plain (so \- and \^ are a '-' and a '^'), and a '-' at either end is
+   just a '-'.  The leading ^ of a negated spec is skipped by the caller. */
+struct rstring__tr_cursor {
+  const unsigned char* p;
+  const unsigned char* end;
+  int now;
+  int max;
+};
+
+static void
+rstring__tr_start(struct rstring__tr_cursor* t, const rstring* spec, int skip)
+{
+  t->p = spec->data + skip;
+  t->end = spec->data + spec->slen;
+  t->now = t->max = 0;
+}
+
+/* The next byte of the spec, -1 at its end, or -2 for a range that goes
+   backwards, like z-a. */
+static int
+rstring__tr_next(struct rstring__tr_cursor* t)
+{
+  if (t->now < t->max) { return ++t->now; }
+  if (t->p == t->end) { return -1; }
+
+  if (*t->p == '\\' && t->p + 1 < t->end) { t->p++; }
+  t->now = t->max = *t->p++;
+
+  if (t->p + 1 < t->end && *t->p == '-') {
+    t->max = t->p[1];
+    t->p += 2;
+    if (t->max < t->now) { return -2; }
+  }
+
+  return t->now;
+}
+
+/* Is spec negated, that is does it start with a ^ that isn't all of it? */
+#define rstring__tr_negated(spec) ((spec)->slen > 1 && (spec)->data[0] == '^')
+
+/* Compile the bytes of spec into cc. */
+static int
+rstring__tr_class(struct bstr__charclass* cc, const rstring* spec)
+{
+  unsigned char seen[UCHAR_MAX + 1] = { 0 };
+  unsigned char bytes[UCHAR_MAX + 1];
+  int n = 0;
+  int c;
+
+  int negated = rstring__tr_negated(spec);
+  struct rstring__tr_cursor t;
+  rstring__tr_start(&t, spec, negated);
+
+  while ((c = rstring__tr_next(&t)) >= 0) {
+    if (!seen[c]) { seen[c] = 1; bytes[n++] = (unsigned char)c; }
+  }
+  if (c == -2) { return RERROR; }
+
+  bstr__charclass_init(cc, bytes, n, negated);
+
+  return ROKAY;
+}
+
+/* Compile the translation of from to (a non-empty) to into t, and the
+   bytes it changes into changed.  Bytes of from past the end of to become
+   its last byte, and with a negated from every byte not in it does.  Both
+   specs are checked all the way through, so a backwards range anywhere is
+   an error whatever the input. */
+static int
+rstring__tr_table(struct bstr__trtable* t,
+                  struct bstr__charclass* changed,
+                  const rstring* from,
+                  const rstring* to)
+{
+  struct rstring__tr_cursor f, r;
+  int c, repl = -1;
+
+  for (c = 0; c <= UCHAR_MAX; ++c) { t->map[c] = (unsigned char)c; }
+
+  rstring__tr_start(&r, to, 0);
+  if (rstring__tr_negated(from)) {
+    struct bstr__charclass rest;
+    if (rstring__tr_class(&rest, from) != ROKAY) { return RERROR; }
+    while ((c = rstring__tr_next(&r)) >= 0) { repl = c; }
+    if (c == -2 || repl < 0) { return RERROR; }
+    for (c = 0; c <= UCHAR_MAX; ++c) {
+      if (rest.in[c]) { t->map[c] = (unsigned char)repl; }
+    }
+  }
+  else {
+    rstring__tr_start(&f, from, 0);
+    while ((c = rstring__tr_next(&f)) >= 0) {
+      int next = rstring__tr_next(&r);
+      if (next == -2 || (next == -1 && repl < 0)) { return RERROR; }
+      if (next >= 0) { repl = next; }
+      t->map[c] = (unsigned char)repl;
+    }
+    if (c == -2) { return RERROR; }
+
+    /* Unlike Ruby, the unused rest of to must be valid too. */
+    while ((c = rstring__tr_next(&r)) >= 0) { }
+    if (c == -2) { return RERROR; }
+  }
+
+  unsigned char bytes[UCHAR_MAX + 1];
+  int n = 0;
+  for (c = 0; c <= UCHAR_MAX; ++c) {
+    if (t->map[c] != c) { bytes[n++] = (unsigned char)c; }
+  }
+  bstr__charclass_init(changed, bytes, n, 0);
+  bstr__trtable_init(t);
+
+  return ROKAY;
+}
+
+/**
+ * @brief Returns a copy of rstr with the bytes in from replaced by the ones in the same place in to, like Ruby's String#tr.
+ *
+ * from and to are character specs: a-z stands for the bytes a through z, a backslash makes the byte after it plain (so "\\-" is a '-'), and a '-' at either end is just a '-'.  If from starts with ^ (and has more after it) it stands for every byte not listed.  Bytes of from past the end of to become the last byte of to, and if to is empty the bytes of from are deleted, as rstring_delete() would.
+ *
+ * @code
+rstring* dna = rstring_new("GATTACA");
+rstring* complement = rstring_tr_cstr(dna, "ACGT", "TGCA");
+rstring_reverse_bang(complement);
+
+assert(rstring_eql_cstr(complement, "TGTAATC") == RTRUE);
+
+... code to free variables here ...
+ * @endcode
+ *
+ * @param rstr The rstring to translate. (Not modified.)
+ * @param from The bytes to replace.
+ * @param to What to replace them with.
+ *
+ * @retval rstring* The translated copy.
+ * @retval NULL Any of the args are invalid, either spec has a backwards range (like z-a), or there were errors.  The specs are checked in full even when rstr is empty or only part of to is used.
+ *
+ * @note The whole table is built first and then applied in one pass, a vector of bytes at a time where the CPU allows it.
+ *
+ * @warning The caller must free the result.
+ */
+rstring*
+rstring_tr(const rstring* rstr, const rstring* from, const rstring* to)
+{
+  if (rstring_view_bad(rstr)) { return NULL; }
+  if (rstring_view_bad(from)) { return NULL; }
+  if (rstring_view_bad(to)) { return NULL; }
+
+  if (to->slen == 0) { return rstring_delete(rstr, from); }
+
+  struct bstr__trtable t;
+  struct bstr__charclass changed;
+  if (rstring__tr_table(&t, &changed, from, to) != ROKAY) { return NULL; }
+
+  /* With nothing to change the copy can share rstr's bytes. */
+  if (bstr__kernels->find_class(rstr->data, rstr->slen, &changed) < 0) {
+    return rstring_copy(rstr);
+  }
+
+  rstring* result = (rstring*)bfromcstralloc(rstr->slen + 1, "");
+  if (rstring_bad(result)) { return NULL; }
+
+  bstr__kernels->translate(result->data, rstr->data, rstr->slen, &t);
+  result->slen = rstr->slen;
+  result->data[result->slen] = '\0';
+
+  return result;
+}
+
+/**
+ * @brief Wraps rstring_tr() but takes char* for from and to.
+ */
+rstring*
+rstring_tr_cstr(const rstring* rstr, const char* from, const char* to)
+{
+  if (from == NULL) { return NULL; }
+  if (to == NULL) { return NULL; }
+
+  rstring_view rfrom = rstring_view_of_cstr(from);
+  rstring_view rto = rstring_view_of_cstr(to);
+
+  return rstring_tr(rstr, &rfrom, &rto);
+}
+
+/**
+ * @brief Replaces the bytes of rstr in from by the ones in the same place in to, like rstring_tr() but in place.
+ *
+ * @retval RTRUE Some bytes were changed (or deleted).
+ * @retval RFALSE Nothing was changed, so rstr was not touched.
+ * @retval RERROR Any of the args are invalid, either spec has a backwards range, or there was an error.
+ */
+int
+rstring_tr_bang(rstring* rstr, const rstring* from, const rstring* to)
+{
+  if (rstring_bad(rstr)) { return RERROR; }
+  if (rstring_view_bad(from)) { return RERROR; }
+  if (rstring_view_bad(to)) { return RERROR; }
+
+  if (to->slen == 0) { return rstring_delete_bang(rstr, from); }
+
+  struct bstr__trtable t;
+  struct bstr__charclass changed;
+  if (rstring__tr_table(&t, &changed, from, to) != ROKAY) { return RERROR; }
+
+  blen_t first = bstr__kernels->find_class(rstr->data, rstr->slen, &changed);
+  if (first < 0) { return RFALSE; }
+
+  if (bstr__unshare(rstr) != BSTR_OK) { return RERROR; }
+
+  bstr__kernels->translate(rstr->data + first,
+                           rstr->data + first,
+                           rstr->slen - first,
+                           &t);
+
+  return RTRUE;
+}
+
+/**
+ * @brief Wraps rstring_tr_bang() but takes char* for from and to.
+ */
+int
+rstring_tr_cstr_bang(rstring* rstr, const char* from, const char* to)
+{
+  if (from == NULL) { return RERROR; }
+  if (to == NULL) { return RERROR; }
+
+  rstring_view rfrom = rstring_view_of_cstr(from);
+  rstring_view rto = rstring_view_of_cstr(to);
+
+  return rstring_tr_bang(rstr, &rfrom, &rto);
+}
+
+/**
+ * @brief Returns a copy of rstr without the bytes in chars, like Ruby's String#delete.
+ *
+ * @code
+rstring* rstr = rstring_delete_cstr(RSTR_LIT("hello world"), "l-o");
+
+assert(rstring_eql_cstr(rstr, "he wrd") == RTRUE);
+ * @endcode
+ *
+ * @param rstr The rstring to delete from. (Not modified.)
+ * @param chars The bytes to delete, a spec as for rstring_tr(), so "^0-9" deletes all but digits.
+ *
+ * @retval rstring* The copy.
+ * @retval NULL Either arg is invalid, chars has a backwards range, or there were errors.
+ *
+ * @warning The caller must free the result.
+ */
+rstring*
+rstring_delete(const rstring* rstr, const rstring* chars)
+{
+  if (rstring_view_bad(rstr)) { return NULL; }
+  if (rstring_view_bad(chars)) { return NULL; }
+
+  struct bstr__charclass cc;
+  if (rstring__tr_class(&cc, chars) != ROKAY) { return NULL; }
+
+  if (bstr__kernels->find_class(rstr->data, rstr->slen, &cc) < 0) {
+    return rstring_copy(rstr);
+  }
+
+  rstring* result = (rstring*)bfromcstralloc(rstr->slen + 1, "");
+  if (rstring_bad(result)) { return NULL; }
+
+  result->slen = bstr__kernels->delete_class(result->data, rstr->data, rstr->slen, &cc);
+  result->data[result->slen] = '\0';
+
+  return result;
+}
+
+/**
+ * @brief Wraps rstring_delete() but takes char* for chars.
+ */
+rstring*
+rstring_delete_cstr(const rstring* rstr, const char* chars)
+{
+  if (chars == NULL) { return NULL; }
+
+  rstring_view rchars = rstring_view_of_cstr(chars);
+
+  return rstring_delete(rstr, &rchars);
+}
+
+/**
+ * @brief Deletes the bytes in chars from rstr, like rstring_delete() but in place.
+ *
+ * @retval RTRUE Some bytes were deleted.
+ * @retval RFALSE None of the bytes of rstr are in chars, so rstr was not touched.
+ * @retval RERROR Either arg is invalid, chars has a backwards range, or there was an error.
+ */
+int
+rstring_delete_bang(rstring* rstr, const rstring* chars)
+{
+  if (rstring_bad(rstr)) { return RERROR; }
+  if (rstring_view_bad(chars)) { return RERROR; }
+
+  struct bstr__charclass cc;
+  if (rstring__tr_class(&cc, chars) != ROKAY) { return RERROR; }
+
+  blen_t first = bstr__kernels->find_class(rstr->data, rstr->slen, &cc);
+  if (first < 0) { return RFALSE; }
+
+  if (bstr__unshare(rstr) != BSTR_OK) { return RERROR; }
+
+  rstr->slen = first + bstr__kernels->delete_class(rstr->data + first,
+                                                   rstr->data + first,
+                                                   rstr->slen - first,
+                                                   &cc);
+  rstr->data[rstr->slen] = '\0';
+
+  return RTRUE;
+}
+
+/**
+ * @brief Wraps rstring_delete_bang() but takes char* for chars.
+ */
+int
+rstring_delete_cstr_bang(rstring* rstr, const char* chars)
+{
+  if (chars == NULL) { return RERROR; }
+
+  rstring_view rchars = rstring_view_of_cstr(chars);
+
+  return rstring_delete_bang(rstr, &rchars);
+}
+
+/* Compile chars, or every byte if it is NULL, for squeezing. */
+static int
+rstring__squeeze_class(struct bstr__charclass* cc, const rstring* chars)
+{
+  if (chars == NULL) {
+    bstr__charclass_init(cc, (const unsigned char*)"", 0, 1);
+    return ROKAY;
+  }
+  if (rstring_view_bad(chars)) { return RERROR; }
+
+  return rstring__tr_class(cc, chars);
+}
+
+/**
+ * @brief Returns a copy of rstr with each run of the same byte from chars cut down to one, like Ruby's String#squeeze.
+ *
+ * @code
+rstring* rstr = rstring_squeeze_cstr(RSTR_LIT("too    many  spaces"), " ");
+
+assert(rstring_eql_cstr(rstr, "too many spaces") == RTRUE);
+ * @endcode
+ *
+ * @param rstr The rstring to squeeze. (Not modified.)
+ * @param chars The bytes to squeeze, a spec as for rstring_tr(), or NULL for every byte (like squeeze with no args in Ruby).
+ *
+ * @retval rstring* The copy.
+ * @retval NULL rstr or chars is invalid, chars has a backwards range, or there were errors.
+ *
+ * @warning The caller must free the result.
+ */
+rstring*
+rstring_squeeze(const rstring* rstr, const rstring* chars)
+{
+  if (rstring_view_bad(rstr)) { return NULL; }
+
+  struct bstr__charclass cc;
+  if (rstring__squeeze_class(&cc, chars) != ROKAY) { return NULL; }
+
+  if (bstr__kernels->find_squeeze(rstr->data, rstr->slen, &cc) < 0) {
+    return rstring_copy(rstr);
+  }
+
+  rstring* result = (rstring*)bfromcstralloc(rstr->slen + 1, "");
+  if (rstring_bad(result)) { return NULL; }
+
+  result->slen = bstr__kernels->squeeze_class(result->data, rstr->data, rstr->slen, &cc);
+  result->data[result->slen] = '\0';
+
+  return result;
+}
+
+/**
+ * @brief Wraps rstring_squeeze() but takes char* for chars (which may still be NULL).
+ */
+rstring*
+rstring_squeeze_cstr(const rstring* rstr, const char* chars)
+{
+  if (chars == NULL) { return rstring_squeeze(rstr, NULL); }
+
+  rstring_view rchars = rstring_view_of_cstr(chars);
+
+  return rstring_squeeze(rstr, &rchars);
+}
+
+/**
+ * @brief Cuts each run of the same byte from chars in rstr down to one, like rstring_squeeze() but in place.
+ *
+ * @retval RTRUE Some bytes were removed.
+ * @retval RFALSE There was nothing to squeeze, so rstr was not touched.
+ * @retval RERROR rstr or chars is invalid, chars has a backwards range, or there was an error.
+ */
+int
+rstring_squeeze_bang(rstring* rstr, const rstring* chars)
+{
+  if (rstring_bad(rstr)) { return RERROR; }
+
+  struct bstr__charclass cc;
+  if (rstring__squeeze_class(&cc, chars) != ROKAY) { return RERROR; }
+
+  blen_t first = bstr__kernels->find_squeeze(rstr->data, rstr->slen, &cc);
+  if (first < 0) { return RFALSE; }
+
+  if (bstr__unshare(rstr) != BSTR_OK) { return RERROR; }
+
+  /* Start at the byte the first run repeats, so it is kept. */
+  rstr->slen = first - 1 + bstr__kernels->squeeze_class(rstr->data + first - 1,
+                                                        rstr->data + first - 1,
+                                                        rstr->slen - first + 1,
+                                                        &cc);
+  rstr->data[rstr->slen] = '\0';
+
+  return RTRUE;
+}
+
+/**
+ * @brief Wraps rstring_squeeze_bang() but takes char* for chars (which may still be NULL).
+ */
+int
+rstring_squeeze_cstr_bang(rstring* rstr, const char* chars)
+{
+  if (chars == NULL) { return rstring_squeeze_bang(rstr, NULL); }
+
+  rstring_view rchars = rstring_view_of_cstr(chars);
+
+  return rstring_squeeze_bang(rstr, &rchars);
+}
+
+/**
+ * @brief Counts the bytes of rstr that are in chars, like Ruby's String#count.
+ *
+ * @code
+blen_t gc = rstring_count_cstr(RSTR_LIT("GATTACA"), "GC");
+
+assert(gc == 2);
+ * @endcode
+ *
+ * @param rstr The rstring to count in.
+ * @param chars The bytes to count, a spec as for rstring_tr().
+ *
+ * @retval count How many bytes of rstr are in chars.
+ * @retval RERROR Either arg is invalid or chars has a backwards range.
+ */
+blen_t
+rstring_count(const rstring* rstr, const rstring* chars)
+{
+  if (rstring_view_bad(rstr)) { return RERROR; }
+  if (rstring_view_bad(chars)) { return RERROR; }
+
+  struct bstr__charclass cc;
+  if (rstring__tr_class(&cc, chars) != ROKAY) { return RERROR; }
+
+  return bstr__kernels->count_class(rstr->data, rstr->slen, &cc);
+}
+
+/**
+ * @brief Wraps rstring_count() but takes char* for chars.
+ */
+blen_t
+rstring_count_cstr(const rstring* rstr, const char* chars)
+{
+  if (chars == NULL) { return RERROR; }
+
+  rstring_view rchars = rstring_view_of_cstr(chars);
+
+  return rstring_count(rstr, &rchars);
+}
+
+/* Kinds of node in a parsed pattern. */
+#define RSTRING__RE_EMPTY 0
+#define RSTRING__RE_SET 1
+#define RSTRING__RE_CAT 2
+#define RSTRING__RE_ALT 3
+#define RSTRING__RE_REPEAT 4
+#define RSTRING__RE_GROUP 5
+#define RSTRING__RE_ASSERT 6
+
+/* Program instructions.  SET consumes a byte of sets[x] and carries on
+   with the next instruction, SPLIT carries on at both x and y (x first),
+   JMP at x, SAVE records the position in capture slot x, ASSERT checks
+   the zero width condition x, and MATCH is a match.  LOOP and AGAIN are
+   the SPLIT in front of and the JMP back at the end of a * loop whose
+   body can match nothing, at nesting level z: LOOP is a SPLIT with the
+   body at the next instruction, and AGAIN goes back to the LOOP at x, or
+   on to y if the pass through the body matched nothing. */
+#define RSTRING__RE_I_SET 0
+#define RSTRING__RE_I_SPLIT 1
+#define RSTRING__RE_I_JMP 2
+#define RSTRING__RE_I_SAVE 3
+#define RSTRING__RE_I_ASSERT 4
+#define RSTRING__RE_I_MATCH 5
+#define RSTRING__RE_I_LOOP 6
+#define RSTRING__RE_I_AGAIN 7
+
+/* Zero width conditions: ^ $ \A \z \b \B.  In the reversed program they
+   are or'ed with RSTRING__RE_BACKWARDS, as the bytes either side of a
+   position then come the other way round. */
+#define RSTRING__RE_BOL 0
+#define RSTRING__RE_EOL 1
+#define RSTRING__RE_BOT 2
+#define RSTRING__RE_EOT 3
+#define RSTRING__RE_WORDB 4
+#define RSTRING__RE_NWORDB 5
+#define RSTRING__RE_BACKWARDS 8
+
+/* Limits that keep compiling hostile patterns cheap.  MAX_KEYS bounds
+   the instructions times the LOOP levels (see rstring__re_closure). */
+#define RSTRING__RE_MAX_INSTS 100000
+#define RSTRING__RE_MAX_KEYS (4 * RSTRING__RE_MAX_INSTS)
+#define RSTRING__RE_MAX_REPEAT 1000
+#define RSTRING__RE_MAX_DEPTH 200
+
+#define rstring__re_inset(set, c) (((set)[(c) >> 3] >> ((c) & 7)) & 1)
+#define rstring__re_isword(c) ((c) >= 0 && ((c) == '_' || ((c) >= '0' && (c) <= '9') || ((c) >= 'A' && (c) <= 'Z') || ((c) >= 'a' && (c) <= 'z')))
+
+struct rstring__re_node {
+  int kind;
+  /* First and last child and the siblings, or -1. */
+  int child, last, next, prev;
+  /* The set, group number or condition. */
+  int arg;
+  /* Repeat counts (max is -1 for no limit) and whether it is greedy. */
+  int min, max, greedy;
+};
+
+struct rstring__re_inst {
+  int op, x, y, z;
+};
+
+struct rstring__re_parser {
+  const unsigned char* p;
+  const unsigned char* end;
+  int flags;
+  int depth;
+  int ngroups;
+  int err;
+  struct rstring__re_node* nodes;
+  int nnodes, mnodes;
+  unsigned char (*sets)[32];
+  int nsets, msets;
+};
+
+struct rstring__re_compiler {
+  const struct rstring__re_node* nodes;
+  struct rstring__re_inst* prog;
+  int n, m;
+  int reverse;
+  int err;
+  /* The LOOP level being compiled, and one more than the deepest. */
+  int level, levels;
+};
+
+/* A DFA state: the program counters it stands for, in priority order,
+   what kind of byte came before (flags & 3, see rstring__re_kind) and
+   whether a match ended just before the byte that led here (flags & 4).
+   next[k] is the state after a byte of class k, or NULL if not worked out
+   yet.  The pcs follow next[]. */
+struct rstring__re_state {
+  unsigned flags;
+  int ninst;
+  unsigned hash;
+  struct rstring__re_state* next[];
+};
+
+#define RSTRING__RE_MATCHED 4
+
+/* A lazily built DFA over one program.  The states live in one block of
+   memory that grows to RLIB_REGEX_CACHE_SIZE and is then emptied when
+   full, and are found again through the hash table. */
+struct rstring__re_dfa {
+  const struct rstring__re_inst* prog;
+  int start;
+  int longest;
+  unsigned char* block;
+  size_t used, size;
+  struct rstring__re_state** table;
+  size_t tabsize;
+  size_t nstates;
+  unsigned long flushes;
+  blen_t flush_pos;
+};
+
+struct rstring_regex {
+  int flags;
+  /* Capture groups, not counting the whole match. */
+  int ngroups;
+
+  unsigned char (*sets)[32];
+  int nsets;
+
+  /* The forward program starts with a loop at 0 that lets the pattern
+     (at start) begin anywhere.  The reversed program is the pattern
+     backwards, with no captures. */
+  struct rstring__re_inst* prog;
+  int ninst, start;
+  struct rstring__re_inst* rprog;
+  int nrinst;
+
+  /* Bytes that are in the same sets and play the same part for the
+     anchors share a DFA column.  rep[k] is a byte of class k, and class
+     nclasses (with rep -1) is the end of the text. */
+  unsigned char cls[UCHAR_MAX + 1];
+  int rep[UCHAR_MAX + 2];
+  int nclasses;
+
+  struct rstring__re_dfa fwd;
+  struct rstring__re_dfa rev;
+
+  /* Scratch space for following the programs.  The stack and the marks
+     are of keys, pc * levels + the LOOP level a path entered (see
+     rstring__re_closure). */
+  int levels;
+  int* stack;
+  unsigned* mark;
+  unsigned gen;
+  int* list;
+  int* list2;
+};
+
+static int
+rstring__re_node_new(struct rstring__re_parser* ps, int kind)
+{
+  if (ps->nnodes == ps->mnodes) {
+    int m = ps->mnodes ? 2 * ps->mnodes : 32;
+    struct rstring__re_node* t = realloc(ps->nodes, sizeof(*t) * (size_t)m);
+    if (t == NULL) { ps->err = 1; return -1; }
+    ps->nodes = t;
+    ps->mnodes = m;
+  }
+
+  struct rstring__re_node* nd = &ps->nodes[ps->nnodes];
+  nd->kind = kind;
+  nd->child = nd->last = nd->next = nd->prev = -1;
+  nd->arg = 0;
+  nd->min = nd->max = 0;
+  nd->greedy = 1;
+
+  return ps->nnodes++;
+}
+
+static void
+rstring__re_add_child(struct rstring__re_parser* ps, int parent, int child)
+{
+  struct rstring__re_node* p = &ps->nodes[parent];
+
+  ps->nodes[child].prev = p->last;
+  if (p->last < 0) { p->child = child; }
+  else { ps->nodes[p->last].next = child; }
+  p->last = child;
+}
+
+static int
+rstring__re_set_new(struct rstring__re_parser* ps)
+{
+  if (ps->nsets == ps->msets) {
+    int m = ps->msets ? 2 * ps->msets : 16;
+    unsigned char (*t)[32] = realloc(ps->sets, sizeof(*t) * (size_t)m);
+    if (t == NULL) { ps->err = 1; return -1; }
+    ps->sets = t;
+    ps->msets = m;
+  }
+  memset(ps->sets[ps->nsets], 0, 32);
+
+  return ps->nsets++;
+}
+
+static void
+rstring__re_set_range(unsigned char* set, int lo, int hi)
+{
+  for (int c = lo; c <= hi; ++c) { set[c >> 3] |= (unsigned char)(1 << (c & 7)); }
+}
+
+static void
+rstring__re_set_invert(unsigned char* set)
+{
+  for (int i = 0; i < 32; ++i) { set[i] = (unsigned char)~set[i]; }
+}
+
+static void
+rstring__re_set_fold(unsigned char* set)
+{
+  for (int c = 'a'; c <= 'z'; ++c) {
+    if (rstring__re_inset(set, c) || rstring__re_inset(set, c - 32)) {
+      rstring__re_set_range(set, c, c);
+      rstring__re_set_range(set, c - 32, c - 32);
+    }
+  }
+}
+
+/* Add the bytes of \d \w \s \h (or, in upper case, all the others) to
+   set.  Returns 0 if e is not one of those letters. */
+static int
+rstring__re_set_escape(unsigned char* set, int e)
+{
+  unsigned char t[32] = { 0 };
+
+  switch (e | 0x20) {
+  case 'd':
+    rstring__re_set_range(t, '0', '9');
+    break;
+  case 'w':
+    rstring__re_set_range(t, '0', '9');
+    rstring__re_set_range(t, 'A', 'Z');
+    rstring__re_set_range(t, 'a', 'z');
+    rstring__re_set_range(t, '_', '_');
+    break;
+  case 's':
+    rstring__re_set_range(t, '\t', '\r');
+    rstring__re_set_range(t, ' ', ' ');
+    break;
+  case 'h':
+    rstring__re_set_range(t, '0', '9');
+    rstring__re_set_range(t, 'A', 'F');
+    rstring__re_set_range(t, 'a', 'f');
+    break;
+  default:
+    return 0;
+  }
+  if (e >= 'A' && e <= 'Z') { rstring__re_set_invert(t); }
+  for (int i = 0; i < 32; ++i) { set[i] |= t[i]; }
+
+  return 1;
+}
+
+/* Add the bytes of a [:name:] class to set, ASCII only.  Returns 0 for
+   unknown names. */
+static int
+rstring__re_set_posix(unsigned char* set, const unsigned char* name, size_t len, int negate)
+{
+  static const char* const names[] = {
+    "alnum", "alpha", "blank", "cntrl", "digit", "graph", "lower",
+    "print", "punct", "space", "upper", "xdigit", "word"
+  };
+  unsigned char t[32] = { 0 };
+  int which = -1;
+
+  for (int i = 0; i < (int)(sizeof(names) / sizeof(names[0])); ++i) {
+    if (strlen(names[i]) == len && memcmp(names[i], name, len) == 0) { which = i; }
+  }
+
+  for (int c = 0; c < 128; ++c) {
+    int in = 0;
+    switch (which) {
+    case 0: in = isalnum(c); break;
+    case 1: in = isalpha(c); break;
+    case 2: in = c == ' ' || c == '\t'; break;
+    case 3: in = iscntrl(c); break;
+    case 4: in = isdigit(c); break;
+    case 5: in = isgraph(c); break;
+    case 6: in = islower(c); break;
+    case 7: in = isprint(c); break;
+    case 8: in = ispunct(c); break;
+    case 9: in = isspace(c); break;
+    case 10: in = isupper(c); break;
+    case 11: in = isxdigit(c); break;
+    case 12: in = isalnum(c) || c == '_'; break;
+    default: return 0;
+    }
+    if (in) { rstring__re_set_range(t, c, c); }
+  }
+  if (negate) { rstring__re_set_invert(t); }
+  for (int i = 0; i < 32; ++i) { set[i] |= t[i]; }
+
+  return 1;
+}
+
+static int
+rstring__re_hexval(int c)
+{
+  if (c >= '0' && c <= '9') { return c - '0'; }
+  if (c >= 'a' && c <= 'f') { return c - 'a' + 10; }
+  if (c >= 'A' && c <= 'F') { return c - 'A' + 10; }
+
+  return -1;
+}
+
+/* The byte a backslash escape stands for, e being the byte after the
+   backslash.  \x and \0 read their digits from ps. */
+static int
+rstring__re_escape_byte(struct rstring__re_parser* ps, int e)
+{
+  int v = 0;
+  int i = 0;
+
+  switch (e) {
+  case 'n': return '\n';
+  case 't': return '\t';
+  case 'r': return '\r';
+  case 'f': return '\f';
+  case 'v': return '\v';
+  case 'a': return '\a';
+  case 'e': return 27;
+  case '0':
+    for (i = 0; i < 2 && ps->p < ps->end && *ps->p >= '0' && *ps->p <= '7'; ++i) {
+      v = v * 8 + (*ps->p++ - '0');
+    }
+    return v;
+  case 'x':
+    for (i = 0; i < 2 && ps->p < ps->end && rstring__re_hexval(*ps->p) >= 0; ++i) {
+      v = v * 16 + rstring__re_hexval(*ps->p++);
+    }
+    if (i == 0) { ps->err = 1; }
+    return v;
+  default:
+    /* Back references, named groups, properties and \G are not
+       supported. */
+    if ((e >= '1' && e <= '9') || e == 'k' || e == 'g' || e == 'p' ||
+        e == 'P' || e == 'G' || e == 'Z') {
+      ps->err = 1;
+    }
+    return e;
+  }
+}
+
+static int
+rstring__re_parse_alt(struct rstring__re_parser* ps);
+
+static int
+rstring__re_parse_class(struct rstring__re_parser* ps)
+{
+  int s = rstring__re_set_new(ps);
+  if (s < 0) { return -1; }
+
+  unsigned char set[32] = { 0 };
+  int negate = 0;
+  int first = 1;
+
+  if (ps->p < ps->end && *ps->p == '^') { negate = 1; ++ps->p; }
+
+  for (;;) {
+    if (ps->p >= ps->end) { ps->err = 1; return -1; }
+
+    int c = *ps->p;
+    if (c == ']' && !first) { ++ps->p; break; }
+    first = 0;
+
+    if (c == '[' && ps->p + 1 < ps->end && ps->p[1] == ':') {
+      const unsigned char* name = ps->p + 2;
+      const unsigned char* q = name;
+      int neg = 0;
+      if (q < ps->end && *q == '^') { neg = 1; ++name; ++q; }
+      while (q + 1 < ps->end && !(q[0] == ':' && q[1] == ']')) { ++q; }
+      if (q + 1 >= ps->end ||
+          !rstring__re_set_posix(set, name, (size_t)(q - name), neg)) {
+        ps->err = 1;
+        return -1;
+      }
+      ps->p = q + 2;
+      continue;
+    }
+    /* Nested classes and && are not supported. */
+    if (c == '[' || (c == '&' && ps->p + 1 < ps->end && ps->p[1] == '&')) {
+      ps->err = 1;
+      return -1;
+    }
+
+    int lo = c;
+    ++ps->p;
+    if (c == '\\') {
+      if (ps->p >= ps->end) { ps->err = 1; return -1; }
+      int e = *ps->p++;
+      if (rstring__re_set_escape(set, e)) { continue; }
+      lo = (e == 'b') ? '\b' : rstring__re_escape_byte(ps, e);
+      if (ps->err) { return -1; }
+    }
+
+    int hi = lo;
+    if (ps->p + 1 < ps->end && ps->p[0] == '-' && ps->p[1] != ']') {
+      ++ps->p;
+      hi = *ps->p++;
+      if (hi == '\\') {
+        if (ps->p >= ps->end) { ps->err = 1; return -1; }
+        int e = *ps->p++;
+        if (rstring__re_set_escape(set, e)) { ps->err = 1; return -1; }
+        hi = (e == 'b') ? '\b' : rstring__re_escape_byte(ps, e);
+        if (ps->err) { return -1; }
+      }
+      if (hi < lo) { ps->err = 1; return -1; }
+    }
+    rstring__re_set_range(set, lo, hi);
+  }
+
+  if (ps->flags & RSTRING_REGEX_CASELESS) { rstring__re_set_fold(set); }
+  if (negate) { rstring__re_set_invert(set); }
+  memcpy(ps->sets[s], set, 32);
+
+  int nd = rstring__re_node_new(ps, RSTRING__RE_SET);
+  if (nd >= 0) { ps->nodes[nd].arg = s; }
+
+  return nd;
+}
+
+/* A node matching one byte of a set built by fill (a byte, or a class
+   escape when c is negative). */
+static int
+rstring__re_byte_node(struct rstring__re_parser* ps, int c, int escape)
+{
+  int s = rstring__re_set_new(ps);
+  if (s < 0) { return -1; }
+
+  if (escape) {
+    rstring__re_set_escape(ps->sets[s], escape);
+  }
+  else if (c < 0) {
+    /* . */
+    rstring__re_set_range(ps->sets[s], 0, UCHAR_MAX);
+    if (!(ps->flags & RSTRING_REGEX_MULTILINE)) {
+      ps->sets[s]['\n' >> 3] &= (unsigned char)~(1 << ('\n' & 7));
+    }
+  }
+  else {
+    rstring__re_set_range(ps->sets[s], c, c);
+    if (ps->flags & RSTRING_REGEX_CASELESS) { rstring__re_set_fold(ps->sets[s]); }
+  }
+
+  int nd = rstring__re_node_new(ps, RSTRING__RE_SET);
+  if (nd >= 0) { ps->nodes[nd].arg = s; }
+
+  return nd;
+}
+
+static int
+rstring__re_assert_node(struct rstring__re_parser* ps, int cond)
+{
+  int nd = rstring__re_node_new(ps, RSTRING__RE_ASSERT);
+  if (nd >= 0) { ps->nodes[nd].arg = cond; }
+
+  return nd;
+}
+
+static int
+rstring__re_parse_atom(struct rstring__re_parser* ps)
+{
+  int c = *ps->p++;
+  int e = 0;
+
+  switch (c) {
+  case '(': {
+    int group = 0;
+    if (ps->p + 1 < ps->end && ps->p[0] == '?' && ps->p[1] == ':') {
+      ps->p += 2;
+    }
+    else if (ps->p < ps->end && ps->p[0] == '?') {
+      /* Look arounds, atomic groups, options and named groups are not
+         supported. */
+      ps->err = 1;
+      return -1;
+    }
+    else {
+      group = ++ps->ngroups;
+    }
+
+    if (++ps->depth > RSTRING__RE_MAX_DEPTH) { ps->err = 1; return -1; }
+    int inner = rstring__re_parse_alt(ps);
+    --ps->depth;
+    if (inner < 0) { return -1; }
+    if (ps->p >= ps->end || *ps->p != ')') { ps->err = 1; return -1; }
+    ++ps->p;
+    if (group == 0) { return inner; }
+
+    int nd = rstring__re_node_new(ps, RSTRING__RE_GROUP);
+    if (nd < 0) { return -1; }
+    ps->nodes[nd].arg = group;
+    rstring__re_add_child(ps, nd, inner);
+    return nd;
+  }
+  case '[':
+    return rstring__re_parse_class(ps);
+  case '.':
+    return rstring__re_byte_node(ps, -1, 0);
+  case '^':
+    return rstring__re_assert_node(ps, RSTRING__RE_BOL);
+  case '$':
+    return rstring__re_assert_node(ps, RSTRING__RE_EOL);
+  case '*':
+  case '+':
+  case '?':
+    /* Nothing to repeat. */
+    ps->err = 1;
+    return -1;
+  case '\\':
+    if (ps->p >= ps->end) { ps->err = 1; return -1; }
+    e = *ps->p++;
+    switch (e) {
+    case 'A': return rstring__re_assert_node(ps, RSTRING__RE_BOT);
+    case 'z': return rstring__re_assert_node(ps, RSTRING__RE_EOT);
+    case 'b': return rstring__re_assert_node(ps, RSTRING__RE_WORDB);
+    case 'B': return rstring__re_assert_node(ps, RSTRING__RE_NWORDB);
+    case 'd': case 'D': case 'w': case 'W':
+    case 's': case 'S': case 'h': case 'H':
+      return rstring__re_byte_node(ps, 0, e);
+    default:
+      c = rstring__re_escape_byte(ps, e);
+      if (ps->err) { return -1; }
+      return rstring__re_byte_node(ps, c, 0);
+    }
+  default:
+    return rstring__re_byte_node(ps, c, 0);
+  }
+}
+
+/* Read a {n}, {n,}, {,m} or {n,m} repeat.  Returns 0 (and reads nothing)
+   if the brace does not start one, in which case it is a plain '{'. */
+static int
+rstring__re_parse_braces(struct rstring__re_parser* ps, int* min, int* max)
+{
+  const unsigned char* q = ps->p + 1;
+  long lo = -1;
+  long hi = -1;
+
+  if (q < ps->end && isdigit(*q)) {
+    for (lo = 0; q < ps->end && isdigit(*q); ++q) {
+      if ((lo = lo * 10 + (*q - '0')) > RSTRING__RE_MAX_REPEAT) { ps->err = 1; }
+    }
+  }
+  if (q < ps->end && *q == ',') {
+    ++q;
+    if (q < ps->end && isdigit(*q)) {
+      for (hi = 0; q < ps->end && isdigit(*q); ++q) {
+        if ((hi = hi * 10 + (*q - '0')) > RSTRING__RE_MAX_REPEAT) { ps->err = 1; }
+      }
+    }
+    if (lo < 0 && hi < 0) { return 0; }
+    if (lo < 0) { lo = 0; }
+  }
+  else {
+    if (lo < 0) { return 0; }
+    hi = lo;
+  }
+  if (q >= ps->end || *q != '}') { return 0; }
+  if (hi >= 0 && hi < lo) { ps->err = 1; }
+
+  ps->p = q + 1;
+  *min = (int)lo;
+  *max = (int)hi;
+
+  return 1;
+}
+
+static int
+rstring__re_parse_repeat(struct rstring__re_parser* ps)
+{
+  int atom = rstring__re_parse_atom(ps);
+  int wraps = 0;
+
+  while (atom >= 0 && ps->p < ps->end) {
+    int min = 0;
+    int max = -1;
+    int c = *ps->p;
+
+    if (c == '*') { ++ps->p; }
+    else if (c == '+') { ++ps->p; min = 1; }
+    else if (c == '?') { ++ps->p; max = 1; }
+    else if (c != '{' || !rstring__re_parse_braces(ps, &min, &max)) { break; }
+    if (ps->err) { return -1; }
+
+    int nd = rstring__re_node_new(ps, RSTRING__RE_REPEAT);
+    if (nd < 0) { return -1; }
+    ps->nodes[nd].min = min;
+    ps->nodes[nd].max = max;
+    if (ps->p < ps->end && *ps->p == '?') {
+      ps->nodes[nd].greedy = 0;
+      ++ps->p;
+    }
+    else if (ps->p < ps->end && *ps->p == '+') {
+      /* Possessive repeats are not supported. */
+      ps->err = 1;
+      return -1;
+    }
+    rstring__re_add_child(ps, nd, atom);
+    atom = nd;
+
+    /* Each repeat nests, so count it against the depth limit. */
+    ++wraps;
+    if (++ps->depth > RSTRING__RE_MAX_DEPTH) { ps->err = 1; return -1; }
+  }
+  ps->depth -= wraps;
+
+  return atom;
+}
+
+static int
+rstring__re_parse_cat(struct rstring__re_parser* ps)
+{
+  int cat = rstring__re_node_new(ps, RSTRING__RE_CAT);
+
+  while (cat >= 0 && !ps->err && ps->p < ps->end && *ps->p != '|' && *ps->p != ')') {
+    int nd = rstring__re_parse_repeat(ps);
+    if (nd < 0) { return -1; }
+    rstring__re_add_child(ps, cat, nd);
+  }
+
+  return ps->err ? -1 : cat;
+}
+
+static int
+rstring__re_parse_alt(struct rstring__re_parser* ps)
+{
+  int first = rstring__re_parse_cat(ps);
+  if (first < 0 || ps->p >= ps->end || *ps->p != '|') { return first; }
+
+  int alt = rstring__re_node_new(ps, RSTRING__RE_ALT);
+  if (alt < 0) { return -1; }
+  rstring__re_add_child(ps, alt, first);
+
+  while (ps->p < ps->end && *ps->p == '|') {
+    ++ps->p;
+    int nd = rstring__re_parse_cat(ps);
+    if (nd < 0) { return -1; }
+    rstring__re_add_child(ps, alt, nd);
+  }
+
+  return alt;
+}
+
+static int
+rstring__re_emit(struct rstring__re_compiler* cp, int op, int x, int y)
+{
+  if (cp->err) { return -1; }
+  if (cp->n == cp->m) {
+    if (cp->m >= RSTRING__RE_MAX_INSTS) { cp->err = 1; return -1; }
+    int m = cp->m ? 2 * cp->m : 64;
+    struct rstring__re_inst* t = realloc(cp->prog, sizeof(*t) * (size_t)m);
+    if (t == NULL) { cp->err = 1; return -1; }
+    cp->prog = t;
+    cp->m = m;
+  }
+  cp->prog[cp->n].op = op;
+  cp->prog[cp->n].x = x;
+  cp->prog[cp->n].y = y;
+  cp->prog[cp->n].z = 0;
+
+  return cp->n++;
+}
+
+/* Whether node id can match the empty string. */
+static int
+rstring__re_nullable(const struct rstring__re_node* nodes, int id)
+{
+  const struct rstring__re_node* nd = &nodes[id];
+  int i = 0;
+
+  switch (nd->kind) {
+  case RSTRING__RE_SET:
+    return 0;
+  case RSTRING__RE_CAT:
+    for (i = nd->child; i >= 0; i = nodes[i].next) {
+      if (!rstring__re_nullable(nodes, i)) { return 0; }
+    }
+    return 1;
+  case RSTRING__RE_ALT:
+    for (i = nd->child; i >= 0; i = nodes[i].next) {
+      if (rstring__re_nullable(nodes, i)) { return 1; }
+    }
+    return 0;
+  case RSTRING__RE_REPEAT:
+    return nd->min == 0 || rstring__re_nullable(nodes, nd->child);
+  case RSTRING__RE_GROUP:
+    return rstring__re_nullable(nodes, nd->child);
+  default:
+    return 1;
+  }
+}
+
+static void
+rstring__re_compile_node(struct rstring__re_compiler* cp, int id)
+{
+  const struct rstring__re_node* nd = &cp->nodes[id];
+  int i = 0;
+  int pc = 0;
+  int chain = -1;
+
+  if (cp->err) { return; }
+
+  switch (nd->kind) {
+  case RSTRING__RE_SET:
+    rstring__re_emit(cp, RSTRING__RE_I_SET, nd->arg, 0);
+    break;
+  case RSTRING__RE_ASSERT:
+    rstring__re_emit(cp, RSTRING__RE_I_ASSERT, nd->arg | (cp->reverse ? RSTRING__RE_BACKWARDS : 0), 0);
+    break;
+  case RSTRING__RE_GROUP:
+    if (!cp->reverse) { rstring__re_emit(cp, RSTRING__RE_I_SAVE, 2 * nd->arg, 0); }
+    rstring__re_compile_node(cp, nd->child);
+    if (!cp->reverse) { rstring__re_emit(cp, RSTRING__RE_I_SAVE, 2 * nd->arg + 1, 0); }
+    break;
+  case RSTRING__RE_CAT:
+    for (i = cp->reverse ? nd->last : nd->child; i >= 0;
+         i = cp->reverse ? cp->nodes[i].prev : cp->nodes[i].next) {
+      rstring__re_compile_node(cp, i);
+    }
+    break;
+  case RSTRING__RE_ALT:
+    /* Each alternative but the last is SPLIT next, after; then the
+       alternative and a JMP to the end.  The JMPs are chained through x
+       until the end is known. */
+    for (i = nd->child; i >= 0 && !cp->err; i = cp->nodes[i].next) {
+      if (cp->nodes[i].next < 0) {
+        rstring__re_compile_node(cp, i);
+        break;
+      }
+      pc = rstring__re_emit(cp, RSTRING__RE_I_SPLIT, 0, 0);
+      if (pc < 0) { return; }
+      cp->prog[pc].x = cp->n;
+      rstring__re_compile_node(cp, i);
+      chain = rstring__re_emit(cp, RSTRING__RE_I_JMP, chain, 0);
+      if (chain < 0) { return; }
+      cp->prog[pc].y = cp->n;
+    }
+    while (!cp->err && chain >= 0) {
+      pc = cp->prog[chain].x;
+      cp->prog[chain].x = cp->n;
+      chain = pc;
+    }
+    break;
+  case RSTRING__RE_REPEAT:
+    for (i = 0; i < nd->min; ++i) { rstring__re_compile_node(cp, nd->child); }
+    if (nd->max < 0 && !cp->reverse && rstring__re_nullable(cp->nodes, nd->child)) {
+      /* L: LOOP body, exit  body  AGAIN L, exit.  As in Ruby, a pass
+         through the body that matched nothing ends the loop.  (Which
+         strings match doesn't change, so the reversed program, which only
+         finds where matches start, does without.) */
+      int level = ++cp->level;
+      if (level >= cp->levels) { cp->levels = level + 1; }
+      int loop = rstring__re_emit(cp, RSTRING__RE_I_LOOP, 0, 0);
+      if (loop < 0) { return; }
+      int body = cp->n;
+      rstring__re_compile_node(cp, nd->child);
+      pc = rstring__re_emit(cp, RSTRING__RE_I_AGAIN, loop, 0);
+      --cp->level;
+      if (pc < 0) { return; }
+      cp->prog[loop].x = nd->greedy ? body : cp->n;
+      cp->prog[loop].y = nd->greedy ? cp->n : body;
+      cp->prog[loop].z = level;
+      cp->prog[pc].y = cp->n;
+      cp->prog[pc].z = level;
+    }
+    else if (nd->max < 0) {
+      /* L: SPLIT body, exit  body  SPLIT L, exit. */
+      int loop = rstring__re_emit(cp, RSTRING__RE_I_SPLIT, 0, 0);
+      if (loop < 0) { return; }
+      int body = cp->n;
+      rstring__re_compile_node(cp, nd->child);
+      pc = rstring__re_emit(cp, RSTRING__RE_I_SPLIT, 0, 0);
+      if (pc < 0) { return; }
+      cp->prog[loop].x = nd->greedy ? body : cp->n;
+      cp->prog[loop].y = nd->greedy ? cp->n : body;
+      cp->prog[pc].x = nd->greedy ? loop : cp->n;
+      cp->prog[pc].y = nd->greedy ? cp->n : loop;
+    }
+    else {
+      /* The optional copies are each SPLIT copy, end; the exits are
+         chained through x until the end is known. */
+      for (i = nd->min; i < nd->max && !cp->err; ++i) {
+        pc = rstring__re_emit(cp, RSTRING__RE_I_SPLIT, chain, 0);
+        if (pc < 0) { return; }
+        chain = pc;
+        cp->prog[pc].y = cp->n;
+        rstring__re_compile_node(cp, nd->child);
+      }
+      while (!cp->err && chain >= 0) {
+        pc = cp->prog[chain].x;
+        cp->prog[chain].x = nd->greedy ? cp->prog[chain].y : cp->n;
+        cp->prog[chain].y = nd->greedy ? cp->n : cp->prog[chain].y;
+        chain = pc;
+      }
+    }
+    break;
+  default:
+    break;
+  }
+}
+
+static int
+rstring__re_holds(int cond, int prev, int next)
+{
+  if (cond & RSTRING__RE_BACKWARDS) {
+    int t = prev;
+    prev = next;
+    next = t;
+    cond &= ~RSTRING__RE_BACKWARDS;
+  }
+
+  switch (cond) {
+  /* As in Ruby, ^ doesn't match after a newline that ends the text. */
+  case RSTRING__RE_BOL: return prev < 0 || (prev == '\n' && next >= 0);
+  case RSTRING__RE_EOL: return next < 0 || next == '\n';
+  case RSTRING__RE_BOT: return prev < 0;
+  case RSTRING__RE_EOT: return next < 0;
+  case RSTRING__RE_WORDB: return rstring__re_isword(prev) != rstring__re_isword(next);
+  default: return rstring__re_isword(prev) == rstring__re_isword(next);
+  }
+}
+
+/* What matters about the byte before a position for the anchors: none
+   (the start of the text), a newline, a word byte, or any other byte. */
+static int
+rstring__re_kind(int c)
+{
+  if (c < 0) { return 0; }
+  if (c == '\n') { return 1; }
+
+  return rstring__re_isword(c) ? 2 : 3;
+}
+
+static const int rstring__re_kind_rep[4] = { -1, '\n', 'a', 0 };
+
+static unsigned
+rstring__re_newgen(rstring_regex* re)
+{
+  if (++re->gen == 0) {
+    int n = re->ninst > re->nrinst ? re->ninst : re->nrinst;
+    memset(re->mark, 0, sizeof(unsigned) * (size_t)n * (size_t)re->levels);
+    re->gen = 1;
+  }
+
+  return re->gen;
+}
+
+#define rstring__re_key(re, pc, level) ((pc) * (re)->levels + (level))
+
+/* A path following the program from one position to the next carries
+   the level of the outermost LOOP it has gone into the body of without
+   reading a byte, or 0.  Paths at the same pc with different levels have
+   to be followed separately, since at an AGAIN one goes round again and
+   the other leaves the loop, so the marks are of keys made from both.
+   The level is 0 again once a byte is read, so the DFA states are still
+   just pcs.  These give the key after the LOOP or AGAIN at pc, in, for
+   the path with the given level (and for LOOP, the branch to). */
+static int
+rstring__re_loop_key(const rstring_regex* re, const struct rstring__re_inst* in,
+                     int pc, int level, int to)
+{
+  return rstring__re_key(re, to, to == pc + 1 && level == 0 ? in->z : level);
+}
+
+static int
+rstring__re_again_key(const rstring_regex* re, const struct rstring__re_inst* in, int level)
+{
+  if (level == 0) { return rstring__re_key(re, in->x, 0); }
+
+  return rstring__re_key(re, in->y, level == in->z ? 0 : level);
+}
+
+/* The key a path at key is marked with.  What SET and MATCH do doesn't
+   depend on the level, so a pc of one of those is only followed once. */
+static int
+rstring__re_mark_key(const rstring_regex* re, const struct rstring__re_inst* prog, int key)
+{
+  int pc = key / re->levels;
+
+  if (prog[pc].op == RSTRING__RE_I_SET || prog[pc].op == RSTRING__RE_I_MATCH) {
+    return rstring__re_key(re, pc, 0);
+  }
+
+  return key;
+}
+
+/* Follow prog from the n pcs in list (highest priority first) at a
+   position between the bytes prev and next (-1 at the ends of the text).
+   The SET and MATCH instructions reached go to out in priority order.
+   Unless longest, the threads after the first MATCH are dropped: they
+   could only give matches that Ruby would not pick.  Returns the count. */
+static int
+rstring__re_closure(rstring_regex* re, const struct rstring__re_inst* prog, int longest,
+                    const int* list, int n, int prev, int next, int* out)
+{
+  unsigned gen = rstring__re_newgen(re);
+  int nout = 0;
+  int top = 0;
+
+  for (int i = n - 1; i >= 0; --i) { re->stack[top++] = rstring__re_key(re, list[i], 0); }
+
+  while (top > 0) {
+    int key = rstring__re_mark_key(re, prog, re->stack[--top]);
+    if (re->mark[key] == gen) { continue; }
+    re->mark[key] = gen;
+
+    int pc = key / re->levels;
+    int level = key % re->levels;
+    const struct rstring__re_inst* in = &prog[pc];
+    switch (in->op) {
+    case RSTRING__RE_I_JMP:
+      re->stack[top++] = rstring__re_key(re, in->x, level);
+      break;
+    case RSTRING__RE_I_SPLIT:
+      re->stack[top++] = rstring__re_key(re, in->y, level);
+      re->stack[top++] = rstring__re_key(re, in->x, level);
+      break;
+    case RSTRING__RE_I_LOOP:
+      re->stack[top++] = rstring__re_loop_key(re, in, pc, level, in->y);
+      re->stack[top++] = rstring__re_loop_key(re, in, pc, level, in->x);
+      break;
+    case RSTRING__RE_I_AGAIN:
+      re->stack[top++] = rstring__re_again_key(re, in, level);
+      break;
+    case RSTRING__RE_I_SAVE:
+      re->stack[top++] = key + re->levels;
+      break;
+    case RSTRING__RE_I_ASSERT:
+      if (rstring__re_holds(in->x, prev, next)) { re->stack[top++] = key + re->levels; }
+      break;
+    case RSTRING__RE_I_MATCH:
+      out[nout++] = pc;
+      if (!longest) { return nout; }
+      break;
+    default:
+      out[nout++] = pc;
+      break;
+    }
+  }
+
+  return nout;
+}
+
+#define rstring__re_state_pcs(re, s) ((int*)((s)->next + (re)->nclasses + 1))
+
+static size_t
+rstring__re_state_size(const rstring_regex* re, int ninst)
+{
+  size_t sz = sizeof(struct rstring__re_state) +
+    sizeof(struct rstring__re_state*) * (size_t)(re->nclasses + 1) +
+    sizeof(int) * (size_t)ninst;
+
+  return (sz + sizeof(void*) - 1) & ~(sizeof(void*) - 1);
+}
+
+/* Empty the state cache, growing it first if it is not at its full size
+   yet.  Returns 0 if the DFA should give up: out of memory, or refilling
+   the cache so often that the NFA would be faster. */
+static int
+rstring__re_dfa_reset(rstring_regex* re, struct rstring__re_dfa* dfa, blen_t pos, size_t need)
+{
+  if (dfa->size < RLIB_REGEX_CACHE_SIZE) {
+    size_t size = dfa->size ? 2 * dfa->size : 16384;
+    while (size < 4 * need && size < RLIB_REGEX_CACHE_SIZE) { size *= 2; }
+    if (size > RLIB_REGEX_CACHE_SIZE) { size = RLIB_REGEX_CACHE_SIZE; }
+
+    size_t tabsize = 16;
+    while (tabsize < 2 * (size / rstring__re_state_size(re, 0))) { tabsize *= 2; }
+
+    free(dfa->block);
+    free(dfa->table);
+    dfa->block = malloc(size);
+    dfa->table = calloc(tabsize, sizeof(struct rstring__re_state*));
+    if (dfa->block == NULL || dfa->table == NULL) {
+      free(dfa->block);
+      free(dfa->table);
+      dfa->block = NULL;
+      dfa->table = NULL;
+      dfa->size = dfa->tabsize = 0;
+      return 0;
+    }
+    dfa->size = size;
+    dfa->tabsize = tabsize;
+  }
+  else {
+    blen_t progress = pos > dfa->flush_pos ? pos - dfa->flush_pos : dfa->flush_pos - pos;
+    if ((size_t)progress < 10 * dfa->nstates) { return 0; }
+    memset(dfa->table, 0, sizeof(struct rstring__re_state*) * dfa->tabsize);
+  }
+
+  dfa->used = 0;
+  dfa->nstates = 0;
+  dfa->flushes++;
+  dfa->flush_pos = pos;
+
+  return need <= dfa->size;
+}
+
+/* The state for the n pcs in list with flags, made if it is new.  pos is
+   where the scan is, for rstring__re_dfa_reset.  NULL if the DFA gave up. */
+static struct rstring__re_state*
+rstring__re_state_get(rstring_regex* re, struct rstring__re_dfa* dfa,
+                      const int* list, int n, unsigned flags, blen_t pos)
+{
+  unsigned h = 2166136261u ^ flags;
+  for (int i = 0; i < n; ++i) { h = (h ^ (unsigned)list[i]) * 16777619u; }
+
+  size_t need = rstring__re_state_size(re, n);
+  size_t mask = dfa->tabsize - 1;
+  size_t idx = 0;
+  struct rstring__re_state* s = NULL;
+
+  if (dfa->table != NULL) {
+    for (idx = h & mask; (s = dfa->table[idx]) != NULL; idx = (idx + 1) & mask) {
+      if (s->hash == h && s->flags == flags && s->ninst == n &&
+          memcmp(rstring__re_state_pcs(re, s), list, sizeof(int) * (size_t)n) == 0) {
+        return s;
+      }
+    }
+  }
+
+  if (dfa->table == NULL || dfa->used + need > dfa->size || 2 * (dfa->nstates + 1) > dfa->tabsize) {
+    if (!rstring__re_dfa_reset(re, dfa, pos, need)) { return NULL; }
+    mask = dfa->tabsize - 1;
+    idx = h & mask;
+  }
+
+  s = (struct rstring__re_state*)(dfa->block + dfa->used);
+  dfa->used += need;
+  dfa->nstates++;
+  s->flags = flags;
+  s->ninst = n;
+  s->hash = h;
+  for (int k = 0; k <= re->nclasses; ++k) { s->next[k] = NULL; }
+  memcpy(rstring__re_state_pcs(re, s), list, sizeof(int) * (size_t)n);
+  dfa->table[idx] = s;
+
+  return s;
+}
+
+/* The state after s reads a byte of class k (the end of the text for
+   class nclasses). */
+static struct rstring__re_state*
+rstring__re_step(rstring_regex* re, struct rstring__re_dfa* dfa,
+                 struct rstring__re_state* s, int k, blen_t pos)
+{
+  int c = re->rep[k];
+  int n = rstring__re_closure(re, dfa->prog, dfa->longest,
+                              rstring__re_state_pcs(re, s), s->ninst,
+                              rstring__re_kind_rep[s->flags & 3], c, re->list);
+  unsigned flags = (unsigned)rstring__re_kind(c);
+  int m = 0;
+
+  for (int i = 0; i < n; ++i) {
+    const struct rstring__re_inst* in = &dfa->prog[re->list[i]];
+    if (in->op == RSTRING__RE_I_MATCH) {
+      flags |= RSTRING__RE_MATCHED;
+    }
+    else if (c >= 0 && rstring__re_inset(re->sets[in->x], c)) {
+      re->list2[m++] = re->list[i] + 1;
+    }
+  }
+
+  unsigned long flushes = dfa->flushes;
+  struct rstring__re_state* t = rstring__re_state_get(re, dfa, re->list2, m, flags, pos);
+
+  /* After a flush s is gone. */
+  if (t != NULL && flushes == dfa->flushes) { s->next[k] = t; }
+
+  return t;
+}
+
+/* Run dfa over the text from position from to position to, backwards
+   over the bytes in between if to < from.  Returns the last position
+   reached at which a match ended (so the end of the leftmost match going
+   forwards, or the start of the longest going backwards), -1 if there is
+   none, or -2 if the DFA gave up.  With first, the first match will do. */
+static blen_t
+rstring__re_dfa_scan(rstring_regex* re, struct rstring__re_dfa* dfa,
+                     const unsigned char* text, blen_t len, blen_t from, blen_t to, int first)
+{
+  int back = to < from;
+  int before = back ? (from < len ? text[from] : -1) : (from > 0 ? text[from - 1] : -1);
+  int after = back ? (to > 0 ? text[to - 1] : -1) : (to < len ? text[to] : -1);
+  blen_t last = -1;
+  blen_t i = 0;
+
+  dfa->flush_pos = from;
+
+  struct rstring__re_state* s =
+    rstring__re_state_get(re, dfa, &dfa->start, 1, (unsigned)rstring__re_kind(before), from);
+  if (s == NULL) { return -2; }
+
+  if (!back) {
+    for (i = from; i < to; ++i) {
+      int k = re->cls[text[i]];
+      struct rstring__re_state* t = s->next[k];
+      if (t == NULL && (t = rstring__re_step(re, dfa, s, k, i)) == NULL) { return -2; }
+      s = t;
+      if (s->flags & RSTRING__RE_MATCHED) {
+        last = i;
+        if (first) { return last; }
+      }
+      if (s->ninst == 0) { return last; }
+    }
+  }
+  else {
+    for (i = from; i > to; --i) {
+      int k = re->cls[text[i - 1]];
+      struct rstring__re_state* t = s->next[k];
+      if (t == NULL && (t = rstring__re_step(re, dfa, s, k, i)) == NULL) { return -2; }
+      s = t;
+      if (s->flags & RSTRING__RE_MATCHED) { last = i; }
+      if (s->ninst == 0) { return last; }
+    }
+  }
+
+  int k = after < 0 ? re->nclasses : re->cls[after];
+  struct rstring__re_state* t = s->next[k];
+  if (t == NULL && (t = rstring__re_step(re, dfa, s, k, to)) == NULL) { return -2; }
+  if (t->flags & RSTRING__RE_MATCHED) { last = to; }
+
+  return last;
+}
+
+struct rstring__re_frame {
+  int pc;
+  int slot;
+  blen_t old;
+};
+
+struct rstring__re_threads {
+  int n;
+  int* pcs;
+  blen_t* caps;
+};
+
+/* Add the threads reached from pc at position pos, with capture slots
+   cur, to l in priority order. */
+static void
+rstring__re_addthread(rstring_regex* re, struct rstring__re_threads* l, int pc0,
+                      blen_t* cur, int nslots, const unsigned char* text, blen_t len,
+                      blen_t pos, struct rstring__re_frame* stack, unsigned gen)
+{
+  int prev = pos > 0 ? text[pos - 1] : -1;
+  int next = pos < len ? text[pos] : -1;
+  int top = 0;
+
+  stack[top].pc = rstring__re_key(re, pc0, 0);
+  stack[top].slot = -1;
+  ++top;
+
+  /* The frames' pcs are keys, as in rstring__re_closure(). */
+  while (top > 0) {
+    struct rstring__re_frame f = stack[--top];
+    if (f.slot >= 0) {
+      cur[f.slot] = f.old;
+      continue;
+    }
+
+    int key = rstring__re_mark_key(re, re->prog, f.pc);
+    if (re->mark[key] == gen) { continue; }
+    re->mark[key] = gen;
+
+    int pc = key / re->levels;
+    int level = key % re->levels;
+    const struct rstring__re_inst* in = &re->prog[pc];
+    switch (in->op) {
+    case RSTRING__RE_I_JMP:
+      stack[top].pc = rstring__re_key(re, in->x, level);
+      stack[top++].slot = -1;
+      break;
+    case RSTRING__RE_I_SPLIT:
+      stack[top].pc = rstring__re_key(re, in->y, level);
+      stack[top++].slot = -1;
+      stack[top].pc = rstring__re_key(re, in->x, level);
+      stack[top++].slot = -1;
+      break;
+    case RSTRING__RE_I_LOOP:
+      stack[top].pc = rstring__re_loop_key(re, in, pc, level, in->y);
+      stack[top++].slot = -1;
+      stack[top].pc = rstring__re_loop_key(re, in, pc, level, in->x);
+      stack[top++].slot = -1;
+      break;
+    case RSTRING__RE_I_AGAIN:
+      stack[top].pc = rstring__re_again_key(re, in, level);
+      stack[top++].slot = -1;
+      break;
+    case RSTRING__RE_I_SAVE:
+      /* Put the slot back once the rest of this path is done. */
+      stack[top].slot = in->x;
+      stack[top++].old = cur[in->x];
+      cur[in->x] = pos;
+      stack[top].pc = key + re->levels;
+      stack[top++].slot = -1;
+      break;
+    case RSTRING__RE_I_ASSERT:
+      if (rstring__re_holds(in->x, prev, next)) {
+        stack[top].pc = key + re->levels;
+        stack[top++].slot = -1;
+      }
+      break;
+    default:
+      l->pcs[l->n] = pc;
+      memcpy(l->caps + (size_t)l->n * (size_t)nslots, cur, sizeof(blen_t) * (size_t)nslots);
+      l->n++;
+      break;
+    }
+  }
+}
+
+/* Run the forward program as an NFA (a Pike VM), keeping the capture
+   positions, from position from up to position end.  anchored starts the
+   pattern at from only; otherwise the loop at pc 0 lets it start
+   anywhere.  This takes time proportional to the length of the text times
+   the size of the program whatever the pattern.  Returns 1 with the slots
+   of the match in caps, 0 if there is no match, or -1 on errors. */
+static int
+rstring__re_pike(rstring_regex* re, const unsigned char* text, blen_t len,
+                 blen_t from, blen_t end, int anchored, blen_t* caps)
+{
+  int nslots = 2 * (re->ngroups + 1);
+  size_t n = (size_t)re->ninst;
+  int matched = 0;
+
+  int* pcs = malloc(sizeof(int) * 2 * n);
+  blen_t* slots = malloc(sizeof(blen_t) * (2 * n * (size_t)nslots + (size_t)nslots));
+  struct rstring__re_frame* stack =
+    malloc(sizeof(struct rstring__re_frame) * (2 * n * (size_t)re->levels + 2));
+  if (pcs == NULL || slots == NULL || stack == NULL) {
+    free(pcs);
+    free(slots);
+    free(stack);
+    return -1;
+  }
+
+  struct rstring__re_threads clist = { 0, pcs, slots };
+  struct rstring__re_threads nlist = { 0, pcs + n, slots + n * (size_t)nslots };
+  blen_t* cur = slots + 2 * n * (size_t)nslots;
+
+  for (int i = 0; i < nslots; ++i) { cur[i] = -1; }
+  rstring__re_addthread(re, &clist, anchored ? re->start : 0, cur, nslots,
+                        text, len, from, stack, rstring__re_newgen(re));
+
+  for (blen_t p = from; clist.n > 0; ++p) {
+    int c = p < end ? text[p] : -1;
+    unsigned gen = rstring__re_newgen(re);
+    nlist.n = 0;
+
+    for (int i = 0; i < clist.n; ++i) {
+      const struct rstring__re_inst* in = &re->prog[clist.pcs[i]];
+      blen_t* ts = clist.caps + (size_t)i * (size_t)nslots;
+
+      if (in->op == RSTRING__RE_I_MATCH) {
+        /* The rest have lower priority. */
+        matched = 1;
+        memcpy(caps, ts, sizeof(blen_t) * (size_t)nslots);
+        break;
+      }
+      if (c >= 0 && rstring__re_inset(re->sets[in->x], c)) {
+        memcpy(cur, ts, sizeof(blen_t) * (size_t)nslots);
+        rstring__re_addthread(re, &nlist, clist.pcs[i] + 1, cur, nslots,
+                              text, len, p + 1, stack, gen);
+      }
+    }
+    if (p >= end) { break; }
+
+    struct rstring__re_threads t = clist;
+    clist = nlist;
+    nlist = t;
+  }
+
+  free(pcs);
+  free(slots);
+  free(stack);
+
+  return matched;
+}
+
+/* Find the match Ruby would: the leftmost one, and of those the one the
+   first alternatives and the greediest (or laziest) repeats give.  The
+   forward DFA finds where it ends and the reversed one where it starts;
+   the Pike VM then only runs over the match, and only if groups is set
+   and the pattern has groups.  caps gets 2 * (ngroups + 1) slots, -1 for
+   groups that took no part.  Returns 1, 0 if there is no match at or
+   after pos, or -1 on errors. */
+static int
+rstring__re_search(rstring_regex* re, const unsigned char* text, blen_t len,
+                   blen_t pos, blen_t* caps, int groups)
+{
+  int nslots = 2 * (re->ngroups + 1);
+
+  blen_t e = rstring__re_dfa_scan(re, &re->fwd, text, len, pos, len, 0);
+  if (e == -1) { return 0; }
+
+  if (e >= 0) {
+    blen_t s = rstring__re_dfa_scan(re, &re->rev, text, len, e, pos, 0);
+    if (s >= 0) {
+      if (groups && re->ngroups > 0) {
+        return rstring__re_pike(re, text, len, s, e, 1, caps);
+      }
+      for (int i = 2; i < nslots; ++i) { caps[i] = -1; }
+      caps[0] = s;
+      caps[1] = e;
+      return 1;
+    }
+  }
+
+  /* The DFA gave up on this text, so use the NFA for all of it. */
+  return rstring__re_pike(re, text, len, pos, len, 0, caps);
+}
+
+/**
+ * @brief Compile a regular expression.
+ *
+ * The syntax is the commonly used part of Ruby's:
+ *
+ * - literal bytes, and escapes like \\n \\t \\xHH and \\. for metacharacters
+ * - . (any byte but a newline, unless RSTRING_REGEX_MULTILINE)
+ * - bracket classes like [a-z_], [^,], [[:alpha:]], with \\d \\w \\s \\h inside
+ * - \\d \\D \\w \\W \\s \\S \\h \\H
+ * - groups with ( ) and non capturing groups with (?: )
+ * - alternation with |
+ * - repeats * + ? {n} {n,} {,m} {n,m}, and the lazy *? +? ?? {n,m}?
+ * - the anchors ^ and $ (at line starts and ends, as in Ruby), \\A, \\z, \\b and \\B
+ *
+ * Back references, look arounds, named groups, possessive repeats, \\Z and (?i) style options are not supported, and such patterns are rejected rather than misread.  Matching is on bytes, and case folding and the classes are ASCII.
+ *
+ * As in Ruby, a pass through a * or + (or {n,}) loop that matches nothing ends the loop, so `(?:a*|b)*` matches just "a" of "ab".  Ruby's finer points here are not copied: in Ruby a pass that matches nothing but sets a group doesn't count as empty, and repeated anchors like `(?:^){2,}?` have quirks of their own.  Patterns like those can still give different groups, or now and then a different match, than Ruby.
+ *
+ * Matching takes time linear in the length of the searched text whatever the pattern (there is no backtracking), so patterns and input from untrusted sources are safe.  The pattern is compiled to a program that is run as a DFA built lazily, one state at a time, as the text needs it.  The states are cached in the regex, up to RLIB_REGEX_CACHE_SIZE bytes for each direction of search.  If the cache keeps filling up, matching falls back on running the program directly, which is still linear but takes time proportional to the length of the text times the size of the program.
+ *
+ * That matters for big counted repeats: each of the 1000 copies in `a{1,1000}b` is its own few instructions, and over a long run of a's the DFA needs a thousand states of up to a thousand of them each, far more than the cache holds.  Such a search runs at the program's speed, tens of microseconds a byte, so most of a minute for 2 MB of a's, where a{1,100}b takes milliseconds.  Keep counts small, or raise RLIB_REGEX_CACHE_SIZE to fit the states.
+ *
+ * @code
+rstring_regex* re = rstring_regex_new_cstr("(\\w+)@(\\w+)\\.com", 0);
+
+rstring_array* m = rstring_match(RSTR_LIT("mail ryan@example.com"), re);
+// m->entry[0] is "ryan@example.com", [1] is "ryan" and [2] is "example"
+
+rstring_array_free(m);
+rstring_regex_free(re);
+ * @endcode
+ *
+ * @param pattern The pattern.  (Not modified.)
+ * @param flags 0, or RSTRING_REGEX_CASELESS and/or RSTRING_REGEX_MULTILINE.
+ *
+ * @retval rstring_regex* A new regex.
+ * @retval NULL The pattern is invalid or unsupported, or there were errors.
+ *
+ * @warning The caller must free the result with rstring_regex_free().
+ *
+ * @warning Searching updates the regex's cache, so a regex must not be used by two threads at once.
+ */
+rstring_regex*
+rstring_regex_new(const rstring* pattern, int flags)
+{
+  if (rstring_view_bad(pattern)) { return NULL; }
+  if ((flags & ~(RSTRING_REGEX_CASELESS | RSTRING_REGEX_MULTILINE)) != 0) { return NULL; }
+
+  struct rstring__re_parser ps;
+  memset(&ps, 0, sizeof(ps));
+  ps.p = pattern->data;
+  ps.end = pattern->data + pattern->slen;
+  ps.flags = flags;
+
+  int root = rstring__re_parse_alt(&ps);
+  if (root < 0 || ps.err || ps.p != ps.end) {
+    free(ps.nodes);
+    free(ps.sets);
+    return NULL;
+  }
+
+  /* A set of every byte, for the loop in front of the pattern. */
+  int any = rstring__re_set_new(&ps);
+
+  rstring_regex* re = calloc(1, sizeof(rstring_regex));
+  struct rstring__re_compiler fw = { ps.nodes, NULL, 0, 0, 0, 0, 0, 1 };
+  struct rstring__re_compiler bw = { ps.nodes, NULL, 0, 0, 1, 0, 0, 1 };
+
+  if (re == NULL || any < 0) {
+    free(re);
+    free(ps.nodes);
+    free(ps.sets);
+    return NULL;
+  }
+  rstring__re_set_range(ps.sets[any], 0, UCHAR_MAX);
+  re->flags = flags;
+  re->ngroups = ps.ngroups;
+  re->sets = ps.sets;
+  re->nsets = ps.nsets;
+
+  /* 0: SPLIT 3, 1   1: SET any   2: JMP 0   3: SAVE 0  pattern  SAVE 1  MATCH */
+  rstring__re_emit(&fw, RSTRING__RE_I_SPLIT, 3, 1);
+  rstring__re_emit(&fw, RSTRING__RE_I_SET, any, 0);
+  rstring__re_emit(&fw, RSTRING__RE_I_JMP, 0, 0);
+  rstring__re_emit(&fw, RSTRING__RE_I_SAVE, 0, 0);
+  rstring__re_compile_node(&fw, root);
+  rstring__re_emit(&fw, RSTRING__RE_I_SAVE, 1, 0);
+  rstring__re_emit(&fw, RSTRING__RE_I_MATCH, 0, 0);
+
+  rstring__re_compile_node(&bw, root);
+  rstring__re_emit(&bw, RSTRING__RE_I_MATCH, 0, 0);
+
+  free(ps.nodes);
+
+  re->prog = fw.prog;
+  re->ninst = fw.n;
+  re->start = 3;
+  re->rprog = bw.prog;
+  re->nrinst = bw.n;
+  re->levels = fw.levels;
+  if (fw.err || bw.err || (size_t)fw.n * (size_t)fw.levels > RSTRING__RE_MAX_KEYS) {
+    rstring_regex_free(re);
+    return NULL;
+  }
+
+  /* Byte classes: split wherever some set starts or stops, and around
+     newlines and word bytes for the anchors. */
+  unsigned char cut[UCHAR_MAX + 2] = { 0 };
+  static const int anchor_cuts[] = {
+    '\n', '\n' + 1, '0', '9' + 1, 'A', 'Z' + 1, '_', '_' + 1, 'a', 'z' + 1
+  };
+  for (int i = 0; i < re->nsets; ++i) {
+    for (int c = 1; c <= UCHAR_MAX; ++c) {
+      if (rstring__re_inset(re->sets[i], c) != rstring__re_inset(re->sets[i], c - 1)) {
+        cut[c] = 1;
+      }
+    }
+  }
+  for (int i = 0; i < (int)(sizeof(anchor_cuts) / sizeof(anchor_cuts[0])); ++i) {
+    cut[anchor_cuts[i]] = 1;
+  }
+  re->nclasses = 0;
+  for (int c = 0; c <= UCHAR_MAX; ++c) {
+    if (c > 0 && cut[c]) { re->nclasses++; }
+    if (c == 0 || cut[c]) { re->rep[re->nclasses] = c; }
+    re->cls[c] = (unsigned char)re->nclasses;
+  }
+  re->nclasses++;
+  re->rep[re->nclasses] = -1;
+
+  int n = re->ninst > re->nrinst ? re->ninst : re->nrinst;
+  size_t keys = (size_t)n * (size_t)re->levels;
+  re->stack = malloc(sizeof(int) * (3 * keys + 1));
+  re->mark = calloc(keys, sizeof(unsigned));
+  re->list = malloc(sizeof(int) * (size_t)n);
+  re->list2 = malloc(sizeof(int) * (size_t)n);
+  if (re->stack == NULL || re->mark == NULL || re->list == NULL || re->list2 == NULL) {
+    rstring_regex_free(re);
+    return NULL;
+  }
+
+  re->fwd.prog = re->prog;
+  re->fwd.start = 0;
+  re->fwd.longest = 0;
+  re->rev.prog = re->rprog;
+  re->rev.start = 0;
+  re->rev.longest = 1;
+
+  return re;
+}
+
+/**
+ * @brief Wraps rstring_regex_new() but takes char* for pattern.
+ */
+rstring_regex*
+rstring_regex_new_cstr(const char* pattern, int flags)
+{
+  rstring_view rpattern = rstring_view_of_cstr(pattern);
+
+  return rstring_regex_new(&rpattern, flags);
+}
+
+/**
+ * @brief Free a regex made by rstring_regex_new().
+ *
+ * @retval ROKAY The regex was freed.
+ * @retval RERROR The regex is NULL.
+ */
+int
+rstring_regex_free(rstring_regex* re)
+{
+  if (re == NULL) { return RERROR; }
+
+  free(re->sets);
+  free(re->prog);
+  free(re->rprog);
+  free(re->stack);
+  free(re->mark);
+  free(re->list);
+  free(re->list2);
+  free(re->fwd.block);
+  free(re->fwd.table);
+  free(re->rev.block);
+  free(re->rev.table);
+  free(re);
+
+  return ROKAY;
+}
+
+/**
+ * @brief Tells whether re matches somewhere in rstr, like Ruby's match?
+ *
+ * This is the cheapest question to ask: it stops at the first match and never works out where the match starts or what the groups hold.
+ *
+ * @retval RTRUE re matches.
+ * @retval RFALSE re does not match.
+ * @retval RERROR Either input is invalid or there were errors.
+ */
+int
+rstring_match_p(const rstring* rstr, rstring_regex* re)
+{
+  if (rstring_view_bad(rstr)) { return RERROR; }
+  if (re == NULL) { return RERROR; }
+
+  blen_t e = rstring__re_dfa_scan(re, &re->fwd, rstr->data, rstr->slen, 0, rstr->slen, 1);
+  if (e >= 0) { return RTRUE; }
+  if (e == -1) { return RFALSE; }
+
+  blen_t caps[2];
+  int nslots = 2 * (re->ngroups + 1);
+  blen_t* slots = nslots > 2 ? malloc(sizeof(blen_t) * (size_t)nslots) : caps;
+  if (slots == NULL) { return RERROR; }
+
+  int val = rstring__re_pike(re, rstr->data, rstr->slen, 0, rstr->slen, 0, slots);
+  if (slots != caps) { free(slots); }
+
+  return val < 0 ? RERROR : (val ? RTRUE : RFALSE);
+}
+
+/**
+ * @brief Tells where re first matches in rstr, like Ruby's =~
+ *
+ * @retval index The index where the match starts.
+ * @retval RERROR Either input is invalid, re does not match, or there were errors.
+ */
+blen_t
+rstring_index_re(const rstring* rstr, rstring_regex* re)
+{
+  if (rstring_view_bad(rstr)) { return RERROR; }
+  if (re == NULL) { return RERROR; }
+
+  blen_t* caps = malloc(sizeof(blen_t) * 2 * (size_t)(re->ngroups + 1));
+  if (caps == NULL) { return RERROR; }
+
+  int val = rstring__re_search(re, rstr->data, rstr->slen, 0, caps, 0);
+  blen_t start = caps[0];
+  free(caps);
+
+  return val == 1 ? start : RERROR;
+}
+
+/* Push the range of slot pair i of caps onto rg (an empty one for groups
+   that took no part). */
+static int
+rstring__re_push_group(struct bstr__ranges* rg, const blen_t* caps, int i)
+{
+  if (caps[2 * i] < 0 || caps[2 * i + 1] < 0) { return bstr__rangecb(rg, 0, 0); }
+
+  return bstr__rangecb(rg, caps[2 * i], caps[2 * i + 1] - caps[2 * i]);
+}
+
+/**
+ * @brief The first match of re in rstr and its groups, like Ruby's match.
+ *
+ * @code
+rstring_regex* re = rstring_regex_new_cstr("(\\d+)-(\\d+)", 0);
+rstring_array* m = rstring_match(RSTR_LIT("pages 10-20"), re);
+// "10-20", "10", "20"
+ * @endcode
+ *
+ * @retval rstring_array* The match followed by each group.  Groups that took no part in the match are empty strings.
+ * @retval NULL Either input is invalid, re does not match, or there were errors.
+ *
+ * @warning The caller must free the result with rstring_array_free().
+ */
+rstring_array*
+rstring_match(const rstring* rstr, rstring_regex* re)
+{
+  if (rstring_view_bad(rstr)) { return NULL; }
+  if (re == NULL) { return NULL; }
+
+  blen_t* caps = malloc(sizeof(blen_t) * 2 * (size_t)(re->ngroups + 1));
+  if (caps == NULL) { return NULL; }
+
+  if (rstring__re_search(re, rstr->data, rstr->slen, 0, caps, 1) != 1) {
+    free(caps);
+    return NULL;
+  }
+
+  struct bstr__ranges rg;
+  bstr__ranges_init(&rg);
+  for (int i = 0; i <= re->ngroups; ++i) {
+    if (rstring__re_push_group(&rg, caps, i) != BSTR_OK) {
+      bstr__ranges_free(&rg);
+      free(caps);
+      return NULL;
+    }
+  }
+  free(caps);
+
+  return bstr__list_pack(rstr, &rg);
+}
+
+/**
+ * @brief Every match of re in rstr, like Ruby's scan.
+ *
+ * Matches don't overlap.  After an empty match the search goes on from the next byte.
+ *
+ * @code
+rstring_regex* re = rstring_regex_new_cstr("\\d+", 0);
+rstring_array* nums = rstring_scan(RSTR_LIT("1, 22 and 333"), re);
+// "1", "22", "333"
+ * @endcode
+ *
+ * @retval rstring_array* Each match, or, if re has groups, the groups of each match one after the other (Ruby would give an array of arrays).  Groups that took no part in a match are empty strings.
+ * @retval NULL Either input is invalid or there were errors.
+ *
+ * @warning The caller must free the result with rstring_array_free().
+ */
+rstring_array*
+rstring_scan(const rstring* rstr, rstring_regex* re)
+{
+  if (rstring_view_bad(rstr)) { return NULL; }
+  if (re == NULL) { return NULL; }
+
+  blen_t* caps = malloc(sizeof(blen_t) * 2 * (size_t)(re->ngroups + 1));
+  if (caps == NULL) { return NULL; }
+
+  struct bstr__ranges rg;
+  bstr__ranges_init(&rg);
+  blen_t pos = 0;
+  int val = 0;
+
+  while (pos <= rstr->slen &&
+         (val = rstring__re_search(re, rstr->data, rstr->slen, pos, caps, 1)) == 1) {
+    val = re->ngroups == 0 ? rstring__re_push_group(&rg, caps, 0) : BSTR_OK;
+    for (int i = 1; i <= re->ngroups && val == BSTR_OK; ++i) {
+      val = rstring__re_push_group(&rg, caps, i);
+    }
+    if (val != BSTR_OK) { break; }
+    pos = caps[1] > caps[0] ? caps[1] : caps[1] + 1;
+  }
+  free(caps);
+
+  if (val < 0) {
+    bstr__ranges_free(&rg);
+    return NULL;
+  }
+
+  return bstr__list_pack(rstr, &rg);
+}
+
+/* Append replacement to result with \0 and \& standing for the match,
+   \1 to \9 for the groups and \\ for a backslash. */
+static int
+rstring__re_append_replacement(bstring result, const rstring* rstr, const rstring* replacement,
+                               const blen_t* caps, int ngroups)
+{
+  blen_t i = 0;
+  blen_t from = 0;
+
+  for (i = 0; i + 1 < replacement->slen; ++i) {
+    int c = replacement->data[i];
+    int e = replacement->data[i + 1];
+    int g = -1;
+
+    if (c != '\\') { continue; }
+    if (e == '&') { g = 0; }
+    else if (e >= '0' && e <= '9') { g = e - '0'; }
+    else if (e != '\\') { continue; }
+
+    if (bcatblk(result, replacement->data + from, i - from) != BSTR_OK) { return RERROR; }
+    if (g < 0) {
+      if (bconchar(result, '\\') != BSTR_OK) { return RERROR; }
+    }
+    else if (g <= ngroups && caps[2 * g] >= 0 && caps[2 * g + 1] >= 0) {
+      if (bcatblk(result, rstr->data + caps[2 * g], caps[2 * g + 1] - caps[2 * g]) != BSTR_OK) {
+        return RERROR;
+      }
+    }
+    from = i + 2;
+    ++i;
+  }
+
+  if (bcatblk(result, replacement->data + from, replacement->slen - from) != BSTR_OK) {
+    return RERROR;
+  }
+
+  return ROKAY;
+}
+
+/**
+ * @brief Replace every match of re in rstr, like Ruby's gsub with a regex.
+ *
+ * In replacement, \\0 or \\& stands for the match, \\1 to \\9 for its groups and \\\\ for a backslash.  (In a C string literal each of those backslashes is written twice.)
+ *
+ * @code
+rstring_regex* re = rstring_regex_new_cstr("(\\w+)@(\\w+)", 0);
+rstring* s = rstring_gsub_re(RSTR_LIT("ryan@home"), re, RSTR_LIT("\\2 at \\1"));
+// "home at ryan"
+ * @endcode
+ *
+ * @retval rstring* A valid rstring with the replacements made.
+ * @retval NULL Any of the args are invalid or there were errors.
+ *
+ * @warning The caller must free the result.
+ */
+rstring*
+rstring_gsub_re(const rstring* rstr, rstring_regex* re, const rstring* replacement)
+{
+  if (rstring_view_bad(rstr)) { return NULL; }
+  if (re == NULL) { return NULL; }
+  if (rstring_view_bad(replacement)) { return NULL; }
+
+  blen_t* caps = malloc(sizeof(blen_t) * 2 * (size_t)(re->ngroups + 1));
+  if (caps == NULL) { return NULL; }
+
+  bstring result = bfromcstralloc(rstr->slen + 1, "");
+  if (result == NULL) { free(caps); return NULL; }
+
+  int groups = bstrchr(replacement, '\\') != BSTR_ERR;
+  blen_t pos = 0;
+  blen_t done = 0;
+  int val = 0;
+
+  while (pos <= rstr->slen &&
+         (val = rstring__re_search(re, rstr->data, rstr->slen, pos, caps, groups)) == 1) {
+    if (bcatblk(result, rstr->data + done, caps[0] - done) != BSTR_OK ||
+        rstring__re_append_replacement(result, rstr, replacement, caps, re->ngroups) != ROKAY) {
+      val = -1;
+      break;
+    }
+    done = pos = caps[1];
+    if (caps[1] == caps[0]) {
+      /* Keep the byte after an empty match and go on past it. */
+      if (pos < rstr->slen && bconchar(result, (char)rstr->data[pos]) != BSTR_OK) {
+        val = -1;
+        break;
+      }
+      done = pos = caps[1] + 1;
+    }
+  }
+  free(caps);
+
+  if (val < 0 ||
+      (done < rstr->slen && bcatblk(result, rstr->data + done, rstr->slen - done) != BSTR_OK)) {
+    bdestroy(result);
+    return NULL;
+  }
+
+  return result;
+}
+
+/**
+ * @brief Split rstr on the matches of re, like Ruby's split with a regex.
+ *
+ * If re has groups, what they matched goes into the result after the field before each match, as in Ruby (groups that took no part in the match are left out).  Empty matches split between bytes but not at the start or end of rstr.  Unlike Ruby, and like rstring_split(), empty fields at the end are kept.
+ *
+ * @code
+rstring_regex* re = rstring_regex_new_cstr("\\s*,\\s*", 0);
+rstring_array* fields = rstring_split_re(RSTR_LIT("a , b,c"), re);
+// "a", "b", "c"
+ * @endcode
+ *
+ * @retval rstring_array* The fields of rstr.
+ * @retval NULL Either input is invalid or there were errors.
+ *
+ * @warning The caller must free the result with rstring_array_free().
+ */
+rstring_array*
+rstring_split_re(const rstring* rstr, rstring_regex* re)
+{
+  if (rstring_view_bad(rstr)) { return NULL; }
+  if (re == NULL) { return NULL; }
+
+  blen_t* caps = malloc(sizeof(blen_t) * 2 * (size_t)(re->ngroups + 1));
+  if (caps == NULL) { return NULL; }
+
+  struct bstr__ranges rg;
+  bstr__ranges_init(&rg);
+  blen_t pos = 0;
+  blen_t beg = 0;
+  int val = 0;
+
+  while (pos <= rstr->slen &&
+         (val = rstring__re_search(re, rstr->data, rstr->slen, pos, caps, 1)) == 1) {
+    if (caps[0] == caps[1]) {
+      if (caps[0] >= rstr->slen) { break; }
+      if (caps[0] == beg) {
+        pos = caps[0] + 1;
+        continue;
+      }
+    }
+
+    val = bstr__rangecb(&rg, beg, caps[0] - beg);
+    for (int i = 1; i <= re->ngroups && val == BSTR_OK; ++i) {
+      if (caps[2 * i] >= 0) { val = rstring__re_push_group(&rg, caps, i); }
+    }
+    if (val != BSTR_OK) { break; }
+    beg = pos = caps[1];
+  }
+  free(caps);
+
+  if (val < 0 || bstr__rangecb(&rg, beg, rstr->slen - beg) != BSTR_OK) {
+    bstr__ranges_free(&rg);
+    return NULL;
+  }
+
+  return bstr__list_pack(rstr, &rg);
+}
+
+/* The tables of an rstring_text_index.  They all live in one block of
+   memory that starts with this header, so the block can be written out
+   and used again as it is (see rstring_text_index_load()). */
+
+#define RSTRING__INDEX_MAGIC "rlibidx1"
+#define RSTRING__INDEX_ORDER 0x01020304u
+
+/* Suffix array entries are kept for every this many text positions by
+   compressed indexes, so finding where a match is takes at most this many
+   steps back through the text. */
+#define RSTRING__INDEX_SAMPLE 32
+
+/* The size of the blocks of the suffix array whose minimums are kept for
+   finding the first match. */
+#define RSTRING__INDEX_RMQ_BLOCK 256
+
+struct rstring__text_index_header {
+  char magic[8];
+  uint32_t order;
+  uint32_t blen_size;
+  uint32_t flags;
+  uint32_t sigma;
+  /* Bytes of text.  There is one more suffix (and row) than that, for the
+     empty suffix at the end. */
+  blen_t n;
+  /* The row of the whole text, whose BWT byte stands for the end. */
+  blen_t primary;
+  /* Spacing of the rank checkpoints. */
+  blen_t step;
+  /* Compressed indexes: suffix array entries kept, and one for every
+     sample text positions. */
+  blen_t sample;
+  blen_t nsamples;
+  /* Full indexes: levels of the sparse table over the block minimums. */
+  blen_t levels;
+  /* Bytes in the whole block. */
+  blen_t size;
+  /* C[c] is the row of the first suffix starting with byte c. */
+  blen_t C[UCHAR_MAX + 2];
+  /* The column of each byte in the rank checkpoints, or -1 for bytes that
+     are not in the text. */
+  int32_t code[UCHAR_MAX + 1];
+};
+
+struct rstring__text_index_layout {
+  size_t bwt, occ, sa, sampled, sampled_rank, rmq, size;
+};
+
+struct rstring_text_index {
+  unsigned char* block;
+  int owned;
+
+  const struct rstring__text_index_header* hdr;
+  /* The Burrows-Wheeler transform: the byte before each suffix, in suffix
+     array order. */
+  const unsigned char* bwt;
+  /* occ[i * sigma + code[c]] is the count of c in bwt before row i * step. */
+  const blen_t* occ;
+  /* The suffix array, or for compressed indexes the entries of the rows
+     marked in sampled, whose ranks come from sampled_rank. */
+  const blen_t* sa;
+  const uint64_t* sampled;
+  const blen_t* sampled_rank;
+  /* Full indexes: the minimum of each block of the suffix array, then for
+     each level j of the sparse table the minimums of 2^j blocks. */
+  const blen_t* rmq;
+};
+
+static int
+rstring__popcount64(uint64_t x)
+{
+  x = x - ((x >> 1) & 0x5555555555555555ull);
+  x = (x & 0x3333333333333333ull) + ((x >> 2) & 0x3333333333333333ull);
+  x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0full;
+
+  return (int)((x * 0x0101010101010101ull) >> 56);
+}
+
+#define rstring__sais_stype(i) ((t[(i) >> 3] >> ((i) & 7)) & 1)
+#define rstring__sais_lms(i) ((i) > 0 && rstring__sais_stype(i) && !rstring__sais_stype((i) - 1))
+
+static void
+rstring__sais_buckets(const blen_t* s, blen_t* bkt, blen_t n, blen_t k, int end)
+{
+  blen_t sum = 0;
+
+  memset(bkt, 0, sizeof(blen_t) * (size_t)k);
+  for (blen_t i = 0; i < n; ++i) { bkt[s[i]]++; }
+  for (blen_t i = 0; i < k; ++i) {
+    sum += bkt[i];
+    bkt[i] = end ? sum : sum - bkt[i];
+  }
+}
+
+/* Fill in the L type suffixes left to right, then the S type ones right
+   to left, from the ones already placed in sa. */
+static void
+rstring__sais_induce(const unsigned char* t, blen_t* sa, const blen_t* s, blen_t* bkt, blen_t n, blen_t k)
+{
+  blen_t i = 0;
+  blen_t j = 0;
+
+  rstring__sais_buckets(s, bkt, n, k, 0);
+  for (i = 0; i < n; ++i) {
+    j = sa[i] - 1;
+    if (sa[i] > 0 && !rstring__sais_stype(j)) { sa[bkt[s[j]]++] = j; }
+  }
+
+  rstring__sais_buckets(s, bkt, n, k, 1);
+  for (i = n - 1; i >= 0; --i) {
+    j = sa[i] - 1;
+    if (sa[i] > 0 && rstring__sais_stype(j)) { sa[--bkt[s[j]]] = j; }
+  }
+}
+
+/* Sort the suffixes of the n symbols at s, each less than k, into sa.  The
+   last symbol must be 0 and the only 0.  This is SA-IS (Nong, Zhang and
+   Chan), which takes linear time and, besides sa, n bits and k counters.
+   Returns 0 if out of memory. */
+static int
+rstring__sais(const blen_t* s, blen_t* sa, blen_t n, blen_t k)
+{
+  blen_t i = 0;
+  blen_t j = 0;
+
+  if (n == 1) {
+    sa[0] = 0;
+    return 1;
+  }
+
+  unsigned char* t = calloc((size_t)n / 8 + 1, 1);
+  blen_t* bkt = malloc(sizeof(blen_t) * (size_t)k);
+  if (t == NULL || bkt == NULL) {
+    free(t);
+    free(bkt);
+    return 0;
+  }
+
+  /* Which suffixes are smaller (S type) than the next one. */
+  t[(n - 1) >> 3] |= (unsigned char)(1 << ((n - 1) & 7));
+  for (i = n - 2; i >= 0; --i) {
+    if (s[i] < s[i + 1] || (s[i] == s[i + 1] && rstring__sais_stype(i + 1))) {
+      t[i >> 3] |= (unsigned char)(1 << (i & 7));
+    }
+  }
+
+  /* Sort the LMS substrings, which start at S types after an L type. */
+  rstring__sais_buckets(s, bkt, n, k, 1);
+  for (i = 0; i < n; ++i) { sa[i] = -1; }
+  for (i = 1; i < n; ++i) {
+    if (rstring__sais_lms(i)) { sa[--bkt[s[i]]] = i; }
+  }
+  rstring__sais_induce(t, sa, s, bkt, n, k);
+
+  /* Name them in that order, equal substrings getting the same name, and
+     make the string of names s1 in the top of sa. */
+  blen_t n1 = 0;
+  for (i = 0; i < n; ++i) {
+    if (rstring__sais_lms(sa[i])) { sa[n1++] = sa[i]; }
+  }
+  for (i = n1; i < n; ++i) { sa[i] = -1; }
+
+  blen_t name = 0;
+  blen_t prev = -1;
+  for (i = 0; i < n1; ++i) {
+    blen_t pos = sa[i];
+    int diff = 0;
+    for (blen_t d = 0; d < n; ++d) {
+      if (prev < 0 || s[pos + d] != s[prev + d] ||
+          rstring__sais_stype(pos + d) != rstring__sais_stype(prev + d)) {
+        diff = 1;
+        break;
+      }
+      if (d > 0 && (rstring__sais_lms(pos + d) || rstring__sais_lms(prev + d))) { break; }
+    }
+    if (diff) {
+      ++name;
+      prev = pos;
+    }
+    sa[n1 + pos / 2] = name - 1;
+  }
+  for (i = n - 1, j = n - 1; i >= n1; --i) {
+    if (sa[i] >= 0) { sa[j--] = sa[i]; }
+  }
+
+  /* Sort the LMS suffixes: directly if the names are all different, or
+     else by sorting the suffixes of s1. */
+  blen_t* s1 = sa + n - n1;
+  if (name < n1) {
+    if (!rstring__sais(s1, sa, n1, name)) {
+      free(t);
+      free(bkt);
+      return 0;
+    }
+  }
+  else {
+    for (i = 0; i < n1; ++i) { sa[s1[i]] = i; }
+  }
+
+  /* Put them at the ends of their buckets and induce the rest from them. */
+  for (i = 1, j = 0; i < n; ++i) {
+    if (rstring__sais_lms(i)) { s1[j++] = i; }
+  }
+  for (i = 0; i < n1; ++i) { sa[i] = s1[sa[i]]; }
+  for (i = n1; i < n; ++i) { sa[i] = -1; }
+  rstring__sais_buckets(s, bkt, n, k, 1);
+  for (i = n1 - 1; i >= 0; --i) {
+    j = sa[i];
+    sa[i] = -1;
+    sa[--bkt[s[j]]] = j;
+  }
+  rstring__sais_induce(t, sa, s, bkt, n, k);
+
+  free(t);
+  free(bkt);
+
+  return 1;
+}
+
+#undef rstring__sais_stype
+#undef rstring__sais_lms
+
+/* Where each table goes in the block described by hdr.  Returns 0 if it
+   would not fit in memory. */
+static int
+rstring__text_index_layout(const struct rstring__text_index_header* hdr,
+                           struct rstring__text_index_layout* lay)
+{
+  size_t rows = (size_t)hdr->n + 1;
+  size_t words = (rows + 63) / 64;
+  size_t blocks = (rows + RSTRING__INDEX_RMQ_BLOCK - 1) / RSTRING__INDEX_RMQ_BLOCK;
+  size_t checkpoints = rows / (size_t)hdr->step + 1;
+  size_t off = 0;
+
+#define RSTRING__INDEX_PUT(field, count, each)                                 \
+  do {                                                                         \
+    off = (off + 7) & ~(size_t)7;                                              \
+    if ((each) > 0 && (size_t)(count) > (SIZE_MAX / 2 - off) / (each)) {       \
+      return 0;                                                                \
+    }                                                                          \
+    lay->field = off;                                                          \
+    off += (size_t)(count) * (each);                                           \
+  } while (0)
+
+  lay->sampled = lay->sampled_rank = lay->rmq = 0;
+  RSTRING__INDEX_PUT(bwt, sizeof(struct rstring__text_index_header), 1);
+  RSTRING__INDEX_PUT(bwt, rows, 1);
+  RSTRING__INDEX_PUT(occ, checkpoints, sizeof(blen_t) * hdr->sigma);
+  if (hdr->flags & RSTRING_INDEX_COMPRESSED) {
+    RSTRING__INDEX_PUT(sa, hdr->nsamples, sizeof(blen_t));
+    RSTRING__INDEX_PUT(sampled, words, sizeof(uint64_t));
+    RSTRING__INDEX_PUT(sampled_rank, words, sizeof(blen_t));
+  }
+  else {
+    RSTRING__INDEX_PUT(sa, rows, sizeof(blen_t));
+    RSTRING__INDEX_PUT(rmq, blocks, sizeof(blen_t) * (size_t)hdr->levels);
+  }
+  lay->size = (off + 7) & ~(size_t)7;
+
+#undef RSTRING__INDEX_PUT
+
+  return lay->size <= (size_t)BLEN_MAX;
+}
+
+static void
+rstring__text_index_attach(rstring_text_index* idx, const struct rstring__text_index_layout* lay)
+{
+  idx->hdr = (const struct rstring__text_index_header*)idx->block;
+  idx->bwt = idx->block + lay->bwt;
+  idx->occ = (const blen_t*)(idx->block + lay->occ);
+  idx->sa = (const blen_t*)(idx->block + lay->sa);
+  idx->sampled = lay->sampled ? (const uint64_t*)(idx->block + lay->sampled) : NULL;
+  idx->sampled_rank = lay->sampled_rank ? (const blen_t*)(idx->block + lay->sampled_rank) : NULL;
+  idx->rmq = lay->rmq ? (const blen_t*)(idx->block + lay->rmq) : NULL;
+}
+
+/* The count of byte c in bwt before row i. */
+static blen_t
+rstring__text_index_rank(const rstring_text_index* idx, unsigned char c, blen_t i)
+{
+  const struct rstring__text_index_header* hdr = idx->hdr;
+  blen_t b = i / hdr->step;
+  blen_t from = b * hdr->step;
+  blen_t r = idx->occ[b * hdr->sigma + hdr->code[c]] +
+    bstr__kernels->count_byte(idx->bwt + from, i - from, c);
+
+  /* The end marker is stored as a 0 byte but isn't one. */
+  if (c == 0 && from <= hdr->primary && hdr->primary < i) { --r; }
+
+  return r;
+}
+
+/* Narrow down the rows of the suffixes starting with pattern, one byte of
+   it at a time from the end.  Returns the count of them, with the first
+   row in *lo. */
+static blen_t
+rstring__text_index_range(const rstring_text_index* idx, const rstring* pattern, blen_t* lo)
+{
+  const struct rstring__text_index_header* hdr = idx->hdr;
+  blen_t l = 0;
+  blen_t h = hdr->n + 1;
+
+  for (blen_t i = pattern->slen - 1; i >= 0 && l < h; --i) {
+    unsigned char c = pattern->data[i];
+    if (hdr->code[c] < 0) { return 0; }
+    l = hdr->C[c] + rstring__text_index_rank(idx, c, l);
+    h = hdr->C[c] + rstring__text_index_rank(idx, c, h);
+  }
+  *lo = l;
+
+  return h > l ? h - l : 0;
+}
+
+/* The text position of the suffix in row i. */
+static blen_t
+rstring__text_index_locate(const rstring_text_index* idx, blen_t i)
+{
+  const struct rstring__text_index_header* hdr = idx->hdr;
+  blen_t steps = 0;
+
+  if (idx->sampled == NULL) { return idx->sa[i]; }
+
+  /* Step back through the text (LF mapping) to a row whose entry was
+     kept.  The row of the whole text always is, so this never runs off
+     the start, and one in every sample positions is, so it takes fewer
+     than sample steps.  Any more and the block was damaged in a way the
+     checks in rstring_text_index_load() can't see. */
+  while (!((idx->sampled[i / 64] >> (i % 64)) & 1)) {
+    if (steps >= hdr->sample) { return RERROR; }
+
+    unsigned char c = idx->bwt[i];
+    i = hdr->C[c] + rstring__text_index_rank(idx, c, i);
+    ++steps;
+  }
+
+  uint64_t below = idx->sampled[i / 64] & (((uint64_t)1 << (i % 64)) - 1);
+
+  return idx->sa[idx->sampled_rank[i / 64] + rstring__popcount64(below)] + steps;
+}
+
+/* The smallest suffix array entry in rows lo up to hi. */
+static blen_t
+rstring__text_index_min(const rstring_text_index* idx, blen_t lo, blen_t hi)
+{
+  const blen_t B = RSTRING__INDEX_RMQ_BLOCK;
+  blen_t nblocks = (idx->hdr->n + B) / B;
+  blen_t bl = lo / B;
+  blen_t bh = (hi - 1) / B;
+  blen_t min = BLEN_MAX;
+  blen_t i = 0;
+
+  if (idx->rmq == NULL || bh - bl < 2) {
+    for (i = lo; i < hi; ++i) {
+      blen_t p = rstring__text_index_locate(idx, i);
+      if (p < min) { min = p; }
+    }
+    return min;
+  }
+
+  /* The ends by hand, and the whole blocks between from the sparse table. */
+  for (i = lo; i < (bl + 1) * B; ++i) {
+    if (idx->sa[i] < min) { min = idx->sa[i]; }
+  }
+  for (i = bh * B; i < hi; ++i) {
+    if (idx->sa[i] < min) { min = idx->sa[i]; }
+  }
+
+  blen_t first = bl + 1;
+  blen_t count = bh - first;
+  int level = 0;
+  while (((blen_t)2 << level) <= count) { ++level; }
+
+  const blen_t* row = idx->rmq + (size_t)level * (size_t)nblocks;
+  if (row[first] < min) { min = row[first]; }
+  if (row[bh - ((blen_t)1 << level)] < min) { min = row[bh - ((blen_t)1 << level)]; }
+
+  return min;
+}
+
+/**
+ * @brief Build an index of text that finds substrings in time depending on their length but not on the length of text.
+ *
+ * For running many rstring_include() or rstring_index() style queries against one large text.  The index holds the suffix array of the text, built in linear time with SA-IS, and the FM-index (the Burrows-Wheeler transform with rank checkpoints) that lets a pattern be looked for one byte at a time.  Counting the occurences of a pattern then takes time proportional to its length however long the text is.
+ *
+ * A full index takes about sizeof(blen_t) + 1 bytes per byte of text plus a little for the rank checkpoints (more for texts using many different bytes).  With RSTRING_INDEX_COMPRESSED the suffix array is mostly dropped, leaving about one and a half bytes per byte of text for texts with few different bytes, like DNA.  Counting is as fast, but finding where matches are takes up to 32 extra steps per match.
+ *
+ * Building needs about 2 * sizeof(blen_t) bytes per byte of text for a while.  The index doesn't refer to text afterwards.
+ *
+ * @code
+rstring_text_index* idx = rstring_index_build(genome, 0);
+
+while (... read a read ...) {
+  if (rstring_include_text_index(idx, read) == RTRUE) { ... }
+}
+
+rstring_text_index_free(idx);
+ * @endcode
+ *
+ * @param text The text to index.  (Not modified.)
+ * @param flags 0 or RSTRING_INDEX_COMPRESSED.
+ *
+ * @retval rstring_text_index* A new index.
+ * @retval NULL The text is invalid or there were errors.
+ *
+ * @warning The caller must free the result with rstring_text_index_free().
+ */
+rstring_text_index*
+rstring_index_build(const rstring* text, int flags)
+{
+  if (rstring_view_bad(text)) { return NULL; }
+  if ((flags & ~RSTRING_INDEX_COMPRESSED) != 0) { return NULL; }
+  if (text->slen >= BLEN_MAX - 1) { return NULL; }
+
+  blen_t n = text->slen;
+  blen_t rows = n + 1;
+  blen_t* s = malloc(sizeof(blen_t) * (size_t)rows);
+  blen_t* sa = malloc(sizeof(blen_t) * (size_t)rows);
+  rstring_text_index* idx = calloc(1, sizeof(rstring_text_index));
+  struct rstring__text_index_header hdr;
+  struct rstring__text_index_layout lay;
+  blen_t counts[UCHAR_MAX + 1] = { 0 };
+  blen_t i = 0;
+  int c = 0;
+
+  if (s == NULL || sa == NULL || idx == NULL) { goto fail; }
+
+  /* The text, with the bytes moved up one to make room for the end. */
+  for (i = 0; i < n; ++i) {
+    s[i] = (blen_t)text->data[i] + 1;
+    counts[text->data[i]]++;
+  }
+  s[n] = 0;
+  if (!rstring__sais(s, sa, rows, UCHAR_MAX + 2)) { goto fail; }
+  free(s);
+  s = NULL;
+
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, RSTRING__INDEX_MAGIC, sizeof(hdr.magic));
+  hdr.order = RSTRING__INDEX_ORDER;
+  hdr.blen_size = sizeof(blen_t);
+  hdr.flags = (uint32_t)flags;
+  hdr.n = n;
+  hdr.C[0] = 1;
+  for (c = 0; c <= UCHAR_MAX; ++c) {
+    hdr.code[c] = counts[c] ? (int32_t)hdr.sigma++ : -1;
+    hdr.C[c + 1] = hdr.C[c] + counts[c];
+  }
+
+  /* Keep the checkpoints to about half a blen_t per row. */
+  hdr.step = 64;
+  while (hdr.step < 2 * (blen_t)hdr.sigma) { hdr.step *= 2; }
+
+  if (flags & RSTRING_INDEX_COMPRESSED) {
+    hdr.sample = RSTRING__INDEX_SAMPLE;
+    hdr.nsamples = n / hdr.sample + 1;
+  }
+  else {
+    blen_t nblocks = (rows + RSTRING__INDEX_RMQ_BLOCK - 1) / RSTRING__INDEX_RMQ_BLOCK;
+    for (hdr.levels = 1; ((blen_t)1 << hdr.levels) <= nblocks; ++hdr.levels) {}
+  }
+
+  if (!rstring__text_index_layout(&hdr, &lay)) { goto fail; }
+  hdr.size = (blen_t)lay.size;
+  idx->block = calloc(lay.size, 1);
+  if (idx->block == NULL) { goto fail; }
+  idx->owned = 1;
+
+  unsigned char* bwt = idx->block + lay.bwt;
+  blen_t* occ = (blen_t*)(idx->block + lay.occ);
+  blen_t running[UCHAR_MAX + 1] = { 0 };
+
+  for (i = 0; i <= rows; ++i) {
+    if (i % hdr.step == 0) {
+      memcpy(occ + (i / hdr.step) * hdr.sigma, running, sizeof(blen_t) * hdr.sigma);
+    }
+    if (i == rows) { break; }
+
+    if (sa[i] == 0) {
+      hdr.primary = i;
+      bwt[i] = 0;
+    }
+    else {
+      bwt[i] = text->data[sa[i] - 1];
+      running[hdr.code[bwt[i]]]++;
+    }
+  }
+
+  if (flags & RSTRING_INDEX_COMPRESSED) {
+    blen_t* samples = (blen_t*)(idx->block + lay.sa);
+    uint64_t* sampled = (uint64_t*)(idx->block + lay.sampled);
+    blen_t* sampled_rank = (blen_t*)(idx->block + lay.sampled_rank);
+    blen_t kept = 0;
+
+    for (i = 0; i < rows; ++i) {
+      if (i % 64 == 0) { sampled_rank[i / 64] = kept; }
+      if (sa[i] % hdr.sample == 0) {
+        sampled[i / 64] |= (uint64_t)1 << (i % 64);
+        samples[kept++] = sa[i];
+      }
+    }
+  }
+  else {
+    const blen_t B = RSTRING__INDEX_RMQ_BLOCK;
+    blen_t nblocks = (rows + B - 1) / B;
+    blen_t* rmq = (blen_t*)(idx->block + lay.rmq);
+
+    memcpy(idx->block + lay.sa, sa, sizeof(blen_t) * (size_t)rows);
+    for (i = 0; i < nblocks; ++i) {
+      blen_t min = BLEN_MAX;
+      for (blen_t j = i * B; j < rows && j < (i + 1) * B; ++j) {
+        if (sa[j] < min) { min = sa[j]; }
+      }
+      rmq[i] = min;
+    }
+    for (blen_t level = 1; level < hdr.levels; ++level) {
+      const blen_t* below = rmq + (level - 1) * nblocks;
+      blen_t* row = rmq + level * nblocks;
+      blen_t half = (blen_t)1 << (level - 1);
+      for (i = 0; i < nblocks; ++i) {
+        row[i] = below[i];
+        if (i + half < nblocks && below[i + half] < row[i]) { row[i] = below[i + half]; }
+      }
+    }
+  }
+  free(sa);
+
+  memcpy(idx->block, &hdr, sizeof(hdr));
+  rstring__text_index_attach(idx, &lay);
+
+  return idx;
+
+fail:
+  free(s);
+  free(sa);
+  if (idx != NULL) { free(idx->block); }
+  free(idx);
+  return NULL;
+}
+
+/**
+ * @brief Free an index made by rstring_index_build() or rstring_text_index_load().
+ *
+ * @retval ROKAY The index was freed.
+ * @retval RERROR The index is NULL.
+ */
+int
+rstring_text_index_free(rstring_text_index* idx)
+{
+  if (idx == NULL) { return RERROR; }
+
+  if (idx->owned) { free(idx->block); }
+  free(idx);
+
+  return ROKAY;
+}
+
+/**
+ * @brief Counts the occurences of pattern in the indexed text, overlapping ones included.
+ *
+ * Takes time proportional to the length of pattern.  (An empty pattern is found before every byte and at the end.)
+ *
+ * @retval count The number of occurences.
+ * @retval RERROR Either input is invalid.
+ */
+blen_t
+rstring_count_text_index(const rstring_text_index* idx, const rstring* pattern)
+{
+  if (idx == NULL) { return RERROR; }
+  if (rstring_view_bad(pattern)) { return RERROR; }
+
+  blen_t lo = 0;
+
+  return rstring__text_index_range(idx, pattern, &lo);
+}
+
+/**
+ * @brief Like rstring_include() on the indexed text.
+ *
+ * Takes time proportional to the length of pattern.
+ *
+ * @retval RTRUE The pattern is present.
+ * @retval RFALSE The pattern is not present.
+ * @retval RERROR Either input is invalid.
+ */
+int
+rstring_include_text_index(const rstring_text_index* idx, const rstring* pattern)
+{
+  blen_t val = rstring_count_text_index(idx, pattern);
+
+  if (val == RERROR) { return RERROR; }
+
+  return val > 0 ? RTRUE : RFALSE;
+}
+
+/**
+ * @brief Like rstring_index() on the indexed text: the first place pattern occurs.
+ *
+ * For a full index this takes time proportional to the length of pattern (plus a constant for looking through the suffix array).  A compressed index has to find every occurence to tell which comes first, which takes up to 32 steps for each.
+ *
+ * @retval index The index in the text of the first occurence of pattern.
+ * @retval RERROR Either input is invalid or the pattern was not found.
+ */
+blen_t
+rstring_index_text_index(const rstring_text_index* idx, const rstring* pattern)
+{
+  if (idx == NULL) { return RERROR; }
+  if (rstring_view_bad(pattern)) { return RERROR; }
+
+  blen_t lo = 0;
+  blen_t count = rstring__text_index_range(idx, pattern, &lo);
+  if (count == 0) { return RERROR; }
+
+  return rstring__text_index_min(idx, lo, lo + count);
+}
+
+/**
+ * @brief The bytes of an index, to be saved and used again with rstring_text_index_load() instead of building the index again.
+ *
+ * The bytes are only good on machines with the same byte order and with rlib built with the same RLIB_LARGE_STRINGS setting.
+ *
+ * @retval rstring* The index as an rstring.
+ * @retval NULL The index is NULL or there were errors.
+ *
+ * @warning The caller must free the result.
+ */
+rstring*
+rstring_text_index_dump(const rstring_text_index* idx)
+{
+  if (idx == NULL) { return NULL; }
+
+  return blk2bstr(idx->block, idx->hdr->size);
+}
+
+/* Check the tables of a loaded block against the header and each other,
+   in one pass over each, so that damaged data is turned away rather than
+   sending a search out of bounds.  Returns 0 if anything is off. */
+static int
+rstring__text_index_check(const rstring_text_index* idx)
+{
+  const struct rstring__text_index_header* hdr = idx->hdr;
+  blen_t rows = hdr->n + 1;
+  blen_t running[UCHAR_MAX + 1] = { 0 };
+  uint32_t sigma = 0;
+  blen_t i = 0;
+  int c = 0;
+
+  /* The byte codes are handed out in order to the bytes in the text. */
+  if (hdr->C[0] != 1 || hdr->C[UCHAR_MAX + 1] != rows) { return 0; }
+  for (c = 0; c <= UCHAR_MAX; ++c) {
+    int32_t code = hdr->C[c + 1] > hdr->C[c] ? (int32_t)sigma++ : -1;
+    if (hdr->code[c] != code) { return 0; }
+  }
+  if (sigma != hdr->sigma) { return 0; }
+
+  /* Every rank checkpoint is the count of each byte before it, and the
+     bwt holds each byte as often as C says. */
+  if (idx->bwt[hdr->primary] != 0) { return 0; }
+  for (i = 0; i <= rows; ++i) {
+    if (i % hdr->step == 0 &&
+        memcmp(idx->occ + (i / hdr->step) * hdr->sigma, running, sizeof(blen_t) * hdr->sigma) != 0) {
+      return 0;
+    }
+    if (i == rows) { break; }
+
+    if (i != hdr->primary) {
+      if (hdr->code[idx->bwt[i]] < 0) { return 0; }
+      running[hdr->code[idx->bwt[i]]]++;
+    }
+  }
+  for (c = 0; c <= UCHAR_MAX; ++c) {
+    if (hdr->code[c] >= 0 && running[hdr->code[c]] != hdr->C[c + 1] - hdr->C[c]) { return 0; }
+  }
+
+  /* Suffix array entries are text positions, and the row of the whole
+     text is position 0. */
+  blen_t kept = rows;
+  blen_t primary = hdr->primary;
+  if (idx->sampled != NULL) {
+    for (i = 0, kept = 0; i < rows; ++i) {
+      if (i % 64 == 0 && idx->sampled_rank[i / 64] != kept) { return 0; }
+      if ((idx->sampled[i / 64] >> (i % 64)) & 1) { ++kept; }
+    }
+    if (kept != hdr->nsamples) { return 0; }
+    if (!((idx->sampled[primary / 64] >> (primary % 64)) & 1)) { return 0; }
+
+    uint64_t below = idx->sampled[primary / 64] & (((uint64_t)1 << (primary % 64)) - 1);
+    primary = idx->sampled_rank[primary / 64] + rstring__popcount64(below);
+  }
+  for (i = 0; i < kept; ++i) {
+    if (idx->sa[i] < 0 || idx->sa[i] > hdr->n) { return 0; }
+  }
+  if (idx->sa[primary] != 0) { return 0; }
+
+  /* Full indexes: as many levels as rstring_index_build() makes, and the
+     block minimums are text positions too. */
+  if (idx->rmq != NULL) {
+    blen_t nblocks = (rows + RSTRING__INDEX_RMQ_BLOCK - 1) / RSTRING__INDEX_RMQ_BLOCK;
+    blen_t levels = 1;
+    while (((blen_t)1 << levels) <= nblocks) { ++levels; }
+    if (hdr->levels != levels) { return 0; }
+
+    for (i = 0; i < nblocks * levels; ++i) {
+      if (idx->rmq[i] < 0 || idx->rmq[i] > hdr->n) { return 0; }
+    }
+  }
+
+  return 1;
+}
+
+/**
+ * @brief Use the bytes of an index from rstring_text_index_dump(), for instance a file of them read in or mmap()ed, without building it again.
+ *
+ * Nothing is copied: the index reads data in place.  Loading makes one pass over the tables to check them against each other, so that damaged data gives NULL rather than a search that reads out of bounds or never ends.  That is much cheaper than building the index, but it does read the whole block.  Damage that leaves the tables consistent, such as a changed suffix array entry, is not caught and gives wrong answers.
+ *
+ * @code
+int fd = open("genome.idx", O_RDONLY);
+struct stat st;
+fstat(fd, &st);
+void* p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+rstring_view bytes = rstring_view_of_blk(p, st.st_size);
+
+rstring_text_index* idx = rstring_text_index_load(&bytes);
+ * @endcode
+ *
+ * @param data The bytes of the index.  Their address must be a multiple of 8, as from malloc() or mmap().
+ *
+ * @retval rstring_text_index* The index.
+ * @retval NULL data is invalid, damaged, misaligned or not an index made by this build of rlib.
+ *
+ * @warning The caller must free the result with rstring_text_index_free(), and data must stay alive and unchanged until then.
+ */
+rstring_text_index*
+rstring_text_index_load(const rstring* data)
+{
+  if (rstring_view_bad(data)) { return NULL; }
+  if (((uintptr_t)data->data & 7) != 0) { return NULL; }
+  if ((size_t)data->slen < sizeof(struct rstring__text_index_header)) { return NULL; }
+
+  const struct rstring__text_index_header* hdr = (const struct rstring__text_index_header*)data->data;
+  struct rstring__text_index_layout lay;
+
+  if (memcmp(hdr->magic, RSTRING__INDEX_MAGIC, sizeof(hdr->magic)) != 0 ||
+      hdr->order != RSTRING__INDEX_ORDER || hdr->blen_size != sizeof(blen_t) ||
+      (hdr->flags & ~(uint32_t)RSTRING_INDEX_COMPRESSED) != 0 ||
+      hdr->sigma > UCHAR_MAX + 1 || hdr->n < 0 || hdr->n >= BLEN_MAX - 1 ||
+      hdr->step < 64 || hdr->primary < 0 || hdr->primary > hdr->n ||
+      hdr->size != data->slen) {
+    return NULL;
+  }
+  if (hdr->flags & RSTRING_INDEX_COMPRESSED) {
+    if (hdr->sample != RSTRING__INDEX_SAMPLE || hdr->nsamples != hdr->n / hdr->sample + 1) { return NULL; }
+  }
+  else if (hdr->levels < 1 || hdr->levels > 64) {
+    return NULL;
+  }
+  for (int c = 0; c <= UCHAR_MAX; ++c) {
+    if (hdr->code[c] < -1 || hdr->code[c] >= (int32_t)hdr->sigma ||
+        hdr->C[c] < 1 || hdr->C[c + 1] < hdr->C[c] || hdr->C[c + 1] > hdr->n + 1) {
+      return NULL;
+    }
+  }
+  if (!rstring__text_index_layout(hdr, &lay) || lay.size != (size_t)data->slen) { return NULL; }
+
+  rstring_text_index* idx = calloc(1, sizeof(rstring_text_index));
+  if (idx == NULL) { return NULL; }
+
+  idx->block = data->data;
+  idx->owned = 0;
+  rstring__text_index_attach(idx, &lay);
+
+  if (!rstring__text_index_check(idx)) {
+    free(idx);
+    return NULL;
+  }
+
+  return idx;
+}
+
+/**
+ * @brief Like rstring_new() but the result is built in the given arena.
+ *
+ * @param arena The arena to allocate from.
+ * @param cstr Char array to convert to rstring.  (Not modified.)
+ *
+ * @retval rstring* A valid rstring living in the arena.
+ * @retval NULL The arena or cstr is NULL, or there were errors creating the rstring.
+ *
+ * @note The result is released by rlib_arena_reset() or rlib_arena_free(), not by rstring_free() (which is a harmless no-op on it).
+ */
+rstring*
+rstring_new_arena(rlib_arena* arena, const char* cstr)
+{
+  if (arena == NULL) { return NULL; }
+
+  rlib_arena* prev = rlib_arena_use(arena);
+  rstring* rstr = rstring_new(cstr);
+  rlib_arena_use(prev);
+
+  return rstr;
+}
+
+/**
+ * @brief Like rstring_copy() but the copy is built in the given arena.
+ *
+ * @retval rstring* A valid rstring copy living in the arena.
+ * @retval NULL The arena is NULL, the input rstring is invalid, or there was an error.
+ */
+rstring*
+rstring_copy_arena(rlib_arena* arena, const rstring* rstr)
+{
+  if (arena == NULL) { return NULL; }
+
+  rlib_arena* prev = rlib_arena_use(arena);
+  rstring* copy = rstring_copy(rstr);
+  rlib_arena_use(prev);
+
+  return copy;
+}
+
+/**
+ * @brief Like rstring_slice() but the slice is built in the given arena.
+ *
+ * @retval rstring* A valid rstring living in the arena.
+ * @retval NULL The arena is NULL, or see rstring_slice().
+ */
+rstring*
+rstring_slice_arena(rlib_arena* arena, const rstring* rstr, blen_t index, blen_t length)
+{
+  if (arena == NULL) { return NULL; }
+
+  rlib_arena* prev = rlib_arena_use(arena);
+  rstring* slice = rstring_slice(rstr, index, length);
+  rlib_arena_use(prev);
+
+  return slice;
+}
+
+/**
+ * @brief Like rstring_split() but the array and all of its rstrings are built in the given arena.
+ *
+ * @retval rstring_array* A valid rstring_array living in the arena.
+ * @retval NULL The arena is NULL, or see rstring_split().
+ */
+rstring_array*
+rstring_split_arena(rlib_arena* arena, rstring* rstr, const rstring* sep)
+{
+  if (arena == NULL) { return NULL; }
+
+  rlib_arena* prev = rlib_arena_use(arena);
+  rstring_array* ary = rstring_split(rstr, sep);
+  rlib_arena_use(prev);
+
+  return ary;
+}
+
+/**
+ * @brief Set the growth policy used by every rstring that doesn't have its own.
+ *
+ * @param policy One of BSTR_GROW_POW2 (the default: round capacity up to the next power of two), BSTR_GROW_HALF (grow by at least 1.5x) or BSTR_GROW_EXACT (what was asked for plus BSTR_GROW_HEADROOM bytes).
+ *
+ * @retval int The previous global policy.
+ * @retval RERROR The policy is not valid.
+ *
+ * @note This also sets the initial capacity of new rstrings, so BSTR_GROW_EXACT makes them no bigger than needed.
+ */
+int
+rlib_set_growth_policy(int policy)
+{
+  if (policy < BSTR_GROW_POW2 || policy > BSTR_GROW_EXACT) { return RERROR; }
+
+  int prev = bstr__grow_policy;
+  bstr__grow_policy = policy;
+
+  return prev;
+}
+
+/**
+ * @brief How many times rstring buffers have been moved or resized on this thread.
+ *
+ * Compare this before and after a workload to see what a growth policy costs in reallocations.
+ *
+ * @retval size_t The number of buffer resizes so far.
+ */
+size_t
+rlib_resize_count()
+{
+  return bstr__resize_count;
+}
+
+/**
+ * @brief Set the size at which rstring buffers move to their own memory mapping.
+ *
+ * Buffers at least this big are backed by anonymous mmap and grow with mremap (on Linux), so growing a huge rstring never copies it.  Buffers that shrink back below the threshold return to the heap.
+ *
+ * @param bytes The new threshold.  0 turns the mmap tier off.  The default is BSTR_MMAP_THRESHOLD (64MB).
+ *
+ * @retval size_t The previous threshold.
+ *
+ * @note On systems without anonymous mmap this has no effect.
+ */
+size_t
+rlib_set_mmap_threshold(size_t bytes)
+{
+  size_t prev = bstr__mmap_threshold;
+  bstr__mmap_threshold = bytes;
+
+  return prev;
+}
+
+/**
+ * @brief Ask the kernel to back mmap tier rstrings with huge pages (MADV_HUGEPAGE).
+ *
+ * @param enable RTRUE to advise huge pages for new and grown mappings, RFALSE to stop.
+ *
+ * @retval int The previous setting.
+ *
+ * @note This is only advice, and a no-op where MADV_HUGEPAGE isn't available.
+ */
+int
+rlib_set_mmap_hugepages(int enable)
+{
+  int prev = bstr__mmap_hugepages;
+  bstr__mmap_hugepages = enable ? RTRUE : RFALSE;
+
+  return prev;
+}
+
+/**
+ * @brief Which instruction set the byte scanning kernels are using.
+ *
+ * Scans for single bytes, delimiters and whitespace (in searching, splitting, line reading and trimming) use the widest vector instructions the CPU has, picked once at startup.
+ *
+ * @retval int RLIB_SIMD_AVX512, RLIB_SIMD_AVX2, RLIB_SIMD_SSE2 or RLIB_SIMD_NONE (plain C, which is all there is off x86 or with RLIB_NO_SIMD defined).
+ */
+int
+rlib_simd_level()
+{
+  return bstr__simd_level;
+}
+
+/**
+ * @brief Make the byte scanning kernels use a narrower instruction set than the best one available, e.g. to compare them.
+ *
+ * @param level RLIB_SIMD_NONE, RLIB_SIMD_SSE2, RLIB_SIMD_AVX2 or RLIB_SIMD_AVX512.  Levels the CPU doesn't support are lowered to the best one it does.
+ *
+ * @retval int The previous level.
+ * @retval RERROR The level is not valid.
+ *
+ * @note This is a process wide setting, not a per thread one.  Change it before starting threads that use rstrings.
+ */
+int
+rlib_set_simd_level(int level)
+{
+  if (level < RLIB_SIMD_NONE || level > RLIB_SIMD_AVX512) { return RERROR; }
+
+  int prev = bstr__simd_level;
+  bstr__simd_level = level < bstr__simd_best ? level : bstr__simd_best;
+  bstr__kernels = bstr__kernels_for(bstr__simd_level);
+
+  return prev;
+}
+
+/**
+ * @brief Set the growth policy of a single rstring, overriding the global one.
+ *
+ * @param rstr The rstring to set the policy of.
+ * @param policy BSTR_GROW_POW2, BSTR_GROW_HALF, BSTR_GROW_EXACT, or BSTR_GROW_DEFAULT to follow the global policy again.
+ *
+ * @retval ROKAY The policy was set.
+ * @retval RERROR The rstring is invalid or the policy is not valid.
+ */
+int
+rstring_set_growth_policy(rstring* rstr, int policy)
+{
+  if (rstring_bad(rstr)) { return RERROR; }
+  if (policy < BSTR_GROW_DEFAULT || policy > BSTR_GROW_EXACT) { return RERROR; }
+
+  rstr->flags = (rstr->flags & ~BSTR_F_GROW_MASK) | (policy << BSTR_F_GROW_SHIFT);
+
+  return ROKAY;
+}
+
+/**
+ * @brief Shrink the memory backing the rstring to fit its contents.
+ *
+ * Use this on long-lived strings once they are done growing.
+ *
+ * @param rstr The rstring to compact.
+ *
+ * @retval ROKAY The rstring was compacted (or was already as small as it can be).
+ * @retval RERROR The rstring is invalid or there was an error.
+ */
+int
+rstring_compact(rstring* rstr)
+{
+  if (rstring_bad(rstr)) { return RERROR; }
+
+  return ballocmin(rstr, rstr->slen + 1);
+}
+
+/**
+ * @brief Compact every rstring in the array, and the array itself.
+ *
+ * @param rary The rstring_array to compact.
+ *
+ * @retval ROKAY The array and its rstrings were compacted.
+ * @retval RERROR The rstring_array is invalid or there was an error.
+ */
+int
+rstring_array_compact(rstring_array* rary)
+{
+  if (rstring_array_bad(rary)) { return RERROR; }
+
+  for (blen_t i = 0; i < rary->qty; ++i) {
+    if (rstring_compact(rary->entry[i]) != ROKAY) { return RERROR; }
+  }
+
+  return bstrListAllocMin(rary, rary->qty > 0 ? rary->qty : 1);
+}
+
+/**
+ * @brief Get the number of bytes currently allocated for the rstring's data.
+ *
+ * @retval blen_t The capacity of the rstring.
+ * @retval RERROR The rstring is invalid.
+ */
+blen_t
+rstring_capacity(const rstring* rstr)
+{
+  if (rstring_bad(rstr)) { return RERROR; }
+
+  return rstr->mlen;
+}
+
+/**
+ * @brief Get the number of allocated but unused bytes in the rstring (not counting the '\0' terminator).
+ *
+ * @retval blen_t The slack of the rstring.
+ * @retval RERROR The rstring is invalid.
+ */
+blen_t
+rstring_slack(const rstring* rstr)
+{
+  if (rstring_bad(rstr)) { return RERROR; }
+
+  return rstr->mlen - rstr->slen - 1;
+}
+
+/**
+ * @brief Get the total slack of every rstring in the array plus the unused entry slots of the array itself, in bytes.
+ *
+ * @retval blen_t The slack of the rstring_array.
+ * @retval RERROR The rstring_array or one of its rstrings is invalid.
+ */
+blen_t
+rstring_array_slack(const rstring_array* rary)
+{
+  if (rstring_array_bad(rary)) { return RERROR; }
+
+  blen_t slack = (rary->mlen - rary->qty) * (blen_t)sizeof(rstring*);
+
+  for (blen_t i = 0; i < rary->qty; ++i) {
+    blen_t entry_slack = rstring_slack(rary->entry[i]);
+    if (entry_slack == RERROR) { return RERROR; }
+
+    slack += entry_slack;
+  }
+
+  return slack;
+}
+
+/*
+ * Zero-copy views
+ */
+
+static rstring_view
+rstring__view(const unsigned char* data, blen_t len)
+{
+  rstring_view view;
+
+  view.mlen  = -1;
+  view.slen  = len;
+  view.data  = (unsigned char*)data;
+  view.flags = 0;
+
+  return view;
+}
+
+#define rstring__bad_view() (rstring__view(NULL, RERROR))
+
+/**
+ * @brief Make a view of all of rstr.
+ *
+ * @param rstr The rstring (or view) to look at.  (Not modified.)
+ *
+ * @retval rstring_view A view of rstr.
+ * @retval rstring_view An invalid view (see rstring_view_bad()) if rstr is invalid.
+ */
+rstring_view
+rstring_view_of(const rstring* rstr)
+{
+  if (rstring_view_bad(rstr)) { return rstring__bad_view(); }
+
+  return rstring__view(rstr->data, rstr->slen);
+}
+
+/**
+ * @brief Make a view of a '\0' terminated char*.
+ *
+ * @retval rstring_view A view of cstr, not including the '\0'.
+ * @retval rstring_view An invalid view if cstr is NULL or too long.
+ */
+rstring_view
+rstring_view_of_cstr(const char* cstr)
+{
+  if (cstr == NULL) { return rstring__bad_view(); }
+
+  size_t len = strlen(cstr);
+  if (len >= (size_t)BLEN_MAX) { return rstring__bad_view(); }
+
+  return rstring__view((const unsigned char*)cstr, (blen_t)len);
+}
+
+/**
+ * @brief Make a view of len bytes starting at blk.
+ *
+ * @retval rstring_view A view of the bytes.
+ * @retval rstring_view An invalid view if blk is NULL or len < 0.
+ */
+rstring_view
+rstring_view_of_blk(const void* blk, blen_t len)
+{
+  if (blk == NULL || len < 0) { return rstring__bad_view(); }
+
+  return rstring__view((const unsigned char*)blk, len);
+}
+
+/**
+ * @brief Like rstring_slice() but returns a view into rstr rather than a new rstring.
+ *
+ * @param rstr The rstring (or view) that we want to substring. (Not modified.)
+ * @param index The starting index of the substring.
+ * @param length The length of the substring.
+ *
+ * @retval rstring_view A view of the specified substring.
+ * @retval rstring_view An invalid view where rstring_slice() would return NULL.
+ */
+rstring_view
+rstring_slice_view(const rstring* rstr, blen_t index, blen_t length)
+{
+  if (rstring_view_bad(rstr)) { return rstring__bad_view(); }
+
+  blen_t len = rstr->slen;
+  blen_t idx = index;
+
+  /* Special weird ruby case. */
+  if (index == len) {
+    return rstring__view(rstr->data + len, 0);
+  }
+
+  /* Negative indices count back from the end. */
+  if (index < 0) {
+    idx = len - idx - 1;
+  }
+
+  if (idx > len || length < 0) {
+    return rstring__bad_view();
+  }
+
+  /* Clamp the same way bmidstr does. */
+  if (index < 0) {
+    length += index;
+    index = 0;
+  }
+  if (length > len - index) { length = len - index; }
+  if (length <= 0) { return rstring__view(rstr->data, 0); }
+
+  return rstring__view(rstr->data + index, length);
+}
+
+/**
+ * @brief Like rstring_chomp() but returns a view into rstr rather than a new rstring.
  *
- * @param rstr Not modified.
- * @param index Get the char at this index in rstr.
+ * @param rstr The rstring (or view) to chomp. (Not modified.)
  *
- * @retval char The idx'th character of the rstring.
- * @retval RERROR If The input rstring is invalid or there was an error.
+ * @retval rstring_view A view of rstr without the last record separator.
+ * @retval rstring_view An invalid view if rstr is invalid.
  */
-int
-rstring_char_at(const rstring* rstr, int idx)
+rstring_view
+rstring_chomp_view(const rstring* rstr)
 {
-  if (rstring_bad(rstr)) { return RERROR; }
-
-  return bchare(rstr, idx, RERROR);
-}
-
+  if (rstring_view_bad(rstr)) { return rstring__bad_view(); }
 
-rstring_array*
-rstring_array_new()
-{
-  rstring_array* rary = NULL;
+  blen_t len = rstr->slen;
 
-  rary = bstrListCreate();
-  if (rary == NULL) { return NULL; }
+  if (len > 0 && rstr->data[len - 1] == '\n') { --len; }
+  if (len > 0 && rstr->data[len - 1] == '\r') { --len; }
 
-  return rary;
+  return rstring__view(rstr->data, len);
 }
 
-int
-rstring_array_push_rstr(rstring_array* rary, rstring* rstr)
+/**
+ * @brief Like rstring_chomp_sep() but returns a view into rstr rather than a new rstring.
+ *
+ * @param rstr The rstring (or view) to chomp. (Not modified.)
+ * @param sep The separator to remove.
+ *
+ * @retval rstring_view A view of rstr without the trailing separator.
+ * @retval rstring_view An invalid view if rstr or sep is invalid.
+ */
+rstring_view
+rstring_chomp_sep_view(const rstring* rstr, const rstring* sep)
 {
-  int current_size = rary->qty;
-  int rval = 0;
-  rval = bstrListAlloc((struct bstrList*)rary, current_size + 1);
-  if (rval == BSTR_ERR) { return RERROR; }
-  rary->qty = current_size + 1;
-  rary->entry[rary->qty - 1] = rstr;
-  assert(rary->qty <= rary->mlen);
-  assert(rary->qty == current_size + 1);
+  if (rstring_view_bad(rstr) || rstring_view_bad(sep)) { return rstring__bad_view(); }
 
-  return ROKAY;
-}
+  blen_t len = rstr->slen;
 
-int
-rstring_array_push_cstr(rstring_array* rary, char* cstr)
-{
-  int current_size = rary->qty;
-  int rval = 0;
-  rstring* rstr = NULL;
-  rval = bstrListAlloc((struct bstrList*)rary, current_size + 1);
-  if (rval == BSTR_ERR) { return RERROR; }
+  /* Ruby's paragraph mode: every trailing newline, each with its \r if it has one. */
+  if (sep->slen == 0) {
+    while (len > 0 && rstr->data[len - 1] == '\n') {
+      --len;
+      if (len > 0 && rstr->data[len - 1] == '\r') { --len; }
+    }
 
-  rstr = rstring_new(cstr);
-  if (rstr == NULL) { return RERROR; }
+    return rstring__view(rstr->data, len);
+  }
 
-  rary->qty = current_size + 1;
-  rary->entry[rary->qty - 1] = rstr;
-  assert(rary->qty <= rary->mlen);
-  assert(rary->qty == current_size + 1);
+  if (sep->slen == 1 && sep->data[0] == '\n') { return rstring_chomp_view(rstr); }
 
-  return ROKAY;
+  if (len >= sep->slen &&
+      bstr__memcmp(rstr->data + len - sep->slen, sep->data, (size_t)sep->slen) == 0) {
+    len -= sep->slen;
+  }
+
+  return rstring__view(rstr->data, len);
 }
 
-rstring*
-rstring_array_get(rstring_array* rary, int index)
+static rstring_view
+rstring__strip_view(const rstring* rstr, int left, int right)
 {
-  if (index < 0 || index >= rary->qty) { return NULL; }
-  if (rary->qty > rary->mlen) { return NULL; }
+  if (rstring_view_bad(rstr)) { return rstring__bad_view(); }
 
-  rstring* rstr = NULL;
-  rstr = rary->entry[index];
-  if (rstr == NULL) { return NULL; }
+  blen_t beg = 0;
+  blen_t end = rstr->slen;
 
-  return rstr;
-}
+  /* One short vector scan in from each end; the middle is never read. */
+  if (right) {
+    end = bstr__kernels->find_last_nonws(rstr->data, end) + 1;
+  }
+  if (left && end > 0) {
+    beg = bstr__kernels->find_nonws(rstr->data, end);
+    if (beg < 0) { beg = end; }
+  }
 
-int
-rstring_array_free(rstring_array* rary)
-{
-  return bstrListDestroy((struct bstrList*)rary);
+  return rstring__view(rstr->data + beg, end - beg);
 }
 
-rstring*
-rstring_array_join(rstring_array* rstrings, const rstring* sep)
+/**
+ * @brief Like rstring_strip() but returns a view into rstr rather than a new rstring.
+ *
+ * @retval rstring_view A view of rstr without leading and trailing whitespace.
+ * @retval rstring_view An invalid view if rstr is invalid.
+ */
+rstring_view
+rstring_strip_view(const rstring* rstr)
 {
-  if (rstrings == NULL || sep == NULL) { return NULL; }
-  if (rstrings->qty == 0) {
-    return rstring_new("");
-  }
-
-  return bjoin((const struct bstrList*)rstrings, (const_bstring)sep);
+  return rstring__strip_view(rstr, RTRUE, RTRUE);
 }
 
 /**
- * @brief Wraps rstring_array_join() but takes char* for sep
+ * @brief Like rstring_lstrip() but returns a view into rstr rather than a new rstring.
+ *
+ * @retval rstring_view A view of rstr without leading whitespace.
+ * @retval rstring_view An invalid view if rstr is invalid.
  */
-rstring*
-rstring_array_join_cstr(rstring_array* rstrings, const char* sep)
+rstring_view
+rstring_lstrip_view(const rstring* rstr)
 {
-  if (rstrings == NULL || sep == NULL) { return NULL; }
-  if (rstrings->qty == 0) {
-    return rstring_new("");
-  }
-
-  rstring* rsep = rstring_new(sep);
-  if (rstring_bad(rsep)) { return NULL; }
-
-  rstring* new_rstr = bjoin((const struct bstrList*)rstrings, (const_bstring)rsep);
-  if (rstring_bad(new_rstr)) {
-    rstring_free(rsep);
-    return NULL;
-  }
-
-  rstring_free(rsep);
-
-  return new_rstr;
+  return rstring__strip_view(rstr, RTRUE, RFALSE);
 }
 
-rstring_array*
-rstring_split(rstring* rstr, const rstring* sep)
+/**
+ * @brief Like rstring_rstrip() but returns a view into rstr rather than a new rstring.
+ *
+ * @retval rstring_view A view of rstr without trailing whitespace.
+ * @retval rstring_view An invalid view if rstr is invalid.
+ */
+rstring_view
+rstring_rstrip_view(const rstring* rstr)
 {
-  return bsplitstr((bstring)rstr, (const_bstring)sep);
+  return rstring__strip_view(rstr, RFALSE, RTRUE);
 }
 
 /**
- * @brief Wraps rstring_split() but takes char* for sep
+ * @brief Get the next field of rstr split on sep as a view, without allocating anything.
+ *
+ * @code
+rstring_view field;
+blen_t pos = 0;
+
+while (rstring_split_view_next(line, tab, &pos, &field) == RTRUE) {
+  ... use field, or rstring_copy(&field) to keep it ...
+}
+ * @endcode
+ *
+ * @param rstr The rstring (or view) to split. (Not modified.)
+ * @param sep The separator.  If it is empty, every char is a field.
+ * @param pos Where to look for the next field.  Start it at 0; it is moved past the field and its separator.
+ * @param field Set to a view of the next field.
+ *
+ * @retval RTRUE field holds the next field.
+ * @retval RFALSE There are no more fields.
+ * @retval RERROR Any of the args are invalid.
+ *
+ * @note Gives the same fields as rstring_split(), including empty ones.
  */
-rstring_array*
-rstring_split_cstr(rstring* rstr, const char* sep)
+int
+rstring_split_view_next(const rstring* rstr, const rstring* sep, blen_t* pos, rstring_view* field)
 {
-  if (rstring_bad(rstr)) { return NULL; }
-  if (sep == NULL) { return NULL; }
+  if (rstring_view_bad(rstr)) { return RERROR; }
+  if (rstring_view_bad(sep)) { return RERROR; }
+  if (pos == NULL || field == NULL || *pos < 0) { return RERROR; }
 
-  rstring* rsep = rstring_new(sep);
-  if (rstring_bad(rsep)) { return NULL; }
+  blen_t len = rstr->slen;
 
-  rstring_array* ary = bsplitstr((bstring)rstr, (const_bstring)rsep);
+  if (sep->slen == 0) {
+    if (*pos >= len) { return RFALSE; }
 
-  if (ary == NULL) {
-    rstring_free(rsep);
-    return NULL;
+    *field = rstring__view(rstr->data + *pos, 1);
+    *pos += 1;
+
+    return RTRUE;
   }
 
-  rstring_free(rsep);
+  /* The last field ends at len, so one past that means we are done. */
+  if (*pos > len) { return RFALSE; }
 
-  return ary;
+  blen_t i = binstr((const_bstring)rstr, *pos, (const_bstring)sep);
+
+  if (i == BSTR_ERR) {
+    *field = rstring__view(rstr->data + *pos, len - *pos);
+    *pos = len + 1;
+  }
+  else {
+    *field = rstring__view(rstr->data + *pos, i - *pos);
+    *pos = i + sep->slen;
+  }
+
+  return RTRUE;
 }
 
 /* END OF RSTRING */
@@ -4559,19 +11956,23 @@ rstring* rfile_basename2(const rstring* fname, const rstring* extname);
 rstring* rfile_basename2_cstr(const rstring* fname, const char* extname);
 rstring* rfile_dirname(const rstring* fname);
 rstring* rfile_extname(const rstring* fname);
+rstring_view rfile_basename_view(const rstring* fname);
+rstring_view rfile_dirname_view(const rstring* fname);
+rstring_view rfile_extname_view(const rstring* fname);
 
 /* Making paths */
 rstring* rfile_join(rstring_array* rary);
 
-static int
+static blen_t
 index_before_first_trailing_file_separator(const rstring* fname)
 {
-  if (rstring_bad(fname)) { return RERROR; }
+  if (rstring_view_bad(fname)) { return RERROR; }
 
-  int i = 0;
+  blen_t i = 0;
 
-  for (i = rstring_length(fname) - 1; i >= 0; --i) {
-    if (rstring_char_at(fname, i) != RFILE_SEPARATOR) {
+  /* There are rarely more than one or two, so no need for a kernel. */
+  for (i = fname->slen - 1; i >= 0; --i) {
+    if (fname->data[i] != RFILE_SEPARATOR) {
       break;
     }
   }
@@ -4579,29 +11980,23 @@ index_before_first_trailing_file_separator(const rstring* fname)
   return i;
 }
 
-static int
-index_of_last_file_separator_from_pos(const rstring* fname, int pos)
+static blen_t
+index_of_last_file_separator_from_pos(const rstring* fname, blen_t pos)
 {
-  if (rstring_bad(fname) || pos < 0 || pos >= rstring_length(fname)) {
+  if (rstring_view_bad(fname) || pos < 0 || pos >= fname->slen) {
     return RERROR;
   }
-  int i = 0;
-
-  for (i = pos; i >= 0; --i) {
-    if (rstring_char_at(fname, i) == RFILE_SEPARATOR) {
-      break;
-    }
-  }
 
-  return i;
+  /* RERROR (-1) when there is none, just like running off the front. */
+  return rstring_rindex_offset(fname, RSTR_LIT(RFILE_SEPARATOR_STR), pos);
 }
 
-static int
+static blen_t
 index_of_last_file_separator(const rstring* fname)
 {
-  if (rstring_bad(fname)) { return RERROR; }
+  if (rstring_view_bad(fname)) { return RERROR; }
 
-  int pos = rstring_length(fname) - 1;
+  blen_t pos = rstring_length(fname) - 1;
 
   return index_of_last_file_separator_from_pos(fname, pos);
 }
@@ -4610,7 +12005,7 @@ index_of_last_file_separator(const rstring* fname)
 /**
  * @brief Tells whether a file exists or not (i.e., stat is successful).
  *
- * @param fname An rstring with the filename to check.
+ * @param fname An rstring (or view) with the filename to check.
  *
  * @retval RTRUE The file exists
  * @retval RFALSE The file does not exist
@@ -4619,7 +12014,7 @@ index_of_last_file_separator(const rstring* fname)
 int
 rfile_exist(const rstring* fname)
 {
-  if (rstring_bad(fname)) { return RERROR; }
+  if (rstring_view_bad(fname)) { return RERROR; }
 
   int ret_val = 0;
   char* cfname = bstr2cstr(fname, '?');
@@ -4628,7 +12023,7 @@ rfile_exist(const rstring* fname)
   struct stat st;
   ret_val = stat(cfname, &st);
 
-  free(cfname);
+  bcstrfree(cfname);
 
   if (ret_val < 0) {
     return RFALSE;
@@ -4641,7 +12036,7 @@ rfile_exist(const rstring* fname)
 /**
  * @brief Tells whether the named directory exists.
  *
- * @param fname An rstring with the dirname to check.
+ * @param fname An rstring (or view) with the dirname to check.
  *
  * @retval RTRUE The dir exists
  * @retval RFALSE The dir does not exist
@@ -4652,7 +12047,7 @@ rfile_exist(const rstring* fname)
 int
 rfile_is_directory(const rstring* fname)
 {
-  if (rstring_bad(fname)) { return RERROR; }
+  if (rstring_view_bad(fname)) { return RERROR; }
 
   int ret_val = 0;
   char* cfname = bstr2cstr(fname, '?');
@@ -4675,7 +12070,7 @@ rfile_is_directory(const rstring* fname)
 /**
  * @brief Tells whether the named file exists and is a regular file.
  *
- * @param fname An rstring with the dirname to check.
+ * @param fname An rstring (or view) with the filename to check.
  *
  * @retval RTRUE The file exists
  * @retval RFALSE The file does not exist
@@ -4686,7 +12081,7 @@ rfile_is_directory(const rstring* fname)
 int
 rfile_is_file(const rstring* fname)
 {
-  if (rstring_bad(fname)) { return RERROR; }
+  if (rstring_view_bad(fname)) { return RERROR; }
 
   int ret_val = 0;
   char* cfname = bstr2cstr(fname, '?');
@@ -4719,60 +12114,10 @@ rfile_is_file(const rstring* fname)
 rstring*
 rfile_basename(const rstring* fname)
 {
-  if (rstring_bad(fname)) { return NULL; }
-
-  int i                = 0;
-  int i_last_fs        = 0;
-  int i_basename_start = 0;
-  int char_at = 0;
-
-  int slen         = rstring_length(fname);
-  if (slen == RERROR) { return NULL; }
-
-  int basename_len = 0;
-
-  rstring* basename = NULL;
-
-  /* If we are passed an empty string.... */
-  if (slen == 0) {
-    basename = rstring_new("");
-    if (rstring_bad(basename)) { return NULL; }
-
-    return basename;
-  }
-
-  i = index_before_first_trailing_file_separator(fname);
-
-  if (i < 0) {
-    /* This can only happen for names like "////" */
-    char_at = rstring_char_at(fname, 0);
-    if (char_at == RERROR || char_at != RFILE_SEPARATOR) {
-      return NULL;
-    }
+  rstring_view view = rfile_basename_view(fname);
+  if (rstring_view_bad(&view)) { return NULL; }
 
-    basename = rstring_new(RFILE_SEPARATOR_STR);
-    if (rstring_bad(basename)) { return NULL; }
-  }
-  else {
-    /* The current index points to the char just before the first of
-       trailing RFILE_SEPARATOR chars if there are any, so the trailing
-       RFILE_SEPARATORs begin at i + 1. */
-    i_last_fs = i + 1;
-
-    for (i = i_last_fs - 1; i >= 0; --i) {
-      char_at = rstring_char_at(fname, i);
-      if (char_at == RFILE_SEPARATOR) {
-        break;
-      }
-    }
-    i_basename_start = i + 1;
-    basename_len     = i_last_fs - i_basename_start;
-
-    basename = rstring_slice(fname, i_basename_start, basename_len);
-    if (rstring_bad(basename)) { return NULL; }
-  }
-
-  return basename;
+  return rstring_copy(&view);
 }
 
 /**
@@ -4789,15 +12134,15 @@ rfile_basename(const rstring* fname)
 rstring*
 rfile_basename2(const rstring* fname, const rstring* extname)
 {
-  if (rstring_bad(fname)) { return NULL; }
-  if (rstring_bad(extname)) { return NULL; }
+  if (rstring_view_bad(fname)) { return NULL; }
+  if (rstring_view_bad(extname)) { return NULL; }
 
   rstring* basename = rfile_basename(fname);
   if (rstring_bad(basename)) { return NULL; }
 
   int retval = 0;
-  int i = 0;
-  int j = 0;
+  blen_t i = 0;
+  blen_t j = 0;
   char extchar = 0;
   char basechar = 0;
 
@@ -4813,11 +12158,11 @@ rfile_basename2(const rstring* fname, const rstring* extname)
 
   /* Now we need to strip off the extname */
 
-  int basename_len = rstring_length(basename);
-  if (basename_len == RERROR) { free(basename); return NULL; }
+  blen_t basename_len = rstring_length(basename);
+  if (basename_len == RERROR) { rstring_free(basename); return NULL; }
 
-  int extname_len = rstring_length(extname);
-  if (extname_len == RERROR) { free(basename); return NULL; }
+  blen_t extname_len = rstring_length(extname);
+  if (extname_len == RERROR) { rstring_free(basename); return NULL; }
 
   /* First, check if the ext is actually present. */
   for (i = 0; i < extname_len; ++i) {
@@ -4860,18 +12205,12 @@ rfile_basename2(const rstring* fname, const rstring* extname)
 rstring*
 rfile_basename2_cstr(const rstring* fname, const char* extname)
 {
-  if (rstring_bad(fname)) { return NULL; }
-  if (extname == NULL) { return NULL; }
-
-  rstring* ext = rstring_new(extname);
-  if (rstring_bad(ext)) { return NULL; }
+  if (rstring_view_bad(fname)) { return NULL; }
 
-  rstring* base = rfile_basename2(fname, ext);
-  if (rstring_bad(base)) { return NULL; }
+  rstring_view ext = rstring_view_of_cstr(extname);
+  if (rstring_view_bad(&ext)) { return NULL; }
 
-  rstring_free(ext);
-
-  return base;
+  return rfile_basename2(fname, &ext);
 }
 
 /**
@@ -4889,55 +12228,10 @@ rfile_basename2_cstr(const rstring* fname, const char* extname)
 rstring*
 rfile_dirname(const rstring* fname)
 {
-  if (rstring_bad(fname)) { return NULL; }
-
-  int i = 0;
-  int char_at = 0;
-  int slen = rstring_length(fname);
-  if (slen == RERROR) { return NULL; }
-
-  rstring* dirname = NULL;
-
-  if (slen == 0) {
-    dirname = rstring_new("");
-    if (rstring_bad(dirname)) { return NULL; }
-
-    return dirname;
-  }
-
-  i = index_of_last_file_separator(fname);
-  char_at = rstring_char_at(fname, 0);
-  if (char_at == RERROR) { return NULL; }
-
-  if (i < 0 && char_at == RFILE_SEPARATOR) {
-    /* Filenames like: "/////" */
-    dirname = rstring_new(RFILE_SEPARATOR_STR);
-    if (rstring_bad(dirname)) { return NULL; }
-  }
-  else if (i < 0) {
-    /* Filenames like: "apple" */
-    dirname = rstring_new(".");
-    if (rstring_bad(dirname)) { return NULL; }
-  }
-  else {
-
-    /* There was a basename.  Now we need to make sure that there
-       aren't a bunch of fs chars right in a row. */
-    i = index_of_last_file_separator_from_pos(fname, i);
-
-    if (i <= 0) {
-      /* This could happen for filenames like: "/////apple" or "/apple" */
-      dirname = rstring_new(RFILE_SEPARATOR_STR);
-      if (rstring_bad(dirname)) { return NULL; }
-    }
-    else {
-      int i_before_last_fs = i - 1;
-      dirname = rstring_slice(fname, 0, i_before_last_fs + 1);
-      if (rstring_bad(dirname)) { return NULL; }
-    }
-  }
+  rstring_view view = rfile_dirname_view(fname);
+  if (rstring_view_bad(&view)) { return NULL; }
 
-  return dirname;
+  return rstring_copy(&view);
 }
 
 
@@ -4954,42 +12248,10 @@ rfile_dirname(const rstring* fname)
 rstring*
 rfile_extname(const rstring* fname)
 {
-  if (rstring_bad(fname)) { return NULL; }
-
-  int basename_len = 0;
-  int last_dot = 0;
-
-  rstring* basename = NULL;
-  rstring* extname  = NULL;
-
-  basename     = rfile_basename(fname);
-  if (rstring_bad(basename)) { return NULL; }
-
-  basename_len = rstring_length(basename);
-  if (basename_len == RERROR) { return NULL; }
-
-  last_dot = bstrrchr((const_bstring)basename, '.');
-
-  if (/* No '.' was found */
-      (last_dot == BSTR_ERR) ||
-
-      /* The last dot was the first char: ".profile" */
-      (last_dot == 0) ||
-
-      /* If the dot was the last thing in the fname: "foo." */
-      (last_dot == basename_len - 1)) {
-
-    extname = rstring_new("");
-    if (rstring_bad(extname)) { return NULL; }
-  }
-  else {
-    extname = rstring_slice(basename, last_dot, basename_len);
-    if (rstring_bad(extname)) { return NULL; }
-  }
-
-  rstring_free(basename);
+  rstring_view view = rfile_extname_view(fname);
+  if (rstring_view_bad(&view)) { return NULL; }
 
-  return extname;
+  return rstring_copy(&view);
 }
 
 /**
@@ -5004,17 +12266,16 @@ rfile_extname(const rstring* fname)
  *
  * @warning The caller must free the result.
  *
- * @todo the no_doubles path will use a bit more memory than it actually needs if some of the double // are removed.
+ * @todo the path will use a bit more memory than it actually needs if some of the double // are removed.
  */
 rstring*
 rfile_join(rstring_array* rary)
 {
   if (rstring_array_bad(rary)) { return NULL; }
 
-  int i = 0;
-  int j = 0;
-  int len = 0;
-  int char_at = 0;
+  blen_t i = 0;
+  blen_t j = 0;
+  blen_t len = 0;
 
   /* Check if any of the rstrings are null */
   for (i = 0; i < rary->qty; ++i) {
@@ -5022,55 +12283,130 @@ rfile_join(rstring_array* rary)
   }
 
   rstring* path = NULL;
-  rstring* sep = NULL;
-  int c = 0;
-  int c_minus_1 = 0;
-
-  sep = rstring_new(RFILE_SEPARATOR_STR);
-  if (rstring_bad(sep)) { return NULL; }
 
   /* Clean up path if early exit from here down. */
-  path = rstring_array_join(rary, sep);
+  path = rstring_array_join(rary, RSTR_LIT(RFILE_SEPARATOR_STR));
   if (rstring_bad(path)) { return NULL; }
-  rstring_free(sep);
 
   /* If it's empty, there are no doubles. */
   len = rstring_length(path);
   if (len == RERROR) { rstring_free(path); return NULL; }
   if (len == 0) { return path; }
 
+  /* Remove doubles of file sep.  path was just made by the join, so it
+     can be squeezed in place. */
+  j = 1;
+  for (i = 1; i < len; ++i) {
+    if (path->data[i] != RFILE_SEPARATOR || path->data[i - 1] != RFILE_SEPARATOR) {
+      path->data[j++] = path->data[i];
+    }
+  }
 
-  /* Remove doubles of file sep. */
-  /* Clean up no_doubles if early exit from here down. */
-  char* no_doubles = malloc(sizeof(char) * ((len + 1)));
-  if (no_doubles == NULL) { rstring_free(path); return NULL; }
+  if (btrunc(path, j) != BSTR_OK) { rstring_free(path); return NULL; }
 
-  j = 0;
-  char_at = rstring_char_at(path, 0);
-  if (char_at == RERROR) { rstring_free(path); free(no_doubles); return NULL; }
+  return path;
+}
 
-  no_doubles[j++] = char_at;
-  for (i = 1; i < len; ++i) {
-    c = rstring_char_at(path, i);
-    c_minus_1 = rstring_char_at(path, i - 1);
-    if (c == RERROR || c_minus_1 == RERROR) {
-      rstring_free(path); free(no_doubles); return NULL;
-    }
+/**
+ * @brief Like rfile_basename() but returns a view into fname rather than a new rstring.
+ *
+ * @param fname An rstring (or view) with the file name.
+ *
+ * @retval rstring_view A view of the basename of the file.
+ * @retval rstring_view An invalid view (see rstring_view_bad()) if fname is invalid.
+ */
+rstring_view
+rfile_basename_view(const rstring* fname)
+{
+  if (rstring_view_bad(fname)) { return rstring__bad_view(); }
 
-    if (c != RFILE_SEPARATOR || c_minus_1 != RFILE_SEPARATOR) {
-      no_doubles[j++] = c;
-    }
+  /* If we are passed an empty string.... */
+  if (fname->slen == 0) { return rstring__view(fname->data, 0); }
+
+  blen_t i = index_before_first_trailing_file_separator(fname);
+
+  if (i < 0) {
+    /* This can only happen for names like "////" */
+    return rstring__view(fname->data, 1);
   }
-  no_doubles[j] = '\0';
 
-  rstring_free(path);
+  /* The current index points to the char just before the first of
+     trailing RFILE_SEPARATOR chars if there are any, so the trailing
+     RFILE_SEPARATORs begin at i + 1. */
+  blen_t i_last_fs = i + 1;
 
-  /* Rewrite the path */
-  path = rstring_new(no_doubles);
-  if (rstring_bad(path)) { free(no_doubles); return NULL; }
-  free(no_doubles);
+  i = index_of_last_file_separator_from_pos(fname, i);
 
-  return path;
+  return rstring__view(fname->data + i + 1, i_last_fs - (i + 1));
+}
+
+/**
+ * @brief Like rfile_dirname() but returns a view rather than a new rstring.
+ *
+ * @param fname An rstring (or view) with the file name.
+ *
+ * @retval rstring_view A view of the directory of the file.  This points into fname, or at a string literal for "." and "/".
+ * @retval rstring_view An invalid view (see rstring_view_bad()) if fname is invalid.
+ */
+rstring_view
+rfile_dirname_view(const rstring* fname)
+{
+  if (rstring_view_bad(fname)) { return rstring__bad_view(); }
+
+  if (fname->slen == 0) { return rstring__view(fname->data, 0); }
+
+  blen_t i = index_of_last_file_separator(fname);
+
+  if (i < 0 && fname->data[0] == RFILE_SEPARATOR) {
+    /* Filenames like: "/////" */
+    return rstring__view((const unsigned char*)RFILE_SEPARATOR_STR, 1);
+  }
+  else if (i < 0) {
+    /* Filenames like: "apple" */
+    return rstring__view((const unsigned char*)".", 1);
+  }
+
+  /* There was a basename.  Now we need to make sure that there
+     aren't a bunch of fs chars right in a row. */
+  i = index_of_last_file_separator_from_pos(fname, i);
+
+  if (i <= 0) {
+    /* This could happen for filenames like: "/////apple" or "/apple" */
+    return rstring__view((const unsigned char*)RFILE_SEPARATOR_STR, 1);
+  }
+
+  return rstring__view(fname->data, i);
+}
+
+/**
+ * @brief Like rfile_extname() but returns a view into fname rather than a new rstring.
+ *
+ * @param fname An rstring (or view) with the file name.
+ *
+ * @retval rstring_view A view of the extension of the file.
+ * @retval rstring_view An invalid view (see rstring_view_bad()) if fname is invalid.
+ */
+rstring_view
+rfile_extname_view(const rstring* fname)
+{
+  rstring_view basename = rfile_basename_view(fname);
+  if (rstring_view_bad(&basename)) { return basename; }
+
+  blen_t last_dot = bstrrchr((const_bstring)&basename, '.');
+
+  if (/* No '.' was found */
+      (last_dot == BSTR_ERR) ||
+
+      /* The last dot was the first char: ".profile" */
+      (last_dot == 0) ||
+
+      /* If the dot was the last thing in the fname: "foo." */
+      (last_dot == basename.slen - 1)) {
+
+    return rstring__view(basename.data + basename.slen, 0);
+  }
+
+  return rstring__view(basename.data + last_dot, basename.slen - last_dot);
 }
 
 /* END OF RFILE */
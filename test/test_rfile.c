@@ -46,7 +46,12 @@ test___rfile_exist___should_TellIfFnameExists(void)
 
   TEST_ASSERT_RTRUE(rfile_exist(rstr));
 
+  /* A view that is not NUL terminated at the end of the name. */
+  rstring_view view = rstring_view_of_blk("ryan_lala.txt.bak", strlen(cfname));
+  TEST_ASSERT_RTRUE(rfile_exist(&view));
+
   remove(cfname);
+  TEST_ASSERT_RFALSE(rfile_exist(&view));
   rstring_free(rstr);
 
   rstr = rstring_new(__FILE__);
@@ -88,6 +93,8 @@ test___rfile_is_directory___should_TellIfPathIsDirectory(void)
 
   rstr = rstring_new(__FILE__);
   TEST_ASSERT_RFALSE(rfile_is_directory(rstr));
+  rstring_view view = rfile_dirname_view(rstr);
+  TEST_ASSERT_RTRUE(rfile_is_directory(&view));
   rstring_free(rstr);
 }
 
@@ -119,7 +126,13 @@ test___rfile_is_file___should_TellIfFileNameIsAFile(void)
 
   rstr = rstring_new(__FILE__);
   TEST_ASSERT_RTRUE(rfile_is_file(rstr));
+  rstring_view view = rfile_dirname_view(rstr);
+  TEST_ASSERT_RFALSE(rfile_is_file(&view));
   rstring_free(rstr);
+
+  /* A view that is not NUL terminated at the end of the name. */
+  view = rstring_view_of_blk(__FILE__ "lala", strlen(__FILE__));
+  TEST_ASSERT_RTRUE(rfile_is_file(&view));
 }
 
 
@@ -406,3 +419,37 @@ test___rfile_join___should_JoinStringsWithFileSep(void)
   /* TEST_ASSERT_NULL(rfile_join(strings4, 2)); */
   /* rstring_free(strings4[1]); */
 }
+
+void
+test___rfile_basename_view___should_ViewPartsOfThePath(void)
+{
+  rstring* fname = rstring_new("/home/mooreryan/apple.pie.c");
+  rstring_view view;
+
+  view = rfile_basename_view(fname);
+  TEST_ASSERT_RTRUE(rstring_eql_cstr(&view, "apple.pie.c"));
+  TEST_ASSERT_EQUAL_PTR(fname->data + 16, view.data);
+
+  view = rfile_dirname_view(fname);
+  TEST_ASSERT_RTRUE(rstring_eql_cstr(&view, "/home/mooreryan"));
+  TEST_ASSERT_EQUAL_PTR(fname->data, view.data);
+
+  view = rfile_extname_view(fname);
+  TEST_ASSERT_RTRUE(rstring_eql_cstr(&view, ".c"));
+
+  /* Views of views work too, so a path can be picked apart in place. */
+  rstring_view dir = rfile_dirname_view(fname);
+  view = rfile_basename_view(&dir);
+  TEST_ASSERT_RTRUE(rstring_eql_cstr(&view, "mooreryan"));
+
+  rstring_view apple = rstring_view_of_cstr("apple");
+  view = rfile_dirname_view(&apple);
+  TEST_ASSERT_RTRUE(rstring_eql_cstr(&view, "."));
+  view = rfile_extname_view(&apple);
+  TEST_ASSERT_RTRUE(rstring_eql_cstr(&view, ""));
+
+  view = rfile_basename_view(NULL);
+  TEST_ASSERT_TRUE(rstring_view_bad(&view));
+
+  rstring_free(fname);
+}
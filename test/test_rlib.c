@@ -9,3 +9,337 @@ void setUp(void)
 void tearDown(void)
 {
 }
+
+void
+test___rlib_arena_use___should_RouteNewRstringsToArena(void)
+{
+  rlib_arena* arena = rlib_arena_new(0);
+
+  TEST_ASSERT_NULL(rlib_arena_use(arena));
+
+  rstring* in_arena = rstring_new("apple");
+  rstring_array* ary = rstring_split_cstr(in_arena, "p");
+  TEST_ASSERT(in_arena->flags & BSTR_F_ARENA);
+  TEST_ASSERT(ary->flags & BSTR_F_ARENA);
+  TEST_ASSERT_EQUAL(3, ary->qty);
+
+  TEST_ASSERT_EQUAL_PTR(arena, rlib_arena_use(NULL));
+
+  rstring* on_heap = rstring_new("pie");
+  TEST_ASSERT_FALSE(on_heap->flags & BSTR_F_ARENA);
+  rstring_free(on_heap);
+
+  rlib_arena_free(arena);
+}
+
+void
+test___rlib_arena_reset___should_ReuseArenaMemory(void)
+{
+  rlib_arena* arena = rlib_arena_new(128);
+  unsigned char* first = NULL;
+
+  TEST_ASSERT_RERROR(rlib_arena_reset(NULL));
+
+  for (int round = 0; round < 3; ++round) {
+    rstring* rstr = rstring_new_arena(arena, "apple");
+    TEST_ASSERT_EQUAL_RSTRING("apple", rstr);
+
+    if (round == 0) {
+      first = rstr->data;
+    } else {
+      TEST_ASSERT_EQUAL_PTR(first, rstr->data);
+    }
+
+    /* Spill into more chunks so reset has several to reuse. */
+    for (int i = 0; i < 50; ++i) {
+      TEST_ASSERT_NOT_NULL(rstring_new_arena(arena, "the quick brown fox jumps over the lazy dog"));
+    }
+
+    TEST_ASSERT_EQUAL(ROKAY, rlib_arena_reset(arena));
+  }
+
+  TEST_ASSERT_EQUAL(ROKAY, rlib_arena_free(arena));
+  TEST_ASSERT_RERROR(rlib_arena_free(NULL));
+}
+
+void
+test___rstring_new___should_StoreShortStringsInline(void)
+{
+  rstring* short_str = rstring_new("apple");
+  rstring* long_str = rstring_new("the quick brown fox jumps over the lazy dog");
+
+  TEST_ASSERT(short_str->flags & BSTR_F_INLINE);
+  TEST_ASSERT_EQUAL_PTR((unsigned char*)(short_str + 1), short_str->data);
+  TEST_ASSERT_FALSE(long_str->flags & BSTR_F_INLINE);
+
+  /* Growing an inline string moves its data out to its own buffer. */
+  TEST_ASSERT_EQUAL(BSTR_OK, bconcat(short_str, long_str));
+  TEST_ASSERT_FALSE(short_str->flags & BSTR_F_INLINE);
+  TEST_ASSERT_EQUAL_RSTRING("applethe quick brown fox jumps over the lazy dog", short_str);
+
+  rstring_free(short_str);
+  rstring_free(long_str);
+}
+
+void
+test___rstring_length___should_UseBlenT(void)
+{
+  rstring* rstr = rstring_new("apple");
+
+#ifdef RLIB_LARGE_STRINGS
+  TEST_ASSERT_EQUAL(sizeof(ptrdiff_t), sizeof(rstring_length(rstr)));
+  TEST_ASSERT(BLEN_MAX > INT_MAX);
+#else
+  TEST_ASSERT_EQUAL(sizeof(int), sizeof(rstring_length(rstr)));
+  TEST_ASSERT_EQUAL(INT_MAX, BLEN_MAX);
+#endif
+
+  TEST_ASSERT_EQUAL(5, rstring_length(rstr));
+
+  rstring_free(rstr);
+}
+
+void
+test___rlib_set_growth_policy___should_SetGlobalPolicy(void)
+{
+  TEST_ASSERT_RERROR(rlib_set_growth_policy(BSTR_GROW_DEFAULT));
+  TEST_ASSERT_EQUAL(BSTR_GROW_POW2, rlib_set_growth_policy(BSTR_GROW_EXACT));
+
+  rstring* rstr = rstring_new("the quick brown fox jumps over the lazy dog");
+  TEST_ASSERT_EQUAL(0, rstring_slack(rstr));
+
+  size_t resizes = rlib_resize_count();
+  TEST_ASSERT_EQUAL(BSTR_OK, bcatcstr(rstr, "!"));
+  TEST_ASSERT_EQUAL(resizes + 1, rlib_resize_count());
+  TEST_ASSERT_EQUAL(BSTR_GROW_HEADROOM, rstring_slack(rstr));
+
+  /* The headroom absorbs the next few appends. */
+  TEST_ASSERT_EQUAL(BSTR_OK, bcatcstr(rstr, "!!!"));
+  TEST_ASSERT_EQUAL(resizes + 1, rlib_resize_count());
+
+  TEST_ASSERT_EQUAL(BSTR_GROW_EXACT, rlib_set_growth_policy(BSTR_GROW_POW2));
+
+  rstring_free(rstr);
+}
+
+void
+test___rlib_set_mmap_threshold___should_MoveLargeBuffersToMmap(void)
+{
+  size_t prev = rlib_set_mmap_threshold(4096);
+  TEST_ASSERT_EQUAL(BSTR_MMAP_THRESHOLD, prev);
+  rlib_set_mmap_hugepages(RTRUE);
+
+  rstring* rstr = rstring_new("apple");
+  for (int i = 0; i < 2000; ++i) {
+    TEST_ASSERT_EQUAL(BSTR_OK, bcatcstr(rstr, "pie"));
+  }
+
+#ifdef BSTR_HAVE_MMAP
+  TEST_ASSERT(rstr->flags & BSTR_F_MMAP);
+#endif
+  TEST_ASSERT_EQUAL(5 + 2000 * 3, rstring_length(rstr));
+  TEST_ASSERT_EQUAL_MEMORY("applepiepie", rstring_data(rstr), 11);
+  TEST_ASSERT_EQUAL_MEMORY("piepie", rstring_data(rstr) + rstring_length(rstr) - 6, 7);
+
+  /* Copies of big strings start out mapped too. */
+  rstring* copy = rstring_copy(rstr);
+  TEST_ASSERT_EQUAL(1, rstring_eql(rstr, copy));
+  rstring_free(copy);
+
+  /* Shrinking below the threshold goes back to the heap. */
+  TEST_ASSERT_EQUAL(BSTR_OK, btrunc(rstr, 100));
+  TEST_ASSERT_EQUAL(ROKAY, rstring_compact(rstr));
+  TEST_ASSERT_FALSE(rstr->flags & BSTR_F_MMAP);
+  TEST_ASSERT_EQUAL_MEMORY("applepiepie", rstring_data(rstr), 11);
+
+  rstring_free(rstr);
+
+  rlib_set_mmap_hugepages(RFALSE);
+  TEST_ASSERT_EQUAL(4096, rlib_set_mmap_threshold(prev));
+}
+
+void
+test___rstring_copy___should_ShareTheBufferUntilWritten(void)
+{
+  rstring* rstr = rstring_new("the quick brown fox jumps over the lazy dog");
+  rstring* copy = rstring_copy(rstr);
+  TEST_ASSERT_RTRUE(rstring_eql(rstr, copy));
+#ifdef RLIB_COW_STRINGS
+  TEST_ASSERT_EQUAL_PTR(rstr->data, copy->data);
+#endif
+
+  /* The first write gives the copy its own buffer. */
+  TEST_ASSERT_EQUAL(BSTR_OK, bcatcstr(copy, "!"));
+  TEST_ASSERT(rstr->data != copy->data);
+  TEST_ASSERT_EQUAL_STRING("the quick brown fox jumps over the lazy dog",
+                           rstring_data(rstr));
+  TEST_ASSERT_EQUAL_STRING("the quick brown fox jumps over the lazy dog!",
+                           rstring_data(copy));
+  rstring_free(copy);
+
+  /* Writing to the original leaves the copy alone too. */
+  copy = rstring_copy(rstr);
+  TEST_ASSERT_EQUAL(BSTR_OK, btrunc(rstr, 3));
+  TEST_ASSERT_EQUAL_STRING("the", rstring_data(rstr));
+  TEST_ASSERT_EQUAL(43, rstring_length(copy));
+  rstring_free(rstr);
+
+  /* Operations that change nothing do not copy the bytes. */
+  rstring* pattern = rstring_new("cat");
+  rstring* repl = rstring_new("kitten");
+  rstring* results[] = {
+    rstring_strip(copy),
+    rstring_chomp(copy),
+    rstring_downcase(copy),
+    rstring_gsub(copy, pattern, repl),
+    rstring_squeeze(copy, NULL)
+  };
+  for (int i = 0; i < 5; ++i) {
+    TEST_ASSERT_RTRUE(rstring_eql(copy, results[i]));
+#ifdef RLIB_COW_STRINGS
+    TEST_ASSERT_EQUAL_PTR(copy->data, results[i]->data);
+#endif
+  }
+
+  /* ...but ones that do change something still work. */
+  rstring* up = rstring_upcase(copy);
+  TEST_ASSERT_EQUAL_STRING("THE QUICK BROWN FOX JUMPS OVER THE LAZY DOG",
+                           rstring_data(up));
+  rstring* rev = rstring_reverse(copy);
+  TEST_ASSERT_EQUAL('g', rstring_char_at(rev, 0));
+  TEST_ASSERT_EQUAL_STRING("the quick brown fox jumps over the lazy dog",
+                           rstring_data(copy));
+
+  /* The bang forms leave a shared buffer alone when nothing changes. */
+  rstring* other = rstring_copy(copy);
+  TEST_ASSERT_RFALSE(rstring_squeeze_bang(other, NULL));
+  TEST_ASSERT_RFALSE(rstring_delete_cstr_bang(other, "!"));
+  TEST_ASSERT_RFALSE(rstring_tr_cstr_bang(other, "!", "?"));
+#ifdef RLIB_COW_STRINGS
+  TEST_ASSERT_EQUAL_PTR(copy->data, other->data);
+#endif
+  rstring_free(other);
+
+  /* ...and copy it before squeezing when something does. */
+  rstring* runs = rstring_new("too  many   spaces");
+  other = rstring_copy(runs);
+  TEST_ASSERT_RTRUE(rstring_squeeze_cstr_bang(other, " "));
+  TEST_ASSERT_EQUAL_STRING("too many spaces", rstring_data(other));
+  TEST_ASSERT_EQUAL_STRING("too  many   spaces", rstring_data(runs));
+  TEST_ASSERT_RTRUE(rstring_squeeze_bang(other, NULL));
+  TEST_ASSERT_EQUAL_STRING("to many spaces", rstring_data(other));
+  rstring_free(other);
+  rstring_free(runs);
+
+  rstring_free(copy);
+  for (int i = 0; i < 5; ++i) {
+    TEST_ASSERT_EQUAL(43, rstring_length(results[i]));
+    rstring_free(results[i]);
+  }
+  rstring_free(up);
+  rstring_free(rev);
+  rstring_free(pattern);
+  rstring_free(repl);
+}
+
+void
+test___rstring_split___should_PackFieldsIntoOneAllocation(void)
+{
+  rstring* line = rstring_new("apple\tpie\t\tis\tgood");
+  rstring_array* fields = rstring_split_cstr(line, "\t");
+
+  TEST_ASSERT_NOT_NULL(fields);
+  TEST_ASSERT(fields->flags & BSTR_F_PACKED);
+  TEST_ASSERT_EQUAL(5, fields->qty);
+
+  const char* expected[] = { "apple", "pie", "", "is", "good" };
+  for (int i = 0; i < 5; ++i) {
+    rstring* field = rstring_array_get(fields, i);
+    TEST_ASSERT_EQUAL_STRING(expected[i], rstring_data(field));
+    TEST_ASSERT(field->flags & BSTR_F_PACKED);
+
+    /* The bytes live in the same block as the list. */
+    TEST_ASSERT((unsigned char*)field->data > (unsigned char*)fields);
+  }
+
+  rstring* joined = rstring_array_join_cstr(fields, ",");
+  TEST_ASSERT_EQUAL_STRING("apple,pie,,is,good", rstring_data(joined));
+  rstring_free(joined);
+
+  /* Entries can still be written to; growing one moves it out. */
+  rstring* pie = rstring_array_get(fields, 1);
+  TEST_ASSERT_RTRUE(rstring_upcase_bang(pie));
+  TEST_ASSERT_EQUAL(BSTR_OK, bcatcstr(pie, "S AND CAKES"));
+  TEST_ASSERT_EQUAL_STRING("PIES AND CAKES", rstring_data(pie));
+  TEST_ASSERT_EQUAL_STRING("is", rstring_data(rstring_array_get(fields, 3)));
+
+  /* So can the array. */
+  TEST_ASSERT_EQUAL(ROKAY, rstring_array_push_cstr(fields, "!"));
+  TEST_ASSERT_FALSE(fields->flags & BSTR_F_INLINE);
+  TEST_ASSERT_EQUAL(6, fields->qty);
+  TEST_ASSERT_EQUAL_STRING("apple", rstring_data(rstring_array_get(fields, 0)));
+  TEST_ASSERT_EQUAL_STRING("!", rstring_data(rstring_array_get(fields, 5)));
+
+  rstring_array_free(fields);
+  rstring_free(line);
+}
+
+void
+test___rlib_set_simd_level___should_GiveSameResultsAtEveryLevel(void)
+{
+  int best = rlib_simd_level();
+  rstring* rstr = rstring_new("");
+
+  /* Long enough to take the vector loops, with a tail for the scalar one. */
+  for (int i = 0; i < 150; ++i) { bconchar(rstr, "ab \tc,\n"[i % 7]); }
+  bconchar(rstr, 'z');
+  bcatcstr(rstr, " \n\t  ");
+
+  TEST_ASSERT_EQUAL(RERROR, rlib_set_simd_level(RLIB_SIMD_AVX512 + 1));
+
+  for (int level = RLIB_SIMD_NONE; level <= RLIB_SIMD_AVX512; ++level) {
+    rlib_set_simd_level(level);
+    TEST_ASSERT_TRUE(rlib_simd_level() <= level);
+
+    TEST_ASSERT_EQUAL(150, bstrchrp(rstr, 'z', 0));
+    TEST_ASSERT_EQUAL(146, bstrrchrp(rstr, '\n', 150));
+    TEST_ASSERT_EQUAL(BSTR_ERR, bstrchrp(rstr, 'q', 0));
+    TEST_ASSERT_EQUAL(150, rstring_index(rstr, RSTR_LIT("z")));
+
+    rstring_array* fields = rstring_split(rstr, RSTR_LIT(","));
+    TEST_ASSERT_EQUAL(22, fields->qty);
+    rstring_array_free(fields);
+
+    rstring* copy = rstring_copy(rstr);
+    TEST_ASSERT_EQUAL(BSTR_OK, btrimws(copy));
+    TEST_ASSERT_EQUAL('a', copy->data[0]);
+    TEST_ASSERT_EQUAL('z', copy->data[copy->slen - 1]);
+    rstring_free(copy);
+
+    rstring_view view = rstring_strip_view(rstr);
+    TEST_ASSERT_EQUAL('a', view.data[0]);
+    TEST_ASSERT_EQUAL('z', view.data[view.slen - 1]);
+
+    TEST_ASSERT_EQUAL(65, rstring_count_cstr(rstr, "a-c"));
+    rstring* squeezed = rstring_squeeze_cstr(rstr, " ");
+    TEST_ASSERT_EQUAL(rstring_length(rstr) - 1, rstring_length(squeezed));
+    rstring* deleted = rstring_delete_cstr(squeezed, "^a-z");
+    rstring* translated = rstring_tr_cstr(deleted, "a-z", "A-Z");
+    TEST_ASSERT_EQUAL(66, rstring_length(translated));
+    TEST_ASSERT_EQUAL(1, rstring_count_cstr(translated, "^A-C"));
+    rstring_free(translated);
+    rstring_free(deleted);
+    rstring_free(squeezed);
+
+    rstring* upper = rstring_upcase(rstr);
+    TEST_ASSERT_EQUAL(66, rstring_count_cstr(upper, "A-Z"));
+    TEST_ASSERT_RTRUE(rstring_swapcase_bang(upper));
+    TEST_ASSERT_RTRUE(rstring_eql(rstr, upper));
+    rstring_free(upper);
+  }
+
+  rlib_set_simd_level(best);
+  TEST_ASSERT_EQUAL(best, rlib_simd_level());
+
+  rstring_free(rstr);
+}
@@ -759,6 +759,12 @@ test___rstring_gsub___should_ReturnCopyWithSubbedStuff()
   gsub_test("apple", "pie", "PIE", "apple");
   gsub_test("apple", "p", "", "ale");
   gsub_test("aabaAb", "a", "aa", "aaaabaaAb");
+
+  /* A one byte pattern sizes the result exactly, up front. */
+  rstring* actual = rstring_gsub(RSTR_LIT("a\tb\tc"), RSTR_LIT("\t"), RSTR_LIT(" | "));
+  TEST_ASSERT_EQUAL_RSTRING("a | b | c", actual);
+  TEST_ASSERT_EQUAL(actual->slen + 1, actual->mlen);
+  rstring_free(actual);
 }
 
 void
@@ -995,6 +1001,14 @@ test___rstring_split_cstr___should_SplitString(void)
   TEST_ASSERT_EQUAL(1, actual->qty);
   rstring_free(rstr);
   rstring_array_free(actual);
+  /* Views work like rstring_split() */
+  actual = rstring_split_cstr(RSTR_LIT("apple/pie"), "/");
+  TEST_ASSERT_EQUAL_RSTRING("apple", actual->entry[0]);
+  TEST_ASSERT_EQUAL_RSTRING("pie", actual->entry[1]);
+  TEST_ASSERT_EQUAL(2, actual->qty);
+  rstring_array_free(actual);
+
+  TEST_ASSERT_NULL(rstring_split_cstr(NULL, "/"));
 }
 
 void
@@ -1055,3 +1069,1095 @@ test___rstring_array_get___should_ReturnElemAtIndex(void)
 
   rstring_array_free(rary);
 }
+
+void
+test___rstring_new_arena___should_BuildRstringInArena(void)
+{
+  rlib_arena* arena = rlib_arena_new(64);
+  rstring* actual = NULL;
+
+  TEST_ASSERT_NULL(rstring_new_arena(NULL, "apple"));
+  TEST_ASSERT_NULL(rstring_new_arena(arena, NULL));
+
+  actual = rstring_new_arena(arena, "apple");
+  TEST_ASSERT_EQUAL_RSTRING("apple", actual);
+  TEST_ASSERT(actual->flags & BSTR_F_ARENA);
+
+  /* Growing past the chunk size still works. */
+  TEST_ASSERT_EQUAL(BSTR_OK, bcatcstr(actual, " pie is the best pie in the whole wide world, really"));
+  TEST_ASSERT_EQUAL_RSTRING("apple pie is the best pie in the whole wide world, really", actual);
+
+  TEST_ASSERT_EQUAL(ROKAY, rstring_free(actual));
+
+  rlib_arena_free(arena);
+}
+
+void
+test___rstring_copy_arena___should_CopyRstringIntoArena(void)
+{
+  rlib_arena* arena = rlib_arena_new(0);
+  rstring* rstr = rstring_new("apple");
+  rstring* actual = NULL;
+
+  TEST_ASSERT_NULL(rstring_copy_arena(arena, NULL));
+
+  actual = rstring_copy_arena(arena, rstr);
+  TEST_ASSERT_EQUAL_RSTRING("apple", actual);
+  TEST_ASSERT(actual->flags & BSTR_F_ARENA);
+  TEST_ASSERT_FALSE(rstr->flags & BSTR_F_ARENA);
+
+  rstring_free(rstr);
+  rlib_arena_free(arena);
+}
+
+void
+test___rstring_slice_arena___should_SliceRstringIntoArena(void)
+{
+  rlib_arena* arena = rlib_arena_new(0);
+  rstring* rstr = rstring_new("apple pie");
+  rstring* actual = NULL;
+
+  actual = rstring_slice_arena(arena, rstr, 6, 3);
+  TEST_ASSERT_EQUAL_RSTRING("pie", actual);
+  TEST_ASSERT(actual->flags & BSTR_F_ARENA);
+
+  rstring_free(rstr);
+  rlib_arena_free(arena);
+}
+
+void
+test___rstring_split_arena___should_SplitRstringIntoArena(void)
+{
+  rlib_arena* arena = rlib_arena_new(0);
+  rstring* rstr = rstring_new("a,b,c,d,e,f");
+  rstring* sep = rstring_new(",");
+  rstring_array* actual = NULL;
+
+  actual = rstring_split_arena(arena, rstr, sep);
+  TEST_ASSERT_EQUAL(6, actual->qty);
+  TEST_ASSERT(actual->flags & BSTR_F_ARENA);
+  TEST_ASSERT_EQUAL_RSTRING("a", actual->entry[0]);
+  TEST_ASSERT_EQUAL_RSTRING("f", actual->entry[5]);
+  TEST_ASSERT(actual->entry[5]->flags & BSTR_F_ARENA);
+
+  /* Heap strings can still be pushed and are freed with the array. */
+  rstring_array_push_cstr(actual, "g");
+  TEST_ASSERT_FALSE(actual->entry[6]->flags & BSTR_F_ARENA);
+  TEST_ASSERT_EQUAL(ROKAY, rstring_array_free(actual));
+
+  rstring_free(rstr);
+  rstring_free(sep);
+  rlib_arena_free(arena);
+}
+
+void
+test___rstring_set_growth_policy___should_ControlHowRstringGrows(void)
+{
+  rstring* rstr = rstring_new("the quick brown fox jumps over the lazy dog");
+
+  TEST_ASSERT_RERROR(rstring_set_growth_policy(NULL, BSTR_GROW_EXACT));
+  TEST_ASSERT_RERROR(rstring_set_growth_policy(rstr, 42));
+
+  TEST_ASSERT_EQUAL(ROKAY, rstring_set_growth_policy(rstr, BSTR_GROW_EXACT));
+  TEST_ASSERT_EQUAL(BSTR_OK, balloc(rstr, 100));
+  TEST_ASSERT_EQUAL(100 + BSTR_GROW_HEADROOM, rstring_capacity(rstr));
+
+  TEST_ASSERT_EQUAL(ROKAY, rstring_set_growth_policy(rstr, BSTR_GROW_HALF));
+  TEST_ASSERT_EQUAL(BSTR_OK, balloc(rstr, 120));
+  TEST_ASSERT_EQUAL(174, rstring_capacity(rstr));
+
+  TEST_ASSERT_EQUAL(ROKAY, rstring_set_growth_policy(rstr, BSTR_GROW_POW2));
+  TEST_ASSERT_EQUAL(BSTR_OK, balloc(rstr, 200));
+  TEST_ASSERT_EQUAL(256, rstring_capacity(rstr));
+
+  TEST_ASSERT_EQUAL_RSTRING("the quick brown fox jumps over the lazy dog", rstr);
+
+  rstring_free(rstr);
+}
+
+void
+test___rstring_compact___should_TrimSlack(void)
+{
+  rstring* rstr = rstring_new("the quick brown fox jumps over the lazy dog");
+
+  TEST_ASSERT_RERROR(rstring_compact(NULL));
+
+  TEST_ASSERT_EQUAL(BSTR_OK, balloc(rstr, 1000));
+  TEST_ASSERT(rstring_slack(rstr) > 900);
+
+  TEST_ASSERT_EQUAL(ROKAY, rstring_compact(rstr));
+  TEST_ASSERT_EQUAL(0, rstring_slack(rstr));
+  TEST_ASSERT_EQUAL(rstring_length(rstr) + 1, rstring_capacity(rstr));
+  TEST_ASSERT_EQUAL_RSTRING("the quick brown fox jumps over the lazy dog", rstr);
+
+  rstring_free(rstr);
+}
+
+void
+test___rstring_array_compact___should_TrimSlackOfArrayAndEntries(void)
+{
+  rstring* rstr = rstring_new("a,b,c,d,e,f");
+  rstring_array* rary = rstring_split_cstr(rstr, ",");
+
+  TEST_ASSERT_RERROR(rstring_array_compact(NULL));
+  TEST_ASSERT_RERROR(rstring_array_slack(NULL));
+
+  TEST_ASSERT_EQUAL(BSTR_OK, balloc(rary->entry[0], 500));
+  TEST_ASSERT(rstring_array_slack(rary) > 500);
+
+  TEST_ASSERT_EQUAL(ROKAY, rstring_array_compact(rary));
+  TEST_ASSERT_EQUAL(rary->qty, rary->mlen);
+  TEST_ASSERT_EQUAL(0, rstring_slack(rary->entry[0]));
+  TEST_ASSERT(rstring_array_slack(rary) < 6 * BSTR_INLINE_MAX);
+  TEST_ASSERT_EQUAL_RSTRING("a", rary->entry[0]);
+  TEST_ASSERT_EQUAL_RSTRING("f", rary->entry[5]);
+
+  rstring_array_free(rary);
+  rstring_free(rstr);
+}
+
+void
+test___rstring_slice_view___should_ViewSubstringWithoutCopying(void)
+{
+  rstring* rstr = rstring_new("apple pie");
+  rstring_view view;
+
+  view = rstring_slice_view(rstr, 0, 5);
+  TEST_ASSERT_RTRUE(rstring_eql_cstr(&view, "apple"));
+  TEST_ASSERT_EQUAL_PTR(rstr->data, view.data);
+
+  view = rstring_slice_view(rstr, 6, 100);
+  TEST_ASSERT_RTRUE(rstring_eql_cstr(&view, "pie"));
+  TEST_ASSERT_EQUAL_PTR(rstr->data + 6, view.data);
+
+  view = rstring_slice_view(rstr, 9, 3);
+  TEST_ASSERT_RTRUE(rstring_eql_cstr(&view, ""));
+
+  /* Same NULL cases as rstring_slice, but as invalid views. */
+  view = rstring_slice_view(rstr, 10, 1);
+  TEST_ASSERT_TRUE(rstring_view_bad(&view));
+  view = rstring_slice_view(rstr, 0, -1);
+  TEST_ASSERT_TRUE(rstring_view_bad(&view));
+  view = rstring_slice_view(NULL, 0, 1);
+  TEST_ASSERT_TRUE(rstring_view_bad(&view));
+
+  /* Views work with the read only functions, and can be copied to keep. */
+  view = rstring_slice_view(rstr, 6, 3);
+  TEST_ASSERT_EQUAL(3, rstring_length(&view));
+  TEST_ASSERT_EQUAL('i', rstring_char_at(&view, 1));
+  TEST_ASSERT_EQUAL(1, rstring_index_cstr(&view, "ie"));
+  TEST_ASSERT_RTRUE(rstring_include_cstr(rstr, "pie"));
+
+  rstring_view sub = rstring_slice_view(&view, 1, 2);
+  TEST_ASSERT_RTRUE(rstring_eql_cstr(&sub, "ie"));
+
+  rstring* copy = rstring_copy(&view);
+  TEST_ASSERT_EQUAL_STRING("pie", rstring_data(copy));
+
+  /* But they are read only. */
+  TEST_ASSERT_EQUAL(BSTR_ERR, bcatcstr(&view, "s"));
+
+  rstring_free(copy);
+  rstring_free(rstr);
+}
+
+void
+test___rstring_strip_view___should_ViewWithoutWhitespace(void)
+{
+  rstring* rstr = rstring_new(" \t apple pie \n");
+  rstring_view view;
+
+  view = rstring_strip_view(rstr);
+  TEST_ASSERT_RTRUE(rstring_eql_cstr(&view, "apple pie"));
+  view = rstring_lstrip_view(rstr);
+  TEST_ASSERT_RTRUE(rstring_eql_cstr(&view, "apple pie \n"));
+  view = rstring_rstrip_view(rstr);
+  TEST_ASSERT_RTRUE(rstring_eql_cstr(&view, " \t apple pie"));
+
+  rstring_view blank = rstring_view_of_cstr("   ");
+  view = rstring_strip_view(&blank);
+  TEST_ASSERT_RTRUE(rstring_eql_cstr(&view, ""));
+  view = rstring_lstrip_view(&blank);
+  TEST_ASSERT_RTRUE(rstring_eql_cstr(&view, ""));
+  view = rstring_rstrip_view(&blank);
+  TEST_ASSERT_RTRUE(rstring_eql_cstr(&view, ""));
+
+  /* A long field is viewed in place, and copies hold just the field. */
+  rstring* field = rstring_new("\n\t ");
+  for (int i = 0; i < 100; ++i) { bcatcstr(field, "0123456789"); }
+  bcatcstr(field, " \r\n");
+  view = rstring_strip_view(field);
+  TEST_ASSERT_EQUAL_PTR(field->data + 3, view.data);
+  TEST_ASSERT_EQUAL(1000, view.slen);
+  rstring* copy = rstring_strip(field);
+  TEST_ASSERT_RTRUE(rstring_eql(copy, &view));
+  rstring_free(copy);
+  copy = rstring_lstrip(field);
+  TEST_ASSERT_EQUAL(1003, rstring_length(copy));
+  rstring_free(copy);
+  copy = rstring_rstrip(field);
+  TEST_ASSERT_EQUAL(1003, rstring_length(copy));
+  rstring_free(copy);
+  rstring_free(field);
+
+  view = rstring_strip_view(NULL);
+  TEST_ASSERT_TRUE(rstring_view_bad(&view));
+
+  rstring_free(rstr);
+}
+
+void
+test___rstring_chomp_view___should_ViewWithoutRecordSeparator(void)
+{
+  const char* cases[][2] = {
+    { "apple\n",   "apple"   },
+    { "apple\r\n", "apple"   },
+    { "apple\r",   "apple"   },
+    { "apple\n\r", "apple\n" },
+    { "apple\n\n", "apple\n" },
+    { "apple",     "apple"   },
+    { "",          ""        }
+  };
+
+  for (int i = 0; i < 7; ++i) {
+    rstring_view rstr = rstring_view_of_cstr(cases[i][0]);
+    rstring_view view = rstring_chomp_view(&rstr);
+    TEST_ASSERT_RTRUE(rstring_eql_cstr(&view, cases[i][1]));
+  }
+}
+
+void
+test___rstring_split_view_next___should_GiveSameFieldsAsSplit(void)
+{
+  const char* cases[][2] = {
+    { "a\tbb\t\tccc\t", "\t" },
+    { "apple, pie, ",   ", " },
+    { "",               ","  },
+    { "abc",            ""   }
+  };
+
+  for (int i = 0; i < 4; ++i) {
+    rstring* rstr = rstring_new(cases[i][0]);
+    rstring* sep  = rstring_new(cases[i][1]);
+    rstring_array* expected = rstring_split(rstr, sep);
+
+    rstring_view field;
+    blen_t pos = 0;
+    blen_t n = 0;
+    int ret;
+
+    while ((ret = rstring_split_view_next(rstr, sep, &pos, &field)) == RTRUE) {
+      TEST_ASSERT_TRUE(n < expected->qty);
+      TEST_ASSERT_RTRUE(rstring_eql(expected->entry[n], &field));
+      ++n;
+    }
+    TEST_ASSERT_RFALSE(ret);
+    TEST_ASSERT_EQUAL(expected->qty, n);
+
+    rstring_array_free(expected);
+    rstring_free(sep);
+    rstring_free(rstr);
+  }
+
+  rstring_view field;
+  blen_t pos = 0;
+  TEST_ASSERT_RERROR(rstring_split_view_next(NULL, NULL, &pos, &field));
+}
+
+void
+test___rstring_upcase_bang___should_UpcaseInPlace(void)
+{
+  rstring* rstr = rstring_new("Apple Pie");
+  unsigned char* data = rstr->data;
+
+  TEST_ASSERT_RTRUE(rstring_upcase_bang(rstr));
+  TEST_ASSERT_EQUAL_STRING("APPLE PIE", rstring_data(rstr));
+  TEST_ASSERT_RFALSE(rstring_upcase_bang(rstr));
+
+  TEST_ASSERT_RTRUE(rstring_downcase_bang(rstr));
+  TEST_ASSERT_EQUAL_STRING("apple pie", rstring_data(rstr));
+  TEST_ASSERT_RFALSE(rstring_downcase_bang(rstr));
+  TEST_ASSERT_EQUAL_PTR(data, rstr->data);
+
+  TEST_ASSERT_RERROR(rstring_upcase_bang(NULL));
+  TEST_ASSERT_RERROR(rstring_downcase_bang(NULL));
+
+  rstring_free(rstr);
+}
+
+void
+test___rstring_strip_bang___should_StripInPlace(void)
+{
+  rstring* rstr = rstring_new("  apple pie \n");
+
+  TEST_ASSERT_RTRUE(rstring_rstrip_bang(rstr));
+  TEST_ASSERT_EQUAL_STRING("  apple pie", rstring_data(rstr));
+  TEST_ASSERT_RFALSE(rstring_rstrip_bang(rstr));
+
+  TEST_ASSERT_RTRUE(rstring_lstrip_bang(rstr));
+  TEST_ASSERT_EQUAL_STRING("apple pie", rstring_data(rstr));
+  TEST_ASSERT_RFALSE(rstring_lstrip_bang(rstr));
+
+  TEST_ASSERT_RFALSE(rstring_strip_bang(rstr));
+  TEST_ASSERT_TRUE(bassigncstr(rstr, "\tpie\t") == BSTR_OK);
+  TEST_ASSERT_RTRUE(rstring_strip_bang(rstr));
+  TEST_ASSERT_EQUAL_STRING("pie", rstring_data(rstr));
+
+  TEST_ASSERT_RERROR(rstring_strip_bang(NULL));
+
+  rstring_free(rstr);
+}
+
+void
+test___rstring_chomp_bang___should_ChompInPlace(void)
+{
+  rstring* rstr = rstring_new("apple\n\r\n");
+
+  TEST_ASSERT_RTRUE(rstring_chomp_bang(rstr));
+  TEST_ASSERT_EQUAL_STRING("apple\n", rstring_data(rstr));
+  TEST_ASSERT_RTRUE(rstring_chomp_bang(rstr));
+  TEST_ASSERT_EQUAL_STRING("apple", rstring_data(rstr));
+  TEST_ASSERT_RFALSE(rstring_chomp_bang(rstr));
+  TEST_ASSERT_EQUAL_STRING("apple", rstring_data(rstr));
+
+  TEST_ASSERT_RERROR(rstring_chomp_bang(NULL));
+
+  rstring_free(rstr);
+}
+
+void
+test___rstring_reverse_bang___should_ReverseInPlace(void)
+{
+  rstring* rstr = rstring_new("apple");
+
+  TEST_ASSERT_RTRUE(rstring_reverse_bang(rstr));
+  TEST_ASSERT_EQUAL_STRING("elppa", rstring_data(rstr));
+
+  TEST_ASSERT_TRUE(bassigncstr(rstr, "racecar") == BSTR_OK);
+  TEST_ASSERT_RFALSE(rstring_reverse_bang(rstr));
+  TEST_ASSERT_EQUAL_STRING("racecar", rstring_data(rstr));
+
+  TEST_ASSERT_TRUE(bassigncstr(rstr, "") == BSTR_OK);
+  TEST_ASSERT_RFALSE(rstring_reverse_bang(rstr));
+
+  TEST_ASSERT_RERROR(rstring_reverse_bang(NULL));
+
+  rstring_free(rstr);
+}
+
+void
+test___rstring_gsub_bang___should_SubstituteInPlace(void)
+{
+  rstring* rstr = rstring_new("aabaAb");
+
+  TEST_ASSERT_RTRUE(rstring_gsub_cstr_bang(rstr, "a", "aa"));
+  TEST_ASSERT_EQUAL_STRING("aaaabaaAb", rstring_data(rstr));
+
+  TEST_ASSERT_RTRUE(rstring_gsub_cstr_bang(rstr, "aa", ""));
+  TEST_ASSERT_EQUAL_STRING("bAb", rstring_data(rstr));
+
+  TEST_ASSERT_RFALSE(rstring_gsub_cstr_bang(rstr, "z", "y"));
+  TEST_ASSERT_EQUAL_STRING("bAb", rstring_data(rstr));
+
+  /* Ruby counts a match as a change even if the replacement is the same. */
+  TEST_ASSERT_RTRUE(rstring_gsub_cstr_bang(rstr, "A", "A"));
+
+  TEST_ASSERT_RERROR(rstring_gsub_cstr_bang(rstr, "", "y"));
+  TEST_ASSERT_RERROR(rstring_gsub_cstr_bang(NULL, "a", "b"));
+  TEST_ASSERT_RERROR(rstring_gsub_bang(rstr, NULL, NULL));
+
+  rstring_free(rstr);
+}
+
+void
+test___RSTR_LIT___should_MakeStaticRstring(void)
+{
+  rstring* rstr = rstring_new("apple\tpie");
+
+  TEST_ASSERT_EQUAL(5, rstring_length(RSTR_LIT("apple")));
+  TEST_ASSERT_RTRUE(rstring_eql(RSTR_LIT("apple\tpie"), rstr));
+  TEST_ASSERT_EQUAL(6, rstring_index(rstr, RSTR_LIT("pie")));
+  TEST_ASSERT_RTRUE(rstring_include(rstr, RSTR_LIT("\t")));
+
+  rstring_array* ary = rstring_split(rstr, RSTR_LIT("\t"));
+  TEST_ASSERT_EQUAL(2, ary->qty);
+
+  rstring* joined = rstring_array_join(ary, RSTR_LIT(", "));
+  TEST_ASSERT_EQUAL_STRING("apple, pie", rstring_data(joined));
+
+  /* Literals are read only. */
+  TEST_ASSERT_EQUAL(BSTR_ERR, bcatcstr(RSTR_LIT("apple"), "pie"));
+  TEST_ASSERT_EQUAL(BSTR_ERR, rstring_free(RSTR_LIT("apple")));
+
+  rstring_free(joined);
+  rstring_array_free(ary);
+  rstring_free(rstr);
+}
+
+void
+test___rstring_index___should_FindSubstringsInLongRuns(void)
+{
+  rstring* rstr = rstring_new("");
+  rstring* substring = rstring_new("");
+
+  for (int i = 0; i < 5000; ++i) { bconchar(rstr, 'A'); }
+  for (int i = 0; i < 600; ++i) { bconchar(substring, 'A'); }
+  bconchar(substring, 'B');
+
+  TEST_ASSERT_EQUAL(RERROR, rstring_index(rstr, substring));
+  TEST_ASSERT_EQUAL(RERROR, binstrr(rstr, rstr->slen, substring));
+
+  bconchar(rstr, 'B');
+  bcatcstr(rstr, "aaaab");
+  TEST_ASSERT_EQUAL(4400, rstring_index(rstr, substring));
+  TEST_ASSERT_EQUAL(4400, binstrr(rstr, rstr->slen, substring));
+  TEST_ASSERT_EQUAL(RERROR, rstring_index_offset(rstr, substring, 4401));
+
+  TEST_ASSERT_EQUAL(4400, binstrcaseless(rstr, 0, substring));
+  TEST_ASSERT_EQUAL(4400, binstrrcaseless(rstr, rstr->slen, substring));
+  TEST_ASSERT_EQUAL(5001, rstring_index(rstr, RSTR_LIT("aaaab")));
+  TEST_ASSERT_EQUAL(4996, binstrcaseless(rstr, 0, RSTR_LIT("aaaab")));
+
+  rstring_free(substring);
+  rstring_free(rstr);
+}
+
+void
+test___rstring_matcher___should_SearchWithPreparedPattern(void)
+{
+  rstring_matcher* matcher = rstring_matcher_new(RSTR_LIT("pie"), 0);
+  rstring_matcher* caseless = rstring_matcher_new_cstr("PIE", RSTRING_MATCHER_CASELESS);
+  rstring* rstr = rstring_new("apple pie, pie, Pie");
+
+  TEST_ASSERT_RTRUE(rstring_include_matcher(rstr, matcher));
+  TEST_ASSERT_RFALSE(rstring_include_matcher(RSTR_LIT("apple"), matcher));
+  TEST_ASSERT_EQUAL(6, rstring_index_matcher(rstr, matcher));
+  TEST_ASSERT_EQUAL(11, rstring_index_offset_matcher(rstr, matcher, 7));
+  TEST_ASSERT_EQUAL(11, rstring_rindex_matcher(rstr, matcher));
+  TEST_ASSERT_EQUAL(16, rstring_rindex_matcher(rstr, caseless));
+  TEST_ASSERT_EQUAL(6, rstring_index_matcher(rstr, caseless));
+
+  rstring* actual = rstring_gsub_matcher(rstr, caseless, RSTR_LIT("tart"));
+  TEST_ASSERT_RTRUE(rstring_eql_cstr(actual, "apple tart, tart, tart"));
+  rstring_free(actual);
+
+  rstring_array* fields = rstring_split_matcher(rstr, matcher);
+  TEST_ASSERT_EQUAL(3, fields->qty);
+  TEST_ASSERT_RTRUE(rstring_eql_cstr(fields->entry[0], "apple "));
+  TEST_ASSERT_RTRUE(rstring_eql_cstr(fields->entry[1], ", "));
+  TEST_ASSERT_RTRUE(rstring_eql_cstr(fields->entry[2], ", Pie"));
+  rstring_array_free(fields);
+
+  /* Back to back separators give empty fields. */
+  rstring* pies = rstring_new("piepie");
+  fields = rstring_split_matcher(pies, matcher);
+  TEST_ASSERT_EQUAL(3, fields->qty);
+  TEST_ASSERT_EQUAL(0, fields->entry[1]->slen);
+  rstring_array_free(fields);
+  fields = rstring_split(pies, RSTR_LIT("pie"));
+  TEST_ASSERT_EQUAL(3, fields->qty);
+  rstring_array_free(fields);
+  rstring_free(pies);
+
+  TEST_ASSERT_RTRUE(rstring_gsub_matcher_bang(rstr, matcher, RSTR_LIT("tart")));
+  TEST_ASSERT_RTRUE(rstring_eql_cstr(rstr, "apple tart, tart, Pie"));
+  TEST_ASSERT_RFALSE(rstring_gsub_matcher_bang(rstr, matcher, RSTR_LIT("tart")));
+
+  TEST_ASSERT_NULL(rstring_matcher_new(NULL, 0));
+  TEST_ASSERT_RERROR(rstring_index_matcher(NULL, matcher));
+  TEST_ASSERT_RERROR(rstring_include_matcher(rstr, NULL));
+
+  rstring_free(rstr);
+  rstring_matcher_free(caseless);
+  rstring_matcher_free(matcher);
+}
+
+static int
+count_matches_cb(void* parm, blen_t pos, blen_t which)
+{
+  (void)pos;
+  (void)which;
+  ++*(blen_t*)parm;
+  return 0;
+}
+
+void
+test___rstring_multimatcher___should_SearchForManyPatternsAtOnce(void)
+{
+  rstring* keywords = rstring_new("he she his hers");
+  rstring_array* patterns = rstring_split_cstr(keywords, " ");
+  rstring_multimatcher* mm = rstring_multimatcher_new(patterns, 0);
+  rstring* rstr = rstring_new("ushers and his");
+  blen_t which = -1;
+
+  TEST_ASSERT_NOT_NULL(mm);
+  TEST_ASSERT_RTRUE(rstring_include_multimatcher(rstr, mm));
+  TEST_ASSERT_RFALSE(rstring_include_multimatcher(RSTR_LIT("usual"), mm));
+
+  /* "she" and "he" and "hers" all match in "ushers", "she" starts first. */
+  TEST_ASSERT_EQUAL(1, rstring_index_multimatcher(rstr, mm, &which));
+  TEST_ASSERT_EQUAL(1, which);
+  TEST_ASSERT_EQUAL(RERROR, rstring_index_multimatcher(RSTR_LIT("usual"), mm, NULL));
+
+  blen_t count = 0;
+  TEST_ASSERT_EQUAL(ROKAY, rstring_scan_multimatcher(rstr, mm, count_matches_cb, &count));
+  TEST_ASSERT_EQUAL(4, count);
+  TEST_ASSERT_EQUAL(4, rstring_count_multimatcher(rstr, mm));
+
+  rstring* with = rstring_new("HE SHE HIS HERS");
+  rstring_array* replacements = rstring_split_cstr(with, " ");
+  rstring* actual = rstring_gsub_multimatcher(rstr, mm, replacements);
+  TEST_ASSERT_RTRUE(rstring_eql_cstr(actual, "uSHErs and HIS"));
+  rstring_free(actual);
+
+  rstring_multimatcher* caseless = rstring_multimatcher_new(patterns, RSTRING_MATCHER_CASELESS);
+  TEST_ASSERT_EQUAL(3, rstring_count_multimatcher(RSTR_LIT("HIS hers"), caseless));
+  rstring_multimatcher_free(caseless);
+
+  TEST_ASSERT_NULL(rstring_gsub_multimatcher(rstr, mm, NULL));
+  TEST_ASSERT_NULL(rstring_multimatcher_new(NULL, 0));
+  TEST_ASSERT_RERROR(rstring_count_multimatcher(NULL, mm));
+
+  rstring_array_free(replacements);
+  rstring_free(with);
+  rstring_free(rstr);
+  rstring_multimatcher_free(mm);
+  rstring_array_free(patterns);
+  rstring_free(keywords);
+}
+
+void
+test___rstring_charclass___should_FindBytesInTheClass(void)
+{
+  rstring_charclass* vowels = rstring_charclass_new_cstr("aeiou", 0);
+  rstring_charclass* bases = rstring_charclass_new_cstr("ACGT", RSTRING_CHARCLASS_INVERT);
+  rstring* seq = rstring_new("ACGTTGCAACGTTGCAACGTTGCAACGTTGCAACGTTGCAACGTTGCAACGTNNACGT");
+
+  TEST_ASSERT_NOT_NULL(vowels);
+  TEST_ASSERT_NOT_NULL(bases);
+
+  TEST_ASSERT_EQUAL(1, rstring_index_charclass(RSTR_LIT("hello world"), vowels));
+  TEST_ASSERT_EQUAL(7, rstring_rindex_charclass(RSTR_LIT("hello world"), vowels));
+  TEST_ASSERT_EQUAL(4, rstring_index_offset_charclass(RSTR_LIT("hello world"), vowels, 2));
+  TEST_ASSERT_EQUAL(RERROR, rstring_index_charclass(RSTR_LIT("rhythm"), vowels));
+
+  TEST_ASSERT_EQUAL(52, rstring_index_charclass(seq, bases));
+  TEST_ASSERT_EQUAL(53, rstring_rindex_charclass(seq, bases));
+  TEST_ASSERT_EQUAL(RERROR, rstring_index_offset_charclass(seq, bases, 54));
+
+  rstring_charclass* seps = rstring_charclass_new_cstr(",;", 0);
+  rstring_array* fields = rstring_split_charclass(RSTR_LIT("a,b;;c"), seps);
+  TEST_ASSERT_EQUAL(4, fields->qty);
+  TEST_ASSERT_RTRUE(rstring_eql_cstr(fields->entry[0], "a"));
+  TEST_ASSERT_RTRUE(rstring_eql_cstr(fields->entry[1], "b"));
+  TEST_ASSERT_RTRUE(rstring_eql_cstr(fields->entry[2], ""));
+  TEST_ASSERT_RTRUE(rstring_eql_cstr(fields->entry[3], "c"));
+  rstring_array_free(fields);
+  rstring_charclass_free(seps);
+
+  TEST_ASSERT_NULL(rstring_charclass_new(NULL, 0));
+  TEST_ASSERT_NULL(rstring_charclass_new_cstr("a", 0x8));
+  TEST_ASSERT_RERROR(rstring_index_charclass(NULL, vowels));
+  TEST_ASSERT_RERROR(rstring_index_charclass(seq, NULL));
+  TEST_ASSERT_RERROR(rstring_charclass_free(NULL));
+
+  rstring_free(seq);
+  rstring_charclass_free(bases);
+  rstring_charclass_free(vowels);
+}
+
+void
+test___rstring_casecmp___should_CompareWithoutRegardToCase(void)
+{
+  rstring* header = rstring_new("Content-Type: text/plain; charset=UTF-8 and a long tail to cross a vector or two");
+
+  TEST_ASSERT_EQUAL(0, rstring_casecmp_cstr(RSTR_LIT("HeLLo"), "hello"));
+  TEST_ASSERT_EQUAL(-1, rstring_casecmp_cstr(RSTR_LIT("abc"), "ABD"));
+  TEST_ASSERT_EQUAL(1, rstring_casecmp_cstr(RSTR_LIT("abd"), "ABC"));
+  TEST_ASSERT_EQUAL(-1, rstring_casecmp_cstr(RSTR_LIT("ab"), "ABC"));
+  TEST_ASSERT_EQUAL(1, rstring_casecmp_cstr(RSTR_LIT("abc"), "AB"));
+  /* '[' sits between 'Z' and 'a', so folding (to lower case) changes the order. */
+  TEST_ASSERT_EQUAL(-1, rstring_casecmp_cstr(RSTR_LIT("["), "Z"));
+  TEST_ASSERT_EQUAL(SHRT_MIN, rstring_casecmp_cstr(NULL, "a"));
+
+  TEST_ASSERT_RTRUE(rstring_eql_caseless_cstr(header, "content-type: TEXT/PLAIN; charset=utf-8 AND A LONG TAIL TO CROSS A VECTOR OR TWO"));
+  TEST_ASSERT_RFALSE(rstring_eql_caseless_cstr(header, "content-type: TEXT/PLAIN; charset=utf-8 AND A LONG TAIL TO CROSS A VECTOR OR TWa"));
+  TEST_ASSERT_RFALSE(rstring_eql_caseless_cstr(RSTR_LIT("@"), "`"));
+  TEST_ASSERT_RERROR(rstring_eql_caseless(header, NULL));
+
+  TEST_ASSERT_RTRUE(rstring_include_caseless_cstr(header, "CHARSET=utf-8"));
+  TEST_ASSERT_RTRUE(rstring_include_caseless_cstr(header, "V"));
+  TEST_ASSERT_RFALSE(rstring_include_caseless_cstr(header, "charset=latin1"));
+  TEST_ASSERT_RERROR(rstring_include_caseless_cstr(header, NULL));
+
+  rstring_free(header);
+}
+
+void
+test___rstring_rindex___should_FindTheLastOccurence(void)
+{
+  rstring* rstr = rstring_new("apple pie, apple tart, apple crumble and a long tail with no fruit in it at all");
+
+  TEST_ASSERT_EQUAL(23, rstring_rindex_cstr(rstr, "apple"));
+  TEST_ASSERT_EQUAL(11, rstring_rindex_offset_cstr(rstr, "apple", 22));
+  TEST_ASSERT_EQUAL(0, rstring_rindex_offset_cstr(rstr, "apple", 10));
+  TEST_ASSERT_EQUAL(rstr->slen - 1, rstring_rindex_cstr(rstr, "l"));
+  TEST_ASSERT_EQUAL(rstr->slen, rstring_rindex_cstr(rstr, ""));
+  TEST_ASSERT_EQUAL(RERROR, rstring_rindex_cstr(rstr, "pear"));
+  TEST_ASSERT_EQUAL(RERROR, rstring_rindex_offset_cstr(rstr, "apple", rstr->slen + 1));
+
+  TEST_ASSERT_EQUAL(RERROR, rstring_rindex_cstr(NULL, "apple"));
+  TEST_ASSERT_EQUAL(RERROR, rstring_rindex_cstr(rstr, NULL));
+
+  rstring_free(rstr);
+}
+
+void
+test___rstring_match___should_MatchRegularExpressions(void)
+{
+  rstring_regex* email = rstring_regex_new_cstr("(\\w+)@(\\w+)\\.com", 0);
+  rstring_regex* nums = rstring_regex_new_cstr("\\d+", 0);
+  rstring_regex* alt = rstring_regex_new_cstr("(a|ab)(c|bcd)(x)?", 0);
+
+  TEST_ASSERT_NOT_NULL(email);
+  TEST_ASSERT_NOT_NULL(nums);
+  TEST_ASSERT_NOT_NULL(alt);
+
+  rstring_array* m = rstring_match(RSTR_LIT("mail ryan@example.com now"), email);
+  TEST_ASSERT_EQUAL(3, m->qty);
+  TEST_ASSERT_RTRUE(rstring_eql_cstr(m->entry[0], "ryan@example.com"));
+  TEST_ASSERT_RTRUE(rstring_eql_cstr(m->entry[1], "ryan"));
+  TEST_ASSERT_RTRUE(rstring_eql_cstr(m->entry[2], "example"));
+  rstring_array_free(m);
+
+  /* The first alternative that lets the match go through wins, as in Ruby. */
+  m = rstring_match(RSTR_LIT("abcd"), alt);
+  TEST_ASSERT_EQUAL(4, m->qty);
+  TEST_ASSERT_RTRUE(rstring_eql_cstr(m->entry[0], "abcd"));
+  TEST_ASSERT_RTRUE(rstring_eql_cstr(m->entry[1], "a"));
+  TEST_ASSERT_RTRUE(rstring_eql_cstr(m->entry[2], "bcd"));
+  TEST_ASSERT_RTRUE(rstring_eql_cstr(m->entry[3], ""));
+  rstring_array_free(m);
+
+  TEST_ASSERT_NULL(rstring_match(RSTR_LIT("no mail"), email));
+  TEST_ASSERT_RTRUE(rstring_match_p(RSTR_LIT("a 1"), nums));
+  TEST_ASSERT_RFALSE(rstring_match_p(RSTR_LIT("a b"), nums));
+  TEST_ASSERT_EQUAL(5, rstring_index_re(RSTR_LIT("page 42"), nums));
+  TEST_ASSERT_EQUAL(RERROR, rstring_index_re(RSTR_LIT("page"), nums));
+
+  rstring_array* all = rstring_scan(RSTR_LIT("1, 22 and 333"), nums);
+  TEST_ASSERT_EQUAL(3, all->qty);
+  TEST_ASSERT_RTRUE(rstring_eql_cstr(all->entry[0], "1"));
+  TEST_ASSERT_RTRUE(rstring_eql_cstr(all->entry[1], "22"));
+  TEST_ASSERT_RTRUE(rstring_eql_cstr(all->entry[2], "333"));
+  rstring_array_free(all);
+
+  rstring* swapped = rstring_gsub_re(RSTR_LIT("a@b and c@d.com"), email, RSTR_LIT("<\\2 \\1 \\\\ \\0>"));
+  TEST_ASSERT_RTRUE(rstring_eql_cstr(swapped, "a@b and <d c \\ c@d.com>"));
+  rstring_free(swapped);
+
+  rstring_regex* sep = rstring_regex_new_cstr("\\s*[,;]\\s*", 0);
+  rstring_array* fields = rstring_split_re(RSTR_LIT("a , b;c,,"), sep);
+  TEST_ASSERT_EQUAL(5, fields->qty);
+  TEST_ASSERT_RTRUE(rstring_eql_cstr(fields->entry[0], "a"));
+  TEST_ASSERT_RTRUE(rstring_eql_cstr(fields->entry[1], "b"));
+  TEST_ASSERT_RTRUE(rstring_eql_cstr(fields->entry[2], "c"));
+  TEST_ASSERT_RTRUE(rstring_eql_cstr(fields->entry[3], ""));
+  TEST_ASSERT_RTRUE(rstring_eql_cstr(fields->entry[4], ""));
+  rstring_array_free(fields);
+  rstring_regex_free(sep);
+
+  rstring_regex* line = rstring_regex_new_cstr("^hello$", RSTRING_REGEX_CASELESS);
+  TEST_ASSERT_RTRUE(rstring_match_p(RSTR_LIT("say\nHeLLo\nthere"), line));
+  TEST_ASSERT_RFALSE(rstring_match_p(RSTR_LIT("say HeLLo there"), line));
+  rstring_regex_free(line);
+
+  /* A pattern that makes backtracking engines take exponential time. */
+  rstring_regex* slow = rstring_regex_new_cstr("(a|aa)*c", 0);
+  rstring* as = rstring_new("aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaab");
+  TEST_ASSERT_RFALSE(rstring_match_p(as, slow));
+  TEST_ASSERT_NULL(rstring_match(as, slow));
+  rstring_free(as);
+  rstring_regex_free(slow);
+
+  /* As in Ruby, a pass through a loop that matches nothing ends it. */
+  rstring_regex* empty = rstring_regex_new_cstr("(?:a*|b)*", 0);
+  m = rstring_match(RSTR_LIT("ab"), empty);
+  TEST_ASSERT_RTRUE(rstring_eql_cstr(m->entry[0], "a"));
+  rstring_array_free(m);
+  rstring_regex_free(empty);
+
+  empty = rstring_regex_new_cstr("(?:\\s*|\\w)*", 0);
+  m = rstring_match(RSTR_LIT(" bB"), empty);
+  TEST_ASSERT_RTRUE(rstring_eql_cstr(m->entry[0], " "));
+  rstring_array_free(m);
+  rstring_regex_free(empty);
+
+  empty = rstring_regex_new_cstr("(a|)*", 0);
+  m = rstring_match(RSTR_LIT("aab"), empty);
+  TEST_ASSERT_RTRUE(rstring_eql_cstr(m->entry[0], "aa"));
+  TEST_ASSERT_RTRUE(rstring_eql_cstr(m->entry[1], ""));
+  rstring_array_free(m);
+  rstring_regex_free(empty);
+
+  TEST_ASSERT_NULL(rstring_regex_new_cstr("(a", 0));
+  TEST_ASSERT_NULL(rstring_regex_new_cstr("a)", 0));
+  TEST_ASSERT_NULL(rstring_regex_new_cstr("*a", 0));
+  TEST_ASSERT_NULL(rstring_regex_new_cstr("[b-a]", 0));
+  TEST_ASSERT_NULL(rstring_regex_new_cstr("(a)\\1", 0));
+  TEST_ASSERT_NULL(rstring_regex_new_cstr("(?=a)", 0));
+  TEST_ASSERT_NULL(rstring_regex_new_cstr("a", 0x8));
+  TEST_ASSERT_NULL(rstring_regex_new(NULL, 0));
+  TEST_ASSERT_RERROR(rstring_match_p(NULL, nums));
+  TEST_ASSERT_RERROR(rstring_match_p(RSTR_LIT("1"), NULL));
+  TEST_ASSERT_NULL(rstring_scan(NULL, nums));
+  TEST_ASSERT_NULL(rstring_gsub_re(RSTR_LIT("1"), nums, NULL));
+  TEST_ASSERT_NULL(rstring_split_re(RSTR_LIT("1"), NULL));
+
+  rstring_regex_free(email);
+  rstring_regex_free(nums);
+  rstring_regex_free(alt);
+}
+
+static int
+collect_positions(void* parm, blen_t pos)
+{
+  blen_t* found = parm;
+
+  found[++found[0]] = pos;
+
+  return found[0] == 3 ? -5 : 0;
+}
+
+void
+test___rstring_count_substr___should_CountOccurences(void)
+{
+  TEST_ASSERT_EQUAL(2, rstring_count_substr(RSTR_LIT("aaaa"), RSTR_LIT("aa")));
+  TEST_ASSERT_EQUAL(3, rstring_count_substr_cstr(RSTR_LIT("a,b,,c"), ","));
+  TEST_ASSERT_EQUAL(2, rstring_count_substr_cstr(RSTR_LIT("the cat and the hat"), "the"));
+  TEST_ASSERT_EQUAL(0, rstring_count_substr_cstr(RSTR_LIT("apple"), "pie"));
+  TEST_ASSERT_EQUAL(4, rstring_count_substr_cstr(RSTR_LIT("abc"), ""));
+  TEST_ASSERT_EQUAL(RERROR, rstring_count_substr(NULL, RSTR_LIT("a")));
+  TEST_ASSERT_EQUAL(RERROR, rstring_count_substr_cstr(RSTR_LIT("a"), NULL));
+
+  blen_t positions[2];
+  TEST_ASSERT_EQUAL(3, rstring_scan_positions(RSTR_LIT("a,b,,c"), RSTR_LIT(","), positions, 2));
+  TEST_ASSERT_EQUAL(1, positions[0]);
+  TEST_ASSERT_EQUAL(3, positions[1]);
+  TEST_ASSERT_EQUAL(3, rstring_scan_positions(RSTR_LIT("a,b,,c"), RSTR_LIT(","), NULL, 0));
+  TEST_ASSERT_EQUAL(RERROR, rstring_scan_positions(RSTR_LIT("a,b,,c"), RSTR_LIT(","), NULL, 2));
+
+  blen_t found[5] = { 0 };
+  TEST_ASSERT_EQUAL(ROKAY, rstring_each_match(RSTR_LIT("xyxy"), RSTR_LIT("xy"), collect_positions, found));
+  TEST_ASSERT_EQUAL(2, found[0]);
+  TEST_ASSERT_EQUAL(0, found[1]);
+  TEST_ASSERT_EQUAL(2, found[2]);
+
+  /* A negative return from the callback stops the scan. */
+  found[0] = 0;
+  TEST_ASSERT_EQUAL(-5, rstring_each_match(RSTR_LIT("xxxxxx"), RSTR_LIT("x"), collect_positions, found));
+  TEST_ASSERT_EQUAL(3, found[0]);
+  TEST_ASSERT_RERROR(rstring_each_match(RSTR_LIT("x"), RSTR_LIT("x"), NULL, NULL));
+}
+
+void
+test___rstring_index_build___should_AnswerSubstringQueries(void)
+{
+  rstring* text = rstring_new("mississippi river, mississippi delta");
+
+  for (int flags = 0; flags <= RSTRING_INDEX_COMPRESSED; ++flags) {
+    rstring_text_index* idx = rstring_index_build(text, flags);
+    TEST_ASSERT_NOT_NULL(idx);
+
+    TEST_ASSERT_EQUAL(2, rstring_count_text_index(idx, RSTR_LIT("mississippi")));
+    TEST_ASSERT_EQUAL(4, rstring_count_text_index(idx, RSTR_LIT("issi")));
+    TEST_ASSERT_EQUAL(0, rstring_count_text_index(idx, RSTR_LIT("missouri")));
+    TEST_ASSERT_EQUAL(37, rstring_count_text_index(idx, RSTR_LIT("")));
+
+    TEST_ASSERT_RTRUE(rstring_include_text_index(idx, RSTR_LIT("delta")));
+    TEST_ASSERT_RFALSE(rstring_include_text_index(idx, RSTR_LIT("deltas")));
+
+    TEST_ASSERT_EQUAL(1, rstring_index_text_index(idx, RSTR_LIT("issi")));
+    TEST_ASSERT_EQUAL(12, rstring_index_text_index(idx, RSTR_LIT("river")));
+    TEST_ASSERT_EQUAL(RERROR, rstring_index_text_index(idx, RSTR_LIT("z")));
+
+    /* The dumped bytes work as an index without building it again. */
+    rstring* bytes = rstring_text_index_dump(idx);
+    rstring_text_index* loaded = rstring_text_index_load(bytes);
+    TEST_ASSERT_NOT_NULL(loaded);
+    TEST_ASSERT_EQUAL(31, rstring_index_text_index(loaded, RSTR_LIT("delta")));
+    TEST_ASSERT_EQUAL(2, rstring_count_text_index(loaded, RSTR_LIT("ppi")));
+    rstring_text_index_free(loaded);
+
+    /* Damaged tables are turned away, or at worst give wrong answers,
+       never a search that runs off the tables. */
+    blen_t tables = (blen_t)sizeof(struct rstring__text_index_header);
+    bytes->data[tables] ^= 0x40;
+    TEST_ASSERT_NULL(rstring_text_index_load(bytes));
+    bytes->data[tables] ^= 0x40;
+
+    for (blen_t i = tables; i < rstring_length(bytes); ++i) {
+      for (int bit = 0; bit < 8; ++bit) {
+        bytes->data[i] ^= (unsigned char)(1 << bit);
+        loaded = rstring_text_index_load(bytes);
+        if (loaded != NULL) {
+          blen_t count = rstring_count_text_index(loaded, RSTR_LIT("issi"));
+          blen_t first = rstring_index_text_index(loaded, RSTR_LIT("issi"));
+          TEST_ASSERT_TRUE(count >= 0 && count <= 37);
+          TEST_ASSERT_TRUE(first >= RERROR && first <= 36);
+          rstring_text_index_free(loaded);
+        }
+        bytes->data[i] ^= (unsigned char)(1 << bit);
+      }
+    }
+
+    bytes->data[0] = 'X';
+    TEST_ASSERT_NULL(rstring_text_index_load(bytes));
+    rstring_free(bytes);
+
+    TEST_ASSERT_EQUAL(RERROR, rstring_count_text_index(idx, NULL));
+    TEST_ASSERT_RERROR(rstring_include_text_index(NULL, RSTR_LIT("a")));
+
+    rstring_text_index_free(idx);
+  }
+
+  TEST_ASSERT_NULL(rstring_index_build(NULL, 0));
+  TEST_ASSERT_NULL(rstring_index_build(text, 0x8));
+  TEST_ASSERT_NULL(rstring_text_index_load(RSTR_LIT("too short")));
+
+  rstring_free(text);
+}
+
+void
+test___rstring_gsub_into___should_WriteSubbedCopyIntoDst(void)
+{
+  rstring* dst = rstring_new("old contents");
+
+  TEST_ASSERT_EQUAL(2, rstring_gsub_into(dst, RSTR_LIT("apple"), RSTR_LIT("p"), RSTR_LIT("AP")));
+  TEST_ASSERT_EQUAL_RSTRING("aAPAPle", dst);
+
+  TEST_ASSERT_EQUAL(2, rstring_gsub_into(dst, RSTR_LIT("apple"), RSTR_LIT("p"), RSTR_LIT("")));
+  TEST_ASSERT_EQUAL_RSTRING("ale", dst);
+
+  TEST_ASSERT_EQUAL(3, rstring_gsub_cstr_into(dst, RSTR_LIT("a-b-c-"), "-", "+"));
+  TEST_ASSERT_EQUAL_RSTRING("a+b+c+", dst);
+
+  TEST_ASSERT_EQUAL(2, rstring_gsub_into(dst, RSTR_LIT("one, two, three"), RSTR_LIT(", "), RSTR_LIT(" and then ")));
+  TEST_ASSERT_EQUAL_RSTRING("one and then two and then three", dst);
+
+  TEST_ASSERT_EQUAL(0, rstring_gsub_into(dst, RSTR_LIT("apple"), RSTR_LIT("pie"), RSTR_LIT("PIE")));
+  TEST_ASSERT_EQUAL_RSTRING("apple", dst);
+
+  TEST_ASSERT_EQUAL(0, rstring_gsub_into(dst, RSTR_LIT(""), RSTR_LIT("a"), RSTR_LIT("b")));
+  TEST_ASSERT_EQUAL_RSTRING("", dst);
+
+  /* Once dst is big enough, rewriting into it allocates nothing. */
+  rstring* line = rstring_new("a\tbb\tccc\tdddd");
+  TEST_ASSERT_EQUAL(3, rstring_gsub_cstr_into(dst, line, "\t", ", "));
+  unsigned char* data = dst->data;
+  for (int i = 0; i < 10; ++i) {
+    TEST_ASSERT_EQUAL(3, rstring_gsub_cstr_into(dst, line, "\t", ", "));
+  }
+  TEST_ASSERT_EQUAL_PTR(data, dst->data);
+  TEST_ASSERT_EQUAL_RSTRING("a, bb, ccc, dddd", dst);
+
+  /* dst may not be (or overlap) any of the others. */
+  TEST_ASSERT_RERROR(rstring_gsub_into(line, line, RSTR_LIT("a"), RSTR_LIT("b")));
+  rstring_view part = rstring_view_of_blk(line->data + 2, 2);
+  TEST_ASSERT_RERROR(rstring_gsub_into(line, &part, RSTR_LIT("a"), RSTR_LIT("b")));
+  TEST_ASSERT_RERROR(rstring_gsub_into(dst, line, RSTR_LIT(""), RSTR_LIT("b")));
+  TEST_ASSERT_RERROR(rstring_gsub_into(NULL, line, RSTR_LIT("a"), RSTR_LIT("b")));
+  TEST_ASSERT_RERROR(rstring_gsub_into(dst, NULL, RSTR_LIT("a"), RSTR_LIT("b")));
+  TEST_ASSERT_RERROR(rstring_gsub_cstr_into(dst, line, NULL, "b"));
+  TEST_ASSERT_RERROR(rstring_gsub_into(RSTR_LIT("view"), line, RSTR_LIT("a"), RSTR_LIT("b")));
+
+  rstring_free(line);
+  rstring_free(dst);
+}
+
+void
+test___rstring_tr___should_TranslateDeleteSqueezeAndCountBytes(void)
+{
+  rstring* actual = NULL;
+
+  TEST_ASSERT_EQUAL_RSTRING("hippo", (actual = rstring_tr_cstr(RSTR_LIT("hello"), "el", "ip")));
+  rstring_free(actual);
+  TEST_ASSERT_EQUAL_RSTRING("*e**o", (actual = rstring_tr_cstr(RSTR_LIT("hello"), "^aeiou", "*")));
+  rstring_free(actual);
+  TEST_ASSERT_EQUAL_RSTRING("ifmmp", (actual = rstring_tr_cstr(RSTR_LIT("hello"), "a-y", "b-z")));
+  rstring_free(actual);
+  TEST_ASSERT_EQUAL_RSTRING("xyyyy", (actual = rstring_tr_cstr(RSTR_LIT("abcdd"), "a-d", "xy")));
+  rstring_free(actual);
+  TEST_ASSERT_EQUAL_RSTRING("ho", (actual = rstring_tr_cstr(RSTR_LIT("hello"), "el", "")));
+  rstring_free(actual);
+  TEST_ASSERT_EQUAL_RSTRING("a+b", (actual = rstring_tr_cstr(RSTR_LIT("a-b"), "\\-", "+")));
+  rstring_free(actual);
+  TEST_ASSERT_NULL(rstring_tr_cstr(RSTR_LIT("hello"), "z-a", "x"));
+  TEST_ASSERT_NULL(rstring_tr_cstr(RSTR_LIT("hello"), NULL, "x"));
+  TEST_ASSERT_NULL(rstring_tr_cstr(RSTR_LIT("hello"), "e", "xz-a"));
+
+  /* The specs are checked even when there is nothing to work on. */
+  rstring* empty = rstring_new("");
+  TEST_ASSERT_NULL(rstring_tr_cstr(RSTR_LIT(""), "z-a", "x"));
+  TEST_ASSERT_NULL(rstring_tr_cstr(RSTR_LIT(""), "a", "z-a"));
+  TEST_ASSERT_NULL(rstring_tr_cstr(RSTR_LIT(""), "z-a", ""));
+  TEST_ASSERT_RERROR(rstring_tr_cstr_bang(empty, "z-a", "x"));
+  TEST_ASSERT_RERROR(rstring_tr_cstr_bang(empty, "a", "z-a"));
+  TEST_ASSERT_NULL(rstring_delete_cstr(RSTR_LIT(""), "z-a"));
+  TEST_ASSERT_RERROR(rstring_delete_cstr_bang(empty, "z-a"));
+  TEST_ASSERT_NULL(rstring_squeeze_cstr(RSTR_LIT(""), "z-a"));
+  TEST_ASSERT_RERROR(rstring_squeeze_cstr_bang(empty, "z-a"));
+  TEST_ASSERT_RERROR(rstring_count_cstr(RSTR_LIT(""), "z-a"));
+  TEST_ASSERT_RFALSE(rstring_tr_cstr_bang(empty, "a-z", "A-Z"));
+  TEST_ASSERT_EQUAL_RSTRING("", empty);
+  rstring_free(empty);
+
+  /* Long enough for the vector kernels. */
+  rstring* dna = rstring_new("");
+  for (int i = 0; i < 100; ++i) { bcatcstr(dna, "GATTACA"); }
+  rstring* copy = rstring_copy(dna);
+  TEST_ASSERT_RTRUE(rstring_tr_cstr_bang(copy, "ACGT", "TGCA"));
+  TEST_ASSERT_RTRUE(rstring_reverse_bang(copy));
+  TEST_ASSERT_EQUAL_STRING("TGTAATC", rstring_data(copy) + copy->slen - 7);
+  TEST_ASSERT_RFALSE(rstring_tr_cstr_bang(copy, "N", "A"));
+  TEST_ASSERT_EQUAL(200, rstring_count_cstr(copy, "CG"));
+  TEST_ASSERT_EQUAL(500, rstring_count_cstr(copy, "^CG"));
+  rstring_free(copy);
+
+  TEST_ASSERT_EQUAL_RSTRING("he wrd", (actual = rstring_delete_cstr(RSTR_LIT("hello world"), "l-o")));
+  rstring_free(actual);
+  TEST_ASSERT_EQUAL_RSTRING("123", (actual = rstring_delete_cstr(RSTR_LIT("a1b2c3"), "^0-9")));
+  rstring_free(actual);
+  copy = rstring_copy(dna);
+  TEST_ASSERT_RTRUE(rstring_delete_cstr_bang(copy, "T"));
+  TEST_ASSERT_EQUAL(500, rstring_length(copy));
+  TEST_ASSERT_EQUAL(0, rstring_count_cstr(copy, "T"));
+  TEST_ASSERT_RFALSE(rstring_delete_cstr_bang(copy, "T"));
+  rstring_free(copy);
+
+  TEST_ASSERT_EQUAL_RSTRING("too many spaces", (actual = rstring_squeeze_cstr(RSTR_LIT("too    many  spaces"), " ")));
+  rstring_free(actual);
+  TEST_ASSERT_EQUAL_RSTRING("misisipi", (actual = rstring_squeeze(RSTR_LIT("mississippi"), NULL)));
+  rstring_free(actual);
+  TEST_ASSERT_EQUAL_RSTRING("misisippi", (actual = rstring_squeeze_cstr(RSTR_LIT("mississippi"), "^p")));
+  rstring_free(actual);
+  copy = rstring_copy(dna);
+  TEST_ASSERT_RTRUE(rstring_squeeze_bang(copy, NULL));
+  TEST_ASSERT_EQUAL(600, rstring_length(copy));
+  TEST_ASSERT_RFALSE(rstring_squeeze_bang(copy, NULL));
+  rstring_free(copy);
+
+  TEST_ASSERT_EQUAL(5, rstring_count_cstr(RSTR_LIT("hello world"), "lo"));
+  TEST_ASSERT_EQUAL(0, rstring_count_cstr(RSTR_LIT("hello world"), ""));
+  TEST_ASSERT_RERROR(rstring_count_cstr(RSTR_LIT("hello"), "z-a"));
+  TEST_ASSERT_RERROR(rstring_count(NULL, RSTR_LIT("a")));
+
+  rstring_free(dna);
+}
+
+void
+test___rstring_swapcase___should_SwapAndCapitalizeAsciiLetters(void)
+{
+  rstring* actual = NULL;
+
+  TEST_ASSERT_EQUAL_RSTRING("hELLO, wORLD!", (actual = rstring_swapcase(RSTR_LIT("Hello, World!"))));
+  rstring_free(actual);
+  TEST_ASSERT_EQUAL_RSTRING("Hello, world!", (actual = rstring_capitalize(RSTR_LIT("hELLO, WORLD!"))));
+  rstring_free(actual);
+  TEST_ASSERT_EQUAL_RSTRING("1st", (actual = rstring_capitalize(RSTR_LIT("1ST"))));
+  rstring_free(actual);
+  TEST_ASSERT_EQUAL_RSTRING("", (actual = rstring_swapcase(RSTR_LIT(""))));
+  rstring_free(actual);
+  TEST_ASSERT_NULL(rstring_swapcase(NULL));
+  TEST_ASSERT_NULL(rstring_capitalize(NULL));
+
+  /* Long enough for the vector kernels, with a change only near the end. */
+  rstring* rstr = rstring_new("");
+  for (int i = 0; i < 100; ++i) { bcatcstr(rstr, "gattaca"); }
+  bcatcstr(rstr, "@[`{Z");
+
+  rstring* copy = rstring_capitalize(rstr);
+  TEST_ASSERT_EQUAL('G', copy->data[0]);
+  TEST_ASSERT_EQUAL_STRING("@[`{z", rstring_data(copy) + copy->slen - 5);
+  TEST_ASSERT_RFALSE(rstring_capitalize_bang(copy));
+  TEST_ASSERT_RTRUE(rstring_swapcase_bang(copy));
+  TEST_ASSERT_EQUAL('g', copy->data[0]);
+  TEST_ASSERT_EQUAL_STRING("ATTACA@[`{Z", rstring_data(copy) + copy->slen - 11);
+  TEST_ASSERT_RTRUE(rstring_downcase_bang(copy));
+  TEST_ASSERT_RFALSE(rstring_downcase_bang(copy));
+  TEST_ASSERT_RTRUE(rstring_upcase_bang(copy));
+  rstring_free(copy);
+
+  copy = rstring_new("1, 2, 3");
+  TEST_ASSERT_RFALSE(rstring_swapcase_bang(copy));
+  TEST_ASSERT_RERROR(rstring_swapcase_bang(NULL));
+  rstring_free(copy);
+
+  rstring_free(rstr);
+}
+
+void
+test___rstring_chomp_sep___should_ChompLikeRuby(void)
+{
+  /* rstr, sep, and what Ruby's String#chomp(sep) gives */
+  const char* cases[][3] = {
+    { "abc\r\n\r\n", "",     "abc"     },
+    { "abc\n\n\r\n", "",     "abc"     },
+    { "abc\n\r",     "",     "abc\n\r" },
+    { "a\r\r\n",     "",     "a\r"     },
+    { "\n",          "",     ""        },
+    { "a\r",         "\n",   "a"       },
+    { "a\n\r\n",     "\n",   "a\n"     },
+    { "a\n",         "\r\n", "a\n"     },
+    { "a\r\n",       "\r\n", "a"       },
+    { "abc",         "bc",   "a"       },
+    { "abc",         "abc",  ""        },
+    { "bc",          "abc",  "bc"      },
+    { "",            "x",    ""        }
+  };
+
+  for (int i = 0; i < 13; ++i) {
+    rstring_view view = rstring_view_of_cstr(cases[i][0]);
+    rstring* actual = rstring_chomp_sep_cstr(&view, cases[i][1]);
+    TEST_ASSERT_EQUAL_RSTRING(cases[i][2], actual);
+    rstring_free(actual);
+
+    rstring* rstr = rstring_new(cases[i][0]);
+    int changed = strcmp(cases[i][0], cases[i][2]) != 0;
+    TEST_ASSERT_EQUAL(changed ? RTRUE : RFALSE, rstring_chomp_sep_cstr_bang(rstr, cases[i][1]));
+    TEST_ASSERT_EQUAL_RSTRING(cases[i][2], rstr);
+    rstring_free(rstr);
+  }
+
+  TEST_ASSERT_NULL(rstring_chomp_sep(RSTR_LIT("a"), NULL));
+  TEST_ASSERT_NULL(rstring_chomp_sep_cstr(NULL, "a"));
+  TEST_ASSERT_RERROR(rstring_chomp_sep_bang(NULL, RSTR_LIT("a")));
+
+  rstring* empty = rstring_chomp(RSTR_LIT(""));
+  TEST_ASSERT_EQUAL_RSTRING("", empty);
+  rstring_free(empty);
+
+  /* A copy that shares its buffer is given its own before it is chomped. */
+  rstring* line = rstring_new("line\r\n");
+  rstring* copy = rstring_copy(line);
+  TEST_ASSERT_RTRUE(rstring_chomp_sep_cstr_bang(copy, "\r\n"));
+  TEST_ASSERT_EQUAL_RSTRING("line", copy);
+  TEST_ASSERT_EQUAL_RSTRING("line\r\n", line);
+  rstring_free(copy);
+  rstring_free(line);
+
+  /* The batch version only moves the lengths. */
+  rstring* text = rstring_new("one\r\n|two\n|three|four\r");
+  rstring_array* lines = rstring_split_cstr(text, "|");
+  unsigned char* two = rstring_array_get(lines, 1)->data;
+  TEST_ASSERT_RTRUE(rstring_array_chomp_cstr_bang(lines, "\n"));
+  TEST_ASSERT_EQUAL_PTR(two, rstring_array_get(lines, 1)->data);
+  rstring* joined = rstring_array_join_cstr(lines, ",");
+  TEST_ASSERT_EQUAL_RSTRING("one,two,three,four", joined);
+  TEST_ASSERT_RFALSE(rstring_array_chomp_bang(lines, RSTR_LIT("\n")));
+  TEST_ASSERT_RERROR(rstring_array_chomp_bang(NULL, RSTR_LIT("\n")));
+  TEST_ASSERT_RERROR(rstring_array_chomp_cstr_bang(lines, NULL));
+  rstring_free(joined);
+  rstring_array_free(lines);
+  rstring_free(text);
+}